@@ -0,0 +1,358 @@
+/*
+ * 816-cc - C compiler driver for the WDC 65816 processor.
+ *
+ * Description: Runs the three stages that turn a C file into
+ * the assembly file used by PVSnesLib in a single process:
+ *   - 816-tcc (compilation, through libtcc),
+ *   - 816-opt (assembly optimization),
+ *   - constify (moves const data to .rodata).
+ * The stages hand over in-memory line buffers instead of
+ * writing and parsing temporary text files.
+ *
+ * This project is released under the GNU Public License.
+ *
+ */
+
+#include "../816-tcc/libtcc.h"
+#include "../816-opt/helpers.h"
+#include "../816-opt/optimizer.h"
+#include "../constify/constify.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <sys/timeb.h>
+#else
+#include <sys/time.h>
+#endif
+
+#define CCVERSION "Developer"
+#define CCDATE __DATE__
+
+/**
+ * @struct ccDefine
+ * @brief A -D or -U option, replayed on each compilation.
+ */
+typedef struct ccDefine
+{
+    const char *sym;   /**< Symbol name. */
+    const char *value; /**< Value for -Dsym=value, or NULL. */
+    int undef;         /**< 1 for -Usym. */
+} ccDefine;
+
+/**
+ * @struct ccOptions
+ * @brief The command line options.
+ */
+typedef struct ccOptions
+{
+    const char **includes; /**< -I paths. */
+    size_t nbIncludes;
+    ccDefine *defines;     /**< -D and -U options, in command line order. */
+    size_t nbDefines;
+    int hirom;             /**< -H: HiRom (Mode 21) memory map. */
+    int fastrom;           /**< -F: FastRom. */
+    int quiet;             /**< -q: no messages from the stages. */
+    int bench;             /**< -bench: print the time spent in each stage. */
+    const char *sectName;  /**< -s#name: section replacing .rodata. */
+    const char *outfile;   /**< -o: output file (single input only). */
+} ccOptions;
+
+/**
+ * @struct ccTimes
+ * @brief Time spent in each stage, in microseconds.
+ */
+typedef struct ccTimes
+{
+    int64_t compile;
+    int64_t optimize;
+    int64_t constify;
+} ccTimes;
+
+/**
+ * @brief Get the current time in microseconds.
+ * @return The current time in microseconds.
+ */
+static int64_t getclock_us(void)
+{
+#ifdef _WIN32
+    struct _timeb tb;
+    _ftime(&tb);
+    return (tb.time * 1000LL + tb.millitm) * 1000LL;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000LL + tv.tv_usec;
+#endif
+}
+
+/**
+ * @brief Print the version.
+ */
+static void printVersion(void)
+{
+    printf("816-cc v%s\n", CCVERSION);
+    printf("built: %s\n", CCDATE);
+}
+
+/**
+ * @brief Print the usage.
+ */
+static void printUsage(void)
+{
+    printf("usage: 816-cc [options] infile1.c [infile2.c...]\n"
+           "\n"
+           "Compile, optimize and constify each C file in a single process.\n"
+           "Each infile.c is written to infile.asm unless -o is given.\n"
+           "\n"
+           "  -o outfile  set output filename (one input file only)\n"
+           "  -H          hiRom (Mode 21) Memory Map compilation\n"
+           "  -F          FastRom compilation\n"
+           "  -Idir       add include path 'dir'\n"
+           "  -Dsym[=val] define 'sym' with value 'val'\n"
+           "  -Usym       undefine 'sym'\n"
+           "  -s#name     change default .rodata to .#name section\n"
+           "  -q          quiet mode\n"
+           "  -bench      print the time spent in each stage\n"
+           "  -v          display version information\n"
+           "  -h          display this information\n");
+}
+
+/**
+ * @brief Read a whole file in memory.
+ * @param filename The file name.
+ * @param psize Receives the size of the file.
+ * @return The NUL-terminated contents (to free), or NULL on error.
+ */
+static char *readFile(const char *filename, size_t *psize)
+{
+    FILE *f;
+    char *buf;
+    long size;
+
+    if (!(f = fopen(filename, "rb")))
+        return NULL;
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (size < 0 || !(buf = malloc(size + 1))) {
+        fclose(f);
+        return NULL;
+    }
+    *psize = fread(buf, 1, size, f);
+    buf[*psize] = '\0';
+    fclose(f);
+
+    return buf;
+}
+
+/**
+ * @brief Run the three stages on one C file.
+ * @param o The command line options.
+ * @param cfile The C file.
+ * @param outfile The assembly file to write.
+ * @param t Accumulates the time spent in each stage.
+ * @return 0 on success, 1 on error.
+ */
+static int compileFile(const ccOptions *o, const char *cfile, const char *outfile, ccTimes *t)
+{
+    TCCState *s;
+    char *asmText, *csrc;
+    size_t i, csize;
+    dynArray file, bss, optAsm;
+    int varsMoved, bytesMoved;
+    FILE *out;
+    int64_t t0, t1, t2, t3;
+
+    /* -------------------------------- */
+    /*      816-tcc: C -> assembly      */
+    /* -------------------------------- */
+    t0 = getclock_us();
+    s = tcc_new();
+    if (!s) {
+        fprintf(stderr, "816-cc: could not create the compiler state\n");
+        return 1;
+    }
+    tcc_set_output_type(s, TCC_OUTPUT_OBJ);
+    tcc_set_memory_map(s, o->hirom, o->fastrom);
+    for (i = 0; i < o->nbIncludes; i++)
+        tcc_add_include_path(s, o->includes[i]);
+    for (i = 0; i < o->nbDefines; i++) {
+        if (o->defines[i].undef)
+            tcc_undefine_symbol(s, o->defines[i].sym);
+        else
+            tcc_define_symbol(s, o->defines[i].sym, o->defines[i].value);
+    }
+    asmText = NULL;
+    if (tcc_add_file(s, cfile) >= 0)
+        asmText = tcc_output_memory(s, NULL);
+    tcc_delete(s);
+    if (!asmText)
+        return 1;
+
+    /* -------------------------------- */
+    /*      816-opt: optimization       */
+    /* -------------------------------- */
+    t1 = getclock_us();
+    file = tidyText(asmText);
+    tcc_free_output(asmText);
+    bss = storeBss(file);
+    optAsm = optimizeAsm(file, bss, o->quiet ? 0 : verbosity());
+    freedynArray(bss);
+
+    /* -------------------------------- */
+    /*   constify: const data to ROM    */
+    /* -------------------------------- */
+    t2 = getclock_us();
+    if (!(csrc = readFile(cfile, &csize))) {
+        fprintf(stderr, "816-cc: cannot open file %s\n", cfile);
+        freedynArray(optAsm);
+        return 1;
+    }
+    if (!(out = fopen(outfile, "wb"))) {
+        fprintf(stderr, "816-cc: cannot create file %s\n", outfile);
+        free(csrc);
+        freedynArray(optAsm);
+        return 1;
+    }
+    constify_lines(csrc, csize, optAsm.arr, optAsm.used, o->sectName, out, &varsMoved,
+                   &bytesMoved);
+    fclose(out);
+    free(csrc);
+    freedynArray(optAsm);
+    t3 = getclock_us();
+
+    if (!o->quiet)
+        printf("constify: Done 'Moved %d variables (%d bytes)'\n", varsMoved, bytesMoved);
+    if (o->bench)
+        fprintf(stderr,
+                "%s: compile %.3f ms, optimize %.3f ms, constify %.3f ms\n",
+                cfile, (t1 - t0) / 1000.0, (t2 - t1) / 1000.0, (t3 - t2) / 1000.0);
+    t->compile += t1 - t0;
+    t->optimize += t2 - t1;
+    t->constify += t3 - t2;
+
+    return 0;
+}
+
+/**
+ * @brief The main function.
+ * @param argc The number of arguments provided.
+ * @param argv The arguments provided.
+ * @return 0 or 1 if one of the files could not be compiled.
+ */
+int main(int argc, char **argv)
+{
+    ccOptions o;
+    ccTimes t;
+    const char **files;
+    size_t nbFiles = 0;
+    char outbuf[1024], *ext;
+    int i, ret = 0;
+    int64_t total;
+
+    memset(&o, 0, sizeof(o));
+    memset(&t, 0, sizeof(t));
+    o.includes = malloc(argc * sizeof(*o.includes));
+    o.defines = malloc(argc * sizeof(*o.defines));
+    files = malloc(argc * sizeof(*files));
+    if (!o.includes || !o.defines || !files) {
+        perror("malloc-options");
+        exit(EXIT_FAILURE);
+    }
+
+    /* -------------------------------- */
+    /*      Parse the arguments         */
+    /* -------------------------------- */
+    for (i = 1; i < argc; i++) {
+        char *a = argv[i];
+
+        if (a[0] != '-') {
+            files[nbFiles++] = a;
+        } else if (!strcmp(a, "-bench")) {
+            o.bench = 1;
+        } else if (a[1] == 'I' || a[1] == 'D' || a[1] == 'U' || a[1] == 'o') {
+            char *arg = a[2] ? a + 2 : (i + 1 < argc ? argv[++i] : NULL);
+
+            if (!arg) {
+                fprintf(stderr, "816-cc: argument to '%s' is missing\n", a);
+                exit(EXIT_FAILURE);
+            }
+            if (a[1] == 'I') {
+                o.includes[o.nbIncludes++] = arg;
+            } else if (a[1] == 'o') {
+                o.outfile = arg;
+            } else {
+                ccDefine *d = &o.defines[o.nbDefines++];
+                char *value = strchr(arg, '=');
+
+                if (value && a[1] == 'D')
+                    *value++ = '\0';
+                else
+                    value = NULL;
+                d->sym = arg;
+                d->value = value;
+                d->undef = a[1] == 'U';
+            }
+        } else if (!strcmp(a, "-H")) {
+            o.hirom = 1;
+        } else if (!strcmp(a, "-F")) {
+            o.fastrom = 1;
+        } else if (!strcmp(a, "-q")) {
+            o.quiet = 1;
+        } else if (a[1] == 's') {
+            o.sectName = a + 2;
+        } else if (!strcmp(a, "-v")) {
+            printVersion();
+            exit(0);
+        } else if (!strcmp(a, "-h")) {
+            printUsage();
+            exit(0);
+        } else {
+            fprintf(stderr, "816-cc: invalid option -- '%s'\n", a);
+            printUsage();
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (nbFiles == 0) {
+        printUsage();
+        exit(EXIT_FAILURE);
+    }
+    if (o.outfile && nbFiles > 1) {
+        fprintf(stderr, "816-cc: cannot specify -o with several input files\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* -------------------------------- */
+    /*       Compile each file          */
+    /* -------------------------------- */
+    for (size_t f = 0; f < nbFiles; f++) {
+        const char *outfile = o.outfile;
+
+        if (!outfile) {
+            snprintf(outbuf, sizeof(outbuf) - 4, "%s", files[f]);
+            ext = strrchr(outbuf, '.');
+            if (!ext || strpbrk(ext, "/\\"))
+                ext = outbuf + strlen(outbuf);
+            strcpy(ext, ".asm");
+            outfile = outbuf;
+        }
+        if (compileFile(&o, files[f], outfile, &t))
+            ret = 1;
+    }
+
+    if (o.bench) {
+        total = t.compile + t.optimize + t.constify;
+        fprintf(stderr,
+                "total: compile %.3f ms, optimize %.3f ms, constify %.3f ms (%.3f ms, %lu files)\n",
+                t.compile / 1000.0, t.optimize / 1000.0, t.constify / 1000.0, total / 1000.0,
+                (unsigned long) nbFiles);
+    }
+
+    free(o.includes);
+    free(o.defines);
+    free(files);
+
+    return ret;
+}
@@ -92,6 +92,40 @@ int isControl(const char *a)
     return 0;
 }
 
+/**
+ * @brief Append one line to a tidied file, unless it is a comment.
+    The line is trimmed of leading/trailing white spaces.
+ * @param file The array of strings being built.
+ * @param nptrs The number of allocated entries in file->arr.
+ * @param buf The line, without its end-of-line character.
+ * @return 1 on success or 0 if out of memory.
+ */
+static int tidyLine(dynArray *file, size_t *nptrs, char *buf)
+{
+    size_t len = strlen(buf);
+
+    if (startWith(buf, ASM_COMMENT))
+        return 1;
+
+    if (file->used == *nptrs) {
+        void *tmp = realloc(file->arr, (2 * *nptrs) * sizeof(char *));
+        if (!tmp) {
+            perror("realloc-lines");
+            return 0;
+        }
+        file->arr = tmp;
+        *nptrs *= 2;
+    }
+    if (!(file->arr[file->used] = malloc(len + 1))) {
+        perror("malloc-lines[used]");
+        return 0;
+    }
+    memcpy(file->arr[file->used], trimWhiteSpace(buf), len + 1);
+    file->used += 1;
+
+    return 1;
+}
+
 /**
  * @brief Create an array of strings from a file
     without comment and leading/trailing white spaces.
@@ -104,7 +138,6 @@ dynArray tidyFile(const int argc, char **argv)
 {
     char buf[MAXLEN_LINE];
     size_t nptrs = 10;
-    size_t len;
     dynArray file;
     file.used = 0;
 
@@ -128,25 +161,9 @@ dynArray tidyFile(const int argc, char **argv)
     }
 
     while (fgets(buf, MAXLEN_LINE, fp)) {
-        buf[(len = strcspn(buf, "\n"))] = 0;
-
-        if (!startWith(buf, ASM_COMMENT)) {
-            if (file.used == nptrs) {
-                void *tmp = realloc(file.arr, (2 * nptrs) * sizeof(char *));
-                if (!tmp) {
-                    perror("realloc-lines");
-                    break;
-                }
-                file.arr = tmp;
-                nptrs *= 2;
-            }
-            if (!(file.arr[file.used] = malloc(len + 1))) {
-                perror("malloc-lines[used]");
-                break;
-            }
-            memcpy(file.arr[file.used], trimWhiteSpace(buf), len + 1);
-            file.used += 1;
-        }
+        buf[strcspn(buf, "\n")] = 0;
+        if (!tidyLine(&file, &nptrs, buf))
+            break;
     }
     if (fp != stdin)
         fclose(fp);
@@ -154,6 +171,41 @@ dynArray tidyFile(const int argc, char **argv)
     return file;
 }
 
+/**
+ * @brief Same as tidyFile, but on an ASM text already in memory
+    (e.g. the output of libtcc's tcc_output_memory()).
+ * @param text The NUL-terminated ASM text.
+ * @return A structure (dynArray).
+ */
+dynArray tidyText(const char *text)
+{
+    char buf[MAXLEN_LINE];
+    size_t nptrs = 10;
+    size_t len;
+    const char *eol;
+    dynArray file;
+    file.used = 0;
+
+    if ((file.arr = malloc(nptrs * sizeof(char *))) == NULL) {
+        perror("malloc-lines");
+        exit(EXIT_FAILURE);
+    }
+
+    while (*text) {
+        eol = strchr(text, '\n');
+        len = eol ? (size_t) (eol - text) : strlen(text);
+        if (len >= MAXLEN_LINE)
+            len = MAXLEN_LINE - 1;
+        memcpy(buf, text, len);
+        buf[len] = 0;
+        if (!tidyLine(&file, &nptrs, buf))
+            break;
+        text = eol ? eol + 1 : text + strlen(text);
+    }
+
+    return file;
+}
+
 /**
  * @brief Create an array of string to store
     block bss instructions (first word only).
@@ -200,9 +252,11 @@ dynArray storeBss(dynArray file)
 
 /**
  * @brief Optimize ASM code.
- * @param file The asm file cleaned (see tidyFile function).
+ * @param file The asm file cleaned (see tidyFile/tidyText functions).
+    It is released by this function.
  * @param bss The bss section (only forst words).
  * @param verbose The level of verbosity (see verbosity function).
+ * @return The optimized lines (release them with freedynArray).
  */
 dynArray optimizeAsm(dynArray file, const dynArray bss, const size_t verbose)
 {
@@ -37,6 +37,7 @@
 int verbosity();
 void PrintVersion(void);
 dynArray tidyFile(const int argc, char **argv);
+dynArray tidyText(const char *text);
 dynArray storeBss(dynArray file);
 dynArray optimizeAsm(dynArray file, dynArray bss, size_t verbose);
 
@@ -48,9 +48,9 @@ char *get_sym_str(TokenSym *sym)
     name[0] = 0;
     /* if static, add prefix */
     if (sym->type.t & VT_STATIC) {
-        if ((sym->type.t & VT_STATICLOCAL) && current_fn[0] != 0
+        if ((sym->type.t & VT_STATICLOCAL) && gen816.current_fn[0] != 0
             && !((sym->type.t & VT_BTYPE) == VT_FUNC))
-            sprintf(name, "%s_FUNC_%s_", STATIC_PREFIX, current_fn);
+            sprintf(name, "%s_FUNC_%s_", STATIC_PREFIX, gen816.current_fn);
         else
             sprintf(name, "%s%s_", STATIC_PREFIX, unique_token);
     }
@@ -61,6 +61,34 @@ char *get_sym_str(TokenSym *sym)
     return name;
 }
 
+/**
+ * @brief Returns the size suffix of the instructions accessing a data symbol.
+ *
+ * zeropage variables are in the direct page, and near ones in bank $00 low
+ * RAM, which is mirrored in bank $7e (the data bank), as are objects of a
+ * __near type; everything else needs a long address. With -fdp-frame, D
+ * does not point at the zeropage variables any more, so they are reached
+ * through their bank $7e mirror too.
+ *
+ * @param sym The symbol.
+ * @return 'b', 'w' or 'l'.
+ */
+static char get_sym_mode(TokenSym *sym)
+{
+    CType *type;
+
+    switch (sym->type.t & VT_PLACEMENT) {
+    case VT_ZEROPAGE:
+        return tcc_state->dp_frame ? 'w' : 'b';
+    case VT_NEAR:
+        return 'w';
+    default:
+        for (type = &sym->type; type->t & VT_ARRAY; type = &type->ref->type)
+            ;
+        return type->t & VT_NEARDATA ? 'w' : 'l';
+    }
+}
+
 /**
  * @brief Adds a character into the current text section and increments the index.
  *
@@ -106,6 +134,135 @@ void s(char *str)
     }
 }
 
+/**
+ * @brief Decodes the text of a line into the mnemonic, operand size,
+ * addressing mode and operand of 'in'.
+ */
+static void insn_decode(Insn816 *in)
+{
+    char *p, *eol, *e, *c;
+    int k;
+
+    p = in->text;
+    eol = p + in->len;
+    if (eol > p && eol[-1] == '\n')
+        eol--;
+    memset(in->op, 0, sizeof(in->op));
+    in->width = 0;
+    in->mode = AM_IMPLIED;
+    in->arg = NULL;
+    in->arg_len = 0;
+
+    /* strip the comment and the surrounding blanks */
+    for (e = p; e < eol && *e != ';'; e++)
+        ;
+    for (c = e; c + 14 <= eol && memcmp(c, "DON'T OPTIMIZE", 14); c++)
+        ;
+    in->keep = c + 14 <= eol;
+    while (p < e && (*p == ' ' || *p == '\t'))
+        p++;
+    while (e > p && (e[-1] == ' ' || e[-1] == '\t' || e[-1] == '\r'))
+        e--;
+
+    if (p == e) {
+        in->kind = INSN_COMMENT;
+    } else if (*p == '.') {
+        in->kind = INSN_DIRECTIVE;
+    } else if (e[-1] == ':' || strspn(p, "+-") >= (size_t) (e - p)) {
+        in->kind = INSN_LABEL;
+    } else {
+        in->kind = INSN_OP;
+        for (k = 0; k < 3 && p < e && isalpha((unsigned char) *p); k++)
+            in->op[k] = *p++;
+        if (p < e && *p == '.' && p + 1 < e) {
+            in->width = p[1];
+            p += 2;
+        }
+        if (p < e && *p != ' ' && *p != '\t') {
+            /* not a plain mnemonic: leave it alone */
+            in->kind = INSN_DIRECTIVE;
+            return;
+        }
+        while (p < e && (*p == ' ' || *p == '\t'))
+            p++;
+        in->arg = p;
+        in->arg_len = e - p;
+        if (p == e)
+            in->mode = AM_IMPLIED;
+        else if (e - p == 1 && *p == 'a')
+            in->mode = AM_ACC;
+        else if (*p == '#')
+            in->mode = AM_IMM;
+        else if (*p == '[' || *p == '(')
+            in->mode = AM_IND;
+        else if (e - p > 2 && e[-2] == ',' && e[-1] == 's')
+            in->mode = AM_STACK;
+        else if (in->width == 'b')
+            in->mode = AM_DP;
+        else
+            in->mode = AM_ABS;
+    }
+}
+
+/**
+ * @brief Appends the lines of 'str' to the lines of the current function.
+ *
+ * The text is only written to the section by insn_flush(), but 'ind' moves
+ * on as if it had been, so that jumps and labels keep pointing at text
+ * offsets.
+ */
+static void insn_add(const char *str)
+{
+    Insn816 *in;
+    const char *eol;
+    int n;
+
+    while (*str) {
+        eol = strchr(str, '\n');
+        n = eol ? eol + 1 - str : (int) strlen(str);
+        in = gen816.nb_insns ? &gen816.insns[gen816.nb_insns - 1] : NULL;
+        if (in && in->text[in->len - 1] != '\n') {
+            /* the end of a line started by the previous pr() */
+            in->text = arena_realloc(&gen816.insn_text, in->text, in->len + 1, in->len + n + 1);
+            memcpy(in->text + in->len, str, n);
+            in->len += n;
+        } else {
+            if (gen816.nb_insns == gen816.max_insns) {
+                gen816.max_insns = gen816.max_insns ? gen816.max_insns * 2 : 256;
+                gen816.insns = tcc_realloc(gen816.insns, gen816.max_insns * sizeof(Insn816));
+            }
+            in = &gen816.insns[gen816.nb_insns++];
+            memset(in, 0, sizeof(*in));
+            in->pos = ind;
+            in->len = n;
+            in->text = arena_alloc(&gen816.insn_text, n + 1);
+            memcpy(in->text, str, n);
+        }
+        in->text[in->len] = '\0';
+        insn_decode(in);
+        ind += n;
+        str += n;
+    }
+}
+
+/**
+ * @brief Returns the index of the first line of the current function at or
+ * after the text offset 'pos'.
+ */
+static int insn_find(int pos)
+{
+    int lo = 0, hi = gen816.nb_insns, mid;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (gen816.insns[mid].pos < pos)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
 char line[MAXLEN];
 
 /**
@@ -113,7 +270,8 @@ char line[MAXLEN];
  *
  * This function uses variadic arguments to allow for input of variable data types
  * and quantities. It uses the vsnprintf function to format the data into a string
- * and then calls the function 's' to add this string into the current text section.
+ * and then calls the function 's' to add this string into the current text section,
+ * or, inside a function, appends its lines to the ones gfunc_epilog() writes out.
  *
  * @param format This is a string that contains the text to be written to the text section.
  *               It can optionally contain embedded format specifiers that will be replaced
@@ -126,12 +284,12 @@ void pr(const char *format, ...)
     va_start(args, format);
     vsnprintf(line, sizeof(line), format, args);
     va_end(args);
-    s(line);
+    if (gen816.insns_open)
+        insn_add(line);
+    else
+        s(line);
 }
 
-// update from mic_to have more space
-int jump[20000][2], jumps = 0;
-
 /**
  * @brief Handles the association between a jump instruction and its target address.
  *
@@ -144,18 +302,19 @@ int jump[20000][2], jumps = 0;
  */
 void gsym_addr(int t, int a)
 {
+    BENCH_ENTER(BENCH_GEN);
     /* code at t wants to jump to a */
     // fprintf(stderr, "gsymming t 0x%x a 0x%x\n", t, a);
     pr("; gsym_addr t %d a %d ind %d\n", t, a, ind);
     /* the label generation code sets this for us so we know when a symbol
        is a label and what its name is, so that we can remember its name
        and position so the output code can insert it correctly */
-    if (label_workaround) {
+    if (gen816.label_workaround) {
         // fprintf("setting label %s to a %d (t %d)\n", label_workaround, a, t);
-        label[labels].name = label_workaround;
-        label[labels].pos = a;
-        labels++;
-        label_workaround = NULL;
+        gen816.label[gen816.labels].name = gen816.label_workaround;
+        gen816.label[gen816.labels].pos = a;
+        gen816.labels++;
+        gen816.label_workaround = NULL;
     }
 
     // pair up the jump with the target address
@@ -164,13 +323,14 @@ void gsym_addr(int t, int a)
     int found = 0;
     int i;
 
-    for (i = 0; i < jumps; i++) {
-        if (jump[i][0] == t)
-            jump[i][1] = a;
+    for (i = 0; i < gen816.jumps; i++) {
+        if (gen816.jump[i][0] == t)
+            gen816.jump[i][1] = a;
         found = 1;
     }
     if (!found)
         pr("; ERROR no jump found to patch\n");
+    BENCH_LEAVE();
 }
 
 /**
@@ -187,8 +347,6 @@ void gsym(int t)
     gsym_addr(t, ind);
 }
 
-int stack_back = 0;
-
 /**
  * @brief Adjusts the stack pointer based on the function call stack and a displacement.
  *
@@ -206,14 +364,49 @@ int adjust_stack(int fc, int disp)
 {
     int stack_adj = fc + disp - loc - 256;
 
+    /* direct page frame offsets do not move, and are checked by gfunc_epilog() */
+    if (tcc_state->dp_frame)
+        return fc;
+
     pr("; stack adjust: fc + disp - loc - 256 %d\n", stack_adj);
 
     if (stack_adj < 0)
         return fc;
 
-    stack_back = -loc + fc + stack_adj;
-    pr("tsc\nclc\nadc.w #%d\ntcs\n", stack_back);
-    return fc - stack_back;
+    gen816.stack_back = -loc + fc + stack_adj;
+    pr("tsc\nclc\nadc.w #%d\ntcs\n", gen816.stack_back);
+    return fc - gen816.stack_back;
+}
+
+/**
+ * @brief Returns the direct page offset of a local or argument, less the
+ * locals size and the pseudo registers, in a -fdp-frame function.
+ *
+ * Locals (negative offsets) are right above the pseudo registers, and the
+ * arguments are above the caller's D saved by the prolog.
+ */
+static int dp_frame_offset(int fc)
+{
+    return fc < 0 ? fc : fc + 2;
+}
+
+/**
+ * @brief Formats the operand of an access to a local or argument.
+ *
+ * Locals are addressed relative to the stack pointer, which moves by the
+ * arguments already pushed for a call (args_size); with -fdp-frame, they are
+ * addressed in the direct page frame instead. The result follows the
+ * mnemonic: " n + __<fn>_locals + 1,s" or ".b n + __<fn>_locals + <regs>".
+ *
+ * @param buf Receives the operand.
+ * @param fc The frame offset of the local.
+ */
+static void local_operand(char *buf, int fc)
+{
+    if (tcc_state->dp_frame)
+        sprintf(buf, ".b %d + __%s_locals + %d", dp_frame_offset(fc), gen816.current_fn, DP_FRAME_REGS);
+    else
+        sprintf(buf, " %d + __%s_locals + 1,s", fc + gen816.args_size, gen816.current_fn);
 }
 
 /**
@@ -228,20 +421,46 @@ int adjust_stack(int fc, int disp)
  */
 int restore_stack(int fc)
 {
-    if (stack_back != 0) {
-        pr("tsc\nsec\nsbc.w #%d\ntcs\n", stack_back);
-        fc += stack_back;
-        stack_back = 0;
+    if (gen816.stack_back != 0) {
+        pr("tsc\nsec\nsbc.w #%d\ntcs\n", gen816.stack_back);
+        fc += gen816.stack_back;
+        gen816.stack_back = 0;
     }
     return fc;
 }
 
-// this used to be local to gfunc_call, but we need it to get the correct
-// stack pointer displacement while building the argument stack for
-// a function call
-int args_size = 0;
+/**
+ * @brief Formats the operand of an access through the pointer in a register.
+ *
+ * Data of a __near type (VT_NEARDATA) is reached through the 16-bit pointer
+ * in the data bank with "(tcc__rN)", anything else through the 24-bit pointer
+ * with "[tcc__rN]".
+ *
+ * @param buf Receives the operand.
+ * @param base The register holding the pointer.
+ * @param t The type of the accessed data.
+ */
+static void ind_operand(char *buf, int base, int t)
+{
+    sprintf(buf, t & VT_NEARDATA ? "(tcc__r%d)" : "[tcc__r%d]", base);
+}
 
-int ll_workaround = 0;
+/**
+ * @brief Formats the operand of an access through a pointer held in a local
+ * of a -fdp-frame function, which is dereferenced where it is.
+ *
+ * @param buf Receives the operand.
+ * @param fc The frame offset of the pointer.
+ * @param t The type of the accessed data.
+ */
+static void dp_ind_operand(char *buf, int fc, int t)
+{
+    sprintf(buf,
+            t & VT_NEARDATA ? "(%d + __%s_locals + %d)" : "[%d + __%s_locals + %d]",
+            dp_frame_offset(fc),
+            gen816.current_fn,
+            DP_FRAME_REGS);
+}
 
 /**
  * @brief The function loads a value from memory or a register into a specified register.
@@ -257,9 +476,11 @@ void load(int r, SValue *sv)
     int length;
     int align;
     int v, sign, t;
+    char iop[MAXLEN + 32], lop[MAXLEN + 32], hop[MAXLEN + 32];
     SValue v1;
+    BENCH_ENTER(BENCH_GEN);
     pr("; load %d\n", r);
-    pr("; type %d reg 0x%x extra 0x%x\n", sv->type.t, sv->r, sv->type.extra);
+    pr("; type %d reg 0x%x\n", sv->type.t, sv->r);
     fr = sv->r;
     ft = sv->type.t;
     fc = sv->c.ul;
@@ -267,30 +488,40 @@ void load(int r, SValue *sv)
     length = type_size(&sv->type, &align);
     if ((ft & VT_BTYPE) == VT_LLONG)
         length = 2; // long longs are handled word-wise
-    if (ll_workaround)
+    if (gen816.ll_workaround)
         length = 4;
 
     int base = -1;
     v = fr & VT_VALMASK;
     if (fr & VT_LVAL) {
         if (v == VT_LLOCAL) {
-            v1.type.t = VT_PTR;
-            v1.r = VT_LOCAL | VT_LVAL;
-            v1.c.ul = sv->c.ul;
-            load(base = 10 /* lr */, &v1);
+            if (tcc_state->dp_frame) {
+                /* the pointer is in the frame: dereference it in place */
+                dp_ind_operand(iop, fc, ft);
+                base = -2;
+            } else {
+                v1.type.t = VT_PTR;
+                v1.type.ref = NULL;
+                v1.r = VT_LOCAL | VT_LVAL;
+                v1.c.ul = sv->c.ul;
+                load(base = 10 /* lr */, &v1);
+            }
             fc = sign = 0;
             v = VT_LOCAL;
         } else if (v == VT_CONST) {
             if (fr & VT_SYM) { // deref symbol + displacement
                 char *sy = get_sym_str(sv->sym);
+                char m = get_sym_mode(sv->sym);
                 if (is_float(ft)) {
                     pr("; fld%d [%s + %d], tcc__f%d\n", length, sy, fc, r - TREG_F0);
                     switch (length) {
                     case 4:
-                        pr("lda.l %s + %d\nsta.b tcc__f%d\nlda.l %s + %d + 2\nsta.b tcc__f%dh\n",
+                        pr("lda.%c %s + %d\nsta.b tcc__f%d\nlda.%c %s + %d + 2\nsta.b tcc__f%dh\n",
+                           m,
                            sy,
                            fc,
                            r - TREG_F0,
+                           m,
                            sy,
                            fc,
                            r - TREG_F0);
@@ -305,19 +536,21 @@ void load(int r, SValue *sv)
                         error("index too big");
                     switch (length) {
                     case 1:
-                        pr("lda.w #0\nsep #$20\nlda.l %s + %d\nrep #$20\n", sy, fc);
+                        pr("lda.w #0\nsep #$20\nlda.%c %s + %d\nrep #$20\n", m, sy, fc);
                         if (!(ft & VT_UNSIGNED))
                             pr("xba\nxba\nbpl +\nora.w #$ff00\n+\n");
                         pr("sta.b tcc__r%d\n", r);
                         break;
                     case 2:
-                        pr("lda.l %s + %d\nsta.b tcc__r%d\n", sy, fc, r);
+                        pr("lda.%c %s + %d\nsta.b tcc__r%d\n", m, sy, fc, r);
                         break;
                     case 4:
-                        pr("lda.l %s + %d\nsta.b tcc__r%d\nlda.l %s + %d + 2\nsta.b tcc__r%dh\n",
+                        pr("lda.%c %s + %d\nsta.b tcc__r%d\nlda.%c %s + %d + 2\nsta.b tcc__r%dh\n",
+                           m,
                            sy,
                            fc,
                            r,
+                           m,
                            sy,
                            fc,
                            r);
@@ -332,24 +565,33 @@ void load(int r, SValue *sv)
                 if (is_float(ft)) {
                     error("dereferencing constant float pointers unimplemented\n");
                 } else {
+                    /* a near address is in the data bank */
+                    char m = ft & VT_NEARDATA ? 'w' : 'l';
                     switch (length) {
                     case 1:
-                        pr("lda.w #0\nsep #$20\nlda.l %d\nrep #$20\n", fc);
+                        pr("lda.w #0\nsep #$20\nlda.%c %d\nrep #$20\n", m, fc);
                         if (!(ft & VT_UNSIGNED))
                             pr("xba\nxba\nbpl +\nora.w #$ff00\n+\n");
                         pr("sta.b tcc__r%d\n", r);
                         break;
                     case 2:
-                        pr("lda.l %d\nsta.b tcc__r%d\n", fc, r);
+                        pr("lda.%c %d\nsta.b tcc__r%d\n", m, fc, r);
                         break;
                     case 4:
-                        pr("lda.l %d\nsta.b tcc__r%d\nlda.l %d + 2\nsta.b tcc__r%dh\n", fc, r, fc, r);
+                        pr("lda.%c %d\nsta.b tcc__r%d\nlda.%c %d + 2\nsta.b tcc__r%dh\n",
+                           m,
+                           fc,
+                           r,
+                           m,
+                           fc,
+                           r);
                         break;
                     default:
                         error("ICE 1");
                     }
                 }
             }
+            BENCH_LEAVE();
             return;
         } else if (v < VT_CONST) { // deref pointer in register
             base = v;
@@ -358,61 +600,48 @@ void load(int r, SValue *sv)
         }
 
         if (v == VT_LOCAL) {
+            if (base >= 0)
+                ind_operand(iop, base, ft);
             if (is_float(ft)) {
                 if (base == -1) {
                     pr("; fld%d [sp,%d],tcc__f%d\n", length, fc, r - TREG_F0);
                     if (length != 4)
                         error("ICE 2f");
-                    fc = adjust_stack(fc, args_size + 2);
-                    pr("lda %d + __%s_locals + 1,s\nsta.b tcc__f%d\nlda %d + __%s_locals + "
-                       "1,s\nsta.b tcc__f%dh\n",
-                       fc + args_size,
-                       current_fn,
-                       r - TREG_F0,
-                       fc + args_size + 2,
-                       current_fn,
-                       r - TREG_F0);
+                    fc = adjust_stack(fc, gen816.args_size + 2);
+                    local_operand(lop, fc);
+                    local_operand(hop, fc + 2);
+                    pr("lda%s\nsta.b tcc__f%d\nlda%s\nsta.b tcc__f%dh\n", lop, r - TREG_F0, hop, r - TREG_F0);
                     fc = restore_stack(fc);
                 } else {
                     pr("; fld%d [tcc__r%d,%d],tcc__f%d\n", length, base, fc, r - TREG_F0);
                     if (length != 4)
                         error("ICE 3f");
-                    pr("ldy #%d\nlda.b [tcc__r%d],y\nsta.b tcc__f%d\niny\niny\nlda.b [tcc__r%d], "
+                    pr("ldy #%d\nlda.b %s,y\nsta.b tcc__f%d\niny\niny\nlda.b %s, "
                        "y\nsta.b tcc__f%dh\n",
                        fc,
-                       base,
+                       iop,
                        r - TREG_F0,
-                       base,
+                       iop,
                        r - TREG_F0);
                 }
             } else {
                 if (base == -1) { // value of local at fc
                     pr("; ld%d [sp,%d],tcc__r%d\n", length, fc, r);
-                    fc = adjust_stack(fc, args_size + 2);
+                    fc = adjust_stack(fc, gen816.args_size + 2);
+                    local_operand(lop, fc);
+                    local_operand(hop, fc + 2);
                     switch (length) {
                     case 1:
-                        pr("lda.w #0\nsep #$20\nlda %d + __%s_locals + 1,s\nrep #$20\n",
-                           fc + args_size,
-                           current_fn);
+                        pr("lda.w #0\nsep #$20\nlda%s\nrep #$20\n", lop);
                         if (!(ft & VT_UNSIGNED))
                             pr("xba\nxba\nbpl +\nora.w #$ff00\n+\n");
                         pr("sta.b tcc__r%d\n", r);
                         break;
                     case 2:
-                        pr("lda %d + __%s_locals + 1,s\nsta.b tcc__r%d\n",
-                           fc + args_size,
-                           current_fn,
-                           r);
+                        pr("lda%s\nsta.b tcc__r%d\n", lop, r);
                         break;
                     case 4:
-                        pr("lda %d + __%s_locals + 1,s\nsta.b tcc__r%d\nlda %d + __%s_locals + "
-                           "1,s\nsta.b tcc__r%dh\n",
-                           fc + args_size,
-                           current_fn,
-                           r,
-                           fc + args_size + 2,
-                           current_fn,
-                           r);
+                        pr("lda%s\nsta.b tcc__r%d\nlda%s\nsta.b tcc__r%dh\n", lop, r, hop, r);
                         break;
                     default:
                         error("ICE 2");
@@ -425,26 +654,26 @@ void load(int r, SValue *sv)
                     case 1:
                         pr("lda.w #0\n");
                         if (!fc)
-                            pr("sep #$20\nlda.b [tcc__r%d]\nrep #$20\n", base);
+                            pr("sep #$20\nlda.b %s\nrep #$20\n", iop);
                         else
-                            pr("ldy #%d\nsep #$20\nlda.b [tcc__r%d],y\nrep #$20\n", fc, base);
+                            pr("ldy #%d\nsep #$20\nlda.b %s,y\nrep #$20\n", fc, iop);
                         if (!(ft & VT_UNSIGNED))
                             pr("xba\nxba\nbpl +\nora.w #$ff00\n+\n");
                         pr("sta.b tcc__r%d\n", r);
                         break;
                     case 2:
                         if (!fc)
-                            pr("lda.b [tcc__r%d]\nsta.b tcc__r%d\n", base, r);
+                            pr("lda.b %s\nsta.b tcc__r%d\n", iop, r);
                         else
-                            pr("ldy #%d\nlda.b [tcc__r%d],y\nsta.b tcc__r%d\n", fc, base, r);
+                            pr("ldy #%d\nlda.b %s,y\nsta.b tcc__r%d\n", fc, iop, r);
                         break;
                     case 4:
-                        pr("ldy #%d\nlda.b [tcc__r%d],y\nsta.b tcc__r%d\niny\niny\nlda.b "
-                           "[tcc__r%d],y\nsta.b tcc__r%dh\n",
+                        pr("ldy #%d\nlda.b %s,y\nsta.b tcc__r%d\niny\niny\nlda.b "
+                           "%s,y\nsta.b tcc__r%dh\n",
                            fc,
-                           base,
+                           iop,
                            r,
-                           base,
+                           iop,
                            r);
                         break;
                     default:
@@ -453,6 +682,7 @@ void load(int r, SValue *sv)
                     }
                 }
             }
+            BENCH_LEAVE();
             return;
         }
     } else { // VT_LVAL
@@ -460,6 +690,12 @@ void load(int r, SValue *sv)
             if (fr & VT_SYM) { // symbolic constant
                 char *sy = get_sym_str(sv->sym);
                 pr("; ld%d #%s + %d, tcc__r%d (type 0x%x)\n", length, sy, fc, r, ft);
+                if (is_near_ptr(&sv->type)) {
+                    /* the offset in the data bank is all a near pointer needs */
+                    pr("lda.w #%s + %d\nsta.b tcc__r%d\n", sy, fc, r);
+                    BENCH_LEAVE();
+                    return;
+                }
                 if (length != PTR_SIZE)
                     pr("; FISHY! length <> PTR_SIZE! (may be an array)\n");
                 pr("lda.w #:%s\nsta.b tcc__r%dh\nlda.w #%s + %d\nsta.b tcc__r%d\n", sy, r, sy, fc, r);
@@ -491,6 +727,7 @@ void load(int r, SValue *sv)
                     error("ICE 4");
                 }
             }
+            BENCH_LEAVE();
             return;
         } else if (v == VT_LOCAL) {
             if (fr & VT_SYM) {
@@ -506,12 +743,23 @@ void load(int r, SValue *sv)
                    ft,
                    fc);
                 // pointer; have to ensure the upper word is correct (page 0)
-                pr("stz.b tcc__r%dh\ntsa\nclc\nadc #(%d + __%s_locals + 1)\nsta.b tcc__r%d\n",
-                   r,
-                   sv->c.ul + args_size,
-                   current_fn,
-                   r);
+                // a near pointer does not have one, the stack is mirrored
+                // in the data bank
+                if (!is_near_ptr(&sv->type))
+                    pr("stz.b tcc__r%dh\n", r);
+                if (tcc_state->dp_frame)
+                    pr("tdc\nclc\nadc #(%d + __%s_locals + %d)\nsta.b tcc__r%d\n",
+                       dp_frame_offset(sv->c.ul),
+                       gen816.current_fn,
+                       DP_FRAME_REGS,
+                       r);
+                else
+                    pr("tsa\nclc\nadc #(%d + __%s_locals + 1)\nsta.b tcc__r%d\n",
+                       sv->c.ul + gen816.args_size,
+                       gen816.current_fn,
+                       r);
             }
+            BENCH_LEAVE();
             return;
         } else if (v == VT_CMP) {
             error("cmp");
@@ -524,6 +772,7 @@ void load(int r, SValue *sv)
             pr("lda #%d\n+\nsta.b tcc__r%d\n",
                t ^ 1,
                r); // stz rXh seems to be unnecessary (we only look at the lower word)
+            BENCH_LEAVE();
             return;
         } else if (v < VT_CONST) { // register value
             if (is_float(ft)) {
@@ -535,6 +784,7 @@ void load(int r, SValue *sv)
                 pr("; mov tcc__r%d, tcc__r%d\n", v, r);
                 pr("lda.b tcc__r%d\nsta.b tcc__r%d\nlda.b tcc__r%dh\nsta.b tcc__r%dh\n", v, r, v, r);
             }
+            BENCH_LEAVE();
             return;
         }
     }
@@ -559,7 +809,9 @@ void store(int r, SValue *sv)
     int v, ft, fc, fr, sign;
     int base;
     int length, align;
+    char iop[MAXLEN + 32], lop[MAXLEN + 32], hop[MAXLEN + 32];
     SValue v1;
+    BENCH_ENTER(BENCH_GEN);
 
     fr = sv->r;
     ft = sv->type.t;
@@ -582,6 +834,7 @@ void store(int r, SValue *sv)
         if (v == VT_CONST) {
             if (fr & VT_SYM) { // deref symbol
                 char *sy = get_sym_str(sv->sym);
+                char m = get_sym_mode(sv->sym);
                 if (r >= TREG_F0)
                     pr("; fst%d tcc__f%d, [%s,%d]\n", length, r - TREG_F0, sy, fc);
                 else
@@ -590,26 +843,30 @@ void store(int r, SValue *sv)
                     error("illegal float store of length %d", length);
                 switch (length) {
                 case 1:
-                    pr("sep #$20\nlda.b tcc__r%d\nsta.l %s + %d\nrep #$20\n", r, sy, fc);
+                    pr("sep #$20\nlda.b tcc__r%d\nsta.%c %s + %d\nrep #$20\n", r, m, sy, fc);
                     break;
                 case 2:
-                    pr("lda.b tcc__r%d\nsta.l %s + %d\n", r, sy, fc);
+                    pr("lda.b tcc__r%d\nsta.%c %s + %d\n", r, m, sy, fc);
                     break;
                 case 4:
                     if (r >= TREG_F0)
-                        pr("lda.b tcc__f%d\nsta.l %s + %d\nlda.b tcc__f%dh\nsta.l %s + %d + 2\n",
+                        pr("lda.b tcc__f%d\nsta.%c %s + %d\nlda.b tcc__f%dh\nsta.%c %s + %d + 2\n",
                            r - TREG_F0,
+                           m,
                            sy,
                            fc,
                            r - TREG_F0,
+                           m,
                            sy,
                            fc);
                     else
-                        pr("lda.b tcc__r%d\nsta.l %s + %d\nlda.b tcc__r%dh\nsta.l %s + %d + 2\n",
+                        pr("lda.b tcc__r%d\nsta.%c %s + %d\nlda.b tcc__r%dh\nsta.%c %s + %d + 2\n",
                            r,
+                           m,
                            sy,
                            fc,
                            r,
+                           m,
                            sy,
                            fc);
                     break;
@@ -617,9 +874,11 @@ void store(int r, SValue *sv)
                     error("ICE 5");
                     break;
                 }
+                BENCH_LEAVE();
                 return;
             } else {
                 v1.type.t = VT_PTR; // ft;
+                v1.type.ref = NULL;
                 v1.r = fr & ~VT_LVAL;
                 v1.c.ul = sv->c.ul;
                 v1.sym = sv->sym;
@@ -627,22 +886,24 @@ void store(int r, SValue *sv)
                 fc = sign = 0;
                 v = VT_LOCAL;
             }
+        } else if (v == VT_LLOCAL) { // only kept by vstore() with -fdp-frame
+            dp_ind_operand(iop, fc, ft);
+            base = -2;
+            fc = sign = 0;
+            v = VT_LOCAL;
         }
         if (v == VT_LOCAL) {
+            if (base >= 0)
+                ind_operand(iop, base, ft);
             if (r >= TREG_F0) { // is_float(ft)) {
-                if (base < 0) {
+                if (base == -1) {
                     pr("; fst%d tcc__f%d, [sp,%d]\n", length, r - TREG_F0, fc);
-                    fc = adjust_stack(fc, args_size + 2);
+                    fc = adjust_stack(fc, gen816.args_size + 2);
+                    local_operand(lop, fc);
+                    local_operand(hop, fc + 2);
                     switch (length) {
                     case 4:
-                        pr("lda.b tcc__f%d\nsta %d + __%s_locals + 1,s\nlda.b tcc__f%dh\nsta %d + "
-                           "__%s_locals + 1,s\n",
-                           r - TREG_F0,
-                           fc + args_size,
-                           current_fn,
-                           r - TREG_F0,
-                           fc + args_size + 2,
-                           current_fn);
+                        pr("lda.b tcc__f%d\nsta%s\nlda.b tcc__f%dh\nsta%s\n", r - TREG_F0, lop, r - TREG_F0, hop);
                         break;
                     default:
                         error("ICE 6f");
@@ -653,45 +914,35 @@ void store(int r, SValue *sv)
                     pr("; fst%d tcc__f%d, [tcc__r%d,%d]\n", length, r - TREG_F0, base, fc);
                     switch (length) {
                     case 4:
-                        pr("ldy.w #0\nlda.b tcc__f%d\nsta.b [tcc__r%d],y\niny\niny\nlda.b "
-                           "tcc__f%dh\nsta.b [tcc__r%d],y\n",
+                        pr("ldy.w #0\nlda.b tcc__f%d\nsta.b %s,y\niny\niny\nlda.b "
+                           "tcc__f%dh\nsta.b %s,y\n",
                            r - TREG_F0,
-                           base,
+                           iop,
                            r - TREG_F0,
-                           base);
+                           iop);
                         break;
                     default:
                         error("ICE 7f");
                         break;
                     }
                 }
+                BENCH_LEAVE();
                 return;
             } else {
-                if (base < 0) { // write to local at fc
+                if (base == -1) { // write to local at fc
                     pr("; st%d tcc__r%d, [sp,%d]\n", length, r, fc);
-                    fc = adjust_stack(fc, args_size + 2);
+                    fc = adjust_stack(fc, gen816.args_size + 2);
+                    local_operand(lop, fc);
+                    local_operand(hop, fc + 2);
                     switch (length) {
                     case 1:
-                        pr("sep #$20\nlda.b tcc__r%d\nsta %d + __%s_locals + 1,s\nrep #$20\n",
-                           r,
-                           fc + args_size,
-                           current_fn);
+                        pr("sep #$20\nlda.b tcc__r%d\nsta%s\nrep #$20\n", r, lop);
                         break;
                     case 2:
-                        pr("lda.b tcc__r%d\nsta %d + __%s_locals + 1,s\n",
-                           r,
-                           fc + args_size,
-                           current_fn);
+                        pr("lda.b tcc__r%d\nsta%s\n", r, lop);
                         break;
                     case 4:
-                        pr("lda.b tcc__r%d\nsta %d + __%s_locals + 1,s\nlda.b tcc__r%dh\nsta %d + "
-                           "__%s_locals + 1,s\n",
-                           r,
-                           fc + args_size,
-                           current_fn,
-                           r,
-                           fc + args_size + 2,
-                           current_fn);
+                        pr("lda.b tcc__r%d\nsta%s\nlda.b tcc__r%dh\nsta%s\n", r, lop, r, hop);
                         break;
                     default:
                         error("ICE 6");
@@ -704,25 +955,25 @@ void store(int r, SValue *sv)
                     case 1:
                         pr("sep #$20\nlda.b tcc__r%d\n", r);
                         if (!fc)
-                            pr("sta.b [tcc__r%d]\nrep #$20\n", base);
+                            pr("sta.b %s\nrep #$20\n", iop);
                         else
-                            pr("ldy #%d\nsta.b [tcc__r%d],y\nrep #$20\n", fc, base);
+                            pr("ldy #%d\nsta.b %s,y\nrep #$20\n", fc, iop);
                         break;
                     case 2:
                         pr("lda.b tcc__r%d\n", r);
                         if (!fc)
-                            pr("sta.b [tcc__r%d]\n", base);
+                            pr("sta.b %s\n", iop);
                         else
-                            pr("ldy #%d\nsta.b [tcc__r%d],y\n", fc, base);
+                            pr("ldy #%d\nsta.b %s,y\n", fc, iop);
                         break;
                     case 4:
-                        pr("lda.b tcc__r%d\nldy #%d\nsta.b [tcc__r%d],y\nlda.b "
-                           "tcc__r%dh\niny\niny\nsta.b [tcc__r%d],y\n",
+                        pr("lda.b tcc__r%d\nldy #%d\nsta.b %s,y\nlda.b "
+                           "tcc__r%dh\niny\niny\nsta.b %s,y\n",
                            r,
                            fc,
-                           base,
+                           iop,
                            r,
-                           base);
+                           iop);
                         break;
                     default:
                         error("ICE 7");
@@ -730,12 +981,43 @@ void store(int r, SValue *sv)
                     }
                 }
             }
+            BENCH_LEAVE();
             return;
         }
     }
     error("store unimplemented");
 }
 
+/**
+ * @brief Tells whether a function receives its first argument in the accumulator.
+ *
+ * Functions declared with __attribute__((regparm(1))) or fastcall get their
+ * first argument in A instead of on the stack, which saves the caller the
+ * push and the stack cleanup; the callee pushes A itself on entry. Only 8
+ * and 16-bit integer arguments fit in A, and such functions are only called
+ * directly (see gfunc_call()).
+ *
+ * @param func_sym The function type symbol (ref of the function type).
+ * @return 1 if the first argument is passed in A, 0 otherwise.
+ */
+static int gfunc_regparm(TokenSym *func_sym)
+{
+    TokenSym *arg;
+    int bt, align;
+
+    if (FUNC_CALL(func_sym->r) != FUNC_FASTCALL1)
+        return 0;
+    arg = func_sym->next;
+    if (func_sym->c == FUNC_OLD || !arg || (func_sym->type.t & VT_BTYPE) == VT_STRUCT)
+        error("regparm needs a prototype with a first parameter and no structure return");
+    bt = arg->type.t & VT_BTYPE;
+    if ((bt != VT_BYTE && bt != VT_SHORT && bt != VT_INT && bt != VT_BOOL && bt != VT_ENUM
+         && !is_near_ptr(&arg->type))
+        || type_size(&arg->type, &align) > 2)
+        error("regparm: the first parameter must be an 8 or 16-bit integer or a near pointer");
+    return 1;
+}
+
 /**
  * @brief Generate function call with a specified number of arguments.
  *
@@ -755,8 +1037,10 @@ void gfunc_call(int nb_args)
 {
     int align, r, i, func_call;
     TokenSym *func_sym;
+    int regparm, a_reg;
 
     int length;
+    BENCH_ENTER(BENCH_GEN);
 
     /* args_size is the size of the function call arguments already
        pushed on the stack. needed so that loads and stores to
@@ -764,18 +1048,32 @@ void gfunc_call(int nb_args)
        list. needs to be restored before returning to make
        nested function calls work (passing structs by value causes
        a memcpy call) */
-    int restore_args_size = args_size;
+    int restore_args_size = gen816.args_size;
+
+    /* the arguments are processed last to first, the first one may go to A */
+    func_sym = vtop[-nb_args].type.ref;
+    regparm = nb_args > 0 && gfunc_regparm(func_sym);
+    a_reg = -1;
+    /* calls through a pointer go through the tcc__jsl_ind_r9 and
+       tcc__jsl_r10 runtime helpers, which may use A to reach the target */
+    if (regparm && (vtop[-nb_args].r & VT_LVAL))
+        error("regparm functions cannot be called through a pointer");
 
     for (i = 0; i < nb_args; i++) {
         length = type_size(&vtop->type, &align);
         if (vtop->type.t & VT_ARRAY)
-            length = PTR_SIZE;
-
-        if ((vtop->type.t & VT_BTYPE) == VT_STRUCT) {
+            length = is_near_ptr(&vtop->type) ? 2 : PTR_SIZE;
+
+        if (regparm && i == nb_args - 1) {
+            /* loaded into A right before the jsr, save_regs() and the
+               function address load only read the register */
+            a_reg = gv(RC_INT);
+            pr("; regparm arg in tcc__r%d\n", a_reg);
+        } else if ((vtop->type.t & VT_BTYPE) == VT_STRUCT) {
             /* allocate the necessary size on stack */
             pr("; sub sp, #%d\n", length);
             pr("tsa\nsec\nsbc #%d\ntas\n", length);
-            args_size += length;
+            gen816.args_size += length;
 
             /* generate structure store */
             r = get_reg(RC_INT);
@@ -800,14 +1098,20 @@ void gfunc_call(int nb_args)
                vtop->r,
                r - TREG_F0);
             pr("pei (tcc__f%dh)\npei (tcc__f%d)\n", r - TREG_F0, r - TREG_F0);
-            args_size += length;
+            gen816.args_size += length;
         } else {
             /* simple type (currently always same size) */
             /* XXX: implicit cast ? */
             if (((vtop->r & VT_VALMASK) == VT_CONST) && ((vtop->r & VT_LVAL) == 0)) {
                 // push immediate
                 pr("; push%d imm r 0x%x\n", length, vtop->r);
-                if (vtop->r & VT_SYM) {
+                if ((vtop->r & VT_SYM) && is_near_ptr(&vtop->type)) {
+                    pr("pea.w %s %c %d\n",
+                       get_sym_str(vtop->sym),
+                       vtop->c.i < 0 ? '-' : '+',
+                       abs(vtop->c.i));
+                    length = 2;
+                } else if (vtop->r & VT_SYM) {
                     char *sy = get_sym_str(vtop->sym);
                     if (length != PTR_SIZE)
                         pr("; FISHY! length <> PTR_SIZE! (may be an array)\n");
@@ -860,52 +1164,50 @@ void gfunc_call(int nb_args)
                     break;
                 }
             }
-            args_size += length;
+            gen816.args_size += length;
         }
         vtop--;
     }
     save_regs(0); /* save used temporary registers */
-    func_sym = vtop->type.ref;
     func_call = func_sym->r;
 
-    /* fast call case */
-    if (func_call >= FUNC_FASTCALL1 && func_call <= FUNC_FASTCALL3) {
-        error("fastcall");
-    }
-
     pr("; call r 0x%x\n", vtop->r);
     if (vtop->r & VT_LVAL) {
         // call a function pointer
         if ((vtop->r & VT_VALMASK) == VT_LLOCAL) {
             SValue v1;
             v1.type.t = VT_PTR;
+            v1.type.ref = NULL;
             v1.r = VT_LOCAL | VT_LVAL;
             v1.c.ul = vtop->c.ul;
             load(9, &v1);
             // the 65816 is two stoopid to do a jsl [r10], so we have to jump thru a hoop here
             pr("; eins\njsr.l tcc__jsl_ind_r9\n");
         } else { // call a symbolic function pointer
-            pr("; symfpcall vtop->sym %p vtop->r 0x%x vtop->type.t 0x%x c 0x%x\n",
-               vtop->sym,
+            pr("; symfpcall vtop->r 0x%x vtop->type.t 0x%x c 0x%x\n",
                vtop->r,
                vtop->type.t,
                vtop->c.ui);
             gv(RC_R10);
             pr("; zwei\njsr.l tcc__jsl_r10\n");
         }
-    } else
+    } else {
+        if (a_reg >= 0)
+            pr("lda.b tcc__r%d\n", a_reg);
         pr("jsr.l %s\n", get_sym_str(vtop->sym));
+    }
 
-    if (args_size - restore_args_size && func_sym->r != FUNC_STDCALL) {
-        pr("; add sp, #%d\n", args_size - restore_args_size);
+    if (gen816.args_size - restore_args_size && func_sym->r != FUNC_STDCALL) {
+        pr("; add sp, #%d\n", gen816.args_size - restore_args_size);
         // pull the arguments off the stack
-        if (args_size - restore_args_size == 2)
+        if (gen816.args_size - restore_args_size == 2)
             pr("pla\n");
         else
-            pr("tsa\nclc\nadc #%d\ntas\n", args_size - restore_args_size);
+            pr("tsa\nclc\nadc #%d\ntas\n", gen816.args_size - restore_args_size);
     }
-    args_size = restore_args_size;
+    gen816.args_size = restore_args_size;
     vtop--;
+    BENCH_LEAVE();
 }
 
 /**
@@ -924,28 +1226,32 @@ void gfunc_call(int nb_args)
 int gjmp(int t)
 {
     int r = ind;
+    BENCH_ENTER(BENCH_GEN);
 
     pr("; gjmp_addr %d at %d\n", t, ind);
-    pr("jmp.w " LOCAL_LABEL "\n", jumps);
+    pr("jmp.w " LOCAL_LABEL "\n", gen816.jumps);
 
-    jump[jumps][0] = r;
+    gen816.jump[gen816.jumps][0] = r;
 
-    for (int i = 0; i < jumps; i++) {
-        if (jump[i][0] == t) {
-            jump[i][0] = r;
+    for (int i = 0; i < gen816.jumps; i++) {
+        if (gen816.jump[i][0] == t) {
+            gen816.jump[i][0] = r;
         }
     }
 
-    jumps++;
+    gen816.jumps++;
     gsym_addr(r, t);
 
+    BENCH_LEAVE();
     return r;
 }
 
 /**
  * @brief Generates a jump instruction to a fixed address.
  *
- * This function is a wrapper around the `gjmp()` function. It calls `gjmp()` with the given address.
+ * Unlike gjmp(), the address is not a jump chain: a jump that happens to
+ * start at a (a loop entry jump right after a label, for instance) must
+ * keep its own target.
  *
  * @param[in] a The target address for the jump.
  *
@@ -953,7 +1259,13 @@ int gjmp(int t)
  */
 void gjmp_addr(int a)
 {
-    gjmp(a);
+    BENCH_ENTER(BENCH_GEN);
+    pr("; gjmp_addr %d at %d\n", a, ind);
+    gen816.jump[gen816.jumps][0] = ind;
+    gen816.jump[gen816.jumps][1] = a;
+    pr("jmp.w " LOCAL_LABEL "\n", gen816.jumps);
+    gen816.jumps++;
+    BENCH_LEAVE();
 }
 
 /**
@@ -972,6 +1284,7 @@ void gjmp_addr(int a)
 int gtst(int inv, int t)
 {
     int v, r;
+    BENCH_ENTER(BENCH_GEN);
     v = vtop->r & VT_VALMASK;
     r = ind;
     pr("; gtst inv %d t %d v %d r %d ind %d\n", inv, t, v, r, ind);
@@ -981,12 +1294,12 @@ int gtst(int inv, int t)
         switch (vtop->c.i) {
         case TOK_NE:
             // remember that we need a label to jump to
-            jump[jumps][0] = r;
+            gen816.jump[gen816.jumps][0] = r;
             pr("; cmp ne\n");
             // branches (too short) pr("b%s " LOCAL_LABEL "\n", inv?"eq":"ne", jumps++);
             pr("b%s +\n", inv ? "ne" : "eq");
             gsym(t);
-            pr("brl " LOCAL_LABEL "\n+\n", jumps++);
+            pr("brl " LOCAL_LABEL "\n+\n", gen816.jumps++);
             break;
         default:
             error("unknown compare");
@@ -1010,6 +1323,7 @@ int gtst(int inv, int t)
             pr("lda.b tcc__f%d\nand.w #$ff00\nora.b tcc__f%dh\n", v - TREG_F0, v - TREG_F0);
             vtop->r = VT_CMP;
             vtop->c.i = TOK_NE;
+            BENCH_LEAVE();
             return gtst(inv, t);
         } else if ((vtop->r & (VT_VALMASK | VT_LVAL | VT_SYM)) == VT_CONST) {
             if ((vtop->type.t & VT_BTYPE) == VT_LLONG)
@@ -1030,11 +1344,13 @@ int gtst(int inv, int t)
                 pr("ora.b tcc__r%d\n", vtop->r2);
             vtop->r = VT_CMP;
             vtop->c.i = TOK_NE;
+            BENCH_LEAVE();
             return gtst(inv, t);
         }
     }
     vtop--;
     pr("; gtst finished; t %d\n", t);
+    BENCH_LEAVE();
     return t;
 }
 
@@ -1051,6 +1367,7 @@ int gtst(int inv, int t)
  * Some of the operations performed include:
  * - For multiplication (`*`), it optimizes for 8-bit computations.
  * - For unsigned multiplication (`TOK_UMULL`), it generates assembly for 32-bit multiplication.
+ * - For 8.8 fixed-point multiplication (`TOK_FMUL8`), it keeps the middle word of the product.
  * - For division and modulus operations (`TOK_PDIV`, `/`, `TOK_UDIV`, `%`, `TOK_UMOD`), it handles both signed and unsigned division.
  * - For bitwise operations (`+`, `-`, `&`, `|`, `^`), it handles the carry flag accordingly.
  * - For comparison operations (`TOK_EQ`, `TOK_NE`, `TOK_GT`, `TOK_LE`, `TOK_LT`, `TOK_GE`, `TOK_UGT`, `TOK_ULE`, `TOK_ULT`, `TOK_UGE`), it handles signed and unsigned comparisons.
@@ -1070,6 +1387,7 @@ void gen_opi(int op)
     int isconst = 0;
     int timesshift, i;
     int skipcall;
+    BENCH_ENTER(BENCH_GEN);
 
     length = type_size(&vtop[0].type, &align);
     r = vtop[-1].r;
@@ -1077,7 +1395,7 @@ void gen_opi(int op)
     fc = vtop[0].c.ul;
 
     // get the actual values
-    if ((fr & VT_VALMASK) == VT_CONST && op != TOK_UMULL && !(fr & VT_SYM)) {
+    if ((fr & VT_VALMASK) == VT_CONST && op != TOK_UMULL && op != TOK_FMUL8 && !(fr & VT_SYM)) {
         // vtop is const, only need to load the other one
         // useless ? ft = vtop[0].type.t;
         vtop--;
@@ -1149,6 +1467,29 @@ void gen_opi(int op)
         pr("jsr.l tcc__mull\n");
         pr("stx.b tcc__r%d\nsty.b tcc__r%d\n", r, vtop->r);
         break;
+    // 8.8 fixed-point multiply: the middle word of the 32-bit product
+    case TOK_FMUL8:
+        sign = !(vtop[0].type.t & VT_UNSIGNED);
+        pr("; fmul8 tcc__r%d, tcc__r%d\n", r, fr);
+        if (sign) {
+            // two's complement correction for the high byte: subtract the
+            // other operand for each negative one
+            pr("lda.w #0\nldx.b tcc__r%d\nbpl +\nlda.b tcc__r%d\n+\n", r, fr);
+            pr("ldx.b tcc__r%d\nbpl +\nclc\nadc.b tcc__r%d\n+\npha\n", fr, r);
+        }
+        pr("lda.b tcc__r%d\nsta.b tcc__r9\nstz.b tcc__r9h\nlda.b tcc__r%d\nsta.b tcc__r10\nstz.b "
+           "tcc__r10h\n",
+           r,
+           fr);
+        pr("jsr.l tcc__mull\nsty.b tcc__r10\n");
+        if (sign)
+            pr("stx.b tcc__r9\npla\neor.w #$ffff\nsec\nadc.b tcc__r9\n");
+        else
+            pr("txa\n");
+        pr("xba\nand #$ff00\nsta.b tcc__r9\nlda.b tcc__r10\nxba\nand #$00ff\nora.b tcc__r9\nsta.b "
+           "tcc__r%d\n",
+           r);
+        break;
     // division and friends
     case TOK_PDIV:
         op = TOK_UDIV;
@@ -1245,15 +1586,14 @@ void gen_opi(int op)
         } else
             error("ICE 42");
 
-        pr("; %s tcc__r%d (0x%x), tcc__r%d (0x%x) (fr type 0x%x c %d r type 0x%x)\n",
+        pr("; %s tcc__r%d (0x%x), tcc__r%d (0x%x) (fr type 0x%x c %d)\n",
            opcalc,
            fr,
            fr,
            r,
            r,
            vtop[0].type.t,
-           vtop[0].c.ul,
-           vtop[-1].type.t);
+           vtop[0].c.ul);
         if (isconst) {
             pr("; length xxy %d vtop->type 0x%x\n", type_size(&vtop->type, &align), vtop->type.t);
             if (length == 4) {
@@ -1391,8 +1731,10 @@ void gen_opi(int op)
                                : "shl",
                r,
                fc);
-            if (!fc)
+            if (!fc) {
+                BENCH_LEAVE();
                 return; // 0 -> nothing to do
+            }
             if (fc == 8 && (op == TOK_SHR || op == TOK_SHL)) {
                 pr("lda.b tcc__r%d\nxba\n", r);
                 switch (op) {
@@ -1406,6 +1748,17 @@ void gen_opi(int op)
                     error("ICE 43");
                 }
                 pr("sta.b tcc__r%d\n", r);
+                BENCH_LEAVE();
+                return;
+            } else if (fc == 8 && op == TOK_SAR) {
+                // byte swap, then sign-extend the low byte
+                pr("lda.b tcc__r%d\nxba\nand #$00ff\nbit #$0080\nbeq +\nora #$ff00\n+\nsta.b tcc__r%d\n", r, r);
+                BENCH_LEAVE();
+                return;
+            } else if (fc == 15 && op == TOK_SAR) {
+                // only the sign is left: 0 or -1
+                pr("lda.b tcc__r%d\nasl a\nlda.w #0\nsbc.w #0\neor.w #$ffff\nsta.b tcc__r%d\n", r, r);
+                BENCH_LEAVE();
                 return;
             } else if (fc > UNROLL_SHIFT_MAX) // too many shifts -> need a loop
                 pr("lda.b tcc__r%d\nldy.w #%d\n-\n", r, fc);
@@ -1431,6 +1784,7 @@ void gen_opi(int op)
                         error("unknown shift");
                     }
                 }
+                BENCH_LEAVE();
                 return;
             }
         } else {
@@ -1466,6 +1820,298 @@ void gen_opi(int op)
     default:
         error("opi 0x%x (%c) unimplemented\n", op, op);
     }
+    BENCH_LEAVE();
+}
+
+/**
+ * @brief Formats the operand of one word of a 32-bit value that can be used
+ * without loading it into a register pair.
+ *
+ * That is a constant, a value already in a register pair, a global, or a
+ * local the stack relative addressing mode can reach.
+ *
+ * @param buf Receives the operand, to follow a mnemonic ("adc%s").
+ * @param sv The value.
+ * @param hi 0 for the low word, 1 for the high word.
+ * @return 0 if the value has to be loaded first.
+ */
+static int opl_operand(char *buf, SValue *sv, int hi)
+{
+    int fc = sv->c.ul + 2 * hi;
+
+    if (sv->r == VT_CONST) {
+        sprintf(buf, ".w #%d", (unsigned short) (hi ? sv->c.ull >> 16 : sv->c.ull));
+    } else if (sv->r < VT_CONST && sv->r2 < VT_CONST) {
+        sprintf(buf, ".b tcc__r%d", hi ? sv->r2 : sv->r);
+    } else if (sv->r == (VT_CONST | VT_SYM | VT_LVAL)) {
+        sprintf(buf, ".%c %s + %d", get_sym_mode(sv->sym), get_sym_str(sv->sym), fc);
+    } else if (sv->r == (VT_LOCAL | VT_LVAL)) {
+        if (!tcc_state->dp_frame && sv->c.i + 2 + gen816.args_size + 2 - loc - 256 >= 0)
+            return 0;
+        local_operand(buf, fc);
+    } else
+        return 0;
+    return 1;
+}
+
+/**
+ * @brief Shifts the 16-bit value in A by 'n' (1 to 15) bits.
+ */
+static void opl_shift_word(int op, int n)
+{
+    if (n >= 8) {
+        pr("xba\n");
+        if (op == TOK_SHL)
+            pr("and.w #$ff00\n");
+        else
+            pr("and.w #$00ff\n");
+        if (op == TOK_SAR)
+            pr("bit.w #$0080\nbeq +\nora.w #$ff00\n+\n");
+        n -= 8;
+    }
+    while (n--) {
+        if (op == TOK_SHL)
+            pr("asl a\n");
+        else if (op == TOK_SHR)
+            pr("lsr a\n");
+        else
+            pr("cmp.w #$8000\nror a\n");
+    }
+}
+
+/**
+ * @brief Shifts the 32-bit value in the register pair r/r2 by the constant 'c'.
+ *
+ * Shifts by 16 bits or more move the words; shifts by 8 bits or more move
+ * the bytes with xba; the remaining bits go through A and the carry, one
+ * word in A and the other shifted in place.
+ */
+static void opl_shift_const(int op, int r, int r2, int c)
+{
+    c &= 31;
+    if (!c)
+        return;
+    if (c >= 16) {
+        if (op == TOK_SHL) {
+            pr("lda.b tcc__r%d\n", r);
+            opl_shift_word(op, c - 16);
+            pr("sta.b tcc__r%d\nstz.b tcc__r%d\n", r2, r);
+        } else {
+            pr("lda.b tcc__r%d\n", r2);
+            opl_shift_word(op, c - 16);
+            pr("sta.b tcc__r%d\n", r);
+            if (op == TOK_SAR)
+                pr("lda.b tcc__r%d\nasl a\nlda.w #0\nsbc.w #0\neor.w #$ffff\nsta.b tcc__r%d\n", r2, r2);
+            else
+                pr("stz.b tcc__r%d\n", r2);
+        }
+        return;
+    }
+    if (c >= 8) {
+        if (op == TOK_SHL) {
+            pr("lda.b tcc__r%d\nxba\nand.w #$ff00\nsta.b tcc__r%d\n", r2, r2);
+            pr("lda.b tcc__r%d\nxba\ntax\nand.w #$00ff\nora.b tcc__r%d\nsta.b tcc__r%d\n", r, r2, r2);
+            pr("txa\nand.w #$ff00\nsta.b tcc__r%d\n", r);
+        } else {
+            pr("lda.b tcc__r%d\nxba\nand.w #$00ff\nsta.b tcc__r%d\n", r, r);
+            pr("lda.b tcc__r%d\nxba\ntax\nand.w #$ff00\nora.b tcc__r%d\nsta.b tcc__r%d\n", r2, r, r);
+            pr("txa\nand.w #$00ff\n");
+            if (op == TOK_SAR)
+                pr("bit.w #$0080\nbeq +\nora.w #$ff00\n+\n");
+            pr("sta.b tcc__r%d\n", r2);
+        }
+        c -= 8;
+        if (!c)
+            return;
+    } else
+        pr("lda.b tcc__r%d\n", op == TOK_SHL ? r : r2);
+    /* the word the bits come out of is in A, the other one is rotated in place */
+    while (c--) {
+        if (op == TOK_SHL)
+            pr("asl a\nrol.b tcc__r%d\n", r2);
+        else if (op == TOK_SHR)
+            pr("lsr a\nror.b tcc__r%d\n", r);
+        else
+            pr("cmp.w #$8000\nror a\nror.b tcc__r%d\n", r);
+    }
+    pr("sta.b tcc__r%d\n", op == TOK_SHL ? r : r2);
+}
+
+/**
+ * @brief Generates a 32-bit (long long) operation inline on the register pairs.
+ *
+ * gen_opl() splits 32-bit operations into 16-bit ones on separate values,
+ * which costs a lot of register shuffling, and calls the runtime for every
+ * shift by a variable. This handles additions, subtractions, bitwise
+ * operations, comparisons and shifts directly on the register pair of the
+ * first operand (vtop[-1].r holds the low word, vtop[-1].r2 the high word);
+ * the second operand is used where it is when it is a constant, a global
+ * or a local. Comparisons leave their result in tcc__r5, like gen_opi().
+ *
+ * @param op The operation.
+ * @return 0 if the operation is left to gen_opl() (multiplications and
+ *         divisions).
+ */
+int gen_opl_inline(int op)
+{
+    char lo[MAXLEN + 32], hi[MAXLEN + 32];
+    const char *opc;
+    int r, r2, r5, c, i, swap;
+    BENCH_ENTER(BENCH_GEN);
+
+    switch (op) {
+    case TOK_SHL:
+    case TOK_SHR:
+    case TOK_SAR:
+        if ((vtop->r & (VT_VALMASK | VT_LVAL | VT_SYM)) == VT_CONST) {
+            c = vtop->c.i;
+            vpop();
+            gv(RC_INT);
+            pr("; %s32 tcc__r%d/tcc__r%d, #%d\n",
+               op == TOK_SAR   ? "sar"
+               : op == TOK_SHR ? "shr"
+                               : "shl",
+               vtop->r,
+               vtop->r2,
+               c);
+            opl_shift_const(op, vtop->r, vtop->r2, c);
+            BENCH_LEAVE();
+            return 1;
+        }
+        gv2(RC_INT, RC_INT);
+        r = vtop[-1].r;
+        r2 = vtop[-1].r2;
+        pr("; %s32 tcc__r%d/tcc__r%d, tcc__r%d\n",
+           op == TOK_SAR   ? "sar"
+           : op == TOK_SHR ? "shr"
+                           : "shl",
+           r,
+           r2,
+           vtop->r);
+        pr("ldy.b tcc__r%d\nbeq +\nlda.b tcc__r%d\n-\n", vtop->r, op == TOK_SHL ? r : r2);
+        if (op == TOK_SHL)
+            pr("asl a\nrol.b tcc__r%d\n", r2);
+        else if (op == TOK_SHR)
+            pr("lsr a\nror.b tcc__r%d\n", r);
+        else
+            pr("cmp.w #$8000\nror a\nror.b tcc__r%d\n", r);
+        pr("dey\nbne -\nsta.b tcc__r%d\n+\n", op == TOK_SHL ? r : r2);
+        vtop--;
+        BENCH_LEAVE();
+        return 1;
+    case '+':
+    case '-':
+    case '&':
+    case '|':
+    case '^':
+    case TOK_EQ:
+    case TOK_NE:
+    case TOK_LT:
+    case TOK_GE:
+    case TOK_LE:
+    case TOK_GT:
+    case TOK_ULT:
+    case TOK_UGE:
+    case TOK_ULE:
+    case TOK_UGT:
+        break;
+    default:
+        BENCH_LEAVE();
+        return 0;
+    }
+
+    r5 = -1;
+    if (op >= TOK_ULT && op <= TOK_GT)
+        r5 = get_reg(RC_R5);
+    /* the first operand goes to a register pair, the second one only if
+       it cannot be used where it is */
+    if (opl_operand(lo, vtop, 0)) {
+        vswap();
+        gv(RC_INT);
+        vswap();
+    }
+    if (!opl_operand(lo, vtop, 0) || !opl_operand(hi, vtop, 1))
+        gv2(RC_INT, RC_INT);
+    opl_operand(lo, vtop, 0);
+    opl_operand(hi, vtop, 1);
+    r = vtop[-1].r;
+    r2 = vtop[-1].r2;
+    c = vtop->r == VT_CONST;
+
+    if (op < TOK_ULT || op > TOK_GT) {
+        pr("; %c32 tcc__r%d/tcc__r%d, %s/%s\n", op, r, r2, lo, hi);
+        if (op == '+' || op == '-') {
+            opc = op == '+' ? "adc" : "sbc";
+            if (c && !(unsigned short) vtop->c.ull) {
+                /* the low word does not change, nor carries */
+                pr("lda.b tcc__r%d\n%s\n%s%s\nsta.b tcc__r%d\n", r2, op == '+' ? "clc" : "sec", opc, hi, r2);
+            } else if (c && !(vtop->c.ull >> 16 & 0xffff)) {
+                /* only the carry goes to the high word */
+                pr("%s\nlda.b tcc__r%d\n%s%s\nsta.b tcc__r%d\n", op == '+' ? "clc" : "sec", r, opc, lo, r);
+                pr("%s +\n%s.b tcc__r%d\n+\n", op == '+' ? "bcc" : "bcs", op == '+' ? "inc" : "dec", r2);
+            } else {
+                pr("%s\nlda.b tcc__r%d\n%s%s\nsta.b tcc__r%d\n", op == '+' ? "clc" : "sec", r, opc, lo, r);
+                pr("lda.b tcc__r%d\n%s%s\nsta.b tcc__r%d\n", r2, opc, hi, r2);
+            }
+        } else {
+            opc = op == '&' ? "and" : op == '|' ? "ora" : "eor";
+            for (i = 0; i < 2; i++) {
+                unsigned short w = i ? vtop->c.ull >> 16 : vtop->c.ull;
+                int rr = i ? r2 : r;
+
+                if (c && ((op == '&' && w == 0xffff) || (op != '&' && w == 0)))
+                    continue;
+                if (c && op == '&' && w == 0)
+                    pr("stz.b tcc__r%d\n", rr);
+                else
+                    pr("lda.b tcc__r%d\n%s%s\nsta.b tcc__r%d\n", rr, opc, i ? hi : lo, rr);
+            }
+        }
+        vtop--;
+        BENCH_LEAVE();
+        return 1;
+    }
+
+    pr("; cmp32 tcc__r%d/tcc__r%d, %s/%s\n", r, r2, lo, hi);
+    pr("ldx #1\n");
+    if (op == TOK_EQ || op == TOK_NE) {
+        pr("lda.b tcc__r%d\ncmp%s\nbne +\nlda.b tcc__r%d\ncmp%s\n", r, lo, r2, hi);
+        if (op == TOK_EQ)
+            pr("beq ++\n+\ndex\n++\n");
+        else
+            pr("bne +\ndex\n+\n");
+    } else {
+        /* a > b is b < a, a <= b is b >= a */
+        swap = op == TOK_GT || op == TOK_LE || op == TOK_UGT || op == TOK_ULE;
+        if (swap)
+            pr("lda%s\ncmp.b tcc__r%d\nlda%s\nsbc.b tcc__r%d\n", lo, r, hi, r2);
+        else
+            pr("lda.b tcc__r%d\ncmp%s\nlda.b tcc__r%d\nsbc%s\n", r, lo, r2, hi);
+        switch (op) {
+        case TOK_ULT:
+        case TOK_UGT:
+            pr("bcc +\n");
+            break;
+        case TOK_UGE:
+        case TOK_ULE:
+            pr("bcs +\n");
+            break;
+        default:
+            /* signed: the sign of the difference, corrected for overflow */
+            pr("bvc +\neor.w #$8000\n+\n%s ++\n", op == TOK_LT || op == TOK_GT ? "bmi" : "bpl");
+            pr("dex\n++\n");
+            op = 0;
+            break;
+        }
+        if (op)
+            pr("dex\n+\n");
+    }
+    pr("stx.b tcc__r%d\n", r5);
+    vtop--;
+    vtop->r = r5;
+    vtop->r2 = VT_CONST;
+    BENCH_LEAVE();
+    return 1;
 }
 
 /**
@@ -1525,6 +2171,7 @@ void float_to_woz(float f, unsigned char *w)
 void gen_opf(int op)
 {
     int ir, align;
+    BENCH_ENTER(BENCH_GEN);
 
     // get the actual values
     gv2(RC_F1, RC_F0);
@@ -1558,6 +2205,7 @@ void gen_opf(int op)
         pr(op == TOK_EQ ? "beq +\n" : "bne +\n");
         pr("dex\n+\nstx.b tcc__r%d\n", ir);
         vtop->r = ir;
+        BENCH_LEAVE();
         return;
 
     case TOK_GT:
@@ -1584,11 +2232,13 @@ void gen_opf(int op)
         }
         pr("++\ndex\n+++\nstx.b tcc__r%d\n", ir);
         vtop->r = ir;
+        BENCH_LEAVE();
         return;
     default:
         error("opf 0x%x (%c) unimplemented\n", op, op);
     }
     vtop->r = TREG_F0;
+    BENCH_LEAVE();
 }
 
 /**
@@ -1629,6 +2279,7 @@ void convert_type_helper(int it, const char *unsigned_fn, const char *signed_fn)
 void gen_cvt_itof(int t)
 {
     int r, r2, it;
+    BENCH_ENTER(BENCH_GEN);
     gv(RC_INT);        // load integer to convert
     r = vtop->r;       // register with int
     r2 = vtop->r2;     // register with high word (for long longs)
@@ -1645,6 +2296,7 @@ void gen_cvt_itof(int t)
         convert_type_helper(it, "jsr.l tcc__ufloat\n", "jsr.l tcc__float\n");
     }
     vtop->r = TREG_F0; // tell TCC that the result is in f0
+    BENCH_LEAVE();
 }
 
 /**
@@ -1664,6 +2316,7 @@ void gen_cvt_itof(int t)
 void gen_cvt_ftoi(int t)
 {
     int r = 0;
+    BENCH_ENTER(BENCH_GEN);
     gv(RC_F0);
     int is_llong = (t & VT_BTYPE) == VT_LLONG;
     if (is_llong) {
@@ -1685,6 +2338,7 @@ void gen_cvt_ftoi(int t)
         pr("lda.b tcc__f0 + 1\nxba\nsta.b tcc__r%d\n", r);
         vtop->r = r;
     }
+    BENCH_LEAVE();
 }
 
 /**
@@ -1705,6 +2359,22 @@ void gen_cvt_ftof(int t)
     error("gen_cvt_ftof 0x%x\n", t);
 }
 
+/**
+ * @brief Converts the near pointer on top of the value stack to a far pointer.
+ *
+ * A near pointer is an offset in the data bank, so the bank of the far
+ * pointer is DATA_BANK.
+ */
+void gen_cvt_neartofar(void)
+{
+    int r = gv(RC_INT);
+    BENCH_ENTER(BENCH_GEN);
+
+    pr("; near to far tcc__r%d\n", r);
+    pr("lda.w #$%x\nsta.b tcc__r%dh\n", DATA_BANK, r);
+    BENCH_LEAVE();
+}
+
 /**
  * @brief Performs an unconditional goto (jump) to a specified address.
  *
@@ -1726,17 +2396,37 @@ void ggoto(void)
 {
     int r = gv(RC_INT);
     int t = vtop->type.t;
+    BENCH_ENTER(BENCH_GEN);
     pr("; ggoto r 0x%x t 0x%x\n", r, t);
+    if (tcc_state->dp_frame) {
+        /* tcc__r9 is not at its own address when D points at a frame: "return"
+           to the target instead */
+        pr("sep #$20\nlda.b tcc__r%dh\npha\nrep #$20\nlda.b tcc__r%d\ndea\npha\nrtl\n", r, r);
+        BENCH_LEAVE();
+        return;
+    }
     pr("lda.b tcc__r%d\nsta.b tcc__r9 + 1\nsep #$20\nlda.b tcc__r%dh\nsta.b tcc__r9h + 1\nlda.b "
        "#$5c\nsta.b tcc__r9\nrep #$20\n",
        r,
        r);
     pr("jml.l tcc__r9\n");
+    BENCH_LEAVE();
 }
 
-int ind_before_section = 0;
-int section_closed = 1;
-int section_count = 0;
+/**
+ * @brief Clears the per translation unit state of the code generator.
+ *
+ * Called by tcc_new(), so that every compilation starts from an empty
+ * jump/label/locals table, as if the compiler had just been started.
+ */
+void gen_816_reset(void)
+{
+    free(gen816.relocptrs);
+    tcc_free(gen816.insns);
+    arena_reset(&gen816.insn_text);
+    memset(&gen816, 0, sizeof(gen816));
+    gen816.section_closed = 1;
+}
 
 /**
  * @brief Generates the function prolog for a given function type.
@@ -1755,6 +2445,7 @@ void gfunc_prolog(CType *func_type)
 {
     TokenSym *sym;
     int n, addr, size, align;
+    BENCH_ENTER(BENCH_GEN);
 
     sym = func_type->ref;
     func_vt = sym->type;
@@ -1768,22 +2459,37 @@ void gfunc_prolog(CType *func_type)
         n += PTR_SIZE;
     }
 
+    /* the lines of the function are kept until gfunc_epilog() */
+    gen816.nb_insns = 0;
+    gen816.insns_open = 1;
+
     /* super-dirty hack to get the function name */
-    strcpy(current_fn, get_sym_str((TokenSym *) (((void *) func_type) - offsetof(TokenSym, type))));
+    strcpy(gen816.current_fn, get_sym_str((TokenSym *) (((void *) func_type) - offsetof(TokenSym, type))));
 
     /* wlalink does not cut up sections, so it is desirable to have a section
        for each function to keep the amount of unused memory in the ROM banks
        low. WLA DX barfs, however, if fed more than 255 sections, so we have
        to be a bit economical: gfunc_epilog() only closes the section if more
        than 50K of assembler code have been written */
-    if (section_closed) {
-        ind_before_section = ind;
+    if (gen816.section_closed) {
+        gen816.ind_before_section = ind;
         //230625 pr("\n.SECTION \".text_0x%x\" SUPERFREE\n", section_count++);
-        pr("\n.SECTION \".%stext_0x%x\" SUPERFREE\n", current_fn, section_count++);
-        section_closed = 0;
+        pr("\n.SECTION \".%stext_0x%x\" SUPERFREE\n", gen816.current_fn, gen816.section_count++);
+        gen816.section_closed = 0;
     }
 
-    pr("\n%s:\n", current_fn);
+    pr("\n%s:\n", gen816.current_fn);
+    gen816.body_start = ind;
+
+    /* a first argument passed in A is pushed right below the return
+       address, at offset 0; the stack arguments move up by two bytes */
+    gen816.regparm = gfunc_regparm(sym);
+    if (gen816.regparm) {
+        pr("pha\n");
+        sym = sym->next;
+        sym_push(sym->v & ~SYM_FIELD, &sym->type, VT_LOCAL | VT_LVAL, 0);
+        addr += 2;
+    }
 
     while ((sym = sym->next)) {
         CType *type = &sym->type;
@@ -1792,17 +2498,659 @@ void gfunc_prolog(CType *func_type)
         addr += size;
         n += size;
     }
-    pr("; sub sp,#__%s_locals\n", current_fn);
-    pr(".ifgr __%s_locals 0\ntsa\nsec\nsbc #__%s_locals\ntas\n.endif\n", current_fn, current_fn);
+    gen816.params_end = addr;
+    gen816.frame_start = ind;
+    if (tcc_state->dp_frame) {
+        /* D = S + 1 after the frame is allocated: the pseudo registers are
+           at the bottom of the frame, the locals right above them */
+        pr("; dp frame #__%s_locals + %d\n", gen816.current_fn, DP_FRAME_REGS);
+        pr("phd\ntsa\nsec\nsbc #__%s_locals + %d\ntas\nina\ntcd\n", gen816.current_fn, DP_FRAME_REGS);
+    } else {
+        pr("; sub sp,#__%s_locals\n", gen816.current_fn);
+        pr(".ifgr __%s_locals 0\ntsa\nsec\nsbc #__%s_locals\ntas\n.endif\n", gen816.current_fn, gen816.current_fn);
+    }
+    gen816.frame_end = ind;
     loc = 0; // huh squared?
+    BENCH_LEAVE();
+}
+
+/**
+ * @brief Removes the stack frame of a function that has no locals.
+ *
+ * Whether a function needs locals is only known once its body has been
+ * generated, so the prolog always allocates a frame of __<fn>_locals
+ * bytes. For functions without locals, this drops the prolog stack
+ * adjustment from the lines of the function and turns the stack relative
+ * "n + __<fn>_locals + 1,s" operands into plain "n + 1,s" ones, so that no
+ * __<fn>_locals define is needed.
+ */
+static void frame_elide(void)
+{
+    char pat[MAXLEN + 16];
+    Insn816 *in;
+    char *p, *q;
+    int plen;
+
+    snprintf(pat, sizeof(pat), "__%s_locals + ", gen816.current_fn);
+    plen = strlen(pat);
+    for (in = gen816.insns; in < gen816.insns + gen816.nb_insns; in++) {
+        if (in->pos < gen816.frame_start)
+            continue;
+        if (in->pos < gen816.frame_end) {
+            in->dead = 1;
+            continue;
+        }
+        if (!strstr(in->text, pat))
+            continue;
+        for (p = q = in->text; *p;) {
+            if (!strncmp(p, pat, plen))
+                p += plen;
+            else
+                *q++ = *p++;
+        }
+        *q = '\0';
+        in->len = q - in->text;
+        insn_decode(in);
+    }
+}
+
+/**
+ * @brief Maps the text offset 'pos' of the current function, which ended at
+ * 'end', to its offset after insn_flush().
+ *
+ * @param newpos The new offset of each line, and of the end.
+ */
+static int insn_moved(int pos, int end, int *newpos)
+{
+    int i = insn_find(pos);
+
+    /* an offset inside a line moves to its start */
+    if (pos < end && (i == gen816.nb_insns || gen816.insns[i].pos > pos))
+        i--;
+    return newpos[i];
+}
+
+/**
+ * @brief Writes the lines of the current function that are not dead to the
+ * text section.
+ *
+ * The jump sources and targets and the labels inside the function move
+ * along with the text; an offset in a dead line moves to the line after it.
+ */
+static void insn_flush(void)
+{
+    Insn816 *in;
+    int *newpos, start, end, i, j, k;
+
+    gen816.insns_open = 0;
+    if (gen816.nb_insns == 0)
+        return;
+    start = gen816.insns[0].pos;
+    end = ind;
+    newpos = tcc_malloc((gen816.nb_insns + 1) * sizeof(int));
+    ind = start;
+    for (i = 0; i < gen816.nb_insns; i++) {
+        in = &gen816.insns[i];
+        newpos[i] = ind;
+        if (!in->dead)
+            s(in->text);
+    }
+    newpos[i] = ind;
+
+    for (k = 0; k < gen816.jumps; k++) {
+        for (j = 0; j < 2; j++) {
+            if (gen816.jump[k][j] >= start && gen816.jump[k][j] <= end)
+                gen816.jump[k][j] = insn_moved(gen816.jump[k][j], end, newpos);
+        }
+    }
+    for (k = 0; k < gen816.labels; k++) {
+        if (gen816.label[k].pos >= start && gen816.label[k].pos <= end)
+            gen816.label[k].pos = insn_moved(gen816.label[k].pos, end, newpos);
+    }
+
+    tcc_free(newpos);
+    gen816.nb_insns = 0;
+    arena_reset(&gen816.insn_text);
+}
+
+/**
+ * @brief Checks whether a mnemonic is one of a space separated list.
+ */
+static int insn_is(const Insn816 *in, const char *list)
+{
+    int n = strlen(in->op);
+    const char *p;
+
+    if (n == 0)
+        return 0;
+    for (p = list; (p = strstr(p, in->op)); p += n) {
+        if ((p == list || p[-1] == ' ') && (p[n] == ' ' || p[n] == '\0'))
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Checks whether an instruction addresses a tcc__rN/tcc__rNh/tcc__fN
+ * pseudo register in direct page mode.
+ */
+static int insn_pseudo(const Insn816 *in)
+{
+    const char *p = in->arg, *e = in->arg + in->arg_len;
+
+    if (in->mode != AM_DP || in->arg_len < 7 || memcmp(p, "tcc__", 5))
+        return 0;
+    p += 5;
+    if (*p != 'r' && *p != 'f')
+        return 0;
+    for (p++; p < e && isdigit((unsigned char) *p); p++)
+        ;
+    if (p < e && *p == 'h')
+        p++;
+    return p == e;
+}
+
+/**
+ * @brief Checks whether two instructions have the same operand.
+ */
+static int insn_same_arg(const Insn816 *a, const Insn816 *b)
+{
+    return a->mode == b->mode && a->arg_len == b->arg_len && !memcmp(a->arg, b->arg, a->arg_len);
+}
+
+/**
+ * @brief Checks whether the operand of 'in' may access the pseudo register
+ * addressed by 'reg'.
+ *
+ * tcc__rN and tcc__rNh are taken as one: "[tcc__rN]" also reads the bank
+ * byte in tcc__rNh, and "tcc__rN + 1" overlaps both. Names are matched as
+ * whole words, so tcc__r1 is not part of tcc__r10.
+ */
+static int insn_mentions(const Insn816 *in, const Insn816 *reg)
+{
+    const char *p = in->arg, *e = in->arg + in->arg_len, *q;
+    int n = reg->arg_len;
+
+    if (reg->arg[n - 1] == 'h')
+        n--;
+    for (; p + n <= e; p++) {
+        if (memcmp(p, reg->arg, n) || (p > in->arg && (isalnum((unsigned char) p[-1]) || p[-1] == '_')))
+            continue;
+        q = p + n;
+        if (q < e && *q == 'h')
+            q++;
+        if (q == e || !(isalnum((unsigned char) *q) || *q == '_'))
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Marks the lines of the current function that jumps or C labels
+ * point at: they start a new basic block.
+ */
+static void peephole_targets(void)
+{
+    int k, t, i;
+
+    for (k = 0; k < gen816.jumps + gen816.labels; k++) {
+        t = k < gen816.jumps ? gen816.jump[k][1] : gen816.label[k - gen816.jumps].pos;
+        i = insn_find(t);
+        if (i < gen816.nb_insns && gen816.insns[i].pos == t)
+            gen816.insns[i].target = 1;
+    }
+}
+
+/**
+ * @brief Checks whether the N/Z flags set by instruction 'i' may be tested
+ * before they are set again.
+ */
+static int peephole_flags_used(int i)
+{
+    Insn816 *in;
+
+    for (i++; i < gen816.nb_insns; i++) {
+        in = &gen816.insns[i];
+        if (in->target || in->kind == INSN_LABEL || in->kind == INSN_DIRECTIVE)
+            return 1;
+        if (in->kind != INSN_OP || in->dead)
+            continue;
+        if (insn_is(in, "bcc bcs beq bne bmi bpl bvc bvs php bra brl jmp jml sep rep"))
+            return 1;
+        if (insn_is(in, "jsr jsl rtl rts"))
+            return 0;
+        if (insn_is(in, "lda ldx ldy adc sbc and ora eor cmp cpx cpy bit inc dec inx iny dex dey "
+                        "asl lsr rol ror tax tay txa tya tsa tsc tdc txy tyx pla plx ply plp xba"))
+            return 0;
+    }
+    return 0;
+}
+
+/**
+ * @brief Removes loads and stores of A that only copy what A already holds.
+ *
+ * The pass follows which pseudo register A mirrors since the last
+ * "lda.b tcc__xx" or "sta.b tcc__xx" within a basic block.
+ */
+static void peephole_loads(void)
+{
+    Insn816 *in, *mir = NULL;
+    int i;
+
+    for (i = 0; i < gen816.nb_insns; i++) {
+        in = &gen816.insns[i];
+        if (in->target)
+            mir = NULL;
+        if (in->kind == INSN_COMMENT || in->dead)
+            continue;
+        if (in->kind != INSN_OP) {
+            mir = NULL;
+            continue;
+        }
+        if (!strcmp(in->op, "lda") && insn_pseudo(in)) {
+            if (mir && insn_same_arg(mir, in) && !in->keep && !peephole_flags_used(i))
+                in->dead = 1;
+            else
+                mir = in;
+        } else if (!strcmp(in->op, "sta") && insn_pseudo(in)) {
+            if (mir && insn_same_arg(mir, in) && !in->keep)
+                in->dead = 1;
+            else
+                mir = in;
+        } else if (insn_is(in, "sta stx sty stz ldx ldy tax tay txy tyx inx iny dex dey cpx cpy cmp bit "
+                               "clc sec clv nop pha phx phy pei pea phb phd phk php plx ply "
+                               "bcc bcs beq bne bmi bpl bvc bvs bra brl jmp")
+                   || (insn_is(in, "inc dec asl lsr rol ror tsb trb") && in->mode != AM_ACC
+                       && in->mode != AM_IMPLIED)) {
+            /* A is left alone, but the mirrored register may be written */
+            if (mir && insn_is(in, "sta stx sty stz inc dec asl lsr rol ror tsb trb")
+                && insn_mentions(in, mir))
+                mir = NULL;
+        } else {
+            mir = NULL;
+        }
+    }
+}
+
+/**
+ * @brief Removes stores to a pseudo register that is stored again, without
+ * being read in between, in the same basic block.
+ */
+static void peephole_stores(void)
+{
+    Insn816 *in, *next;
+    int i, j, acc;
+
+    for (i = 0; i < gen816.nb_insns; i++) {
+        in = &gen816.insns[i];
+        if (in->kind != INSN_OP || in->dead || in->keep || !insn_is(in, "sta stz stx sty")
+            || !insn_pseudo(in))
+            continue;
+        /* sta/stz store as many bytes as A is wide, stx/sty as X/Y */
+        acc = insn_is(in, "sta stz");
+        for (j = i + 1; j < gen816.nb_insns; j++) {
+            next = &gen816.insns[j];
+            if (next->target || next->kind == INSN_LABEL || next->kind == INSN_DIRECTIVE)
+                break;
+            if (next->kind != INSN_OP || next->dead)
+                continue;
+            if (insn_mentions(next, in)) {
+                if (insn_same_arg(next, in) && (acc ? insn_is(next, "sta stz") : insn_is(next, "stx sty")))
+                    in->dead = 1;
+                break;
+            }
+            if (insn_is(next, "bcc bcs beq bne bmi bpl bvc bvs bra brl jmp jml jsr jsl rtl rts rti sep rep plp"))
+                break;
+        }
+    }
+}
+
+/**
+ * @brief Removes jumps to the line that follows them.
+ */
+static void peephole_jumps(int end)
+{
+    Insn816 *in;
+    int i, j, k, t, next;
+
+    for (i = 0; i < gen816.nb_insns; i++) {
+        in = &gen816.insns[i];
+        if (in->kind != INSN_OP || in->dead || !insn_is(in, "jmp brl bra") || in->arg_len < 9
+            || memcmp(in->arg, "__local_", 8))
+            continue;
+        k = atoi(in->arg + 8);
+        if (k < 0 || k >= gen816.jumps)
+            continue;
+        t = gen816.jump[k][1];
+        /* where execution continues if the jump is removed */
+        next = end;
+        for (j = i + 1; j < gen816.nb_insns; j++) {
+            if (!gen816.insns[j].dead && gen816.insns[j].kind != INSN_COMMENT) {
+                next = gen816.insns[j].pos;
+                break;
+            }
+        }
+        if (t >= in->pos + in->len && t <= next)
+            in->dead = 1;
+    }
+}
+
+/**
+ * @brief Local optimization of the current function (-fpeephole).
+ *
+ * Runs on the lines pr() has recorded for the function, with their
+ * mnemonic, size, addressing mode and operand: local passes mark the
+ * redundant instructions dead, and insn_flush() leaves them out.
+ */
+static void peephole(void)
+{
+    if (ind <= gen816.body_start)
+        return;
+
+    peephole_targets();
+    peephole_loads();
+    peephole_stores();
+    peephole_jumps(ind);
+}
+
+/**
+ * @brief Makes a local addressable by the loop code of -floop-opt.
+ *
+ * A local the stack relative addressing mode can reach is used in place;
+ * otherwise it is loaded into the pseudo register 'r' (through
+ * adjust_stack()), which stands in for it until loop_close().
+ *
+ * @param buf Receives the operand, to follow a mnemonic ("lda%s").
+ * @param sv The local.
+ * @param r The pseudo register to use for a local that is out of reach.
+ * @return 'r' if the local was loaded into it, -1 if it is used in place.
+ */
+static int loop_open(char *buf, SValue *sv, int r)
+{
+    if (tcc_state->dp_frame || sv->c.i + gen816.args_size + 2 - loc - 256 < 0) {
+        local_operand(buf, sv->c.i);
+        return -1;
+    }
+    load(r, sv);
+    sprintf(buf, ".b tcc__r%d", r);
+    return r;
+}
+
+/**
+ * @brief Writes back a local loop_open() has loaded into a pseudo register.
+ *
+ * This goes through A; the caller reloads it from the register if needed.
+ */
+static void loop_close(char *buf, SValue *sv, int r)
+{
+    if (r >= 0) {
+        store(r, sv);
+        pr("lda%s\n", buf);
+    }
+}
+
+/**
+ * @brief Checks whether the code since 'head' is short enough for a branch
+ * back to it (128 bytes), taking every instruction as 4 bytes.
+ */
+static int loop_near(int head)
+{
+    Insn816 *in;
+    int size = 0;
+
+    for (in = gen816.insns + insn_find(head); in < gen816.insns + gen816.nb_insns; in++) {
+        if (in->kind == INSN_OP)
+            size += 4;
+        else if (in->kind == INSN_DIRECTIVE)
+            size += 64;
+    }
+    return size <= 112;
+}
+
+/**
+ * @brief Emits the jump or branch 'insn' to the text offset 'head'.
+ */
+static void loop_jump(const char *insn, int head)
+{
+    gen816.jump[gen816.jumps][0] = ind;
+    gen816.jump[gen816.jumps][1] = head;
+    pr("%s " LOCAL_LABEL "\n", insn, gen816.jumps++);
+}
+
+/**
+ * @brief Branches back to 'head' if the condition 'cc' ("ne", "cc", ...)
+ * holds: with a short branch if the loop is small enough, otherwise with an
+ * inverted branch over a brl.
+ */
+static void loop_branch(const char *cc, int head)
+{
+    static const char conds[] = "cccseqnemipl";
+    char insn[4];
+    int i;
+
+    if (loop_near(head)) {
+        sprintf(insn, "b%s", cc);
+        loop_jump(insn, head);
+        return;
+    }
+    /* the conditions come in pairs: flip the last bit of the index */
+    for (i = 0; memcmp(conds + 2 * i, cc, 2); i++)
+        ;
+    pr("b%.2s +\n", conds + 2 * (i ^ 1));
+    loop_jump("brl", head);
+    pr("+\n");
+}
+
+/**
+ * @brief Steps the counter of a counted loop and branches back to the loop
+ * body while it has not reached its bound (-floop-opt).
+ *
+ * The counter is incremented or decremented in place and compared with the
+ * bound right away, instead of being stored, reloaded into a pseudo
+ * register and compared by gen_opi().
+ *
+ * @param ctr The counter, a 16-bit local.
+ * @param step 1 or -1.
+ * @param op The comparison that keeps the loop going: TOK_NE, TOK_LT,
+ * TOK_GE, TOK_LE, TOK_GT or their unsigned forms.
+ * @param bound A constant, or a 16-bit local or global variable.
+ * @param head The text offset of the loop body.
+ */
+void gen_loop_step(SValue *ctr, int step, int op, SValue *bound, int head)
+{
+    char cop[MAXLEN + 32], bop[MAXLEN + 32];
+    const char *cc;
+    int r, swap;
+    BENCH_ENTER(BENCH_GEN);
+
+    save_regs(0);
+    pr("; loop step %d\n", step);
+    if ((bound->r & (VT_VALMASK | VT_LVAL | VT_SYM)) == VT_CONST)
+        sprintf(bop, ".w #%d", bound->c.i & 0xffff);
+    else if ((bound->r & VT_VALMASK) == VT_LOCAL)
+        loop_open(bop, bound, TREG_R10);
+    else
+        sprintf(bop, ".%c %s", get_sym_mode(bound->sym), get_sym_str(bound->sym));
+
+    r = loop_open(cop, ctr, TREG_R9);
+    pr("lda%s\n%s\nsta%s\n", cop, step > 0 ? "ina" : "dea", cop);
+    loop_close(cop, ctr, r);
+
+    /* "i <= n" is tested as "n >= i", and "i > n" as "n < i" */
+    swap = (op == TOK_LE || op == TOK_GT || op == TOK_ULE || op == TOK_UGT);
+    if (swap)
+        pr("lda%s\n", bop);
+    if (op == TOK_NE) {
+        if (strcmp(bop, ".w #0"))
+            pr("cmp%s\n", bop);
+        cc = "ne";
+    } else if (op == TOK_GE && !strcmp(bop, ".w #0")) {
+        cc = "pl";
+    } else if (op == TOK_ULT || op == TOK_UGE || op == TOK_ULE || op == TOK_UGT) {
+        pr("cmp%s\n", swap ? cop : bop);
+        cc = (op == TOK_ULT || op == TOK_UGT) ? "cc" : "cs";
+    } else {
+        /* signed: the sign of the difference, corrected on overflow */
+        pr("sec\nsbc%s\nbvc +\neor.w #$8000\n+\n", swap ? cop : bop);
+        cc = (op == TOK_LT || op == TOK_GT) ? "mi" : "pl";
+    }
+    loop_branch(cc, head);
+    BENCH_LEAVE();
+}
+
+/**
+ * @brief Counts a loop down to zero and branches back to the loop body
+ * until it gets there (-floop-opt).
+ *
+ * @param ctr The counter, a 16-bit local, or NULL if it is held in X.
+ * @param post Non-zero to test the value before the decrement ("n--"),
+ * zero to test the value after it ("--n").
+ * @param head The text offset of the loop body.
+ */
+void gen_loop_count(SValue *ctr, int post, int head)
+{
+    char cop[MAXLEN + 32];
+    int r;
+    BENCH_ENTER(BENCH_GEN);
+
+    save_regs(0);
+    pr("; loop count%s\n", ctr ? "" : " in X");
+    if (!ctr) {
+        pr("dex\n");
+        if (post)
+            pr("cpx.w #$ffff\n");
+    } else {
+        r = loop_open(cop, ctr, TREG_R9);
+        if (cop[1] == 'b' && r < 0 && !post) {
+            pr("dec%s\n", cop);
+        } else {
+            pr("lda%s\ndea\nsta%s\n", cop, cop);
+            loop_close(cop, ctr, r);
+            if (post)
+                pr("ina\n");
+        }
+    }
+    loop_branch("ne", head);
+    BENCH_LEAVE();
+}
+
+/**
+ * @brief Loads the count of a loop into X, before the loop (-floop-opt).
+ *
+ * @param ctr The counter, a 16-bit local, or NULL for the constant 'n'.
+ * @param n The number of iterations if 'ctr' is NULL.
+ */
+void gen_loop_enter(SValue *ctr, int n)
+{
+    char cop[MAXLEN + 32];
+    BENCH_ENTER(BENCH_GEN);
+
+    save_regs(0);
+    pr("; loop count in X\n");
+    if (!ctr) {
+        pr("ldx.w #%d\n", n);
+        BENCH_LEAVE();
+        return;
+    }
+    loop_open(cop, ctr, TREG_R9);
+    pr("lda%s\ntax\n", cop);
+    BENCH_LEAVE();
+}
+
+/**
+ * @brief Checks whether the code since 'head' leaves X alone, so that a
+ * loop counter loaded by gen_loop_enter() is still there (-floop-opt).
+ */
+int gen_loop_x_kept(int head)
+{
+    Insn816 *in;
+    const char *imm;
+    BENCH_ENTER(BENCH_GEN);
+
+    for (in = gen816.insns + insn_find(head); in < gen816.insns + gen816.nb_insns; in++) {
+        if (in->kind == INSN_DIRECTIVE) {
+            BENCH_LEAVE();
+            return 0;
+        }
+        if (in->kind != INSN_OP)
+            continue;
+        if (insn_is(in, "ldx inx dex tax tsx tyx plx mvn mvp jsr jsl jml rti")) {
+            BENCH_LEAVE();
+            return 0;
+        }
+        /* a change of the index register size */
+        if (insn_is(in, "rep sep")) {
+            imm = in->arg_len > 2 ? in->arg + 1 : "";
+            if (*imm != '$' || strtol(imm + 1, NULL, 16) & 0x10) {
+                BENCH_LEAVE();
+                return 0;
+            }
+        }
+    }
+    BENCH_LEAVE();
+    return 1;
+}
+
+/**
+ * @brief Adds 'delta' to a pointer stepped along with a loop counter
+ * (-floop-opt).
+ *
+ * Element addresses are 16-bit offsets in the bank of the array, as in
+ * gen_opi(): only the low word changes.
+ */
+void gen_loop_ptr_step(SValue *ptr, int delta)
+{
+    char pop[MAXLEN + 32];
+    int r;
+    BENCH_ENTER(BENCH_GEN);
+
+    save_regs(0);
+    r = loop_open(pop, ptr, TREG_R9);
+    pr("; loop pointer step %d\n", delta);
+    if (delta > 0)
+        pr("lda%s\nclc\nadc.w #%d\nsta%s\n", pop, delta, pop);
+    else
+        pr("lda%s\nsec\nsbc.w #%d\nsta%s\n", pop, -delta, pop);
+    if (r >= 0)
+        store(r, ptr);
+    BENCH_LEAVE();
 }
 
-#define MAX_LOCALS 1000
 #define STACK_SIZE_LIMIT 0x1f00
 
-char locals[MAX_LOCALS][MAXLEN];
-int localnos[MAX_LOCALS];
-int localno = 0;
+/**
+ * @brief Releases the direct page frame of a -fdp-frame function.
+ *
+ * The return value is in the function's own pseudo registers; it is carried
+ * over to those of the caller in X and Y while the caller's D is restored.
+ */
+static void dp_frame_epilog(void)
+{
+    const char *lo = NULL, *hi = NULL;
+    int align;
+
+    if (is_float(func_vt.t)) {
+        lo = "tcc__f0";
+        hi = "tcc__f0h";
+    } else if ((func_vt.t & VT_BTYPE) == VT_LLONG) {
+        lo = "tcc__r0";
+        hi = "tcc__r1";
+    } else if ((func_vt.t & VT_BTYPE) != VT_VOID) {
+        lo = "tcc__r0";
+        if ((func_vt.t & VT_BTYPE) == VT_STRUCT || type_size(&func_vt, &align) > 2)
+            hi = "tcc__r0h";
+    }
+    pr("; release dp frame\n");
+    if (lo)
+        pr("ldy.b %s\n", lo);
+    if (hi)
+        pr("ldx.b %s\n", hi);
+    pr("tsa\nclc\nadc #__%s_locals + %d\ntas\npld\n", gen816.current_fn, DP_FRAME_REGS);
+    if (lo)
+        pr("sty.b %s\n", lo);
+    if (hi)
+        pr("stx.b %s\n", hi);
+}
 
 /**
  * @brief Generates the function epilog.
@@ -1817,29 +3165,54 @@ int localno = 0;
  */
 void gfunc_epilog(void)
 {
-    pr("; add sp, #__%s_locals\n", current_fn);
-    pr(".ifgr __%s_locals 0\ntsa\nclc\nadc #__%s_locals\ntas\n.endif\n", current_fn, current_fn);
+    /* no locals: no frame at all, arguments are addressed relative to
+       the stack pointer as it was on entry */
+    int frameless = (loc == 0 && !tcc_state->dp_frame);
+    BENCH_ENTER(BENCH_GEN);
+
+    if (frameless)
+        frame_elide();
+    if (tcc_state->peephole)
+        peephole();
+    if (tcc_state->dp_frame) {
+        if (DP_FRAME_REGS - loc + dp_frame_offset(gen816.params_end) > DP_FRAME_SIZE)
+            error("the frame of '%s' does not fit in the direct page (-fdp-frame)", gen816.current_fn);
+        dp_frame_epilog();
+    } else if (!frameless) {
+        pr("; add sp, #__%s_locals\n", gen816.current_fn);
+        pr(".ifgr __%s_locals 0\ntsa\nclc\nadc #__%s_locals\ntas\n.endif\n", gen816.current_fn, gen816.current_fn);
+    }
+    if (gen816.regparm)
+        pr("pla\n"); /* drop the first argument pushed by the prolog */
     pr("rtl\n");
 
     pr(".ENDS\n");
-    section_closed = 1;
+    gen816.section_closed = 1;
+    insn_flush();
 
     if (-loc > STACK_SIZE_LIMIT) {
         error("stack overflow");
     }
 
+    if (frameless) {
+        gen816.current_fn[0] = '\0';
+        BENCH_LEAVE();
+        return;
+    }
+
     /* simply putting a ".define __<current_fn>_locals -<loc>" after the
        function does not work in some cases for unknown reasons (wla-dx
        complains about unresolved symbols); putting them before the reference
        works, but this has to be done by the output code, so we have to save
        the various locals sizes somewhere */
-    if (localno < MAX_LOCALS) {
-        strcpy(locals[localno], current_fn);
-        localnos[localno] = -loc;
-        localno++;
+    if (gen816.localno < MAX_LOCALS) {
+        strcpy(gen816.locals[gen816.localno], gen816.current_fn);
+        gen816.localnos[gen816.localno] = -loc;
+        gen816.localno++;
     } else {
         error("maximum number of local variables exceeded");
     }
 
-    current_fn[0] = '\0';
+    gen816.current_fn[0] = '\0';
+    BENCH_LEAVE();
 }
@@ -121,6 +121,20 @@ int reg_classes[NB_REGS] = {
 
 #define LOCAL_LABEL "__local_%d"
 
+/* the data bank register of C code: near pointers are offsets in this bank */
+#define DATA_BANK 0x7e
+
+/* with -fdp-frame, the bottom of each frame holds the function's own copy
+   of the pseudo registers (tcc__r0-r10, tcc__f0-f3 and tcc__SP), and its
+   locals and arguments follow; everything must be within 256 bytes of D */
+#define DP_FRAME_REGS 0x40
+#define DP_FRAME_SIZE 256
+
+/* the placement of a data symbol (VT_PLACEMENT) is kept in bits 2-3 of
+   st_other, above the ELF visibility, for the .bss output */
+#define ST_PLACEMENT_SHIFT 2
+#define ST_PLACEMENT(o) (((o) >> ST_PLACEMENT_SHIFT) << VT_PLACEMENT_SHIFT & VT_PLACEMENT)
+
 #define MAXLEN 512
 
 #define MAX_LABELS 1000
@@ -138,12 +152,9 @@ char unique_token[] = "{WLA_FILENAME}";
  */
 
 #define STATIC_PREFIX "tccs_"
-char current_fn[MAXLEN] = "";
-
-// Variable relocate a given section
-char **relocptrs = NULL;
 
-char *label_workaround = NULL;
+#define MAX_JUMPS 20000
+#define MAX_LOCALS 1000
 
 /**
  * @struct labels_816
@@ -158,6 +169,98 @@ struct labels_816
     int pos;    /**< @brief The position of the label in the code. */
 };
 
-struct labels_816 label[MAX_LABELS]; /**< @brief Array to store multiple label structures. */
+/**
+ * @struct Insn816
+ *
+ * @brief One line of a function's assembler text.
+ *
+ * While a function is generated, pr() appends one of these for every line
+ * instead of writing the text out; gfunc_epilog() removes the stack frame
+ * and runs the peephole pass on the list, then writes the lines that are
+ * not dead to the text section.
+ */
+typedef struct Insn816
+{
+    int pos;         /**< @brief Text offset of the line, as counted by 'ind'. */
+    int len;         /**< @brief Length of the line, including its newline. */
+    char *text;      /**< @brief The line, in GenContext816.insn_text. */
+    int kind;        /**< @brief INSN_OP, INSN_LABEL, INSN_DIRECTIVE or INSN_COMMENT. */
+    char op[4];      /**< @brief Mnemonic ("lda"), empty if not an instruction. */
+    char width;      /**< @brief Operand size suffix: 'b', 'w', 'l' or 0. */
+    int mode;        /**< @brief Addressing mode (AM_xxx). */
+    const char *arg; /**< @brief Operand text (not NUL-terminated). */
+    int arg_len;     /**< @brief Length of the operand text. */
+    int target;      /**< @brief A jump or a C label points at this line. */
+    int keep;        /**< @brief Marked "DON'T OPTIMIZE". */
+    int dead;        /**< @brief Removed by the peephole pass. */
+} Insn816;
+
+#define INSN_OP 0        /* an instruction */
+#define INSN_LABEL 1     /* a named or anonymous (+/-) label */
+#define INSN_DIRECTIVE 2 /* an assembler directive */
+#define INSN_COMMENT 3   /* a comment or an empty line */
+
+#define AM_IMPLIED 0 /* no operand */
+#define AM_ACC 1     /* "a" */
+#define AM_IMM 2     /* "#..." */
+#define AM_DP 3      /* direct page (".b" suffix) */
+#define AM_ABS 4     /* absolute or long */
+#define AM_STACK 5   /* stack relative ("n,s") */
+#define AM_IND 6     /* indirect ("[...]" or "(...)") */
 
-int labels = 0;
\ No newline at end of file
+/**
+ * @struct GenContext816
+ *
+ * @brief Per translation unit state of the 65816 code generator.
+ *
+ * Everything the code generator accumulates while compiling one file and
+ * that tcc_output_binary() needs to write the assembler output. It is
+ * cleared by gen_816_reset() whenever a new TCCState is created, so that
+ * several files can be compiled one after the other in the same process.
+ */
+typedef struct GenContext816
+{
+    char current_fn[MAXLEN]; /**< @brief Name of the function being generated. */
+
+    /** @brief Jump sources and targets (text offsets), update from mic_ to have more space. */
+    int jump[MAX_JUMPS][2];
+    int jumps;
+
+    struct labels_816 label[MAX_LABELS]; /**< @brief Array to store multiple label structures. */
+    int labels;
+    char *label_workaround; /**< @brief Name of the C label gsym_addr() is about to place. */
+
+    /** @brief Locals size of each function, written as __<fn>_locals defines. */
+    char locals[MAX_LOCALS][MAXLEN];
+    int localnos[MAX_LOCALS];
+    int localno;
+
+    char **relocptrs; /**< @brief Symbol names of relocated pointers (see relocate_section()). */
+
+    int stack_back; /**< @brief Pending stack adjustment of adjust_stack(). */
+    /** @brief Size of the function call arguments pushed so far; used to be local to
+        gfunc_call, but we need it to get the correct stack pointer displacement while
+        building the argument stack for a function call. */
+    int args_size;
+    int ll_workaround;
+
+    int ind_before_section;
+    int section_closed;
+    int section_count;
+
+    /** @brief Text offsets of the prolog stack adjustment of the current function,
+        removed again by gfunc_epilog() if the function ends up without locals. */
+    int frame_start;
+    int frame_end;
+    int regparm; /**< @brief The current function receives its first argument in A. */
+    int params_end; /**< @brief Frame offset right above the arguments of the current function. */
+    int body_start; /**< @brief Text offset right after the label of the current function. */
+
+    Insn816 *insns; /**< @brief Lines of the current function, written out by gfunc_epilog(). */
+    int nb_insns;
+    int max_insns;
+    int insns_open;     /**< @brief pr() appends to 'insns' (set by gfunc_prolog()). */
+    TCCArena insn_text; /**< @brief Text of the lines. */
+} GenContext816;
+
+GenContext816 gen816;
\ No newline at end of file
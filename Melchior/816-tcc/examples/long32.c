@@ -0,0 +1,23 @@
+/*
+ * 32-bit arithmetic benchmark: each function does one long long operation
+ * on globals. Compile with "816-tcc -c -o long32.asm long32.c" and count
+ * the cycles of each function (see "32-bit arithmetic" in Readme.md).
+ */
+
+long long a = 123456789, b = -987654;
+unsigned long long ua = 0x89abcdef;
+long long r;
+int n = 13, t;
+
+void add(void) { r = a + b; }
+void sub(void) { r = a - b; }
+void and_(void) { r = a & b; }
+void addc(void) { r = a + 1000; }
+void shl3(void) { r = a << 3; }
+void sar12(void) { r = a >> 12; }
+void shr20(void) { r = ua >> 20; }
+void shln(void) { r = a << n; }
+void lt(void) { t = a < b; }
+void eq(void) { t = a == b; }
+void ult(void) { if (ua < 0x10000) t = 1; }
+void mul(void) { r = a * b; }
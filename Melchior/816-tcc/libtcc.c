@@ -26,6 +26,7 @@
 /* display benchmark infos */
 int total_lines;
 int total_bytes;
+TCCBench tcc_bench;
 
 /* parser */
 static struct BufferedFile *file;
@@ -91,6 +92,7 @@ static int global_expr;   /* true if compound literals must be allocated
 static CType func_vt;     /* current function return type (used by return
                              instruction) */
 static int func_vc;
+static int inline_level; /* number of inline bodies being expanded */
 static int last_line_num, last_ind, func_ind; /* debug last line number and pc */
 static int tok_ident;
 static TokenSym **table_ident;
@@ -100,11 +102,14 @@ static char *funcname;
 static TokenSym *global_stack, *local_stack;
 static TokenSym *define_stack;
 static TokenSym *global_label_stack, *local_label_stack;
+/* identifiers and symbols live until the state is deleted, macro bodies
+   until the end of the file that defines them: they are freed at once
+   with their arena */
+static TCCArena tu_arena;
+static TCCArena tokstr_arena;
 /* symbol allocator */
 #define SYM_POOL_NB (8192 / sizeof(TokenSym))
 static TokenSym *sym_free_first;
-static void **sym_pools;
-static int nb_sym_pools;
 
 static SValue vstack[VSTACK_SIZE], *vtop;
 /* some predefined types */
@@ -337,6 +342,7 @@ static inline int toup(int c)
 
 #include "tccpp.c"
 #include "tccgen.c"
+#include "tcccache.c"
 
 #ifdef CONFIG_TCC_ASM
 
@@ -471,17 +477,30 @@ char *tcc_fileextension(const char *name)
 }
 
 /* memory management */
-#ifdef MEM_DEBUG
-int mem_cur_size;
-int mem_max_size;
-unsigned malloc_usable_size(void *);
+
+/* heap in use and its peak, reported by -bench */
+long mem_cur_size;
+long mem_max_size;
+
+/* size of a heap block, as the C library accounts it (0 if unknown) */
+static unsigned long tcc_mem_size(void *ptr)
+{
+    if (!ptr)
+        return 0;
+#if defined(_WIN32)
+    return _msize(ptr);
+#elif defined(__APPLE__)
+    return malloc_size(ptr);
+#elif defined(__GLIBC__)
+    return malloc_usable_size(ptr);
+#else
+    return 0;
 #endif
+}
 
 void tcc_free(void *ptr)
 {
-#ifdef MEM_DEBUG
-    mem_cur_size -= malloc_usable_size(ptr);
-#endif
+    mem_cur_size -= tcc_mem_size(ptr);
     free(ptr);
 }
 
@@ -489,11 +508,10 @@ void *tcc_malloc(unsigned long size)
 {
     void *ptr;
     ptr = malloc(size);
-#ifdef MEM_DEBUG
-    mem_cur_size += malloc_usable_size(ptr);
+    tcc_bench.allocs++;
+    mem_cur_size += tcc_mem_size(ptr);
     if (mem_cur_size > mem_max_size)
         mem_max_size = mem_cur_size;
-#endif
     return ptr;
 }
 
@@ -508,21 +526,86 @@ void *tcc_mallocz(unsigned long size)
 void *tcc_realloc(void *ptr, unsigned long size)
 {
     void *ptr1;
-#ifdef MEM_DEBUG
-    mem_cur_size -= malloc_usable_size(ptr);
-#endif
+    mem_cur_size -= tcc_mem_size(ptr);
     ptr1 = realloc(ptr, size);
+    tcc_bench.allocs++;
     if (!ptr1 && size)
         error("memory full");
-#ifdef MEM_DEBUG
     /* NOTE: count not correct if alloc error, but not critical */
-    mem_cur_size += malloc_usable_size(ptr1);
+    mem_cur_size += tcc_mem_size(ptr1);
     if (mem_cur_size > mem_max_size)
         mem_max_size = mem_cur_size;
-#endif
     return ptr1;
 }
 
+/* arena chunks start small, for short files, and double up to the
+   maximum size; blocks are aligned like the chunks */
+#define ARENA_CHUNK_MIN (4 * 1024)
+#define ARENA_CHUNK_MAX (64 * 1024)
+#define ARENA_ALIGN sizeof(ArenaChunk)
+
+void *arena_alloc(TCCArena *a, unsigned long size)
+{
+    ArenaChunk *c;
+    unsigned long n;
+
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    if (size > (unsigned long) (a->end - a->ptr)) {
+        a->chunk_size = a->chunk_size ? a->chunk_size * 2 : ARENA_CHUNK_MIN;
+        if (a->chunk_size > ARENA_CHUNK_MAX)
+            a->chunk_size = ARENA_CHUNK_MAX;
+        n = size > a->chunk_size ? size : a->chunk_size;
+        c = tcc_malloc(sizeof(ArenaChunk) + n);
+        if (!c)
+            error("memory full");
+        c->next = a->chunks;
+        a->chunks = c;
+        a->ptr = (char *) (c + 1);
+        a->end = a->ptr + n;
+    }
+    a->last = a->ptr;
+    a->ptr += size;
+    return a->last;
+}
+
+/* grow 'ptr', a block of 'old_size' bytes allocated from 'a' (or NULL), to
+   'size' bytes; the last block allocated grows in place when there is room */
+void *arena_realloc(TCCArena *a, void *ptr, unsigned long old_size, unsigned long size)
+{
+    void *ptr1;
+
+    if (ptr && ptr == a->last && size <= (unsigned long) (a->end - a->last)) {
+        a->ptr = a->last;
+        return arena_alloc(a, size);
+    }
+    ptr1 = arena_alloc(a, size);
+    if (ptr)
+        memcpy(ptr1, ptr, old_size);
+    return ptr1;
+}
+
+/* free the blocks of 'a' allocated since 'mark', a copy of 'a' taken
+   earlier */
+void arena_release(TCCArena *a, const TCCArena *mark)
+{
+    ArenaChunk *c, *next;
+
+    for (c = a->chunks; c != mark->chunks; c = next) {
+        next = c->next;
+        tcc_free(c);
+    }
+    *a = *mark;
+}
+
+/* free all the blocks of 'a' */
+void arena_reset(TCCArena *a)
+{
+    TCCArena empty;
+
+    memset(&empty, 0, sizeof(empty));
+    arena_release(a, &empty);
+}
+
 char *tcc_strdup(const char *str)
 {
     char *ptr;
@@ -534,7 +617,7 @@ char *tcc_strdup(const char *str)
 void tcc_memstats(void)
 {
 #ifdef MEM_DEBUG
-    printf("memory in use: %d\n", mem_cur_size);
+    printf("memory in use: %ld\n", mem_cur_size);
 #endif
 }
 
@@ -578,8 +661,7 @@ static TokenSym *__sym_malloc(void)
     TokenSym *sym_pool, *sym, *last_sym;
     int i;
 
-    sym_pool = tcc_malloc(SYM_POOL_NB * sizeof(TokenSym));
-    dynarray_add(&sym_pools, &nb_sym_pools, sym_pool);
+    sym_pool = arena_alloc(&tu_arena, SYM_POOL_NB * sizeof(TokenSym));
 
     last_sym = sym_free_first;
     sym = sym_pool;
@@ -599,6 +681,7 @@ static inline TokenSym *sym_malloc(void)
     if (!sym)
         sym = __sym_malloc();
     sym_free_first = sym->next;
+    tcc_bench.syms++;
     return sym;
 }
 
@@ -654,6 +737,7 @@ static void section_realloc(Section *sec, unsigned long new_size)
     unsigned long size;
     unsigned char *data;
 
+    tcc_bench.section_reallocs++;
     size = sec->data_allocated;
     if (size == 0)
         size = 1;
@@ -730,6 +814,9 @@ static void put_extern_sym2(
 #ifdef TCC_TARGET_PE
         if (sym->type.t & VT_EXPORT)
             other |= 1;
+#endif
+#ifdef TCC_TARGET_816
+        other |= (sym->type.t & VT_PLACEMENT) >> VT_PLACEMENT_SHIFT << ST_PLACEMENT_SHIFT;
 #endif
     }
 
@@ -783,8 +870,8 @@ static void put_extern_sym2(
         }
 #ifdef TCC_TARGET_816
         if (sym->type.t & VT_STATIC) {
-            if ((sym->type.t & VT_STATICLOCAL) && current_fn[0] != 0)
-                sprintf(buf1, "%s_FUNC_%s_", STATIC_PREFIX, current_fn);
+            if ((sym->type.t & VT_STATICLOCAL) && gen816.current_fn[0] != 0)
+                sprintf(buf1, "%s_FUNC_%s_", STATIC_PREFIX, gen816.current_fn);
             else
                 sprintf(buf1, "%s%s_", STATIC_PREFIX, unique_token);
             strcat(buf1, name);
@@ -1198,17 +1285,21 @@ void tcc_close(BufferedFile *bf)
 static int tcc_compile(TCCState *s1)
 {
     TokenSym *define_start;
+    TCCArena tokstr_start;
     char buf[512];
     volatile int section_sym;
 
 #ifdef INC_DEBUG
     printf("%s: **** new file\n", file->filename);
 #endif
+    if (tcc_bench.on)
+        bench_switch(BENCH_PARSE);
     preprocess_init(s1);
 
     cur_text_section = NULL;
     funcname = "";
     anon_sym = SYM_FIRST_ANOM;
+    inline_level = 0;
 
     /* file info: full path + filename */
     section_sym = 0; /* avoid warning */
@@ -1275,6 +1366,7 @@ static int tcc_compile(TCCState *s1)
 #endif
 
     define_start = define_stack;
+    tokstr_start = tokstr_arena;
     nocode_wanted = 1;
 
     if (setjmp(s1->error_jmp_buf) == 0) {
@@ -1284,6 +1376,8 @@ static int tcc_compile(TCCState *s1)
         ch = file->buf_ptr[0];
         tok_flags = TOK_FLAG_BOL | TOK_FLAG_BOF;
         parse_flags = PARSE_FLAG_PREPROCESS | PARSE_FLAG_TOK_NUM;
+        /* after a cache miss, the tokens were already preprocessed */
+        macro_ptr = s1->cache_tokens;
         next();
         decl(VT_CONST);
         if (tok != TOK_EOF)
@@ -1299,6 +1393,10 @@ static int tcc_compile(TCCState *s1)
     /* reset define stack, but leave -Dsymbols (may be incorrect if
        they are undefined) */
     free_defines(define_start);
+    arena_release(&tokstr_arena, &tokstr_start);
+    tok_str_free(s1->cache_tokens);
+    s1->cache_tokens = NULL;
+    macro_ptr = NULL;
 
     gen_inline_functions();
 
@@ -1307,6 +1405,8 @@ static int tcc_compile(TCCState *s1)
     sym_pop(&local_stack, NULL);
 #endif
 
+    if (tcc_bench.on)
+        bench_switch(BENCH_OTHER);
     return s1->nb_errors != 0 ? -1 : 0;
 }
 
@@ -1349,6 +1449,7 @@ void tcc_define_symbol(TCCState *s1, const char *sym, const char *value)
     if (!value)
         value = "1";
     pstrcat(bf->buffer, IO_BUF_SIZE, value);
+    tcc_cache_add_define(s1, sym, value);
 
     /* init file structure */
     bf->fd = -1;
@@ -1361,7 +1462,9 @@ void tcc_define_symbol(TCCState *s1, const char *sym, const char *value)
 
     s1->include_stack_ptr = s1->include_stack;
 
-    /* parse with define parser */
+    /* parse with define parser; the flags may still be set by a previous
+       compilation in this process */
+    parse_flags = 0;
     ch = file->buf_ptr[0];
     next_nomacro();
     parse_define();
@@ -1373,6 +1476,7 @@ void tcc_undefine_symbol(TCCState *s1, const char *sym)
 {
     TokenSym *ts;
     TokenSym *s;
+    tcc_cache_add_define(s1, sym, NULL);
     ts = tok_alloc(sym, strlen(sym));
     s = define_find(ts->tok);
     /* undefine symbol by putting an invalid name */
@@ -1382,8 +1486,6 @@ void tcc_undefine_symbol(TCCState *s1, const char *sym)
 
 static void tcc_cleanup(void)
 {
-    int i, n;
-
     if (NULL == tcc_state)
         return;
     tcc_state = NULL;
@@ -1391,18 +1493,19 @@ static void tcc_cleanup(void)
     /* free -D defines */
     free_defines(NULL);
 
-    /* free tokens */
-    n = tok_ident - TOK_IDENT;
-    for (i = 0; i < n; i++)
-        tcc_free(table_ident[i]);
+    /* free tokens, symbols and token strings */
     tcc_free(table_ident);
-
-    /* free sym_pools */
-    dynarray_reset(&sym_pools, &nb_sym_pools);
+    table_ident = NULL;
+    arena_reset(&tu_arena);
+    arena_reset(&tokstr_arena);
     /* string buffer */
     cstr_free(&tokcstr);
     /* reset symbol stack */
     sym_free_first = NULL;
+    /* locals whose address was taken, recorded for the loop optimizations */
+    tcc_free(loop_addrs);
+    loop_addrs = NULL;
+    nb_loop_addrs = 0;
     /* cleanup from error/setjmp */
     macro_ptr = NULL;
 }
@@ -1414,6 +1517,9 @@ TCCState *tcc_new(void)
     int a, b, c;
 
     tcc_cleanup();
+#ifdef TCC_TARGET_816
+    gen_816_reset();
+#endif
 
     s = tcc_mallocz(sizeof(TCCState));
     if (!s)
@@ -1425,6 +1531,9 @@ TCCState *tcc_new(void)
     tcc_set_lib_path(s, CONFIG_TCCDIR);
 #endif
     s->output_type = TCC_OUTPUT_MEMORY;
+#ifdef TCC_TARGET_816
+    s->output_format = TCC_OUTPUT_FORMAT_BINARY;
+#endif
     preprocess_new();
     s->include_stack_ptr = s->include_stack;
 
@@ -1589,6 +1698,8 @@ void tcc_delete(TCCState *s1)
     dynarray_reset(&s1->sysinclude_paths, &s1->nb_sysinclude_paths);
 
     tcc_free(s1->tcc_lib_path);
+    tcc_free(s1->cache_dir);
+    tcc_free(s1->cache_tokens);
     tcc_free(s1->runtime_mem);
     tcc_free(s1);
 }
@@ -1645,6 +1756,15 @@ static int tcc_add_file_internal(TCCState *s1, const char *filename, int flags)
 
     if (!ext[0] || !PATHCMP(ext, "c")) {
         /* C file assumed */
+        if (s1->cache_dir && s1->output_type == TCC_OUTPUT_OBJ) {
+            ret = tcc_cache_lookup(s1, filename);
+            if (ret != 0) {
+                /* hit: the object comes from the cache */
+                if (ret > 0)
+                    ret = 0;
+                goto the_end;
+            }
+        }
         ret = tcc_compile(s1);
         goto the_end;
     }
@@ -1933,6 +2053,9 @@ static const FlagDef flag_defs[] = {
     {offsetof(TCCState, char_is_unsigned), FD_INVERT, "signed-char"},
     {offsetof(TCCState, nocommon), FD_INVERT, "common"},
     {offsetof(TCCState, leading_underscore), 0, "leading-underscore"},
+    {offsetof(TCCState, peephole), 0, "peephole"},
+    {offsetof(TCCState, dp_frame), 0, "dp-frame"},
+    {offsetof(TCCState, loop_opt), 0, "loop-opt"},
 };
 
 /* set/reset a flag */
@@ -1941,6 +2064,13 @@ int tcc_set_flag(TCCState *s, const char *flag_name, int value)
     return set_flag(s, flag_defs, countof(flag_defs), flag_name, value);
 }
 
+/* select the HiRom (Mode 21) and/or FastRom memory map */
+void tcc_set_memory_map(TCCState *s, int hirom, int fastrom)
+{
+    s->hirom_comp = hirom;
+    s->fastrom_comp = fastrom;
+}
+
 /* set CONFIG_TCCDIR at runtime */
 void tcc_set_lib_path(TCCState *s, const char *path)
 {
@@ -1948,10 +2078,66 @@ void tcc_set_lib_path(TCCState *s, const char *path)
     s->tcc_lib_path = tcc_strdup(path);
 }
 
-void tcc_print_stats(TCCState *s, int64_t total_time)
+/* current time in microseconds */
+int64_t tcc_clock_us(void)
+{
+#ifdef _WIN32
+    struct _timeb tb;
+    _ftime(&tb);
+    return (tb.time * 1000LL + tb.millitm) * 1000LL;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000LL + tv.tv_usec;
+#endif
+}
+
+/* charge the time since the last switch to the current phase and start
+   timing 'phase'; return the phase that was being timed */
+int bench_switch(int phase)
+{
+    int64_t now;
+    int prev;
+
+    now = tcc_clock_us();
+    prev = tcc_bench.phase;
+    tcc_bench.time[prev] += now - tcc_bench.since;
+    tcc_bench.since = now;
+    tcc_bench.phase = phase;
+    return prev;
+}
+
+static const char *const bench_phase_names[BENCH_PHASES] = {"other", "pp", "parse", "gen", "reloc", "output"};
+
+/* print the -bench statistics, as text or (json != 0) as a JSON object */
+void tcc_print_stats(TCCState *s, int64_t total_time, int json)
 {
     double tt;
+    int i;
+
+    if (tcc_bench.on)
+        bench_switch(tcc_bench.phase);
     tt = (double) total_time / 1000000.0;
+    if (json) {
+        printf("{\"idents\": %d, \"lines\": %d, \"bytes\": %d, \"time\": {\"total\": %0.6f",
+               tok_ident - TOK_IDENT,
+               total_lines,
+               total_bytes,
+               tt);
+        for (i = 0; i < BENCH_PHASES; i++)
+            printf(", \"%s\": %0.6f", bench_phase_names[i], tcc_bench.time[i] / 1000000.0);
+        printf("}, \"peak_heap\": %ld, \"allocs\": %lu, \"section_reallocs\": %d, \"jumps\": %d, "
+               "\"labels\": %d, \"symbols\": %d, \"asm_bytes\": %lu}\n",
+               mem_max_size,
+               tcc_bench.allocs,
+               tcc_bench.section_reallocs,
+               gen816.jumps,
+               gen816.labels,
+               tcc_bench.syms,
+               tcc_bench.asm_bytes);
+        return;
+    }
+
     if (tt < 0.001)
         tt = 0.001;
     if (total_bytes < 1)
@@ -1963,4 +2149,20 @@ void tcc_print_stats(TCCState *s, int64_t total_time)
            tt,
            (int) (total_lines / tt),
            total_bytes / tt / 1000000.0);
+    printf("time:");
+    for (i = 0; i < BENCH_PHASES; i++)
+        printf(" %s %0.3f s (%d%%)%s",
+               bench_phase_names[i],
+               tcc_bench.time[i] / 1000000.0,
+               (int) (tcc_bench.time[i] * 100 / (total_time > 0 ? total_time : 1)),
+               i < BENCH_PHASES - 1 ? "," : "\n");
+    printf("memory: %ld bytes peak heap, %lu allocations, %d section reallocs, %d symbols\n",
+           mem_max_size,
+           tcc_bench.allocs,
+           tcc_bench.section_reallocs,
+           tcc_bench.syms);
+    printf("output: %d jumps, %d labels, %lu bytes of assembler\n",
+           gen816.jumps,
+           gen816.labels,
+           tcc_bench.asm_bytes);
 }
@@ -32,6 +32,9 @@ LIBTCCAPI void tcc_set_error_func(TCCState *s,
 /* set/reset a warning */
 LIBTCCAPI int tcc_set_warning(TCCState *s, const char *warning_name, int value);
 
+/* select the HiRom (Mode 21) and/or FastRom memory map (like -H and -F) */
+LIBTCCAPI void tcc_set_memory_map(TCCState *s, int hirom, int fastrom);
+
 /*****************************/
 /* preprocessor */
 
@@ -88,6 +91,20 @@ LIBTCCAPI int tcc_add_symbol(TCCState *s, const char *name, void *val);
    tcc_relocate() before. */
 LIBTCCAPI int tcc_output_file(TCCState *s, const char *filename);
 
+/* pass the generated assembly to 'sink' in consecutive chunks (not
+   NUL-terminated) instead of writing a file. Returns -1 on error. */
+LIBTCCAPI int tcc_output_sink(TCCState *s,
+                              void *opaque,
+                              void (*sink)(void *opaque, const char *data, int len));
+
+/* return the generated assembly as a NUL-terminated buffer and store its
+   length in '*psize' (if not NULL). Returns NULL on error. The buffer
+   must be released with tcc_free_output(). */
+LIBTCCAPI char *tcc_output_memory(TCCState *s, int *psize);
+
+/* release a buffer returned by tcc_output_memory() */
+LIBTCCAPI void tcc_free_output(char *buf);
+
 /* link and run main() function and return its value. DO NOT call
    tcc_relocate() before. */
 LIBTCCAPI int tcc_run(TCCState *s, int argc, char **argv);
@@ -102,6 +119,15 @@ LIBTCCAPI void *tcc_get_symbol(TCCState *s, const char *name);
 /* set CONFIG_TCCDIR at runtime */
 LIBTCCAPI void tcc_set_lib_path(TCCState *s, const char *path);
 
+/* cache the generated assembly in 'dir', keyed by the preprocessed
+   source and the code generation options. 'max_size' is the cache size
+   limit in bytes (0 = default). Only used for single file TCC_OUTPUT_OBJ
+   compilations. */
+LIBTCCAPI void tcc_set_cache(TCCState *s, const char *dir, unsigned long max_size);
+
+/* print the hit/miss counters of the cache directory */
+LIBTCCAPI void tcc_print_cache_stats(TCCState *s);
+
 #ifdef __cplusplus
 }
 #endif
@@ -26,6 +26,11 @@
 #include "elf.h"
 #include "libtcc.h"
 #include <string.h>
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <sys/wait.h>
+#endif
 
 /**
  * @brief Display help information.
@@ -45,16 +50,32 @@ void help(void)
         "- Modified for PVSneslib by Alekmaul in 2021\n"
         "- Updated by Kobenairb in 2022\n"
         "- Added support for Mode 21 (HiRom) Memory Mapping and FastRom by DigiDwrf in 2024\n\n"
-        "usage: 816-tcc [-v] [-c] [-H] [-F] [-o outfile] [-Idir] [-Wwarn] [infile1 infile2...]\n"
+        "usage: 816-tcc [-v] [-c] [-H] [-F] [-o outfile] [-j N] [-Idir] [-Wwarn] [-cache dir] "
+        "[infile1 infile2...]\n"
         "\n"
         "General options:\n"
         "  -v          display current version, increase verbosity\n"
         "  -c          compile only - generate an object file\n"
         "  -H          hiRom (Mode 21) Memory Map compilation\n"
         "  -F          FastRom compilation\n"
-        "  -o outfile  set output filename\n"
+        "  -o outfile  set output filename ('-' writes the assembly to stdout)\n"
+        "  -j N        with -c and several input files, compile N files at a time\n"
+        "              (each infile.c is written to infile.asm)\n"
         "  -Wwarning   set or reset (with 'no-' prefix) 'warning' (see man page)\n"
         "  -w          disable all warnings\n"
+        "  -bench[=json] output compilation statistics and the time and memory\n"
+        "              profile of each phase (as a JSON object with =json)\n"
+        "Optimization options:\n"
+        "  -finline-limit=N  expand static inline functions of at most N tokens\n"
+        "                    at their call sites (default 0: never)\n"
+        "  -fpeephole        remove redundant loads, stores and jumps\n"
+        "                    from each function\n"
+        "  -fdp-frame        address locals through a direct page frame\n"
+        "  -floop-opt        test loops at the bottom, step counted loops\n"
+        "                    in place and index arrays through pointers\n"
+        "Cache options:\n"
+        "  -cache dir      reuse the output of identical preprocessed sources from 'dir'\n"
+        "  -cache-size N   limit the cache directory to N megabytes (default 64)\n"
         "Preprocessor options:\n"
         "  -E          preprocess only\n"
         "  -Idir       add include path 'dir'\n"
@@ -109,6 +130,9 @@ static int output_type;
 static int reloc_output;
 static const char *outfile;
 static int do_bench = 0;
+static const char *cache_dir;
+static unsigned long cache_size;
+static int nb_jobs = 1;
 
 #define TCC_OPTION_HAS_ARG 0x0001
 #define TCC_OPTION_NOSEP 0x0002 /* cannot have space before option and arg */
@@ -138,6 +162,8 @@ enum {
     TCC_OPTION_bench,
     TCC_OPTION_bt,
     TCC_OPTION_b,
+    TCC_OPTION_cache_size,
+    TCC_OPTION_cache,
     TCC_OPTION_g,
     TCC_OPTION_c,
     TCC_OPTION_static,
@@ -162,6 +188,7 @@ enum {
     TCC_OPTION_x,
     TCC_OPTION_H,
     TCC_OPTION_F,
+    TCC_OPTION_j,
 };
 
 /**
@@ -176,12 +203,14 @@ static const TCCOption tcc_options[] = {
     {"L", TCC_OPTION_L, TCC_OPTION_HAS_ARG},                    /**< Library directory */
     {"B", TCC_OPTION_B, TCC_OPTION_HAS_ARG},                    /**< Linker option */
     {"l", TCC_OPTION_l, TCC_OPTION_HAS_ARG | TCC_OPTION_NOSEP}, /**< Link library */
-    {"bench", TCC_OPTION_bench, 0},                             /**< Run benchmark */
+    {"bench", TCC_OPTION_bench, TCC_OPTION_HAS_ARG | TCC_OPTION_NOSEP}, /**< Run benchmark */
     {"bt", TCC_OPTION_bt, TCC_OPTION_HAS_ARG},                  /**< Set traceback level */
 #ifdef CONFIG_TCC_BCHECK
     {"b", TCC_OPTION_b, 0}, /**< Perform bounds checking */
 #endif
     {"g", TCC_OPTION_g, TCC_OPTION_HAS_ARG | TCC_OPTION_NOSEP},     /**< Generate debug info */
+    {"cache-size", TCC_OPTION_cache_size, TCC_OPTION_HAS_ARG},      /**< Cache size limit (MB) */
+    {"cache", TCC_OPTION_cache, TCC_OPTION_HAS_ARG},                /**< Compilation cache dir */
     {"c", TCC_OPTION_c, 0},                                         /**< Compile only */
     {"static", TCC_OPTION_static, 0},                               /**< Generate static library */
     {"shared", TCC_OPTION_shared, 0},                               /**< Generate shared library */
@@ -205,26 +234,10 @@ static const TCCOption tcc_options[] = {
     {"x", TCC_OPTION_x, TCC_OPTION_HAS_ARG}, /**< Specify input language */
     {"H", TCC_OPTION_H, 0},                  /**< HiRom compiler */
     {"F", TCC_OPTION_F, 0},                  /**< FastRom compiler */
+    {"j", TCC_OPTION_j, TCC_OPTION_HAS_ARG}, /**< Parallel compile jobs */
     {NULL},                                  /**< Null-terminated option */
 };
 
-/**
- * @brief Get the current time in microseconds.
- * @return The current time in microseconds.
- */
-static int64_t getclock_us(void)
-{
-#ifdef _WIN32
-    struct _timeb tb;
-    _ftime(&tb);
-    return (tb.time * 1000LL + tb.millitm) * 1000LL;
-#else
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    return tv.tv_sec * 1000000LL + tv.tv_usec;
-#endif
-}
-
 /**
  * @brief Check if a string starts with a given value.
  *
@@ -313,10 +326,6 @@ int parse_args(TCCState *s, int argc, char **argv)
     const char *optarg, *p1, *r1;
     char *r;
 
-#ifdef TCC_TARGET_816
-    s->output_format = TCC_OUTPUT_FORMAT_BINARY;
-#endif
-
     optind = 0;
     while (optind < argc) {
         r = argv[optind++];
@@ -394,7 +403,12 @@ int parse_args(TCCState *s, int argc, char **argv)
                 nb_libraries++;
                 break;
             case TCC_OPTION_bench:
-                do_bench = 1;
+                if (*optarg == '\0')
+                    do_bench = 1;
+                else if (strcmp(optarg, "=json") == 0)
+                    do_bench = 2;
+                else
+                    error("invalid option -- '%s'", r);
                 break;
 #ifdef CONFIG_TCC_BACKTRACE
             case TCC_OPTION_bt:
@@ -410,6 +424,12 @@ int parse_args(TCCState *s, int argc, char **argv)
             case TCC_OPTION_g:
                 s->do_debug = 1;
                 break;
+            case TCC_OPTION_cache:
+                cache_dir = optarg;
+                break;
+            case TCC_OPTION_cache_size:
+                cache_size = strtoul(optarg, NULL, 10) * 1024 * 1024;
+                break;
             case TCC_OPTION_c:
                 multiple_files = 1;
                 output_type = TCC_OUTPUT_OBJ;
@@ -420,6 +440,11 @@ int parse_args(TCCState *s, int argc, char **argv)
             case TCC_OPTION_F:
                 s->fastrom_comp = 1;
                 break;
+            case TCC_OPTION_j:
+                nb_jobs = atoi(optarg);
+                if (nb_jobs < 1)
+                    nb_jobs = 1;
+                break;
             case TCC_OPTION_static:
                 s->static_link = 1;
                 break;
@@ -464,7 +489,9 @@ int parse_args(TCCState *s, int argc, char **argv)
                 } while (*optarg++ == 'v');
                 break;
             case TCC_OPTION_f:
-                if (tcc_set_flag(s, optarg, 1) < 0 && s->warn_unsupported)
+                if (strstart(optarg, "inline-limit=", &p1))
+                    s->inline_limit = atoi(p1);
+                else if (tcc_set_flag(s, optarg, 1) < 0 && s->warn_unsupported)
                     goto unsupported_option;
                 break;
             case TCC_OPTION_W:
@@ -561,6 +588,260 @@ int parse_args(TCCState *s, int argc, char **argv)
     return optind + 1;
 }
 
+/**
+ * @brief A compiler process started by compile_batch().
+ */
+typedef struct CompileJob
+{
+#ifdef _WIN32
+    HANDLE handle;
+#else
+    pid_t pid;
+#endif
+    const char *filename;
+} CompileJob;
+
+/**
+ * @brief Compute the output name of a file compiled by compile_batch():
+ * the base name of the input with its extension replaced by ".asm".
+ */
+static void batch_outfile(char *buf, int buf_size, const char *filename)
+{
+    char *ext;
+
+    pstrcpy(buf, buf_size, tcc_basename(filename));
+    ext = tcc_fileextension(buf);
+    pstrcpy(ext, buf_size - (ext - buf), ".asm");
+}
+
+/**
+ * @brief Stop before compiling anything if two input files have the same
+ * output name (a/foo.c and b/foo.c both give foo.asm), since their jobs
+ * would write the same file at the same time.
+ */
+static void batch_check_outfiles(void)
+{
+    char out1[1024], out2[1024];
+    int i, j;
+
+    for (i = 0; i < nb_files; i++) {
+        batch_outfile(out1, sizeof(out1), files[i]);
+        for (j = i + 1; j < nb_files; j++) {
+            batch_outfile(out2, sizeof(out2), files[j]);
+#ifdef _WIN32
+            if (!stricmp(out1, out2))
+#else
+            if (!strcmp(out1, out2))
+#endif
+                error("'%s' and '%s' would both be compiled to '%s'", files[i], files[j], out1);
+        }
+    }
+}
+
+#ifdef _WIN32
+/**
+ * @brief Quote a command line argument for _spawnv(), which joins its
+ * arguments with spaces.
+ */
+static char *quote_arg(const char *arg)
+{
+    char *q;
+    int len;
+
+    if (*arg && !strpbrk(arg, " \t"))
+        return tcc_strdup(arg);
+    len = strlen(arg);
+    q = tcc_malloc(len + 3);
+    q[0] = '"';
+    memcpy(q + 1, arg, len);
+    q[len + 1] = '"';
+    q[len + 2] = '\0';
+    return q;
+}
+
+/**
+ * @brief Start the compiler again on a single input file.
+ *
+ * The child gets the original command line (as saved before parse_args()
+ * edited it) without the input files and -j, followed by "-o out filename".
+ *
+ * @return The process handle, or NULL on error.
+ */
+static HANDLE start_job(
+    TCCState *s, int argc, char **argv, char **argv_saved, const char *filename, const char *out)
+{
+    char exe[1024];
+    char **args;
+    int i, k, n;
+    intptr_t h;
+
+    GetModuleFileName(NULL, exe, sizeof(exe));
+    args = tcc_malloc((argc + 4) * sizeof(char *));
+    n = 0;
+    args[n++] = quote_arg(exe);
+    for (i = 1; i < argc; i++) {
+        for (k = 0; k < nb_files; k++) {
+            if (files[k] == argv[i])
+                break;
+        }
+        if (k < nb_files)
+            continue;
+        if (!strncmp(argv_saved[i], "-j", 2)) {
+            if (argv_saved[i][2] == '\0')
+                i++;
+            continue;
+        }
+        args[n++] = quote_arg(argv_saved[i]);
+    }
+    args[n++] = tcc_strdup("-o");
+    args[n++] = quote_arg(out);
+    args[n++] = quote_arg(filename);
+    args[n] = NULL;
+
+    h = _spawnv(_P_NOWAIT, exe, (const char *const *) args);
+
+    while (n > 0)
+        tcc_free(args[--n]);
+    tcc_free(args);
+    return h == -1 ? NULL : (HANDLE) h;
+}
+
+/**
+ * @brief Wait for one of the running jobs to finish.
+ *
+ * @return The index of the finished job; its exit status is stored in *status.
+ */
+static int wait_job(CompileJob *jobs, int running, int *status)
+{
+    HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+    DWORD r, code;
+    int i;
+
+    for (i = 0; i < running; i++)
+        handles[i] = jobs[i].handle;
+    r = WaitForMultipleObjects(running, handles, FALSE, INFINITE);
+    i = r - WAIT_OBJECT_0;
+    if (i < 0 || i >= running)
+        error("waiting for compile jobs failed");
+    if (!GetExitCodeProcess(jobs[i].handle, &code))
+        code = 1;
+    CloseHandle(jobs[i].handle);
+    *status = code;
+    return i;
+}
+#else
+/**
+ * @brief Fork a compiler process for a single input file.
+ *
+ * The child inherits the options parsed into 's', compiles 'filename' to
+ * 'out' and exits with the same status 816-tcc would have.
+ *
+ * @return The process id of the child, or -1 on error.
+ */
+static pid_t start_job(TCCState *s, const char *filename, const char *out)
+{
+    pid_t pid;
+    int ret;
+
+    fflush(stdout);
+    fflush(stderr);
+    pid = fork();
+    if (pid != 0)
+        return pid;
+
+    if (1 == s->verbose)
+        printf("-> %s\n", filename);
+    ret = 0;
+    if (tcc_add_file(s, filename) < 0 || tcc_output_file(s, out))
+        ret = 1;
+    fflush(stdout);
+    _exit(ret);
+}
+
+/**
+ * @brief Wait for one of the running jobs to finish.
+ *
+ * @return The index of the finished job; its exit status is stored in *status.
+ */
+static int wait_job(CompileJob *jobs, int running, int *status)
+{
+    pid_t pid;
+    int i, st;
+
+    for (;;) {
+        pid = waitpid(-1, &st, 0);
+        if (pid < 0)
+            error("waiting for compile jobs failed");
+        for (i = 0; i < running; i++) {
+            if (jobs[i].pid == pid) {
+                *status = WIFEXITED(st) ? WEXITSTATUS(st) : 1;
+                return i;
+            }
+        }
+    }
+}
+#endif
+
+/**
+ * @brief Compile each input file to its own output file, running up to
+ * nb_jobs compilers at a time.
+ *
+ * Every file is compiled by a separate process, exactly as if 816-tcc had
+ * been run on it alone with "-c infile.c -o infile.asm", so the output does
+ * not depend on the number of jobs or on the order in which they finish.
+ *
+ * @return 0 if all files compiled, 1 otherwise.
+ */
+static int compile_batch(TCCState *s, int argc, char **argv, char **argv_saved)
+{
+    CompileJob *jobs;
+    char out[1024];
+    int i, next, running, status, ret;
+
+    batch_check_outfiles();
+#ifdef _WIN32
+    if (nb_jobs > MAXIMUM_WAIT_OBJECTS)
+        nb_jobs = MAXIMUM_WAIT_OBJECTS;
+#endif
+    jobs = tcc_malloc(nb_jobs * sizeof(CompileJob));
+    next = running = ret = 0;
+    while (next < nb_files || running > 0) {
+        if (next < nb_files && running < nb_jobs) {
+            const char *filename = files[next++];
+
+            batch_outfile(out, sizeof(out), filename);
+            jobs[running].filename = filename;
+#ifdef _WIN32
+            jobs[running].handle = start_job(s, argc, argv, argv_saved, filename, out);
+            if (!jobs[running].handle) {
+#else
+            jobs[running].pid = start_job(s, filename, out);
+            if (jobs[running].pid < 0) {
+#endif
+                error_noabort("cannot start a compile job for '%s'", filename);
+                ret = 1;
+                continue;
+            }
+            running++;
+            continue;
+        }
+        i = wait_job(jobs, running, &status);
+        if (status != 0)
+            ret = 1;
+        jobs[i] = jobs[--running];
+    }
+    tcc_free(jobs);
+    return ret;
+}
+
+/**
+ * @brief Output sink used for "-o -": copy the generated assembly to stdout.
+ */
+static void write_stdout(void *opaque, const char *data, int len)
+{
+    fwrite(data, 1, len, (FILE *) opaque);
+}
+
 /**
  * @brief The entry point of the program.
  *
@@ -579,6 +860,7 @@ int main(int argc, char **argv)
     TCCState *s;
     int nb_objfiles, ret, optind;
     char objfilename[1024];
+    char **argv_saved;
     int64_t start_time = 0;
 
     s = tcc_new();
@@ -596,6 +878,12 @@ int main(int argc, char **argv)
     print_search_dirs = 0;
     ret = 0;
 
+    /* parse_args() edits some arguments in place, the compile jobs started
+       by compile_batch() need the original ones */
+    argv_saved = tcc_malloc(argc * sizeof(char *));
+    for (i = 0; i < argc; i++)
+        argv_saved[i] = tcc_strdup(argv[i]);
+
     optind = parse_args(s, argc - 1, argv + 1);
     if (print_search_dirs) {
         /* enough for Linux kernel */
@@ -616,11 +904,11 @@ int main(int argc, char **argv)
     if (outfile && output_type == TCC_OUTPUT_MEMORY)
         output_type = TCC_OUTPUT_EXE;
 
-    /* check -c consistency : only single file handled. XXX: checks file type */
+    /* check -c consistency : several input files are compiled one by one
+       by compile_batch(). XXX: checks file type */
     if (output_type == TCC_OUTPUT_OBJ && !reloc_output) {
-        /* accepts only a single input file */
-        if (nb_objfiles != 1)
-            error("cannot specify multiple files with -c");
+        if (nb_objfiles != 1 && outfile)
+            error("cannot specify -o with multiple files");
         if (nb_libraries != 0)
             error("cannot specify libraries with -c");
     }
@@ -655,12 +943,29 @@ int main(int argc, char **argv)
         }
     }
 
+    /* a cache entry stands for one object file */
+    if (cache_dir && output_type == TCC_OUTPUT_OBJ && !reloc_output)
+        tcc_set_cache(s, cache_dir, cache_size);
+
     if (do_bench) {
-        start_time = getclock_us();
+        start_time = tcc_clock_us();
+        tcc_bench.on = 1;
+        tcc_bench.phase = BENCH_OTHER;
+        tcc_bench.since = start_time;
     }
 
     tcc_set_output_type(s, output_type);
 
+    if (output_type == TCC_OUTPUT_OBJ && !reloc_output && nb_objfiles > 1) {
+        ret = compile_batch(s, argc, argv, argv_saved);
+        if (do_bench)
+            printf("%d files, %d jobs, %0.3f s\n",
+                   nb_files,
+                   nb_jobs,
+                   (tcc_clock_us() - start_time) / 1000000.0);
+        goto the_end;
+    }
+
     /* compile or add each files or library */
     for (i = 0; i < nb_files && ret == 0; i++) {
         const char *filename;
@@ -679,13 +984,7 @@ int main(int argc, char **argv)
         }
     }
 
-    /* free all files */
-    tcc_free(files);
-
     if (0 == ret) {
-        if (do_bench)
-            tcc_print_stats(s, getclock_us() - start_time);
-
 #ifndef TCC_TARGET_816
         if (s->output_type == TCC_OUTPUT_PREPROCESS) {
             if (outfile)
@@ -694,14 +993,30 @@ int main(int argc, char **argv)
             ret = tcc_run(s, argc - optind, argv + optind);
         else
 #endif
-            ret = tcc_output_file(s, outfile) ? 1 : 0;
+            if (strcmp(outfile, "-") == 0)
+                ret = tcc_output_sink(s, stdout, write_stdout) ? 1 : 0;
+            else
+                ret = tcc_output_file(s, outfile) ? 1 : 0;
+
+        if (do_bench) {
+            tcc_print_stats(s, tcc_clock_us() - start_time, do_bench == 2);
+            if (do_bench == 1)
+                tcc_print_cache_stats(s);
+        }
     }
 
+the_end:
+    /* free all files */
+    tcc_free(files);
+    for (i = 0; i < argc; i++)
+        tcc_free(argv_saved[i]);
+    tcc_free(argv_saved);
+
     tcc_delete(s);
 
 #ifdef MEM_DEBUG
     if (do_bench) {
-        printf("memory: %d bytes, max = %d bytes\n", mem_cur_size, mem_max_size);
+        printf("memory: %ld bytes, max = %ld bytes\n", mem_cur_size, mem_max_size);
     }
 #endif
     return ret;
@@ -35,6 +35,7 @@
 
 #ifdef _WIN32
 #include <windows.h>
+#include <malloc.h>
 #undef RC_NONE
 #define inline __inline
 #define inp next_inp
@@ -48,6 +49,11 @@
 #include <sys/time.h>
 #include <sys/ucontext.h>
 #include <sys/mman.h>
+#if defined(__APPLE__)
+#include <malloc/malloc.h>
+#elif defined(__GLIBC__)
+#include <malloc.h>
+#endif
 #endif
 
 #endif /* !CONFIG_TCCBOOT */
@@ -263,7 +269,8 @@ typedef struct AttributeDef
     unsigned packed : 1, aligned : 5, /* alignement (0..16) */
         func_call : 3,                /* calling convention (0..5), see below */
         func_export : 1, func_import : 1, func_args : 8, func_proto : 1, mode : 4, resize : 1,
-        fill : 10;
+        placement : 2,                /* data placement (0..3), see VT_PLACEMENT */
+        fill : 8;
     struct Section *section;
 } AttributeDef;
 
@@ -341,6 +348,24 @@ typedef struct ParseState
     CValue tokc;
 } ParseState;
 
+/* block of an arena; the data follows the header */
+typedef union ArenaChunk
+{
+    union ArenaChunk *next;
+    double align;
+} ArenaChunk;
+
+/* bump allocator: blocks are never freed one by one, but all at once
+   by arena_reset() */
+typedef struct TCCArena
+{
+    ArenaChunk *chunks;       /* chunks allocated so far, last one first */
+    char *ptr;                /* free space of the current chunk */
+    char *end;
+    char *last;               /* last block allocated, which can grow in place */
+    unsigned long chunk_size; /* size of the current chunk */
+} TCCArena;
+
 /* used to record tokens */
 typedef struct TokenString
 {
@@ -348,13 +373,22 @@ typedef struct TokenString
     int len;
     int allocated_len;
     int last_line_num;
+    TCCArena *arena; /* allocate 'str' there instead of on the heap */
 } TokenString;
 
+/* compilation cache states */
+#define TCC_CACHE_NONE 0     /* no lookup done yet */
+#define TCC_CACHE_HIT 1      /* output is copied from the cache */
+#define TCC_CACHE_MISS 2     /* output is compiled, then stored */
+#define TCC_CACHE_DISABLED 3 /* more than one file: cache not used */
+
 /* inline functions */
 typedef struct InlineFunc
 {
     int *token_str;
     TokenSym *sym;
+    int nb_toks;   /* body size in tokens, -1 if it cannot be expanded */
+    int expanding; /* set while the body is replayed at a call site */
     char filename[1];
 } InlineFunc;
 
@@ -524,6 +558,19 @@ struct TCCState
 
     struct InlineFunc **inline_fns;
     int nb_inline_fns;
+    int inline_limit; /* expand static inline bodies up to this many tokens */
+    int peephole;     /* -fpeephole: optimize each function before it is written out */
+    int dp_frame;     /* -fdp-frame: point D at the stack frame of each function */
+    int loop_opt;     /* -floop-opt: bottom-tested loops, counted loops in place */
+
+    /* compilation cache (see tcccache.c) */
+    char *cache_dir;
+    unsigned long cache_max_size;
+    uint64_t cache_opt_hash; /* hash of the command line defines */
+    uint64_t cache_key;      /* key of the translation unit */
+    int cache_state;         /* TCC_CACHE_xxx */
+    int cache_hits, cache_misses;
+    int *cache_tokens;       /* preprocessed tokens of a miss, parsed by tcc_compile() */
 
 #ifdef TCC_TARGET_I386
     int seg_size;
@@ -597,6 +644,10 @@ struct TCCState
 #define VT_CONSTANT 0x0800 /* const modifier */
 #define VT_VOLATILE 0x1000 /* volatile modifier */
 #define VT_SIGNED 0x2000   /* signed type */
+#ifdef TCC_TARGET_816
+#define VT_FIXED 0x10000000 /* __fixed: 8.8 (int) or 16.16 (long long) */
+#define VT_NEARDATA 0x80000000 /* __near: in the data bank, reached by 16-bit pointers */
+#endif
 
 /* storage */
 #define VT_EXTERN 0x00000080  /* extern definition */
@@ -607,12 +658,23 @@ struct TCCState
 #define VT_EXPORT 0x00008000  /* win32: data exported from dll */
 #ifdef TCC_TARGET_816
 #define VT_STATICLOCAL 0x00004000
+/* data placement attributes of a global variable */
+#define VT_NEAR 0x20000000      /* near: bank $00 low RAM, absolute addressing */
+#define VT_ZEROPAGE 0x40000000  /* zeropage: direct page, direct addressing */
+#define VT_FAR 0x60000000       /* far: any bank, long addressing */
+#define VT_PLACEMENT 0x60000000 /* mask for the placement */
+#define VT_PLACEMENT_SHIFT 29
 #endif
 
 #define VT_STRUCT_SHIFT 16 /* shift for bitfield shift values */
 
 /* type mask (except storage) */
+#ifdef TCC_TARGET_816
+#define VT_STORAGE \
+    (VT_EXTERN | VT_STATIC | VT_TYPEDEF | VT_INLINE | VT_IMPORT | VT_EXPORT | VT_PLACEMENT)
+#else
 #define VT_STORAGE (VT_EXTERN | VT_STATIC | VT_TYPEDEF | VT_INLINE | VT_IMPORT | VT_EXPORT)
+#endif
 #ifdef TCC_TARGET_816
 #define VT_TYPE (~(VT_STORAGE) & ~(VT_STATICLOCAL))
 #else
@@ -652,6 +714,7 @@ struct TCCState
 #define TOK_LSTR 0xb8
 #define TOK_CFLOAT 0xb9   /* float constant */
 #define TOK_LINENUM 0xba  /* line number info */
+#define TOK_FILENAME 0xbb /* file name info (cached token streams) */
 #define TOK_CDOUBLE 0xc0  /* double constant */
 #define TOK_CLDOUBLE 0xc1 /* long double constant */
 #define TOK_UMULL 0xc2    /* unsigned 32x32 -> 64 mul */
@@ -659,6 +722,7 @@ struct TCCState
 #define TOK_ADDC2 0xc4    /* add with carry use */
 #define TOK_SUBC1 0xc5    /* add with carry generation */
 #define TOK_SUBC2 0xc6    /* add with carry use */
+#define TOK_FMUL8 0xc7    /* 8.8 fixed-point multiply */
 #define TOK_CUINT 0xc8    /* unsigned int constant */
 #define TOK_CLLONG 0xc9   /* long long constant */
 #define TOK_CULLONG 0xca  /* unsigned long long constant */
@@ -828,13 +892,58 @@ void warning(const char *fmt, ...);
 
 void tcc_set_lib_path_w32(TCCState *s);
 int tcc_set_flag(TCCState *s, const char *flag_name, int value);
-void tcc_print_stats(TCCState *s, int64_t total_time);
+void tcc_print_stats(TCCState *s, int64_t total_time, int json);
+
+/* phases timed by -bench */
+enum {
+    BENCH_OTHER,  /* option parsing, setup, cache */
+    BENCH_PP,     /* preprocessing (tccpp.c) */
+    BENCH_PARSE,  /* parsing and semantic analysis (tccgen.c) */
+    BENCH_GEN,    /* 65816 code generation (816-gen.c) */
+    BENCH_RELOC,  /* relocation of the sections */
+    BENCH_OUTPUT, /* writing the assembler text */
+    BENCH_PHASES
+};
+
+/**
+ * @struct TCCBench
+ * @brief Profile collected for -bench.
+ *
+ * The time of each phase is accumulated by switching from one phase to
+ * the next with bench_switch() at the entry points of the phases; the
+ * phase times thus always add up to the total time.
+ */
+typedef struct TCCBench
+{
+    int on;                      /**< @brief Collect the phase times. */
+    int phase;                   /**< @brief The phase being timed. */
+    int64_t since;               /**< @brief When it was entered (microseconds). */
+    int64_t time[BENCH_PHASES];  /**< @brief Time spent in each phase (microseconds). */
+    int syms;                    /**< @brief Symbols allocated. */
+    int section_reallocs;        /**< @brief Calls to section_realloc(). */
+    unsigned long asm_bytes;     /**< @brief Bytes of assembler text written. */
+    unsigned long allocs;        /**< @brief Calls to tcc_malloc() and tcc_realloc(). */
+} TCCBench;
+
+extern TCCBench tcc_bench;
+int64_t tcc_clock_us(void);
+int bench_switch(int phase);
+
+/* time the rest of the calling function as 'ph', back to the phase of
+   the caller with BENCH_LEAVE(); nested entries into the phase being timed
+   do not read the clock */
+#define BENCH_ENTER(ph) int bench_caller = tcc_bench.on && tcc_bench.phase != (ph) ? bench_switch(ph) : -1
+#define BENCH_LEAVE() (bench_caller >= 0 ? (void) bench_switch(bench_caller) : (void) 0)
 
 void tcc_free(void *ptr);
 void *tcc_malloc(unsigned long size);
 void *tcc_mallocz(unsigned long size);
 void *tcc_realloc(void *ptr, unsigned long size);
 char *tcc_strdup(const char *str);
+void *arena_alloc(TCCArena *a, unsigned long size);
+void *arena_realloc(TCCArena *a, void *ptr, unsigned long old_size, unsigned long size);
+void arena_release(TCCArena *a, const TCCArena *mark);
+void arena_reset(TCCArena *a);
 
 char *tcc_basename(const char *name);
 char *tcc_fileextension(const char *name);
@@ -851,6 +960,16 @@ static inline int is_float(int t)
     return bt == VT_LDOUBLE || bt == VT_DOUBLE || bt == VT_FLOAT;
 }
 
+#ifdef TCC_TARGET_816
+/* true if 'type' is a near pointer (or an array decaying to one): the
+   pointed type is __near, and the address is a 16-bit offset in the data bank */
+static inline int is_near_ptr(CType *type)
+{
+    return (type->t & VT_BTYPE) == VT_PTR && type->ref
+           && (type->ref->type.t & VT_NEARDATA);
+}
+#endif
+
 /* space exlcuding newline */
 static inline int is_space(int ch)
 {
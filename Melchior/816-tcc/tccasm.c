@@ -680,6 +680,7 @@ static int tcc_assemble_internal(TCCState *s1, int do_preprocess)
 static int tcc_assemble(TCCState *s1, int do_preprocess)
 {
     TokenSym *define_start;
+    TCCArena tokstr_start;
     int ret;
 
     preprocess_init(s1);
@@ -689,6 +690,7 @@ static int tcc_assemble(TCCState *s1, int do_preprocess)
     ind = cur_text_section->data_offset;
 
     define_start = define_stack;
+    tokstr_start = tokstr_arena;
 
     /* an elf symbol of type STT_FILE must be put so that STB_LOCAL
        symbols can be safely used */
@@ -699,6 +701,7 @@ static int tcc_assemble(TCCState *s1, int do_preprocess)
     cur_text_section->data_offset = ind;
 
     free_defines(define_start);
+    arena_release(&tokstr_arena, &tokstr_start);
 
     return ret;
 }
@@ -0,0 +1,650 @@
+/*
+ *  Compilation cache for 816-tcc
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * The cache maps the preprocessed token stream of a translation unit (plus
+ * the options that change code generation) to the assembly file produced
+ * for it. Entries are stored as <key>.asm in the cache directory; when the
+ * directory grows over its size limit the least recently used entries are
+ * removed. Each lookup appends a hit or miss record to CACHE_STATS_FILE.
+ */
+
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#include <sys/utime.h>
+#else
+#include <dirent.h>
+#include <utime.h>
+#endif
+
+#define CACHE_STATS_FILE "816-tcc-cache.stats"
+#define CACHE_FORMAT_VERSION 1
+#define CACHE_DEFAULT_MAX_SIZE (64UL * 1024 * 1024)
+
+#define FNV64_OFFSET 0xcbf29ce484222325ULL
+#define FNV64_PRIME 0x100000001b3ULL
+
+typedef struct CacheEntry
+{
+    char name[32];
+    unsigned long size;
+    time_t mtime;
+} CacheEntry;
+
+/**
+ * @brief Fold a block of bytes into a 64-bit FNV-1a hash.
+ *
+ * @param h     The running hash value.
+ * @param data  The bytes to add.
+ * @param len   The number of bytes.
+ * @return      The updated hash value.
+ */
+static uint64_t cache_hash_bytes(uint64_t h, const void *data, int len)
+{
+    const unsigned char *p = data;
+
+    while (len-- > 0) {
+        h ^= *p++;
+        h *= FNV64_PRIME;
+    }
+    return h;
+}
+
+/**
+ * @brief Fold a NUL-terminated string (terminator included) into a hash.
+ */
+static uint64_t cache_hash_str(uint64_t h, const char *str)
+{
+    return cache_hash_bytes(h, str, strlen(str) + 1);
+}
+
+/**
+ * @brief Fold an integer into a hash.
+ */
+static uint64_t cache_hash_int(uint64_t h, int v)
+{
+    return cache_hash_bytes(h, &v, sizeof(v));
+}
+
+/**
+ * @brief Record a -D/-U command line define in the option hash.
+ *
+ * Called from tcc_define_symbol() and tcc_undefine_symbol() so that the
+ * cache key changes whenever the set of command line defines does, even
+ * if the define is not referenced by the translation unit.
+ *
+ * @param s1     The TCC state.
+ * @param sym    The symbol name.
+ * @param value  The symbol value, or NULL for an undefine.
+ */
+static void tcc_cache_add_define(TCCState *s1, const char *sym, const char *value)
+{
+    uint64_t h = s1->cache_opt_hash ? s1->cache_opt_hash : FNV64_OFFSET;
+
+    h = cache_hash_str(h, value ? "D" : "U");
+    h = cache_hash_str(h, sym);
+    if (value)
+        h = cache_hash_str(h, value);
+    s1->cache_opt_hash = h;
+}
+
+/**
+ * @brief Build the path of a file inside the cache directory.
+ */
+static void cache_path(TCCState *s1, char *buf, int buf_size, const char *name)
+{
+    snprintf(buf, buf_size, "%s/%s", s1->cache_dir, name);
+}
+
+/**
+ * @brief Build the file name of the cache entry for the current key.
+ */
+static void cache_entry_path(TCCState *s1, char *buf, int buf_size)
+{
+    char name[32];
+
+    snprintf(name,
+             sizeof(name),
+             "%08x%08x.asm",
+             (unsigned int) (s1->cache_key >> 32),
+             (unsigned int) s1->cache_key);
+    cache_path(s1, buf, buf_size, name);
+}
+
+/**
+ * @brief Copy a whole file.
+ *
+ * @param src  The source file name.
+ * @param dst  The destination file name.
+ * @return     The number of bytes copied, or -1 on error.
+ */
+static long cache_copy_file(const char *src, const char *dst)
+{
+    FILE *in, *out;
+    char buf[8192];
+    size_t n;
+    long total = 0;
+
+    in = fopen(src, "rb");
+    if (!in)
+        return -1;
+    out = fopen(dst, "wb");
+    if (!out) {
+        fclose(in);
+        return -1;
+    }
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+        if (fwrite(buf, 1, n, out) != n) {
+            total = -1;
+            break;
+        }
+        total += n;
+    }
+    fclose(in);
+    if (fclose(out) != 0)
+        total = -1;
+    return total;
+}
+
+/**
+ * @brief Load the persistent hit/miss counters of the cache directory.
+ *
+ * The stats file holds one "hit" or "miss" record per lookup. Files
+ * written by older versions hold "hits N" and "misses N" totals, which
+ * are added in.
+ */
+static void cache_read_stats(TCCState *s1, int *hits, int *misses)
+{
+    char path[1024], line[64];
+    FILE *f;
+    int n;
+
+    *hits = *misses = 0;
+    cache_path(s1, path, sizeof(path), CACHE_STATS_FILE);
+    f = fopen(path, "r");
+    if (!f)
+        return;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "hits %d", &n) == 1)
+            *hits += n;
+        else if (sscanf(line, "misses %d", &n) == 1)
+            *misses += n;
+        else if (!strcmp(line, "hit\n"))
+            (*hits)++;
+        else if (!strcmp(line, "miss\n"))
+            (*misses)++;
+    }
+    fclose(f);
+}
+
+/**
+ * @brief Add a hit or a miss to the persistent counters.
+ *
+ * The record is appended rather than the counters rewritten, so that
+ * compilers running in parallel (-j) do not lose each other's updates.
+ */
+static void cache_update_stats(TCCState *s1, int hit)
+{
+    char path[1024];
+    FILE *f;
+
+    cache_path(s1, path, sizeof(path), CACHE_STATS_FILE);
+    f = fopen(path, "a");
+    if (!f)
+        return;
+    fputs(hit ? "hit\n" : "miss\n", f);
+    fclose(f);
+}
+
+/**
+ * @brief List the entries of the cache directory.
+ *
+ * @param s1       The TCC state.
+ * @param pentries Receives a tcc_malloc'ed array of entries.
+ * @return         The number of entries.
+ */
+static int cache_list_entries(TCCState *s1, CacheEntry **pentries)
+{
+    CacheEntry *entries = NULL;
+    int nb = 0, allocated = 0;
+    char path[1024];
+    struct stat st;
+    const char *name;
+#ifdef _WIN32
+    WIN32_FIND_DATA fd;
+    HANDLE h;
+
+    cache_path(s1, path, sizeof(path), "*.asm");
+    h = FindFirstFile(path, &fd);
+    if (h == INVALID_HANDLE_VALUE) {
+        *pentries = NULL;
+        return 0;
+    }
+    do {
+        name = fd.cFileName;
+#else
+    DIR *dir;
+    struct dirent *de;
+
+    dir = opendir(s1->cache_dir);
+    if (!dir) {
+        *pentries = NULL;
+        return 0;
+    }
+    while ((de = readdir(dir)) != NULL) {
+        name = de->d_name;
+        if (strlen(name) < 4 || strcmp(name + strlen(name) - 4, ".asm"))
+            continue;
+#endif
+        if (strlen(name) >= sizeof(entries->name))
+            continue;
+        cache_path(s1, path, sizeof(path), name);
+        if (stat(path, &st) != 0)
+            continue;
+        if (nb == allocated) {
+            allocated = allocated ? allocated * 2 : 64;
+            entries = tcc_realloc(entries, allocated * sizeof(CacheEntry));
+        }
+        pstrcpy(entries[nb].name, sizeof(entries[nb].name), name);
+        entries[nb].size = st.st_size;
+        entries[nb].mtime = st.st_mtime;
+        nb++;
+#ifdef _WIN32
+    } while (FindNextFile(h, &fd));
+    FindClose(h);
+#else
+    }
+    closedir(dir);
+#endif
+    *pentries = entries;
+    return nb;
+}
+
+static int cache_entry_cmp(const void *a, const void *b)
+{
+    const CacheEntry *e1 = a, *e2 = b;
+
+    if (e1->mtime != e2->mtime)
+        return e1->mtime < e2->mtime ? -1 : 1;
+    return strcmp(e1->name, e2->name);
+}
+
+/**
+ * @brief Remove the least recently used entries until the cache fits in
+ * its size limit.
+ *
+ * Entries are touched on every hit, so the modification time doubles as
+ * the last access time.
+ */
+static void cache_evict(TCCState *s1)
+{
+    CacheEntry *entries;
+    unsigned long total = 0;
+    char path[1024];
+    int i, nb;
+
+    nb = cache_list_entries(s1, &entries);
+    for (i = 0; i < nb; i++)
+        total += entries[i].size;
+    if (total > s1->cache_max_size) {
+        qsort(entries, nb, sizeof(CacheEntry), cache_entry_cmp);
+        for (i = 0; i < nb && total > s1->cache_max_size; i++) {
+            cache_path(s1, path, sizeof(path), entries[i].name);
+            if (remove(path) == 0) {
+                total -= entries[i].size;
+                if (s1->verbose)
+                    printf("cache: evicted %s\n", entries[i].name);
+            }
+        }
+    }
+    tcc_free(entries);
+}
+
+/**
+ * @brief Record the current token, preceded by the name of its file when
+ * it changed since the previous token.
+ *
+ * @param str       The token string.
+ * @param filename  The file of the previous token, updated in place.
+ */
+static void cache_record_tok(TokenString *str, char *filename)
+{
+    CString cstr;
+    CValue cval;
+
+    if (strcmp(filename, file->filename)) {
+        pstrcpy(filename, sizeof(file->filename), file->filename);
+        cstr_new(&cstr);
+        cstr_cat(&cstr, filename);
+        cstr_ccat(&cstr, '\0');
+        cval.cstr = &cstr;
+        tok_str_add2(str, TOK_FILENAME, &cval);
+        cstr_free(&cstr);
+        /* line numbers restart with the file */
+        str->last_line_num = -1;
+    }
+    tok_str_add_tok(str);
+}
+
+/**
+ * @brief Hash the preprocessed token stream of the file opened in 'file'.
+ *
+ * The tokens are recorded as well, so that a miss can be compiled without
+ * preprocessing the file again. The defines created by the file are
+ * dropped afterwards so that the compilation starts from the same
+ * preprocessor state.
+ *
+ * #pragma pack is handled by the preprocessor and changes the layout of
+ * the structures parsed after it: its state is hashed, and the tokens are
+ * not kept when it changes, since replaying them would only see the last
+ * state.
+ *
+ * @param s1    The TCC state.
+ * @param ph    The running hash, updated in place.
+ * @param pstr  Receives the tcc_malloc'ed token string, or NULL if the
+ *              file has to be preprocessed again.
+ * @return      0 on success, -1 if preprocessing failed.
+ */
+static int cache_hash_tokens(TCCState *s1, uint64_t *ph, int **pstr)
+{
+    TokenSym *define_start;
+    TCCArena tokstr_start;
+    TokenString str;
+    char filename[sizeof(file->filename)];
+    uint64_t h = *ph;
+    int ret = 0, pack, pack_depth, replay = 1;
+
+    preprocess_init(s1);
+    define_start = define_stack;
+    tokstr_start = tokstr_arena;
+    tok_str_new(&str);
+    pstrcpy(filename, sizeof(filename), file->filename);
+    pack = *s1->pack_stack_ptr;
+    pack_depth = s1->pack_stack_ptr - s1->pack_stack;
+
+    if (setjmp(s1->error_jmp_buf) == 0) {
+        s1->nb_errors = 0;
+        s1->error_set_jmp_enabled = 1;
+
+        ch = file->buf_ptr[0];
+        tok_flags = TOK_FLAG_BOL | TOK_FLAG_BOF;
+        parse_flags = PARSE_FLAG_PREPROCESS;
+        for (;;) {
+            next();
+            if (*s1->pack_stack_ptr != pack || s1->pack_stack_ptr - s1->pack_stack != pack_depth) {
+                pack = *s1->pack_stack_ptr;
+                pack_depth = s1->pack_stack_ptr - s1->pack_stack;
+                h = cache_hash_str(h, "#pragma pack");
+                h = cache_hash_int(h, pack);
+                h = cache_hash_int(h, pack_depth);
+                replay = 0;
+            }
+            cache_record_tok(&str, filename);
+            if (tok == TOK_EOF)
+                break;
+            h = cache_hash_str(h, get_tok_str(tok, &tokc));
+        }
+    }
+    s1->error_set_jmp_enabled = 0;
+    if (s1->nb_errors)
+        ret = -1;
+
+    /* close files left open by an error inside an include */
+    while (s1->include_stack_ptr > s1->include_stack) {
+        tcc_close(file);
+        file = *--s1->include_stack_ptr;
+    }
+    free_defines(define_start);
+    arena_release(&tokstr_arena, &tokstr_start);
+    macro_ptr = NULL;
+    if (ret < 0 || !replay) {
+        tok_str_free(str.str);
+        *pstr = NULL;
+    } else {
+        tok_str_add(&str, 0);
+        *pstr = str.str;
+    }
+    *ph = h;
+    return ret;
+}
+
+/**
+ * @brief Look up the translation unit opened in 'file' in the cache.
+ *
+ * On a hit the compilation can be skipped: tcc_output_file() will copy the
+ * cached assembly. On a miss tcc_compile() parses the tokens preprocessed
+ * for the key (or the reopened file, see cache_hash_tokens()), and the
+ * result is stored by tcc_output_file().
+ *
+ * @param s1        The TCC state.
+ * @param filename  The name of the file being compiled.
+ * @return          1 on a hit, 0 on a miss, -1 on error.
+ */
+static int tcc_cache_lookup(TCCState *s1, const char *filename)
+{
+    char path[1024];
+    struct stat st;
+    uint64_t h;
+    int hit, saved_lines, saved_bytes, *str;
+
+    if (s1->cache_state != TCC_CACHE_NONE) {
+        /* a cached object can only stand for a whole output file */
+        if (s1->cache_state == TCC_CACHE_HIT) {
+            error_noabort("the compilation cache handles one file per output");
+            return -1;
+        }
+        s1->cache_state = TCC_CACHE_DISABLED;
+        return 0;
+    }
+
+    h = cache_hash_str(FNV64_OFFSET, "816-tcc " TCC_VERSION);
+    h = cache_hash_int(h, CACHE_FORMAT_VERSION);
+    h = cache_hash_int(h, s1->hirom_comp);
+    h = cache_hash_int(h, s1->fastrom_comp);
+    h = cache_hash_int(h, s1->char_is_unsigned);
+    h = cache_hash_int(h, s1->inline_limit);
+    h = cache_hash_int(h, s1->peephole);
+    h = cache_hash_int(h, s1->dp_frame);
+    h = cache_hash_int(h, s1->loop_opt);
+    h = cache_hash_bytes(h, &s1->cache_opt_hash, sizeof(s1->cache_opt_hash));
+    saved_lines = total_lines;
+    saved_bytes = total_bytes;
+    if (cache_hash_tokens(s1, &h, &str) < 0)
+        return -1;
+    s1->cache_key = h;
+
+#ifdef _WIN32
+    _mkdir(s1->cache_dir);
+#else
+    mkdir(s1->cache_dir, 0777);
+#endif
+    cache_entry_path(s1, path, sizeof(path));
+    hit = stat(path, &st) == 0;
+    cache_update_stats(s1, hit);
+    if (hit) {
+        tok_str_free(str);
+        s1->cache_state = TCC_CACHE_HIT;
+        s1->cache_hits++;
+        /* refresh the entry for the LRU eviction */
+        utime(path, NULL);
+        if (s1->verbose)
+            printf("cache: hit %s -> %s\n", filename, path);
+        return 1;
+    }
+
+    s1->cache_state = TCC_CACHE_MISS;
+    s1->cache_misses++;
+    if (s1->verbose)
+        printf("cache: miss %s\n", filename);
+
+    if (str) {
+        s1->cache_tokens = str;
+        return 0;
+    }
+
+    /* rewind the source for the real compilation, which counts the same
+       lines again */
+    tcc_close(file);
+    total_lines = saved_lines;
+    total_bytes = saved_bytes;
+    file = tcc_open(s1, filename);
+    if (!file) {
+        error_noabort("file '%s' not found", filename);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Write the cached assembly of a hit to the output file.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int tcc_cache_restore(TCCState *s1, const char *filename)
+{
+    char path[1024];
+
+    cache_entry_path(s1, path, sizeof(path));
+    if (cache_copy_file(path, filename) < 0) {
+        error_noabort("could not write '%s'", filename);
+        return -1;
+    }
+    if (s1->verbose)
+        printf("<- %s\n", filename);
+    return 0;
+}
+
+/**
+ * @brief Store a freshly generated output file in the cache and trim the
+ * cache to its size limit.
+ *
+ * The entry is written under a temporary name and renamed, so concurrent
+ * compilers never see a partial file.
+ */
+static void tcc_cache_store(TCCState *s1, const char *filename)
+{
+    char path[1024], tmp[1024];
+
+    cache_entry_path(s1, path, sizeof(path));
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int) getpid());
+    if (cache_copy_file(filename, tmp) < 0 || rename(tmp, path) != 0)
+        remove(tmp);
+    cache_evict(s1);
+}
+
+/**
+ * @brief Pass the cached assembly of a hit to an output callback.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int tcc_cache_read(TCCState *s1, void *opaque, void (*sink)(void *opaque, const char *data, int len))
+{
+    char path[1024], buf[8192];
+    FILE *in;
+    size_t n;
+
+    cache_entry_path(s1, path, sizeof(path));
+    in = fopen(path, "rb");
+    if (!in) {
+        error_noabort("could not read '%s'", path);
+        return -1;
+    }
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+        sink(opaque, buf, n);
+    fclose(in);
+    return 0;
+}
+
+/**
+ * @brief Open a temporary cache entry for output that is not written to a
+ * file of its own.
+ *
+ * @param tmp       Receives the temporary file name.
+ * @param tmp_size  The size of 'tmp'.
+ * @return          The open entry, or NULL if it cannot be created.
+ */
+static FILE *tcc_cache_store_open(TCCState *s1, char *tmp, int tmp_size)
+{
+    char path[1024];
+
+    cache_entry_path(s1, path, sizeof(path));
+    snprintf(tmp, tmp_size, "%s.%d.tmp", path, (int) getpid());
+    return fopen(tmp, "wb");
+}
+
+/**
+ * @brief Close an entry opened by tcc_cache_store_open() and move it into
+ * place if 'ok' is set.
+ */
+static void tcc_cache_store_close(TCCState *s1, FILE *f, const char *tmp, int ok)
+{
+    char path[1024];
+
+    if (!f)
+        return;
+    if (fclose(f) != 0)
+        ok = 0;
+    cache_entry_path(s1, path, sizeof(path));
+    if (!ok || rename(tmp, path) != 0)
+        remove(tmp);
+    cache_evict(s1);
+}
+
+/**
+ * @brief Enable the compilation cache.
+ *
+ * The cache only applies to a state that compiles a single C file into an
+ * object (TCC_OUTPUT_OBJ).
+ *
+ * @param s         The TCC state.
+ * @param dir       The cache directory, created if missing.
+ * @param max_size  The cache size limit in bytes, 0 for the default.
+ */
+void tcc_set_cache(TCCState *s, const char *dir, unsigned long max_size)
+{
+    tcc_free(s->cache_dir);
+    s->cache_dir = dir ? tcc_strdup(dir) : NULL;
+    s->cache_max_size = max_size ? max_size : CACHE_DEFAULT_MAX_SIZE;
+}
+
+/**
+ * @brief Print the cache counters of the cache directory.
+ */
+void tcc_print_cache_stats(TCCState *s)
+{
+    CacheEntry *entries;
+    unsigned long total = 0;
+    int i, nb, hits, misses;
+
+    if (!s->cache_dir)
+        return;
+    cache_read_stats(s, &hits, &misses);
+    nb = cache_list_entries(s, &entries);
+    for (i = 0; i < nb; i++)
+        total += entries[i].size;
+    tcc_free(entries);
+    printf("cache: %d hits, %d misses (%0.1f%% hit rate), %d entries, %lu/%lu bytes\n",
+           hits,
+           misses,
+           hits + misses ? 100.0 * hits / (hits + misses) : 0.0,
+           nb,
+           total,
+           s->cache_max_size);
+}
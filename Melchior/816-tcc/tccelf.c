@@ -792,8 +792,8 @@ static void relocate_section(TCCState *s1, Section *s)
     int esym_index;
 #endif
 #ifdef TCC_TARGET_816
-    if (!relocptrs) {
-        relocptrs = calloc(0x100000, sizeof(char *));
+    if (!gen816.relocptrs) {
+        gen816.relocptrs = calloc(0x100000, sizeof(char *));
     }
 #endif
 
@@ -948,9 +948,9 @@ static void relocate_section(TCCState *s1, Section *s)
 #elif defined(TCC_TARGET_816)
         case R_DATA_32:
             /* no need to change the value at ptr, we only need the offset, and that's already there */
-            if (relocptrs[((unsigned long) ptr) & 0xfffff])
+            if (gen816.relocptrs[((unsigned long) ptr) & 0xfffff])
                 error("relocptrs collision");
-            relocptrs[((unsigned long) ptr) & 0xfffff] = symtab_section->link->data + sym->st_name;
+            gen816.relocptrs[((unsigned long) ptr) & 0xfffff] = symtab_section->link->data + sym->st_name;
             break;
         default:
             fprintf(stderr,
@@ -1741,20 +1741,108 @@ static const char elf_interp[] = "/lib/ld-linux.so.2";
 #endif
 #endif
 
+/**
+ * @brief Destination of the generated output: a file, a caller-supplied
+ * sink, or both.
+ *
+ * Output is collected in a small buffer so that sinks are called with
+ * reasonably large chunks instead of once per character.
+ */
+typedef struct AsmWriter
+{
+    FILE *f;                                               /**< Output file, or NULL. */
+    void (*sink)(void *opaque, const char *data, int len); /**< Output callback, or NULL. */
+    void *opaque;                                          /**< Argument passed to the sink. */
+    int len;                                               /**< Number of buffered bytes. */
+    char buf[4096];                                        /**< Pending output. */
+} AsmWriter;
+
+/**
+ * @brief Pass the buffered output on to the file and/or the sink.
+ */
+static void asm_flush(AsmWriter *w)
+{
+    if (w->len == 0)
+        return;
+    tcc_bench.asm_bytes += w->len;
+    if (w->f)
+        fwrite(w->buf, 1, w->len, w->f);
+    if (w->sink)
+        w->sink(w->opaque, w->buf, w->len);
+    w->len = 0;
+}
+
+/**
+ * @brief Write 'len' bytes of output.
+ */
+static void asm_write(AsmWriter *w, const void *data, int len)
+{
+    const char *p = data;
+    int n;
+
+    while (len > 0) {
+        if (w->len == sizeof(w->buf))
+            asm_flush(w);
+        n = sizeof(w->buf) - w->len;
+        if (n > len)
+            n = len;
+        memcpy(w->buf + w->len, p, n);
+        w->len += n;
+        p += n;
+        len -= n;
+    }
+}
+
+/**
+ * @brief Write a single character of output.
+ */
+static void asm_putc(int c, AsmWriter *w)
+{
+    if (w->len == sizeof(w->buf))
+        asm_flush(w);
+    w->buf[w->len++] = c;
+}
+
+/**
+ * @brief Write formatted output.
+ */
+static void asm_printf(AsmWriter *w, const char *fmt, ...)
+{
+    char buf[1024], *p;
+    va_list ap;
+    int len;
+
+    va_start(ap, fmt);
+    len = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (len < (int) sizeof(buf)) {
+        if (len > 0)
+            asm_write(w, buf, len);
+        return;
+    }
+    /* rare long line (e.g. a huge symbol name): format it again on the heap */
+    p = tcc_malloc(len + 1);
+    va_start(ap, fmt);
+    vsnprintf(p, len + 1, fmt, ap);
+    va_end(ap);
+    asm_write(w, p, len);
+    tcc_free(p);
+}
+
 /**
  * @brief Output the binary executable file.
  *
- * This function writes the binary executable file to the specified file stream.
+ * This function writes the binary executable file to the specified writer.
  * The output format is determined by the target architecture and can be an
  * object file, an executable file, or any other binary format supported by TCC.
  *
  * @param s1              The TCC state structure.
- * @param f               The file stream to write the output to.
+ * @param w               The writer receiving the output.
  * @param section_order   An array specifying the order in which sections should
  *                        be written to the output. It is an optional parameter,
  *                        and if NULL, the default order is used.
  */
-static void tcc_output_binary(TCCState *s1, FILE *f, const int *section_order)
+static void tcc_output_binary(TCCState *s1, AsmWriter *w, const int *section_order)
 {
 #ifndef TCC_TARGET_816
     Section *s;
@@ -1765,46 +1853,51 @@ static void tcc_output_binary(TCCState *s1, FILE *f, const int *section_order)
         s = s1->sections[section_order[i]];
         if (s->sh_type != SHT_NOBITS && (s->sh_flags & SHF_ALLOC)) {
             while (offset < s->sh_offset) {
-                fputc(0, f);
+                asm_putc(0, w);
                 offset++;
             }
             size = s->sh_size;
-            fwrite(s->data, 1, size, f);
+            asm_write(w, s->data, size);
             offset += size;
         }
     }
 #else
     Section *s;
     int i, j, k, size;
+    BENCH_ENTER(BENCH_OUTPUT);
 
     /* include header */
-    fprintf(f, ".include \"hdr.asm\"\n");
-    fprintf(f, ".accu 16\n.index 16\n");
-    fprintf(f, ".16bit\n");
+    asm_printf(w, ".include \"hdr.asm\"\n");
+    asm_printf(w, ".accu 16\n.index 16\n");
+    asm_printf(w, ".16bit\n");
     if (s1->hirom_comp) {
         if (s1->fastrom_comp)
-            fprintf(f, ".BASE $C0\n"); /* HiRom - FastROM */
+            asm_printf(w, ".BASE $C0\n"); /* HiRom - FastROM */
         else
-            fprintf(f, ".BASE $40\n"); /* HiRom - slowROM */
+            asm_printf(w, ".BASE $40\n"); /* HiRom - slowROM */
     } else if (s1->fastrom_comp)
-        fprintf(f, ".BASE $80\n"); /* LoRom - FastROM */
+        asm_printf(w, ".BASE $80\n"); /* LoRom - FastROM */
 
     /* local variable size constants; used to be generated as part of the
        function epilog, but WLA DX barfed once in a while about missing
        symbols. putting them at the start of the file works around that. */
-    for (i = 0; i < localno; i++) {
-        fprintf(f, ".define __%s_locals %d\n", locals[i], localnos[i]);
+    for (i = 0; i < gen816.localno; i++) {
+        asm_printf(w, ".define __%s_locals %d\n", gen816.locals[i], gen816.localnos[i]);
     }
 
     /* relocate sections
        this not only rewrites the pointers inside sections (with bogus
        data), but, more importantly, saves the names of the symbols we have
        to output later in place of this bogus data in the relocptrs[] array. */
+    if (tcc_bench.on)
+        bench_switch(BENCH_RELOC);
     for (i = 1; i < s1->nb_sections; i++) {
         s = s1->sections[section_order[i]];
         if (s->reloc && s != s1->got)
             relocate_section(s1, s);
     }
+    if (tcc_bench.on)
+        bench_switch(BENCH_OUTPUT);
 
     /* output sections */
     for (i = 1; i < s1->nb_sections; i++) {
@@ -1824,52 +1917,84 @@ static void tcc_output_binary(TCCState *s1, FILE *f, const int *section_order)
             int next_jump_pos
                 = 0; /* the next offset in the text section where we will look for a jump target */
             for (j = 0; j < size; j++) {
-                for (k = 0; k < labels; k++) {
-                    if (label[k].pos == j)
-                        fprintf(f, "%s%s:\n", STATIC_PREFIX /* "__local_" */, label[k].name);
+                for (k = 0; k < gen816.labels; k++) {
+                    if (gen816.label[k].pos == j)
+                        asm_printf(w, "%s%s:\n", STATIC_PREFIX /* "__local_" */, gen816.label[k].name);
                 }
                 /* insert jump labels */
                 if (next_jump_pos == j) {
                     next_jump_pos = size;
-                    for (k = 0; k < jumps; k++) {
+                    for (k = 0; k < gen816.jumps; k++) {
                         /* while we're here, look for the next jump target after this one */
-                        if (jump[k][1] > j && jump[k][1] < next_jump_pos)
-                            next_jump_pos = jump[k][1];
+                        if (gen816.jump[k][1] > j && gen816.jump[k][1] < next_jump_pos)
+                            next_jump_pos = gen816.jump[k][1];
                         /* write the jump target label(s) for this position */
-                        if (jump[k][1] == j)
-                            fprintf(f, LOCAL_LABEL ":\n", k);
+                        if (gen816.jump[k][1] == j)
+                            asm_printf(w, LOCAL_LABEL ":\n", k);
                     }
                 }
-                fputc(s->data[j], f);
+                asm_putc(s->data[j], w);
             }
-            if (!section_closed)
-                fprintf(f, ".ENDS\n");
+            if (!gen816.section_closed)
+                asm_printf(w, ".ENDS\n");
         } else if (s == bss_section) {
-            /* uninitialized data, we only need a .ramsection */
+            /* uninitialized data, we only need a .ramsection per placement:
+               default (bank $7e), near (bank $00 low RAM), zeropage (direct
+               page, which starts at $0000 like the pseudo registers) and far */
+            static const char *const ramsections[4] = {
+                ".RAMSECTION \".bss\" BANK $7e SLOT 2\n",
+                ".RAMSECTION \".nbss\" BANK 0 SLOT 1\n",
+                /* starts at or below $100 - size, so that it ends in the
+                   direct page: wlalink fails if it does not fit there */
+                ".RAMSECTION \".zbss\" BANK 0 SLOT 1 ORGA $%x SEMISUBFREE\n",
+                ".RAMSECTION \".fbss\" BANK $7f SLOT 2\n",
+            };
             ElfW(TokenSym) * esym;
-            int empty = 1;
-            if (s1->hirom_comp || s1->fastrom_comp)
-                fprintf(f, ".BASE $00\n"); /* Return to base $00 */
-            fprintf(f, ".RAMSECTION \".bss\" BANK $7e SLOT 2\n");
-            for (j = 0, esym = (ElfW(TokenSym) *) symtab_section->data;
-                 j < symtab_section->sh_size / sizeof(ElfW(TokenSym));
-                 esym++, j++) {
-                if (esym->st_shndx == SHN_COMMON
-                    && strlen(symtab_section->link->data
-                              + esym->st_name)) /* omit nameless symbols (fixes 20041218-1.c) */
-                {
-                    /* looks like these are the symbols that need to go here,
-                       but that is merely an educated guess. works for me, though. */
-                    fprintf(f,
-                            "%s%s dsb %d\n",
-                            /*ELF32_ST_BIND(esym->st_info) == STB_LOCAL ? STATIC_PREFIX:*/ "",
-                            symtab_section->link->data + esym->st_name,
-                            esym->st_size);
-                    empty = 0;
+            int placement, empty, placesize;
+            for (placement = 0; placement < 4; placement++) {
+                for (empty = 1, placesize = 0, j = 0, esym = (ElfW(TokenSym) *) symtab_section->data;
+                     j < symtab_section->sh_size / sizeof(ElfW(TokenSym));
+                     esym++, j++) {
+                    if (esym->st_shndx == SHN_COMMON
+                        && ST_PLACEMENT(esym->st_other) == placement << VT_PLACEMENT_SHIFT) {
+                        empty = 0;
+                        if (strlen(symtab_section->link->data + esym->st_name))
+                            placesize += esym->st_size;
+                    }
+                }
+                /* .bss is always written: 816-opt looks for it */
+                if (empty && placement)
+                    continue;
+                /* zeropage variables are addressed with .b, they must be in
+                   the direct page next to the pseudo registers */
+                if (placement << VT_PLACEMENT_SHIFT == VT_ZEROPAGE
+                    && placesize > DP_FRAME_SIZE - DP_FRAME_REGS)
+                    error("zeropage variables use %d bytes, the direct page only has %d bytes "
+                          "after the pseudo registers",
+                          placesize, DP_FRAME_SIZE - DP_FRAME_REGS);
+                if (s1->hirom_comp || s1->fastrom_comp)
+                    asm_printf(w, ".BASE $00\n"); /* Return to base $00 */
+                asm_printf(w, ramsections[placement], DP_FRAME_SIZE - placesize);
+                for (j = 0, esym = (ElfW(TokenSym) *) symtab_section->data;
+                     j < symtab_section->sh_size / sizeof(ElfW(TokenSym));
+                     esym++, j++) {
+                    if (esym->st_shndx == SHN_COMMON
+                        && ST_PLACEMENT(esym->st_other) == placement << VT_PLACEMENT_SHIFT
+                        && strlen(symtab_section->link->data
+                                  + esym->st_name)) /* omit nameless symbols (fixes 20041218-1.c) */
+                    {
+                        /* looks like these are the symbols that need to go here,
+                           but that is merely an educated guess. works for me, though. */
+                        asm_printf(w,
+                                "%s%s dsb %d\n",
+                                /*ELF32_ST_BIND(esym->st_info) == STB_LOCAL ? STATIC_PREFIX:*/ "",
+                                symtab_section->link->data + esym->st_name,
+                                esym->st_size);
+                    }
                 }
-            }
 
-            fprintf(f, ".ENDS\n");
+                asm_printf(w, ".ENDS\n");
+            }
         } else { /* .data, .rodata, user-defined sections */
 
             int deebeed = 0; /* remembers whether we have printed ".DB"
@@ -1887,24 +2012,24 @@ static void tcc_output_binary(TCCState *s1, FILE *f, const int *section_order)
             for (k = startk; k < endk; k++) {
                 if (k == 0) { /* .ramsection */
                     if (s1->hirom_comp || s1->fastrom_comp)
-                        fprintf(f, ".BASE $00\n"); /* Return to base $00 */
-                    fprintf(f,
+                        asm_printf(w, ".BASE $00\n"); /* Return to base $00 */
+                    asm_printf(w,
                             ".RAMSECTION \"ram%s%s\" APPENDTO \"globram.data\"\n",
                             unique_token,
                             s->name);
                 } else { /* (ROM) .section */
                     // check for .data section to append to global one
                     if (!strcmp(s->name, ".data"))
-                        fprintf(f,
+                        asm_printf(w,
                                 ".SECTION \"%s%s\" APPENDTO \"glob.data\"\n",
                                 unique_token,
                                 s->name);
                     else {
                         if (s1->hirom_comp)
-                            fprintf(f, ".SECTION \"%s\" SEMIFREE ORG $8000\n",
+                            asm_printf(w, ".SECTION \"%s\" SEMIFREE ORG $8000\n",
                                     s->name); // 09042021
                         else
-                            fprintf(f, ".SECTION \"%s\" SUPERFREE\n",
+                            asm_printf(w, ".SECTION \"%s\" SUPERFREE\n",
                                     s->name); // 09042021
                     }
                 }
@@ -1959,17 +2084,17 @@ static void tcc_output_binary(TCCState *s1, FILE *f, const int *section_order)
                         /* if we already printed a symbol in this section, define this symbol as size 0 so it
                             gets the same address as the other ones at this position. */
                         if (k == 0 && (bytecount > 0 || symbol_printed)) {
-                            fprintf(f, "dsb %d", bytecount);
+                            asm_printf(w, "dsb %d", bytecount);
                             bytecount = 0;
                         }
 
                         /* if there are two sections, print label only in .ramsection */
                         if (k == 0)
-                            fprintf(f, "\n%s%s ", symprefix, symname);
+                            asm_printf(w, "\n%s%s ", symprefix, symname);
                         else if (startk == 1)
-                            fprintf(f, "\n%s%s: ", symprefix, symname);
+                            asm_printf(w, "\n%s%s: ", symprefix, symname);
                         else
-                            fprintf(f, "\n");
+                            asm_printf(w, "\n");
                         symbol_printed = 1;
                     }
 
@@ -1982,15 +2107,15 @@ static void tcc_output_binary(TCCState *s1, FILE *f, const int *section_order)
                         if (k == 0) { /* .ramsection, just count bytes */
                             bytecount++;
                         } else { /* (ROM) .section, need to output data */
-                            if (relocptrs && relocptrs[((unsigned long) &s->data[j]) & 0xfffff]) {
+                            if (gen816.relocptrs && gen816.relocptrs[((unsigned long) &s->data[j]) & 0xfffff]) {
                                 /* relocated -> print a symbolic pointer */
-                                char *ptrname = relocptrs[((unsigned long) &s->data[j]) & 0xfffff];
-                                fprintf(f, ".dw %s + %d, :%s", ptrname, ptr, ptrname);
+                                char *ptrname = gen816.relocptrs[((unsigned long) &s->data[j]) & 0xfffff];
+                                asm_printf(w, ".dw %s + %d, :%s", ptrname, ptr, ptrname);
                                 j += 3; /* we have handled 3 more bytes than expected */
                                 deebeed = 0;
                             } else {
                                 /* any non-symbolic data; print one byte, then let the generic code take over */
-                                fprintf(f, ".db $%x", ptrc);
+                                asm_printf(w, ".db $%x", ptrc);
                                 deebeed = 1;
                             }
                         }
@@ -1998,13 +2123,13 @@ static void tcc_output_binary(TCCState *s1, FILE *f, const int *section_order)
                     }
 
                     /* no symbol here, just print the data */
-                    if (k == 1 && relocptrs && relocptrs[((unsigned long) &s->data[j]) & 0xfffff]) {
+                    if (k == 1 && gen816.relocptrs && gen816.relocptrs[((unsigned long) &s->data[j]) & 0xfffff]) {
                         /* unlabeled data may have been relocated, too */
-                        fprintf(f,
+                        asm_printf(w,
                                 "\n.dw %s + %d\n.dw :%s",
-                                relocptrs[((unsigned long) &s->data[j]) & 0xfffff],
+                                gen816.relocptrs[((unsigned long) &s->data[j]) & 0xfffff],
                                 *(unsigned int *) (&s->data[j]),
-                                relocptrs[((unsigned long) &s->data[j]) & 0xfffff]);
+                                gen816.relocptrs[((unsigned long) &s->data[j]) & 0xfffff]);
                         j += 3;
                         deebeed = 0;
                         continue;
@@ -2012,24 +2137,25 @@ static void tcc_output_binary(TCCState *s1, FILE *f, const int *section_order)
 
                     if (!deebeed) {
                         if (k == 1)
-                            fprintf(f, "\n.db ");
+                            asm_printf(w, "\n.db ");
                         deebeed = 1;
                     } else if (k == 1)
-                        fprintf(f, ",");
+                        asm_printf(w, ",");
                     if (k == 1)
-                        fprintf(f, "$%x", s->data[j]);
+                        asm_printf(w, "$%x", s->data[j]);
                     bytecount++;
                 }
 
                 if (k == 0) {
                     if (bytecount) // 07/06/2023, added because of previous test removed
-                        fprintf(f, "dsb %d\n", bytecount);
+                        asm_printf(w, "dsb %d\n", bytecount);
                     bytecount = 0;
                 }
-                fprintf(f, "\n.ENDS\n\n");
+                asm_printf(w, "\n.ENDS\n\n");
             }
         }
     }
+    BENCH_LEAVE();
 #endif
 }
 
@@ -2066,10 +2192,11 @@ void patch_dynsym_undef(TCCState *s1, Section *s)
  * based on the TCCState structure.
  *
  * @param s1        The TCC state structure.
- * @param filename  The name of the output ELF file.
+ * @param filename  The name of the output ELF file, or NULL to write to 'w'.
+ * @param w         The writer receiving the assembly when 'filename' is NULL.
  * @return          0 on success, -1 on failure.
  */
-int elf_output_file(TCCState *s1, const char *filename)
+static int elf_output(TCCState *s1, const char *filename, AsmWriter *w)
 {
 #ifndef TCC_TARGET_816
     ElfW(Ehdr) ehdr;
@@ -2722,6 +2849,15 @@ int elf_output_file(TCCState *s1, const char *filename)
     }
 #endif
 
+#ifdef TCC_TARGET_816
+    if (!filename) {
+        tcc_output_binary(s1, w, section_order);
+        asm_flush(w);
+        ret = 0;
+        goto the_end;
+    }
+#endif
+
     /* write elf file */
     if (file_type == TCC_OUTPUT_OBJ)
         mode = 0666;
@@ -2842,7 +2978,14 @@ int elf_output_file(TCCState *s1, const char *filename)
         }
 #endif
     } else {
-        tcc_output_binary(s1, f, section_order);
+        AsmWriter fw;
+
+        fw.f = f;
+        fw.sink = NULL;
+        fw.opaque = NULL;
+        fw.len = 0;
+        tcc_output_binary(s1, &fw, section_order);
+        asm_flush(&fw);
     }
     fclose(f);
 
@@ -2874,11 +3017,108 @@ int tcc_output_file(TCCState *s, const char *filename)
     } else
 #endif
     {
-        ret = elf_output_file(s, filename);
+        if (s->cache_state == TCC_CACHE_HIT)
+            return tcc_cache_restore(s, filename);
+        ret = elf_output(s, filename, NULL);
+        if (ret == 0 && s->cache_state == TCC_CACHE_MISS)
+            tcc_cache_store(s, filename);
     }
     return ret;
 }
 
+#ifdef TCC_TARGET_816
+/**
+ * @brief Pass the generated assembly to a callback instead of a file.
+ *
+ * The sink is called several times with consecutive chunks of the output
+ * (not NUL-terminated). Like tcc_output_file(), this can only be done once
+ * per state.
+ *
+ * @param s       The TCC state structure.
+ * @param opaque  The first argument of every sink call.
+ * @param sink    The callback receiving the output.
+ * @return        0 on success, -1 on failure.
+ */
+int tcc_output_sink(TCCState *s, void *opaque, void (*sink)(void *opaque, const char *data, int len))
+{
+    AsmWriter w;
+    char tmp[1024];
+    int ret;
+
+    if (s->cache_state == TCC_CACHE_HIT)
+        return tcc_cache_read(s, opaque, sink);
+    w.f = NULL;
+    w.sink = sink;
+    w.opaque = opaque;
+    w.len = 0;
+    /* a miss is stored in the cache while it is being generated */
+    if (s->cache_state == TCC_CACHE_MISS)
+        w.f = tcc_cache_store_open(s, tmp, sizeof(tmp));
+    ret = elf_output(s, NULL, &w);
+    if (s->cache_state == TCC_CACHE_MISS)
+        tcc_cache_store_close(s, w.f, tmp, ret == 0);
+    return ret;
+}
+
+/**
+ * @brief Growing buffer filled by tcc_output_memory().
+ */
+typedef struct OutputBuffer
+{
+    char *data; /**< The output, NUL-terminated once complete. */
+    int len;    /**< Number of bytes of output. */
+    int size;   /**< Allocated size of 'data'. */
+} OutputBuffer;
+
+static void output_buffer_sink(void *opaque, const char *data, int len)
+{
+    OutputBuffer *b = opaque;
+
+    if (b->len + len + 1 > b->size) {
+        b->size = b->size ? b->size * 2 : 65536;
+        while (b->len + len + 1 > b->size)
+            b->size *= 2;
+        b->data = tcc_realloc(b->data, b->size);
+    }
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+}
+
+/**
+ * @brief Return the generated assembly as a memory buffer.
+ *
+ * @param s      The TCC state structure.
+ * @param psize  If not NULL, receives the length of the output.
+ * @return       The NUL-terminated output, to be released with
+ *               tcc_free_output(), or NULL on failure.
+ */
+char *tcc_output_memory(TCCState *s, int *psize)
+{
+    OutputBuffer b;
+
+    b.data = NULL;
+    b.len = b.size = 0;
+    if (tcc_output_sink(s, &b, output_buffer_sink) < 0) {
+        tcc_free(b.data);
+        return NULL;
+    }
+    if (!b.data)
+        b.data = tcc_malloc(1);
+    b.data[b.len] = '\0';
+    if (psize)
+        *psize = b.len;
+    return b.data;
+}
+
+/**
+ * @brief Release a buffer returned by tcc_output_memory().
+ */
+void tcc_free_output(char *buf)
+{
+    tcc_free(buf);
+}
+#endif
+
 #ifndef TCC_TARGET_816
 /**
  * @brief Load data from a file into memory.
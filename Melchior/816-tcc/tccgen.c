@@ -175,6 +175,31 @@ static TokenSym *external_global_sym(int v, CType *type, int r)
     return s;
 }
 
+#ifdef TCC_TARGET_816
+/**
+ * @brief Merge the placement attribute of a redeclaration into a global symbol.
+ *
+ * @param s The symbol.
+ * @param type The type of the redeclaration.
+ */
+static void merge_placement(TokenSym *s, CType *type)
+{
+    int placement = type->t & VT_PLACEMENT;
+    ElfW(TokenSym) * esym;
+
+    if (!placement || (s->type.t & VT_PLACEMENT) == placement)
+        return;
+    if (s->type.t & VT_PLACEMENT)
+        error("conflicting placement for '%s'", get_tok_str(s->v, NULL));
+    s->type.t |= placement;
+    /* already in the symbol table */
+    if (s->c) {
+        esym = &((ElfW(TokenSym) *) symtab_section->data)[s->c];
+        esym->st_other |= placement >> VT_PLACEMENT_SHIFT << ST_PLACEMENT_SHIFT;
+    }
+}
+#endif
+
 /**
  * @brief Define a new external reference to a symbol 'v' of type 'u'.
  *
@@ -199,6 +224,9 @@ static TokenSym *external_sym(int v, CType *type, int r)
     } else if (!is_compatible_types(&s->type, type)) {
         error("incompatible types for redefinition of '%s'", get_tok_str(v, NULL));
     }
+#ifdef TCC_TARGET_816
+    merge_placement(s, type);
+#endif
     return s;
 }
 
@@ -323,7 +351,7 @@ void save_reg(int r)
 #endif
                 size = type_size(type, &align);
                 loc = (loc - size) & -align;
-                sv.type.t = type->t;
+                sv.type = *type;
                 sv.r = VT_LOCAL | VT_LVAL;
                 sv.c.ul = loc;
                 store(r, &sv);
@@ -541,7 +569,12 @@ int gv(int rc)
         cst = ((vtop->r & VT_VALMASK) == VT_CONST) && !(vtop->r & VT_LVAL);
 #endif
         /* remove bit field info to avoid loops */
+#ifdef TCC_TARGET_816
+        /* the near qualifier selects the addressing of the load */
+        vtop->type.t &= ~(VT_BITFIELD | (-1 << VT_STRUCT_SHIFT)) | VT_NEARDATA;
+#else
         vtop->type.t &= ~(VT_BITFIELD | (-1 << VT_STRUCT_SHIFT));
+#endif
         /* cast to int to propagate signedness in following ops */
         if ((vtop->type.t & VT_BTYPE) == VT_LLONG) {
             type.t = VT_LLONG;
@@ -644,6 +677,15 @@ int gv(int rc)
                     vpushi(ll >> 16);
 #else
                     vpushi(ll >> 32); /* second word */
+#endif
+#ifdef TCC_TARGET_816
+                } else if (vtop->r == (VT_LOCAL | VT_LVAL) || vtop->r == (VT_CONST | VT_SYM | VT_LVAL)) {
+                    /* a local or a global: the second word is right above
+                       the first one, no need to go through its address */
+                    load(r, vtop);
+                    vdup();
+                    vtop[-1].r = r; /* save register value */
+                    vtop->c.ul += 2;
 #endif
                 } else if (r >= VT_CONST || /* XXX: test to VT_CONST incorrect ? */
                            (vtop->r & VT_LVAL)) {
@@ -670,7 +712,7 @@ int gv(int rc)
                     else
 #endif
                     pr("; pushit type 0x%x\n", vtop->type.t);
-                    ll_workaround = 1;
+                    gen816.ll_workaround = 1;
 #endif
                     /* increment pointer to get second word */
                     vtop->type.t = VT_INT;
@@ -683,7 +725,7 @@ int gv(int rc)
                     gen_op('+');
                     vtop->r |= VT_LVAL;
 #ifdef TCC_TARGET_816
-                    ll_workaround = 0;
+                    gen816.ll_workaround = 0;
                     pr("; endpush\n");
 #endif
                 } else {
@@ -979,6 +1021,10 @@ void gen_opl(int op)
     unsigned short reg_lret = REG_LRET;
     SValue tmp;
 
+#ifdef TCC_TARGET_816
+    if (gen_opl_inline(op))
+        return;
+#endif
     switch (op) {
     case '/':
     case TOK_PDIV:
@@ -1202,16 +1248,16 @@ void gen_opl(int op)
 #elif defined(TCC_TARGET_816)
 #if 0
                 b = ind;
-                jump[jumps][0] = ind;
+                gen816.jump[gen816.jumps][0] = ind;
                 pr("; cmpll ne a %d b %d op 0x%x op1 0x%x\n", a, b, op, op1);
                 // branches (too short) p("b%s " LOCAL_LABEL "\n", inv?"eq":"ne", jumps++);
-                pr("beq +\nbrl " LOCAL_LABEL "\n+\n", jumps++);
+                pr("beq +\nbrl " LOCAL_LABEL "\n+\n", gen816.jumps++);
 #endif
         pr("; cmpll high order word equal?\n");
         b = ind;
-        jump[jumps][0] = ind;
+        gen816.jump[gen816.jumps][0] = ind;
         // flags from the compare are long gone, but the compare opi has saved the value for us in y
-        pr("tya\nbne " LOCAL_LABEL "\n", jumps++);
+        pr("tya\nbne " LOCAL_LABEL "\n", gen816.jumps++);
 #else
 #error not supported
 #endif
@@ -1569,6 +1615,10 @@ static void check_comparison_pointer_types(SValue *p1, SValue *p2, int op)
     tmp_type2 = *type2;
     tmp_type1.t &= ~(VT_UNSIGNED | VT_CONSTANT | VT_VOLATILE);
     tmp_type2.t &= ~(VT_UNSIGNED | VT_CONSTANT | VT_VOLATILE);
+#ifdef TCC_TARGET_816
+    tmp_type1.t &= ~VT_NEARDATA;
+    tmp_type2.t &= ~VT_NEARDATA;
+#endif
     if (!is_compatible_types(&tmp_type1, &tmp_type2)) {
         /* gcc-like error if '-' is used */
         if (op == '-')
@@ -1578,6 +1628,471 @@ static void check_comparison_pointer_types(SValue *p1, SValue *p2, int op)
     }
 }
 
+#ifdef TCC_TARGET_816
+/* fixed-point support: __fixed int is 8.8, __fixed long long is 16.16.
+   Values are plain integers scaled by 2^frac; the operations below
+   rescale their operands and then reuse the integer code paths. */
+
+/* number of fraction bits of type 't' */
+static int fixed_frac(int t)
+{
+    if (!(t & VT_FIXED))
+        return 0;
+    return (t & VT_BTYPE) == VT_LLONG ? 16 : 8;
+}
+
+/* result type of an operation involving a fixed-point operand: the
+   wider of the two formats */
+static int fixed_common_type(int t1, int t2)
+{
+    int t;
+
+    t = VT_INT;
+    if ((t1 & VT_BTYPE) == VT_LLONG || (t2 & VT_BTYPE) == VT_LLONG)
+        t = VT_LLONG;
+    if ((t1 & (VT_BTYPE | VT_UNSIGNED)) == (t | VT_UNSIGNED)
+        || (t2 & (VT_BTYPE | VT_UNSIGNED)) == (t | VT_UNSIGNED))
+        t |= VT_UNSIGNED;
+    return t | VT_FIXED;
+}
+
+/* value of an integer constant on the value stack */
+static long long fixed_const(SValue *sv)
+{
+    if ((sv->type.t & VT_BTYPE) == VT_LLONG)
+        return (sv->type.t & VT_UNSIGNED) ? (long long) sv->c.ull : sv->c.ll;
+    return (sv->type.t & VT_UNSIGNED) ? (long long) sv->c.ui : sv->c.i;
+}
+
+static int fixed_is_const(SValue *sv)
+{
+    return (sv->r & (VT_VALMASK | VT_LVAL | VT_SYM)) == VT_CONST;
+}
+
+/* cast between fixed-point, integer and float types. Returns 0 if the
+   generic cast code is sufficient. */
+static int fixed_cast(CType *type)
+{
+    int sf, df, sbt, dbt;
+    long double ld;
+    CType t;
+    CValue cv;
+
+    sbt = vtop->type.t & VT_BTYPE;
+    dbt = type->t & VT_BTYPE;
+    sf = fixed_frac(vtop->type.t);
+    df = fixed_frac(type->t);
+    if (sf == df || dbt == VT_BOOL || !(is_integer_btype(dbt) || is_float(dbt))
+        || !(is_integer_btype(sbt) || sbt == VT_BOOL || is_float(sbt))) {
+        /* same scale, truth value or not an arithmetic conversion */
+        vtop->type.t &= ~VT_FIXED;
+        return 0;
+    }
+    t.t = type->t & ~VT_FIXED;
+    t.ref = type->ref;
+    if (is_float(sbt)) {
+        if (fixed_is_const(vtop)) {
+            /* round constants to the nearest representable value */
+            if (sbt == VT_FLOAT)
+                ld = vtop->c.f;
+            else if (sbt == VT_DOUBLE)
+                ld = vtop->c.d;
+            else
+                ld = vtop->c.ld;
+            ld *= (long double) (1 << df);
+            vtop--;
+            vpushll((long long) (ld < 0 ? ld - 0.5 : ld + 0.5));
+        } else {
+            /* scale in floating point, then truncate */
+            cv.ld = (long double) (1 << df);
+            if (sbt == VT_FLOAT)
+                cv.f = cv.ld;
+            else if (sbt == VT_DOUBLE)
+                cv.d = cv.ld;
+            vsetc(&vtop->type, VT_CONST, &cv);
+            gen_op('*');
+        }
+        gen_cast(&t);
+    } else if (is_float(dbt)) {
+        vtop->type.t &= ~VT_FIXED;
+        gen_cast(&t);
+        cv.ld = 1.0 / (long double) (1 << sf);
+        if (dbt == VT_FLOAT)
+            cv.f = cv.ld;
+        else if (dbt == VT_DOUBLE)
+            cv.d = cv.ld;
+        vsetc(&t, VT_CONST, &cv);
+        gen_op('*');
+    } else if (df > sf) {
+        /* widen first so that no integer bits are lost */
+        vtop->type.t &= ~VT_FIXED;
+        gen_cast(&t);
+        vpushi(df - sf);
+        gen_op(TOK_SHL);
+    } else {
+        /* drop fraction bits (rounding towards minus infinity), then
+           narrow */
+        vtop->type.t &= ~VT_FIXED;
+        vpushi(sf - df);
+        gen_op(TOK_SAR);
+        gen_cast(&t);
+    }
+    vtop->type = *type;
+    return 1;
+}
+
+/* convert vtop to the fixed-point format 't'. Plain integers are only
+   widened, not scaled, when 'raw' is set. The result is stripped of
+   VT_FIXED so that the integer code paths can be used on it. */
+static void fixed_operand(int t, int raw)
+{
+    CType type;
+
+    type.t = t;
+    type.ref = NULL;
+    if (raw && !(vtop->type.t & VT_FIXED))
+        type.t &= ~VT_FIXED;
+    gen_cast(&type);
+    vtop->type.t &= ~VT_FIXED;
+}
+
+/* move vtop into a new local unless it can be reloaded as it is */
+static void fixed_spill(void)
+{
+    int size, align, addr;
+    CType type;
+
+    if (fixed_is_const(vtop)
+        || ((vtop->r & (VT_VALMASK | VT_LVAL | VT_SYM)) == (VT_LOCAL | VT_LVAL)
+            && !(vtop->r & VT_MUSTCAST)))
+        return;
+    type = vtop->type;
+    size = type_size(&type, &align);
+    loc = (loc - size) & -align;
+    addr = loc;
+    vset(&type, VT_LOCAL | VT_LVAL, addr);
+    vswap();
+    vstore();
+    vpop();
+    vset(&type, VT_LOCAL | VT_LVAL, addr);
+}
+
+/* push the low or high word of a spilled 16.16 value */
+static void fixed_word(SValue *sv, int hi)
+{
+    vpushv(sv);
+    if (fixed_is_const(sv))
+        vtop->c.ui = (unsigned short) (hi ? sv->c.ll >> 16 : sv->c.ll);
+    else if (hi)
+        vtop->c.ul += 2;
+    vtop->type.t = VT_INT | VT_UNSIGNED;
+}
+
+/* 16.16 multiply: bits 16..47 of the 64-bit product, assembled from
+   16x16->32 partial products. For signed operands the high word is
+   corrected by the other operand's low word for each negative one. */
+static void gen_fixmul16(int t)
+{
+    SValue a, b;
+
+    fixed_spill();
+    vswap();
+    fixed_spill();
+    a = vtop[0];
+    b = vtop[-1];
+    vtop -= 2;
+
+    fixed_word(&a, 0);
+    fixed_word(&b, 0);
+    gen_op(TOK_UMULL);
+    vtop->type.t = VT_LLONG | VT_UNSIGNED;
+    vpushi(16);
+    gen_op(TOK_SHR);
+    fixed_word(&a, 0);
+    fixed_word(&b, 1);
+    gen_op(TOK_UMULL);
+    vtop->type.t = VT_LLONG | VT_UNSIGNED;
+    gen_op('+');
+    fixed_word(&a, 1);
+    fixed_word(&b, 0);
+    gen_op(TOK_UMULL);
+    vtop->type.t = VT_LLONG | VT_UNSIGNED;
+    gen_op('+');
+
+    /* high word: ah * bh, minus the sign corrections */
+    fixed_word(&a, 1);
+    fixed_word(&b, 1);
+    gen_op('*');
+    if (!(t & VT_UNSIGNED)) {
+        fixed_word(&a, 1);
+        vtop->type.t = VT_INT;
+        vpushi(15);
+        gen_op(TOK_SAR);
+        fixed_word(&b, 0);
+        gen_op('&');
+        gen_op('-');
+        fixed_word(&b, 1);
+        vtop->type.t = VT_INT;
+        vpushi(15);
+        gen_op(TOK_SAR);
+        fixed_word(&a, 0);
+        gen_op('&');
+        gen_op('-');
+    }
+    /* stack: S H -> S + (H << 16) */
+    vswap();
+    lexpand();
+    vrotb(3);
+    gen_op('+');
+    lbuild(t & ~VT_FIXED);
+}
+
+/* 16.16 divide: (a << 16) / b does not fit in 32 bits, so the quotient
+   is developed four bits at a time from the running remainder. Exact
+   as long as the remainder shifted by four fits, i.e. |b| < 2048.0. */
+static void gen_fixdiv16(int t)
+{
+    SValue a, b, q, r;
+    CType type;
+    int size, align, i;
+
+    type.t = t & ~VT_FIXED;
+    type.ref = NULL;
+    size = type_size(&type, &align);
+    fixed_spill();
+    b = *vtop--;
+    fixed_spill();
+    a = *vtop--;
+    loc = (loc - size) & -align;
+    vset(&type, VT_LOCAL | VT_LVAL, loc);
+    q = *vtop--;
+    loc = (loc - size) & -align;
+    vset(&type, VT_LOCAL | VT_LVAL, loc);
+    r = *vtop--;
+
+    vpushv(&q);
+    vpushv(&a);
+    vpushv(&b);
+    gen_op('/');
+    vstore();
+    vpop();
+    vpushv(&r);
+    vpushv(&a);
+    vpushv(&b);
+    gen_op('%');
+    vstore();
+    vpop();
+    for (i = 0; i < 4; i++) {
+        vpushv(&r);
+        vpushv(&r);
+        vpushi(4);
+        gen_op(TOK_SHL);
+        vstore();
+        vpop();
+        vpushv(&q);
+        vpushv(&q);
+        vpushi(4);
+        gen_op(TOK_SHL);
+        vpushv(&r);
+        vpushv(&b);
+        gen_op('/');
+        gen_op('+');
+        vstore();
+        vpop();
+        if (i < 3) {
+            vpushv(&r);
+            vpushv(&r);
+            vpushv(&b);
+            gen_op('%');
+            vstore();
+            vpop();
+        }
+    }
+    vpushv(&q);
+}
+
+/* fixed-point '*' and '/' on two operands already in format 't' */
+static void gen_fixmuldiv(int op, int t)
+{
+    int f, c1, c2;
+    long long l1, l2;
+    CType type;
+
+    f = fixed_frac(t);
+    type.t = t & ~VT_FIXED;
+    type.ref = NULL;
+    c1 = fixed_is_const(vtop - 1);
+    c2 = fixed_is_const(vtop);
+    l1 = c1 ? fixed_const(vtop - 1) : 0;
+    l2 = c2 ? fixed_const(vtop) : 0;
+    if (c1 && c2 && (op == '*' || l2 != 0)) {
+        /* constant folding */
+        if (op == '*')
+            l1 = (t & VT_UNSIGNED) ? (long long) (((unsigned long long) l1 * l2) >> f) : (l1 * l2) >> f;
+        else
+            l1 = (t & VT_UNSIGNED) ? (long long) (((unsigned long long) l1 << f) / l2) : (l1 * (1 << f)) / l2;
+        vtop -= 2;
+        vpushll(l1);
+        gen_cast(&type);
+        return;
+    }
+    if (op == '*' && c1 && !(l1 & ((1 << f) - 1))) {
+        vswap();
+        c2 = 1;
+        l2 = l1;
+    }
+    if (c2 && l2 != 0 && !(l2 & ((1 << f) - 1))) {
+        /* constant without fraction bits: an integer multiply or divide */
+        vtop->c.ll = l2 >> f;
+        if ((t & VT_BTYPE) != VT_LLONG)
+            vtop->c.i = (int) (l2 >> f);
+        gen_op(op);
+        return;
+    }
+    if (nocode_wanted) {
+        gen_op(op);
+        return;
+    }
+    if (op == '*') {
+        if (f == 8)
+            gen_opi(TOK_FMUL8);
+        else
+            gen_fixmul16(t);
+    } else if (f == 8) {
+        /* 8.8: widen the dividend to 32 bits so that the shift fits */
+        type.t = VT_LLONG | (t & VT_UNSIGNED);
+        gen_cast(&type);
+        vswap();
+        gen_cast(&type);
+        vpushi(8);
+        gen_op(TOK_SHL);
+        vswap();
+        gen_op('/');
+        type.t = t & ~VT_FIXED;
+        gen_cast(&type);
+    } else {
+        gen_fixdiv16(t);
+    }
+}
+
+/* gen_op() for operations involving at least one fixed-point operand */
+static void gen_op_fixed(int op)
+{
+    int t, t1, t2, bt1, bt2, raw1, raw2;
+    CType type;
+
+    t1 = vtop[-1].type.t;
+    t2 = vtop[0].type.t;
+    bt1 = t1 & VT_BTYPE;
+    bt2 = t2 & VT_BTYPE;
+    type.ref = NULL;
+
+    if (bt1 == VT_PTR || bt2 == VT_PTR || is_float(bt1) || is_float(bt2)) {
+        /* the fixed-point operand takes the other operand's type: its
+           integer part for pointer arithmetic, its value for floats */
+        if (bt1 == VT_PTR || bt2 == VT_PTR)
+            type.t = VT_INT;
+        else
+            type.t = is_float(bt1) ? bt1 : bt2;
+        if (t1 & VT_FIXED) {
+            vswap();
+            gen_cast(&type);
+            vswap();
+        }
+        if (t2 & VT_FIXED)
+            gen_cast(&type);
+        gen_op(op);
+        return;
+    }
+    if (op == TOK_SHL || op == TOK_SAR || op == TOK_SHR) {
+        /* shifts work on the representation; the count is an integer */
+        if (t2 & VT_FIXED) {
+            type.t = VT_INT;
+            gen_cast(&type);
+        }
+        vtop[-1].type.t &= ~VT_FIXED;
+        gen_op(op);
+        vtop->type.t |= t1 & VT_FIXED;
+        return;
+    }
+
+    t = fixed_common_type(t1, t2);
+    /* additive operations and comparisons scale plain integers to the
+       fixed-point format; products and bit operations use them as they
+       are. A plain integer divisor divides the value directly. */
+    raw1 = raw2 = (op == '*' || op == '&' || op == '|' || op == '^');
+    if (op == '/')
+        raw2 = 1;
+    vswap();
+    fixed_operand(t, raw1);
+    vswap();
+    fixed_operand(t, raw2);
+    if ((op == '*' && (t1 & VT_FIXED) && (t2 & VT_FIXED)) || (op == '/' && (t2 & VT_FIXED)))
+        gen_fixmuldiv(op, t);
+    else
+        gen_op(op);
+    if (op < TOK_ULT || op > TOK_GT)
+        vtop->type.t = t;
+}
+
+/* near pointers: a pointer to a __near qualified type holds the 16-bit
+   offset of its target in the data bank, and is dereferenced with (dp),y
+   instead of [dp],y. */
+
+/* qualify 'type' __near. The elements of an array are qualified too, as
+   their address comes from the same near pointer. */
+static void near_qualify(CType *type)
+{
+    CType elem;
+
+    if (type->t & VT_ARRAY) {
+        elem = type->ref->type;
+        near_qualify(&elem);
+        type->ref = sym_push(SYM_FIELD, &elem, 0, type->ref->c);
+    }
+    type->t |= VT_NEARDATA;
+}
+
+/* an object is __near if it, or the innermost element of an array, is */
+static int is_near_object(CType *type)
+{
+    while (type->t & VT_ARRAY)
+        type = &type->ref->type;
+    return (type->t & VT_NEARDATA) != 0;
+}
+
+/* cast between near and far pointers: a far pointer becomes near by
+   dropping its bank, a near one becomes far in the data bank. Returns 0
+   if the generic cast code is sufficient. */
+static int near_cast(CType *type)
+{
+    int dnear;
+
+    if ((vtop->type.t & VT_BTYPE) != VT_PTR || (type->t & VT_BTYPE) != VT_PTR)
+        return 0;
+    dnear = is_near_ptr(type);
+    if (is_near_ptr(&vtop->type) == dnear)
+        return 0;
+    if ((vtop->r & (VT_VALMASK | VT_LVAL | VT_SYM)) == VT_CONST) {
+        /* a null pointer stays null */
+        vtop->c.ul &= 0xffff;
+        if (!dnear && vtop->c.ul)
+            vtop->c.ul |= DATA_BANK << 16;
+    } else if (!dnear && (vtop->r & (VT_VALMASK | VT_LVAL | VT_SYM)) != (VT_CONST | VT_SYM)
+               && !nocode_wanted) {
+        /* the address of a symbol is loaded with its bank anyway */
+        gen_cvt_neartofar();
+    }
+    if ((vtop->r & VT_LVAL) && (vtop->type.t & VT_NEARDATA)) {
+        vtop->type = *type;
+        vtop->type.t |= VT_NEARDATA;
+    } else {
+        vtop->type = *type;
+    }
+    return 1;
+}
+#endif
+
 /* generic gen_op: handles types problems */
 void gen_op(int op)
 {
@@ -1586,6 +2101,12 @@ void gen_op(int op)
 
     t1 = vtop[-1].type.t;
     t2 = vtop[0].type.t;
+#ifdef TCC_TARGET_816
+    if ((t1 | t2) & VT_FIXED) {
+        gen_op_fixed(op);
+        return;
+    }
+#endif
     bt1 = t1 & VT_BTYPE;
     bt2 = t2 & VT_BTYPE;
 
@@ -1842,6 +2363,13 @@ static void gen_cast(CType *type)
         gv(RC_INT);
     }
 
+#ifdef TCC_TARGET_816
+    if (((vtop->type.t | type->t) & VT_FIXED) && fixed_cast(type))
+        return;
+    if (near_cast(type))
+        return;
+#endif
+
     dbt = type->t & (VT_BTYPE | VT_UNSIGNED);
     sbt = vtop->type.t & (VT_BTYPE | VT_UNSIGNED);
 
@@ -2045,6 +2573,14 @@ static void gen_cast(CType *type)
            we must update the VT_LVAL_xxx size */
         vtop->r = (vtop->r & ~VT_LVAL_TYPE) | (lvalue_type(type->ref->type.t) & VT_LVAL_TYPE);
     }
+#ifdef TCC_TARGET_816
+    /* an lvalue keeps the addressing of its data */
+    if ((vtop->r & VT_LVAL) && (vtop->type.t & VT_NEARDATA)) {
+        vtop->type = *type;
+        vtop->type.t |= VT_NEARDATA;
+        return;
+    }
+#endif
     vtop->type = *type;
 }
 
@@ -2072,6 +2608,12 @@ static int type_size(CType *type, int *a)
 
             return ts * s->c;
         } else {
+#ifdef TCC_TARGET_816
+            if (is_near_ptr(type)) {
+                *a = 2;
+                return 2;
+            }
+#endif
             *a = PTR_SIZE;
             return PTR_SIZE;
         }
@@ -2240,6 +2782,12 @@ void type_to_str(char *buf, int buf_size, CType *type, const char *varstr)
         pstrcat(buf, buf_size, "volatile ");
     if (t & VT_UNSIGNED)
         pstrcat(buf, buf_size, "unsigned ");
+#ifdef TCC_TARGET_816
+    if (t & VT_FIXED)
+        pstrcat(buf, buf_size, "__fixed ");
+    if (t & VT_NEARDATA)
+        pstrcat(buf, buf_size, "__near ");
+#endif
     switch (bt) {
     case VT_VOID:
         tstr = "void";
@@ -2359,9 +2907,18 @@ static void gen_assign_cast(CType *dt)
             tmp_type2 = *type2;
             tmp_type1.t &= ~(VT_UNSIGNED | VT_CONSTANT | VT_VOLATILE);
             tmp_type2.t &= ~(VT_UNSIGNED | VT_CONSTANT | VT_VOLATILE);
+#ifdef TCC_TARGET_816
+            tmp_type1.t &= ~VT_NEARDATA;
+            tmp_type2.t &= ~VT_NEARDATA;
+#endif
             if (!is_compatible_types(&tmp_type1, &tmp_type2))
                 warning("assignment from incompatible pointer type");
         }
+#ifdef TCC_TARGET_816
+        /* the bank of a far pointer is lost */
+        if (is_near_ptr(dt) && !is_near_ptr(st))
+            warning("assignment to near pointer from far pointer without a cast");
+#endif
         /* check const and volatile */
         if ((!(type1->t & VT_CONSTANT) && (type2->t & VT_CONSTANT))
             || (!(type1->t & VT_VOLATILE) && (type2->t & VT_VOLATILE)))
@@ -2381,6 +2938,10 @@ static void gen_assign_cast(CType *dt)
         tmp_type2 = *st;
         tmp_type1.t &= ~(VT_CONSTANT | VT_VOLATILE);
         tmp_type2.t &= ~(VT_CONSTANT | VT_VOLATILE);
+#ifdef TCC_TARGET_816
+        tmp_type1.t &= ~VT_NEARDATA;
+        tmp_type2.t &= ~VT_NEARDATA;
+#endif
         if (!is_compatible_types(&tmp_type1, &tmp_type2)) {
         error:
             type_to_str(buf1, sizeof(buf1), st, NULL);
@@ -2399,6 +2960,7 @@ void vstore(void)
     int sbt, dbt, ft, r, t, size, align, bit_size, bit_pos, rc, delayed_cast;
 #ifdef TCC_TARGET_816
     static int nocast = 0;
+    int near;
 #endif
 
     ft = vtop[-1].type.t;
@@ -2432,8 +2994,16 @@ void vstore(void)
 
             /* destination */
             vswap();
+#ifdef TCC_TARGET_816
+            near = vtop->type.t & VT_NEARDATA;
+#endif
             vtop->type.t = VT_PTR;
             gaddrof();
+#ifdef TCC_TARGET_816
+            /* memcpy() takes far pointers */
+            if (near)
+                gen_cvt_neartofar();
+#endif
 
             /* address of memcpy() */
 #ifdef TCC_ARM_EABI
@@ -2448,8 +3018,15 @@ void vstore(void)
             vswap();
             /* source */
             vpushv(vtop - 2);
+#ifdef TCC_TARGET_816
+            near = vtop->type.t & VT_NEARDATA;
+#endif
             vtop->type.t = VT_PTR;
             gaddrof();
+#ifdef TCC_TARGET_816
+            if (near)
+                gen_cvt_neartofar();
+#endif
             /* type size */
             vpushi(size);
             gfunc_call(3);
@@ -2471,7 +3048,11 @@ void vstore(void)
         bit_pos = (ft >> VT_STRUCT_SHIFT) & 0x3f;
         bit_size = (ft >> (VT_STRUCT_SHIFT + 6)) & 0x3f;
         /* remove bit field info to avoid loops */
+#ifdef TCC_TARGET_816
+        vtop[-1].type.t = ft & (~(VT_BITFIELD | (-1 << VT_STRUCT_SHIFT)) | VT_NEARDATA);
+#else
         vtop[-1].type.t = ft & ~(VT_BITFIELD | (-1 << VT_STRUCT_SHIFT));
+#endif
 
         if ((ft & VT_BTYPE) == VT_BOOL) {
             gen_cast(&vtop[-1].type);
@@ -2547,11 +3128,17 @@ void vstore(void)
             }
             r = gv(rc); /* generate value */
             /* if lvalue was saved on stack, must read it */
+#ifdef TCC_TARGET_816
+            /* unless it can be used in place in a direct page frame */
+            if ((vtop[-1].r & VT_VALMASK) == VT_LLOCAL && !tcc_state->dp_frame) {
+#else
             if ((vtop[-1].r & VT_VALMASK) == VT_LLOCAL) {
+#endif
                 SValue sv;
                 t = get_reg(RC_INT);
 #if defined(TCC_TARGET_X86_64) || defined(TCC_TARGET_816)
                 sv.type.t = VT_PTR;
+                sv.type.ref = NULL;
 #else
                 sv.type.t = VT_INT;
 #endif
@@ -2615,6 +3202,8 @@ void inc(int post, int c)
    - section(x) : generate data/code in this section.
    - unused : currently ignored, but may be used someday.
    - regparm(n) : pass function parameters in registers (i386 only)
+   - near, zeropage, far : place a global variable in bank $00 low RAM,
+     the direct page or any bank (65816 only)
  */
 static void parse_attribute(AttributeDef *ad)
 {
@@ -2694,6 +3283,36 @@ static void parse_attribute(AttributeDef *ad)
             case TOK_FASTCALL3:
                 ad->func_call = FUNC_FASTCALLW;
                 break;
+#endif
+#ifdef TCC_TARGET_816
+            /* the 65816 has a single register to spare: regparm(n) and
+               fastcall both pass the first argument in A */
+            case TOK_REGPARM1:
+            case TOK_REGPARM2:
+                skip('(');
+                n = expr_const();
+                if (n > 0)
+                    ad->func_call = FUNC_FASTCALL1;
+                skip(')');
+                break;
+            case TOK_FASTCALL1:
+            case TOK_FASTCALL2:
+            case TOK_FASTCALL3:
+                ad->func_call = FUNC_FASTCALL1;
+                break;
+            /* where a global variable lives, and so how it is addressed */
+            case TOK_NEAR1:
+            case TOK_NEAR2:
+                ad->placement = VT_NEAR >> VT_PLACEMENT_SHIFT;
+                break;
+            case TOK_ZEROPAGE1:
+            case TOK_ZEROPAGE2:
+                ad->placement = VT_ZEROPAGE >> VT_PLACEMENT_SHIFT;
+                break;
+            case TOK_FAR1:
+            case TOK_FAR2:
+                ad->placement = VT_FAR >> VT_PLACEMENT_SHIFT;
+                break;
 #endif
             case TOK_MODE:
                 skip('(');
@@ -3072,6 +3691,17 @@ static int parse_btype(CType *type, AttributeDef *ad)
             next();
             typespec_found = 1;
             break;
+#ifdef TCC_TARGET_816
+        case TOK_FIXED:
+            t |= VT_FIXED;
+            next();
+            typespec_found = 1;
+            break;
+        case TOK_NEAR3:
+            t |= VT_NEARDATA;
+            next();
+            break;
+#endif
 
             /* storage */
         case TOK_EXTERN:
@@ -3149,6 +3779,11 @@ the_end:
         t = (t & ~VT_BTYPE) | VT_INT;
 #else
         t = (t & ~VT_BTYPE) | VT_LLONG;
+#endif
+#ifdef TCC_TARGET_816
+    /* __fixed is 8.8 on top of int and 16.16 on top of long long */
+    if ((t & VT_FIXED) && (t & VT_BTYPE) != VT_INT && (t & VT_BTYPE) != VT_LLONG)
+        error("__fixed requires an int or long long base type");
 #endif
     type->t = t;
     return type_found;
@@ -3311,6 +3946,11 @@ static void type_decl(CType *type, AttributeDef *ad, int *v, int td)
         case TOK_RESTRICT2:
         case TOK_RESTRICT3:
             goto redo;
+#ifdef TCC_TARGET_816
+        case TOK_NEAR3:
+            qualifiers |= VT_NEARDATA;
+            goto redo;
+#endif
         }
         mk_pointer(type);
         type->t |= qualifiers;
@@ -3385,8 +4025,15 @@ static void indir(void)
             return;
         expect("pointer");
     }
-    if ((vtop->r & VT_LVAL) && !nocode_wanted)
-        gv(RC_INT);
+    if ((vtop->r & VT_LVAL) && !nocode_wanted) {
+#ifdef TCC_TARGET_816
+        /* a pointer in a direct page frame is dereferenced where it is */
+        if (tcc_state->dp_frame && vtop->r == (VT_LOCAL | VT_LVAL))
+            vtop->r = VT_LLOCAL;
+        else
+#endif
+            gv(RC_INT);
+    }
     vtop->type = *pointed_type(&vtop->type);
     /* Arrays and functions are never lvalues */
     if (!(vtop->type.t & VT_ARRAY) && (vtop->type.t & VT_BTYPE) != VT_FUNC) {
@@ -3458,7 +4105,303 @@ static void vpush_tokc(int t)
     vsetc(&type, VT_CONST, &tokc);
 }
 
-static void unary(void)
+/* small static inline functions can be expanded at their call sites
+   instead of being called: the recorded token string of the body is
+   replayed with the parameters bound to the argument values */
+
+/* return the number of tokens of an inline function body, or -1 if
+   the body uses something that cannot be replayed inside another
+   function (labels, static locals, asm, function name) */
+static int inline_body_size(const int *str)
+{
+    int t, prev, prev2, n, nb_cond, in_case;
+    CValue cval;
+
+    n = 0;
+    prev = prev2 = 0;
+    nb_cond = 0; /* '?' waiting for their ':' */
+    in_case = 0; /* in a case expression, waiting for its ':' */
+    for (;;) {
+        TOK_GET(t, str, cval);
+        if (t == TOK_EOF || t == 0)
+            break;
+        if (t == TOK_LINENUM)
+            continue;
+        switch (t) {
+        case TOK_GOTO:
+        case TOK_LABEL:
+        case TOK_STATIC:
+        case TOK_ASM1:
+        case TOK_ASM2:
+        case TOK_ASM3:
+        case TOK___FUNCTION__:
+        case TOK___FUNC__:
+            return -1;
+        case '?':
+            nb_cond++;
+            break;
+        case TOK_CASE:
+            in_case = 1;
+            break;
+        case ':':
+            if (nb_cond) {
+                nb_cond--;
+            } else if (in_case) {
+                in_case = 0;
+            } else if (prev >= TOK_UIDENT
+                       && (prev2 == 0 || prev2 == '{' || prev2 == '}' || prev2 == ';'
+                           || prev2 == ':' || prev2 == ')' || prev2 == TOK_ELSE
+                           || prev2 == TOK_DO)) {
+                /* a label definition would clash with the caller's labels */
+                return -1;
+            }
+            break;
+        }
+        prev2 = prev;
+        prev = t;
+        n++;
+    }
+    return n;
+}
+
+/* return true if parameter 'v' may be modified or have its address
+   taken by the body 'str' */
+static int inline_param_written(const int *str, int v)
+{
+    int t, prev, next_t;
+    CValue cval;
+
+    prev = 0;
+    for (;;) {
+        TOK_GET(t, str, cval);
+        if (t == TOK_EOF || t == 0)
+            break;
+        if (t == TOK_LINENUM)
+            continue;
+        if (t == v) {
+            if (prev == '&' || prev == TOK_INC || prev == TOK_DEC)
+                return 1;
+            do {
+                TOK_GET(next_t, str, cval);
+            } while (next_t == TOK_LINENUM);
+            switch (next_t) {
+            case '=':
+            case TOK_INC:
+            case TOK_DEC:
+            case TOK_A_MOD:
+            case TOK_A_AND:
+            case TOK_A_MUL:
+            case TOK_A_ADD:
+            case TOK_A_SUB:
+            case TOK_A_DIV:
+            case TOK_A_XOR:
+            case TOK_A_OR:
+            case TOK_A_SHL:
+            case TOK_A_SAR:
+                return 1;
+            }
+            if (next_t == TOK_EOF || next_t == 0)
+                break;
+            t = next_t;
+        }
+        prev = t;
+    }
+    return 0;
+}
+
+/* return true if the body 'str' of function 'func' references an
+   identifier that is currently declared in the caller's scope and
+   would therefore not resolve to the same symbol once replayed */
+static int inline_captures_local(const int *str, TokenSym *func)
+{
+    int t;
+    CValue cval;
+    TokenSym *s, *p;
+
+    for (;;) {
+        TOK_GET(t, str, cval);
+        if (t == TOK_EOF || t == 0)
+            break;
+        if (t < TOK_UIDENT)
+            continue;
+        for (p = func->next; p; p = p->next) {
+            if ((p->v & ~SYM_FIELD) == t)
+                break;
+        }
+        if (p)
+            continue;
+        for (s = local_stack; s; s = s->prev) {
+            if ((s->v & ~SYM_STRUCT) == t)
+                return 1;
+        }
+    }
+    return 0;
+}
+
+/* return the recorded inline function that a call to 'sym' can be
+   expanded to, or NULL if a real call must be generated */
+static InlineFunc *inline_find(TokenSym *sym)
+{
+    InlineFunc *fn;
+    TokenSym *s, *p;
+    int i;
+
+    if (tcc_state->inline_limit <= 0 || nocode_wanted)
+        return NULL;
+    if ((sym->type.t & (VT_STATIC | VT_INLINE | VT_BTYPE)) != (VT_STATIC | VT_INLINE | VT_FUNC))
+        return NULL;
+    fn = NULL;
+    for (i = 0; i < tcc_state->nb_inline_fns; ++i) {
+        if (tcc_state->inline_fns[i]->sym == sym) {
+            fn = tcc_state->inline_fns[i];
+            break;
+        }
+    }
+    if (!fn || fn->expanding || fn->nb_toks < 0 || fn->nb_toks > tcc_state->inline_limit)
+        return NULL;
+    s = sym->type.ref;
+    if (s->c == FUNC_OLD || s->c == FUNC_ELLIPSIS || (s->type.t & VT_BTYPE) == VT_STRUCT)
+        return NULL;
+    for (p = s->next; p; p = p->next) {
+        if ((p->type.t & VT_BTYPE) == VT_STRUCT)
+            return NULL;
+    }
+    if (inline_captures_local(fn->token_str, s))
+        return NULL;
+    return fn;
+}
+
+/* expand the inline function 'fn' whose arguments are on the value
+   stack above the function value 'nb_args' entries down, and leave the
+   return value on the value stack as gfunc_call() would */
+static void inline_expand(InlineFunc *fn, int nb_args, SValue *ret)
+{
+    TokenSym *s, *p, *scope;
+    SValue *arg;
+    CType type;
+    ParseState saved_parse_state;
+    CType saved_func_vt;
+    int saved_rsym, size, align, addr;
+
+    s = vtop[-nb_args].type.ref;
+    scope = local_stack;
+    /* bind the parameters, first one first so that they get pushed in
+       declaration order */
+    for (p = s->next, arg = vtop - nb_args + 1; p; p = p->next, arg++) {
+        type = p->type;
+        if ((arg->r & (VT_VALMASK | VT_LVAL | VT_SYM)) == VT_CONST
+            && (type.t & VT_BTYPE) != VT_LLONG && !is_float(type.t)
+            && !inline_param_written(fn->token_str, p->v & ~SYM_FIELD)) {
+            /* read-only parameter with a constant argument: substitute
+               the constant itself */
+            sym_push(p->v & ~SYM_FIELD, &type, VT_CONST, arg->c.i);
+        } else {
+            size = type_size(&type, &align);
+            loc = (loc - size) & -align;
+            addr = loc;
+            sym_push(p->v & ~SYM_FIELD, &type, VT_LOCAL | VT_LVAL, addr);
+            type.t &= ~VT_CONSTANT;
+            vpushv(arg);
+            vset(&type, VT_LOCAL | VT_LVAL, addr);
+            vswap();
+            vstore();
+            vpop();
+        }
+    }
+    /* drop the arguments and the function value */
+    for (; nb_args >= 0; nb_args--)
+        vpop();
+    save_regs(0);
+
+    save_parse_state(&saved_parse_state);
+    saved_func_vt = func_vt;
+    saved_rsym = rsym;
+    func_vt = s->type;
+    rsym = 0;
+    fn->expanding = 1;
+    inline_level++;
+
+    macro_ptr = fn->token_str;
+    next();
+    block(NULL, NULL, NULL, NULL, 0, 0);
+    gsym(rsym);
+
+    inline_level--;
+    fn->expanding = 0;
+    rsym = saved_rsym;
+    func_vt = saved_func_vt;
+    restore_parse_state(&saved_parse_state);
+    sym_pop(&local_stack, scope);
+
+    vsetc(&ret->type, ret->r, &ret->c);
+    vtop->r2 = ret->r2;
+}
+
+#ifdef TCC_TARGET_816
+/* in a counted loop generated with -floop-opt (see loop_block()), the
+   element addresses of the arrays the body indexes with the counter are
+   kept in pointers that are stepped along with it */
+
+#define LOOP_MAX_PTRS 4
+
+typedef struct LoopPtr {
+    SValue base; /* the array or pointer, as unary() pushes it */
+    CType type;  /* pointer to its elements */
+    int addr;    /* frame offset of the pointer */
+    int size;    /* element size */
+} LoopPtr;
+
+typedef struct Loop {
+    struct Loop *prev; /* enclosing loop */
+    const int *body;   /* recorded body */
+    TokenSym *ctr;     /* counter the arrays are indexed with, or NULL */
+    int hits;          /* "a[counter]" replaced by the pointer of 'a' */
+    int nb_ptrs;
+    LoopPtr ptrs[LOOP_MAX_PTRS];
+} Loop;
+
+static Loop *cur_loop;  /* innermost loop whose body is being generated */
+static int *loop_addrs; /* frame offsets of the locals whose address was taken */
+static int nb_loop_addrs;
+
+/* remember that the address of the local on the value stack is taken */
+static void loop_note_addr(void)
+{
+    if ((vtop->r & (VT_VALMASK | VT_LVAL)) != (VT_LOCAL | VT_LVAL))
+        return;
+    loop_addrs = tcc_realloc(loop_addrs, (nb_loop_addrs + 1) * sizeof(int));
+    loop_addrs[nb_loop_addrs++] = vtop->c.i;
+}
+
+/* 'vtop[-1][vtop[0]]' with the counter of an enclosing loop as the index:
+   if the array is one whose element address is kept in a pointer, replace
+   both with the pointer, for indir() to dereference */
+static int loop_index(void)
+{
+    Loop *lp;
+    LoopPtr *p;
+
+    for (lp = cur_loop; lp; lp = lp->prev) {
+        if (!lp->ctr || (vtop->r & (VT_VALMASK | VT_LVAL)) != (VT_LOCAL | VT_LVAL)
+            || vtop->c.i != lp->ctr->c || (vtop->type.t & VT_BTYPE) != (lp->ctr->type.t & VT_BTYPE))
+            continue;
+        for (p = lp->ptrs; p < lp->ptrs + lp->nb_ptrs; p++) {
+            if (vtop[-1].r == p->base.r && vtop[-1].c.i == p->base.c.i
+                && (!(p->base.r & VT_SYM) || vtop[-1].sym == p->base.sym)
+                && is_compatible_types(&vtop[-1].type, &p->base.type)) {
+                vpop();
+                vpop();
+                vset(&p->type, VT_LOCAL | VT_LVAL, p->addr);
+                lp->hits++;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+#endif
+
+static void unary(void)
 {
     int n, t, align, size, r;
     CType type;
@@ -3599,6 +4542,10 @@ tok_next:
             && !(vtop->type.t & VT_LLOCAL))
             test_lvalue();
         mk_pointer(&vtop->type);
+#ifdef TCC_TARGET_816
+        if (tcc_state->loop_opt)
+            loop_note_addr();
+#endif
         gaddrof();
         break;
     case '!':
@@ -3781,7 +4728,7 @@ tok_next:
                effect to generate code for it at the end of the
                compilation unit. Inline function as always
                generated in the text section. */
-            if (!s->c)
+            if (!s->c && (tok != '(' || !inline_find(s)))
                 put_extern_sym(s, text_section, 0, 0);
             r = VT_SYM | VT_CONST;
         } else {
@@ -3807,6 +4754,9 @@ tok_next:
             if (tok == TOK_ARROW)
                 indir();
             qualifiers = vtop->type.t & (VT_CONSTANT | VT_VOLATILE);
+#ifdef TCC_TARGET_816
+            qualifiers |= vtop->type.t & VT_NEARDATA;
+#endif
             test_lvalue();
             gaddrof();
             next();
@@ -3824,11 +4774,27 @@ tok_next:
                 error("field not found: %s", get_tok_str(tok & ~SYM_FIELD, NULL));
             /* add field offset to pointer */
             vtop->type = char_pointer_type; /* change type to 'char *' */
+#ifdef TCC_TARGET_816
+            /* a near pointer still in its frame slot is only two bytes */
+            if (tcc_state->dp_frame && vtop->r == (VT_LOCAL | VT_LVAL)
+                && (qualifiers & VT_NEARDATA)) {
+                vtop->type.t = VT_BYTE | VT_NEARDATA;
+                mk_pointer(&vtop->type);
+            }
+#endif
             vpushi(s->c);
             gen_op('+');
             /* change type to field type, and set to lvalue */
             vtop->type = s->type;
             vtop->type.t |= qualifiers;
+#ifdef TCC_TARGET_816
+            /* the first field of a struct behind a pointer in a direct
+               page frame: the pointer is still where gaddrof() left it */
+            if (tcc_state->dp_frame && vtop->r == (VT_LOCAL | VT_LVAL))
+                vtop->r = VT_LLOCAL;
+            if ((qualifiers & VT_NEARDATA) && (vtop->type.t & VT_ARRAY))
+                near_qualify(&vtop->type);
+#endif
             /* an array is never an lvalue */
             if (!(vtop->type.t & VT_ARRAY)) {
                 vtop->r |= lvalue_type(vtop->type.t);
@@ -3842,12 +4808,16 @@ tok_next:
         } else if (tok == '[') {
             next();
             gexpr();
-            gen_op('+');
+#ifdef TCC_TARGET_816
+            if (!loop_index())
+#endif
+                gen_op('+');
             indir();
             skip(']');
         } else if (tok == '(') {
             SValue ret;
             TokenSym *sa;
+            InlineFunc *fn;
             int nb_args;
 
             /* function call  */
@@ -3864,6 +4834,14 @@ tok_next:
             } else {
                 vtop->r &= ~VT_LVAL; /* no lvalue */
             }
+            fn = NULL;
+            if (vtop->r & VT_SYM) {
+                fn = inline_find(vtop->sym);
+                /* not expanded: the out of line copy is needed */
+                if (!fn && !vtop->sym->c
+                    && (vtop->sym->type.t & (VT_STATIC | VT_INLINE | VT_BTYPE)) == (VT_STATIC | VT_INLINE | VT_FUNC))
+                    put_extern_sym(vtop->sym, text_section, 0, 0);
+            }
             /* get return type */
             s = vtop->type.ref;
             next();
@@ -3913,14 +4891,19 @@ tok_next:
             if (sa)
                 error("too few arguments to function");
             skip(')');
-            if (!nocode_wanted) {
-                gfunc_call(nb_args);
+            if (fn) {
+                /* expand the body, it leaves the return value */
+                inline_expand(fn, nb_args, &ret);
             } else {
-                vtop -= (nb_args + 1);
+                if (!nocode_wanted) {
+                    gfunc_call(nb_args);
+                } else {
+                    vtop -= (nb_args + 1);
+                }
+                /* return value */
+                vsetc(&ret.type, ret.r, &ret.c);
+                vtop->r2 = ret.r2;
             }
-            /* return value */
-            vsetc(&ret.type, ret.r, &ret.c);
-            vtop->r2 = ret.r2;
         } else {
             break;
         }
@@ -4198,6 +5181,11 @@ static void expr_cond(void)
                     type.t |= VT_UNSIGNED;
             }
 
+#ifdef TCC_TARGET_816
+            if (((t1 | t2) & VT_FIXED)
+                && ((type.t & VT_BTYPE) == VT_INT || (type.t & VT_BTYPE) == VT_LLONG))
+                type.t = fixed_common_type(t1, t2);
+#endif
             /* now we convert second operand */
             gen_cast(&type);
             if (VT_STRUCT == (vtop->type.t & VT_BTYPE))
@@ -4354,6 +5342,690 @@ static void label_or_decl(int l)
     decl(l);
 }
 
+#ifdef TCC_TARGET_816
+/* -floop-opt: the header and body of a loop statement are recorded as
+   token strings, then replayed with the test at the bottom, so that each
+   iteration ends with a single branch back to the body. The recorded
+   tokens also show whether the loop is a counted one: "for (i = a; i < b;
+   i++)", "while (n--)" or "do ... while (--n)", with a 16-bit local counter
+   that the body does not change and whose address is not taken. The step
+   and test of such a loop are a short sequence on the counter in place
+   (gen_loop_step(), gen_loop_count()); the arrays the body indexes with the
+   counter are reached through pointers stepped along with it; and the loop
+   runs with its count in X if the body leaves X alone and has no other use
+   for the counter. */
+
+/* what the recorded body of a loop contains */
+#define LOOP_EXIT 1  /* a break out of the loop, or a goto */
+#define LOOP_ENTRY 2 /* a label, a case of an enclosing switch, or asm */
+#define LOOP_CALL 4  /* a call or an inner loop, which likely use X */
+
+#define LOOP_MAX_TOKS 6
+
+/* append the tokens up to the 'end' that closes the current expression
+   to 'str'; 'inner' is set within a loop or a switch of the body */
+static void loop_record_until(TokenString *str, int end, int inner, int *flags, int prev)
+{
+    int level = 0;
+
+    while (level || tok != end) {
+        switch (tok) {
+        case TOK_EOF:
+            skip(end);
+            break;
+        case '(':
+            if (prev >= TOK_UIDENT || prev == ')')
+                *flags |= LOOP_CALL;
+            level++;
+            break;
+        case '[':
+        case '{':
+            level++;
+            break;
+        case ')':
+        case ']':
+        case '}':
+            if (!level)
+                skip(end);
+            level--;
+            break;
+        case TOK_BREAK:
+            if (!inner)
+                *flags |= LOOP_EXIT;
+            break;
+        case TOK_GOTO:
+            *flags |= LOOP_EXIT;
+            break;
+        case TOK_CASE:
+        case TOK_DEFAULT:
+        case TOK_LABEL:
+        case TOK_ASM1:
+        case TOK_ASM2:
+        case TOK_ASM3:
+            *flags |= LOOP_ENTRY;
+            break;
+        case TOK_FOR:
+        case TOK_WHILE:
+        case TOK_DO:
+            *flags |= LOOP_CALL;
+            break;
+        }
+        prev = tok;
+        tok_str_add_tok(str);
+        next();
+    }
+}
+
+/* append the token 'end' to 'str' and skip it */
+static void loop_record_tok(TokenString *str, int end)
+{
+    if (tok != end)
+        skip(end);
+    tok_str_add_tok(str);
+    next();
+}
+
+/* append the parenthesized expression at the current token to 'str' */
+static void loop_record_paren(TokenString *str, int inner, int *flags)
+{
+    loop_record_tok(str, '(');
+    loop_record_until(str, ')', inner, flags, '(');
+    loop_record_tok(str, ')');
+}
+
+/* append the statement at the current token to 'str' */
+static void loop_record_stmt(TokenString *str, int inner, int *flags)
+{
+    int t = tok;
+
+    switch (t) {
+    case '{':
+        loop_record_tok(str, '{');
+        while (tok != '}' && tok != TOK_EOF)
+            loop_record_stmt(str, inner, flags);
+        loop_record_tok(str, '}');
+        break;
+    case TOK_FOR:
+    case TOK_WHILE:
+    case TOK_SWITCH:
+        if (t != TOK_SWITCH)
+            *flags |= LOOP_CALL;
+        /* fall through */
+    case TOK_IF:
+        loop_record_tok(str, t);
+        loop_record_paren(str, inner, flags);
+        loop_record_stmt(str, inner || t != TOK_IF, flags);
+        if (t == TOK_IF && tok == TOK_ELSE) {
+            loop_record_tok(str, TOK_ELSE);
+            loop_record_stmt(str, inner, flags);
+        }
+        break;
+    case TOK_DO:
+        *flags |= LOOP_CALL;
+        loop_record_tok(str, TOK_DO);
+        loop_record_stmt(str, 1, flags);
+        loop_record_tok(str, TOK_WHILE);
+        loop_record_paren(str, inner, flags);
+        loop_record_tok(str, ';');
+        break;
+    case TOK_CASE:
+    case TOK_DEFAULT:
+        if (!inner)
+            *flags |= LOOP_ENTRY;
+        loop_record_tok(str, t);
+        loop_record_until(str, ':', inner, flags, t);
+        loop_record_tok(str, ':');
+        loop_record_stmt(str, inner, flags);
+        break;
+    default:
+        if (t >= TOK_UIDENT) {
+            loop_record_tok(str, t);
+            if (tok == ':') {
+                /* a label */
+                *flags |= LOOP_ENTRY;
+                loop_record_tok(str, ':');
+                loop_record_stmt(str, inner, flags);
+                break;
+            }
+        }
+        loop_record_until(str, ';', inner, flags, t);
+        loop_record_tok(str, ';');
+        break;
+    }
+}
+
+/* record the expression up to 'end' (';' or ')') and skip 'end' */
+static int *loop_record_expr(int end)
+{
+    TokenString str;
+    int flags = 0;
+
+    tok_str_new(&str);
+    loop_record_until(&str, end, 0, &flags, 0);
+    skip(end);
+    tok_str_add(&str, -1);
+    tok_str_add(&str, 0);
+    return str.str;
+}
+
+/* record the body of a loop; '*flags' receives what it contains */
+static int *loop_record_body(int *flags)
+{
+    TokenString str;
+
+    tok_str_new(&str);
+    *flags = 0;
+    loop_record_stmt(&str, 0, flags);
+    tok_str_add(&str, -1);
+    tok_str_add(&str, 0);
+    return str.str;
+}
+
+/* generate the recorded expression 'str', that ended with 'end', and
+   leave its value on the value stack */
+static void loop_expr(const int *str, int end)
+{
+    ParseState saved_parse_state;
+
+    save_parse_state(&saved_parse_state);
+    macro_ptr = (int *) str;
+    next();
+    gexpr();
+    if (tok != TOK_EOF)
+        skip(end);
+    restore_parse_state(&saved_parse_state);
+}
+
+/* generate the recorded body 'lp->body' of a loop */
+static void loop_body(Loop *lp, int *bsym, int *csym, int *case_sym, int *def_sym, int case_reg)
+{
+    ParseState saved_parse_state;
+
+    save_parse_state(&saved_parse_state);
+    macro_ptr = (int *) lp->body;
+    lp->prev = cur_loop;
+    cur_loop = lp;
+    next();
+    block(bsym, csym, case_sym, def_sym, case_reg, 0);
+    cur_loop = lp->prev;
+    restore_parse_state(&saved_parse_state);
+}
+
+/* copy the tokens of the short recorded string 'str' to 'toks', and the
+   value of its integer constants to 'vals'; return their number, or -1
+   if there are more than LOOP_MAX_TOKS */
+static int loop_tokens(const int *str, int *toks, int *vals)
+{
+    int t, n;
+    CValue cval;
+
+    for (n = 0;;) {
+        TOK_GET(t, str, cval);
+        if (t == TOK_EOF || t == 0)
+            return n;
+        if (t == TOK_LINENUM)
+            continue;
+        if (n == LOOP_MAX_TOKS)
+            return -1;
+        toks[n] = t;
+        vals[n++] = cval.i;
+    }
+}
+
+/* return the number of times 'str' names 'v', not counting member names */
+static int loop_uses(const int *str, int v)
+{
+    int t, prev, n;
+    CValue cval;
+
+    for (n = prev = 0;;) {
+        TOK_GET(t, str, cval);
+        if (t == TOK_EOF || t == 0)
+            return n;
+        if (t == TOK_LINENUM)
+            continue;
+        if (t == v && prev != '.' && prev != TOK_ARROW)
+            n++;
+        prev = t;
+    }
+}
+
+/* return true if 'str' may take the address of 'v' */
+static int loop_addr_taken(const int *str, int v)
+{
+    int t, prev;
+    CValue cval;
+
+    for (prev = 0;;) {
+        TOK_GET(t, str, cval);
+        if (t == TOK_EOF || t == 0)
+            return 0;
+        if (t == TOK_LINENUM)
+            continue;
+        if (t == v && prev == '&')
+            return 1;
+        prev = t;
+    }
+}
+
+/* return true if 's' is a local that the loop 'lp' may use as its counter
+   or step a pointer of: not volatile, its address never taken, and not
+   changed by the body */
+static int loop_local(TokenSym *s, Loop *lp)
+{
+    Loop *outer;
+    int i;
+
+    if ((s->r & (VT_VALMASK | VT_LVAL)) != (VT_LOCAL | VT_LVAL)
+        || (s->type.t & (VT_VOLATILE | VT_CONSTANT | VT_ARRAY)))
+        return 0;
+    for (i = 0; i < nb_loop_addrs; i++) {
+        if (loop_addrs[i] == s->c)
+            return 0;
+    }
+    /* the address may also be taken further down an enclosing loop */
+    for (outer = cur_loop; outer; outer = outer->prev) {
+        if (loop_addr_taken(outer->body, s->v))
+            return 0;
+    }
+    return !inline_param_written(lp->body, s->v);
+}
+
+/* return the 16-bit integer variable or constant named 'v', or NULL */
+static TokenSym *loop_int(int v)
+{
+    TokenSym *s;
+    int bt;
+
+    if (v < TOK_UIDENT || !(s = sym_find(v)))
+        return NULL;
+    bt = s->type.t & VT_BTYPE;
+    if ((bt != VT_INT && bt != VT_SHORT) || (s->type.t & (VT_FIXED | VT_ARRAY)))
+        return NULL;
+    return s;
+}
+
+/* the bound of a counted loop, from the 'n' tokens 'toks': a constant
+   (0 if there are no tokens), or a 16-bit variable other than the counter;
+   return 0 if it is neither */
+static int loop_bound(SValue *sv, int *toks, int *vals, int n, TokenSym *ctr)
+{
+    TokenSym *s;
+    int c;
+
+    memset(sv, 0, sizeof(*sv));
+    sv->type.t = VT_INT;
+    sv->r = VT_CONST;
+    if (n == 0)
+        return 1;
+    if ((n == 1 && toks[0] == TOK_CINT) || (n == 2 && toks[0] == '-' && toks[1] == TOK_CINT)) {
+        c = n == 1 ? vals[0] : -vals[1];
+        sv->c.i = c;
+        return c >= -32768 && c <= 32767;
+    }
+    if (n == 1 && toks[0] == TOK_CUINT) {
+        sv->type.t |= VT_UNSIGNED;
+        sv->c.i = vals[0];
+        return (unsigned) vals[0] <= 65535;
+    }
+    if (n != 1 || !(s = loop_int(toks[0])) || s == ctr || (s->type.t & VT_VOLATILE))
+        return 0;
+    sv->type = s->type;
+    sv->r = s->r;
+    if ((s->r & (VT_VALMASK | VT_LVAL | VT_SYM)) == VT_CONST) {
+        /* an enumeration constant */
+        sv->c.i = s->c;
+        return 1;
+    }
+    if ((s->r & (VT_VALMASK | VT_LVAL | VT_SYM)) == (VT_CONST | VT_LVAL | VT_SYM)) {
+        sv->sym = s;
+        return 1;
+    }
+    sv->c.i = s->c;
+    return (s->r & (VT_VALMASK | VT_LVAL)) == (VT_LOCAL | VT_LVAL);
+}
+
+/* the step of a counted loop: "v++", "++v", "v--", "--v", "v += 1" or
+   "v -= 1"; return 1 or -1 and set '*v', or return 0 */
+static int loop_step(int *toks, int *vals, int n, int *v)
+{
+    if (n == 2 && (toks[0] == TOK_INC || toks[0] == TOK_DEC)) {
+        *v = toks[1];
+        return toks[0] == TOK_INC ? 1 : -1;
+    }
+    if (n == 2 && (toks[1] == TOK_INC || toks[1] == TOK_DEC)) {
+        *v = toks[0];
+        return toks[1] == TOK_INC ? 1 : -1;
+    }
+    if (n == 3 && (toks[1] == TOK_A_ADD || toks[1] == TOK_A_SUB) && toks[2] == TOK_CINT && vals[2] == 1) {
+        *v = toks[0];
+        return toks[1] == TOK_A_ADD ? 1 : -1;
+    }
+    return 0;
+}
+
+/* keep the element address of the array or pointer 'v', that the body of
+   the counted loop 'lp' indexes with its counter, in a pointer */
+static void loop_add_ptr(Loop *lp, int v)
+{
+    TokenSym *s;
+    LoopPtr *p;
+    int size, align;
+
+    if (lp->nb_ptrs == LOOP_MAX_PTRS || !(s = sym_find(v)))
+        return;
+    for (p = lp->ptrs; p < lp->ptrs + lp->nb_ptrs; p++) {
+        if (p->base.r == s->r && (s->r & VT_SYM ? p->base.sym == s : p->base.c.i == s->c))
+            return;
+    }
+    if (s->type.t & VT_ARRAY) {
+        if ((s->r & VT_VALMASK) != VT_LOCAL && (s->r & (VT_VALMASK | VT_SYM)) != (VT_CONST | VT_SYM))
+            return;
+    } else if ((s->type.t & VT_BTYPE) != VT_PTR || !loop_local(s, lp)) {
+        return;
+    }
+    if ((pointed_type(&s->type)->t & VT_BTYPE) == VT_VOID || (size = pointed_size(&s->type)) <= 0)
+        return;
+
+    p = &lp->ptrs[lp->nb_ptrs++];
+    memset(&p->base, 0, sizeof(p->base));
+    p->base.type = s->type;
+    p->base.r = s->r;
+    if (s->r & VT_SYM)
+        p->base.sym = s;
+    else
+        p->base.c.i = s->c;
+    p->type = *pointed_type(&s->type);
+    mk_pointer(&p->type);
+    p->size = size;
+    size = type_size(&p->type, &align);
+    loc = (loc - size) & -align;
+    p->addr = loc;
+}
+
+/* find the arrays the body of 'lp' indexes with 'v' ("a[v]") */
+static void loop_find_ptrs(Loop *lp, int v)
+{
+    const int *str = lp->body;
+    int t, w[4];
+    CValue cval;
+
+    w[0] = w[1] = w[2] = w[3] = 0;
+    for (;;) {
+        TOK_GET(t, str, cval);
+        if (t == TOK_EOF || t == 0)
+            break;
+        if (t == TOK_LINENUM)
+            continue;
+        if (t == ']' && w[3] == v && w[2] == '[' && w[1] >= TOK_UIDENT && w[0] != '.' && w[0] != TOK_ARROW)
+            loop_add_ptr(lp, w[1]);
+        w[0] = w[1];
+        w[1] = w[2];
+        w[2] = w[3];
+        w[3] = t;
+    }
+}
+
+/* push the value of the local or global 's' */
+static void loop_push_sym(TokenSym *s)
+{
+    vset(&s->type, s->r, s->c);
+    if (s->r & VT_SYM) {
+        vtop->sym = s;
+        vtop->c.ul = 0;
+    }
+}
+
+/* store the constant 'c' into the counter 's' */
+static void loop_set(TokenSym *s, int c)
+{
+    loop_push_sym(s);
+    vpushi(c);
+    vstore();
+    vpop();
+}
+
+/* return whether "a op b" holds, with 'a' and 'b' already sign or zero
+   extended as 'op' compares them */
+static int loop_holds(int a, int op, int b)
+{
+    switch (op) {
+    case TOK_LT:
+    case TOK_ULT:
+        return a < b;
+    case TOK_GE:
+    case TOK_UGE:
+        return a >= b;
+    default:
+        return a != b;
+    }
+}
+
+/* the "for" statement with -floop-opt */
+static void loop_for(int *case_sym, int *def_sym, int case_reg)
+{
+    int *init, *cond, *step;
+    int ti[LOOP_MAX_TOKS], vi[LOOP_MAX_TOKS], tc[LOOP_MAX_TOKS], vc[LOOP_MAX_TOKS];
+    int ts[LOOP_MAX_TOKS], vs[LOOP_MAX_TOKS];
+    int ni, nc, ns, flags, a, b, e, head, v, st, op, uns, cst, has_a, enters, va, vb, count, in_x;
+    TokenSym *ctr;
+    SValue csv, bound, sv;
+    LoopPtr *p;
+    Loop lp;
+
+    next();
+    skip('(');
+    init = loop_record_expr(';');
+    cond = loop_record_expr(';');
+    step = loop_record_expr(')');
+    memset(&lp, 0, sizeof(lp));
+    lp.body = loop_record_body(&flags);
+    ni = loop_tokens(init, ti, vi);
+    nc = loop_tokens(cond, tc, vc);
+    ns = loop_tokens(step, ts, vs);
+
+    /* a counted loop: "i op bound" (or just "i") and a step of one */
+    ctr = NULL;
+    op = TOK_NE;
+    st = loop_step(ts, vs, ns, &v);
+    if (st && nc >= 1 && tc[0] == v && (ctr = loop_int(v)) && loop_local(ctr, &lp) && !loop_addr_taken(init, v)) {
+        if (nc == 1)
+            loop_bound(&bound, tc, vc, 0, ctr);
+        else if ((op = tc[1]) < TOK_LT || op > TOK_GT || !loop_bound(&bound, tc + 2, vc + 2, nc - 2, ctr))
+            ctr = NULL;
+        /* the counter must move towards the bound */
+        if (op != TOK_NE && (st > 0) != (op == TOK_LT || op == TOK_LE))
+            ctr = NULL;
+    } else {
+        ctr = NULL;
+    }
+
+    has_a = enters = count = 0;
+    va = vb = 0;
+    if (ctr) {
+        uns = (ctr->type.t & VT_UNSIGNED) || (bound.type.t & VT_UNSIGNED);
+        cst = (bound.r & (VT_VALMASK | VT_LVAL | VT_SYM)) == VT_CONST;
+        if (cst) {
+            vb = uns ? bound.c.i & 0xffff : (short) bound.c.i;
+            if (op == TOK_LE || op == TOK_GT) {
+                /* "i <= b" is "i < b + 1", and "i > b" is "i >= b + 1" */
+                if (vb == (uns ? 0xffff : 0x7fff))
+                    ctr = NULL;
+                op = op == TOK_LE ? TOK_LT : TOK_GE;
+                bound.c.i = ++vb;
+            }
+            has_a = ((ni == 3 && ti[2] == TOK_CINT) || (ni == 4 && ti[2] == '-' && ti[3] == TOK_CINT))
+                    && ti[0] == v && ti[1] == '=';
+            if (has_a) {
+                va = ni == 3 ? vi[2] : -vi[3];
+                va = uns ? va & 0xffff : (short) va;
+            }
+            /* a counter that stays within 0..32767 is compared unsigned */
+            if ((op == TOK_LT && has_a && va >= 0 && vb >= 0) || (op == TOK_GE && vb >= 1))
+                uns = 1;
+            enters = has_a && loop_holds(va, op, vb);
+        }
+        if (uns && op != TOK_NE)
+            op = op == TOK_LT ? TOK_ULT : op == TOK_GE ? TOK_UGE : op == TOK_LE ? TOK_ULE : TOK_UGT;
+    }
+    if (ctr && !(flags & LOOP_ENTRY)) {
+        lp.ctr = ctr;
+        loop_find_ptrs(&lp, v);
+    }
+
+    if (ni != 0) {
+        loop_expr(init, ';');
+        vpop();
+    }
+
+    /* the element pointers, and the count in X if the loop may run with it */
+    for (p = lp.ptrs; p < lp.ptrs + lp.nb_ptrs; p++) {
+        vset(&p->type, VT_LOCAL | VT_LVAL, p->addr);
+        vpushv(&p->base);
+        loop_push_sym(ctr);
+        gen_op('+');
+        vstore();
+        vpop();
+    }
+    if (enters && !(flags & (LOOP_EXIT | LOOP_ENTRY | LOOP_CALL))) {
+        count = (st > 0 ? vb - va : va - vb + (op != TOK_NE)) & 0xffff;
+        if (count)
+            gen_loop_enter(NULL, count);
+    }
+
+    a = b = e = 0;
+    if (ctr && !enters) {
+        /* test before the first iteration */
+        loop_expr(cond, ';');
+        a = gtst(1, 0);
+    } else if (!ctr && nc != 0 && !(nc == 1 && tc[0] == TOK_CINT && vc[0])) {
+        e = gjmp(0);
+    }
+    head = ind;
+    loop_body(&lp, &a, &b, case_sym, def_sym, case_reg);
+    gsym(b);
+    if (ctr) {
+        /* X holds the count if nothing else used the counter */
+        in_x = count && lp.hits == loop_uses(lp.body, v) && gen_loop_x_kept(head);
+        for (p = lp.ptrs; p < lp.ptrs + lp.nb_ptrs; p++) {
+            memset(&sv, 0, sizeof(sv));
+            sv.type = p->type;
+            sv.r = VT_LOCAL | VT_LVAL;
+            sv.c.i = p->addr;
+            gen_loop_ptr_step(&sv, st * p->size);
+        }
+        if (in_x) {
+            gen_loop_count(NULL, 0, head);
+        } else {
+            memset(&csv, 0, sizeof(csv));
+            csv.type = ctr->type;
+            csv.r = ctr->r;
+            csv.c.i = ctr->c;
+            gen_loop_step(&csv, st, op, &bound, head);
+        }
+        gsym(a);
+        if (in_x)
+            loop_set(ctr, va + st * count);
+    } else {
+        if (ns != 0) {
+            loop_expr(step, ')');
+            vpop();
+        }
+        if (e) {
+            gsym(e);
+            loop_expr(cond, ';');
+            gsym_addr(gtst(0, 0), head);
+        } else {
+            gjmp_addr(head);
+        }
+        gsym(a);
+    }
+    tok_str_free(init);
+    tok_str_free(cond);
+    tok_str_free(step);
+    tok_str_free((int *) lp.body);
+}
+
+/* the "while" and "do ... while" statements with -floop-opt */
+static void loop_while(int *case_sym, int *def_sym, int case_reg)
+{
+    int *cond;
+    int tc[LOOP_MAX_TOKS], vc[LOOP_MAX_TOKS];
+    int is_do, nc, flags, a, b, e, head, post, x, in_x;
+    TokenSym *ctr;
+    SValue csv;
+    Loop lp;
+
+    is_do = tok == TOK_DO;
+    next();
+    memset(&lp, 0, sizeof(lp));
+    if (is_do) {
+        lp.body = loop_record_body(&flags);
+        skip(TOK_WHILE);
+        skip('(');
+        cond = loop_record_expr(')');
+        skip(';');
+    } else {
+        skip('(');
+        cond = loop_record_expr(')');
+        lp.body = loop_record_body(&flags);
+    }
+    nc = loop_tokens(cond, tc, vc);
+
+    /* counted down to zero: "n--" or "--n" */
+    ctr = NULL;
+    post = 0;
+    if (nc == 2 && (tc[0] == TOK_DEC || tc[1] == TOK_DEC)) {
+        post = tc[1] == TOK_DEC;
+        ctr = loop_int(tc[post ? 0 : 1]);
+        if (ctr && !loop_local(ctr, &lp))
+            ctr = NULL;
+    }
+    memset(&csv, 0, sizeof(csv));
+    if (ctr) {
+        csv.type = ctr->type;
+        csv.r = ctr->r;
+        csv.c.i = ctr->c;
+    }
+    x = ctr && !(flags & (LOOP_EXIT | LOOP_ENTRY | LOOP_CALL)) && !loop_uses(lp.body, ctr->v);
+    if (x)
+        gen_loop_enter(&csv, 0);
+
+    a = b = e = 0;
+    if (!is_do && !(nc == 1 && tc[0] == TOK_CINT && vc[0]))
+        e = gjmp(0);
+    head = ind;
+    loop_body(&lp, &a, &b, case_sym, def_sym, case_reg);
+    gsym(b);
+    gsym(e);
+    in_x = 0;
+    if (ctr) {
+        in_x = x && gen_loop_x_kept(head);
+        gen_loop_count(in_x ? NULL : &csv, post, head);
+    } else if (e || is_do) {
+        loop_expr(cond, ')');
+        gsym_addr(gtst(0, 0), head);
+    } else {
+        gjmp_addr(head);
+    }
+    gsym(a);
+    /* X ends at 0, or at -1 after the test of "n--" */
+    if (in_x)
+        loop_set(ctr, -post);
+    tok_str_free(cond);
+    tok_str_free((int *) lp.body);
+}
+
+/* a loop statement with -floop-opt */
+static void loop_block(int *case_sym, int *def_sym, int case_reg)
+{
+    if (tok == TOK_FOR)
+        loop_for(case_sym, def_sym, case_reg);
+    else
+        loop_while(case_sym, def_sym, case_reg);
+}
+#endif
+
 static void block(int *bsym, int *csym, int *case_sym, int *def_sym, int case_reg, int is_expr)
 {
     int a, b, c, d;
@@ -4372,6 +6044,11 @@ static void block(int *bsym, int *csym, int *case_sym, int *def_sym, int case_re
         vtop->type.t = VT_VOID;
     }
 
+#ifdef TCC_TARGET_816
+    if (tcc_state->loop_opt && !nocode_wanted && (tok == TOK_FOR || tok == TOK_WHILE || tok == TOK_DO)) {
+        loop_block(case_sym, def_sym, case_reg);
+    } else
+#endif
     if (tok == TOK_IF) {
         /* if test */
         next();
@@ -4496,7 +6173,10 @@ static void block(int *bsym, int *csym, int *case_sym, int *def_sym, int case_re
             vtop--; /* NOT vpop() because on x86 it would flush the fp stack */
         }
         skip(';');
-        rsym = gjmp(rsym); /* jmp */
+        /* a return ending an expanded inline body outside of any loop
+           falls through to the end of the expansion */
+        if (!inline_level || bsym || tok != '}' || !macro_ptr || *macro_ptr != TOK_EOF)
+            rsym = gjmp(rsym); /* jmp */
     } else if (tok == TOK_BREAK) {
         /* compute jump */
         if (!bsym)
@@ -4663,10 +6343,10 @@ static void block(int *bsym, int *csym, int *case_sym, int *def_sym, int case_re
                     error("duplicate label '%s'", get_tok_str(s->v, NULL));
 #ifdef TCC_TARGET_816
                 /* 816 code generator needs to know the names of labels, but only
-                   gets addresses; using label_workaround to both indicate that
+                   gets addresses; using gen816.label_workaround to both indicate that
                    this is a label, and what its name is. gsym_addr() resets
-                   label_workaround to NULL when done. */
-                label_workaround = get_tok_str(s->v, NULL);
+                   gen816.label_workaround to NULL when done. */
+                gen816.label_workaround = get_tok_str(s->v, NULL);
                 gsym((long) s->next);
 #else
                 gsym(s->jnext);
@@ -4676,7 +6356,7 @@ static void block(int *bsym, int *csym, int *case_sym, int *def_sym, int case_re
                 s = label_push(&global_label_stack, b, LABEL_DEFINED);
 #ifdef TCC_TARGET_816
                 /* see above */
-                label_workaround = get_tok_str(s->v, NULL);
+                gen816.label_workaround = get_tok_str(s->v, NULL);
                 gsym((long) s->next); /* without this, labels end up in the wrong place (too late) */
 #endif
             }
@@ -5315,6 +6995,9 @@ static void decl_initializer_alloc(
     } else {
         TokenSym *sym;
         int is_const_var = 0;
+#ifdef TCC_TARGET_816
+        int placement;
+#endif
 
         sym = NULL;
         if (v && scope == VT_CONST) {
@@ -5323,6 +7006,9 @@ static void decl_initializer_alloc(
             if (sym) {
                 if (!is_compatible_types(&sym->type, type))
                     error("incompatible types for redefinition of '%s'", get_tok_str(v, NULL));
+#ifdef TCC_TARGET_816
+                merge_placement(sym, type);
+#endif
                 if (sym->type.t & VT_EXTERN) {
                     /* if the variable is extern, it was not allocated */
                     sym->type.t &= ~VT_EXTERN;
@@ -5348,6 +7034,19 @@ static void decl_initializer_alloc(
             }
         }
 
+#ifdef TCC_TARGET_816
+        /* low RAM is not filled by the startup code, and the direct page
+           is only 256 bytes large */
+        placement = (sym ? sym->type.t : type->t) & VT_PLACEMENT;
+        if (has_init && (placement == VT_NEAR || placement == VT_ZEROPAGE))
+            error("near or zeropage variable '%s' cannot be initialized", get_tok_str(v, NULL));
+        if (placement == VT_ZEROPAGE && size > 256)
+            error("zeropage variable '%s' does not fit in the direct page", get_tok_str(v, NULL));
+        /* near pointers cannot reach ROM or the second RAM bank */
+        if (is_near_object(type)
+            && (placement == VT_FAR || has_init == 2 || (has_init && is_const_var)))
+            error("near variable '%s' must be in the data bank", get_tok_str(v, NULL));
+#endif
         /* allocate symbol in corresponding section */
         sec = ad->section;
         if (!sec) {
@@ -5511,6 +7210,10 @@ static void gen_function(TokenSym *sym)
     sym_push2(&local_stack, SYM_FIELD, 0, 0);
     gfunc_prolog(&sym->type);
     rsym = 0;
+#ifdef TCC_TARGET_816
+    cur_loop = NULL;
+    nb_loop_addrs = 0;
+#endif
     block(NULL, NULL, NULL, NULL, 0, 0);
     gsym(rsym);
     gfunc_epilog();
@@ -5707,6 +7410,8 @@ static void decl(int l)
                     strcpy(fn->filename, filename);
                     fn->sym = sym;
                     fn->token_str = func_str.str;
+                    fn->nb_toks = inline_body_size(func_str.str);
+                    fn->expanding = 0;
                     dynarray_add((void ***) &tcc_state->inline_fns, &tcc_state->nb_inline_fns, fn);
 
                 } else {
@@ -5736,6 +7441,15 @@ static void decl(int l)
                     if (!(type.t & VT_ARRAY))
                         r |= lvalue_type(type.t);
                     has_init = (tok == '=');
+#ifdef TCC_TARGET_816
+                    if (ad.placement) {
+                        if (l == VT_LOCAL && !(btype.t & (VT_STATIC | VT_EXTERN)))
+                            warning("placement attribute ignored for local variable '%s'",
+                                    get_tok_str(v, NULL));
+                        else
+                            type.t |= ad.placement << VT_PLACEMENT_SHIFT;
+                    }
+#endif
                     if ((btype.t & VT_EXTERN)
                         || ((type.t & VT_ARRAY) && (type.t & VT_STATIC) && !has_init
                             && l == VT_CONST && type.ref->c < 0)) {
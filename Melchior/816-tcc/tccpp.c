@@ -79,7 +79,7 @@ static TokenSym *tok_alloc_new(TokenSym **pts, const char *str, int len)
         table_ident = ptable;
     }
 
-    ts = tcc_malloc(sizeof(TokenSym) + len);
+    ts = arena_alloc(&tu_arena, sizeof(TokenSym) + len);
     table_ident[i] = ts;
     ts->tok = tok_ident++;
     ts->sym_define = NULL;
@@ -831,6 +831,7 @@ static inline int tok_ext_size(int t)
     case TOK_STR:
     case TOK_LSTR:
     case TOK_PPNUM:
+    case TOK_FILENAME:
         error("unsupported token");
         return 1;
     case TOK_CDOUBLE:
@@ -863,6 +864,22 @@ static inline void tok_str_new(TokenString *s)
     s->len = 0;
     s->allocated_len = 0;
     s->last_line_num = -1;
+    s->arena = NULL;
+}
+
+/**
+ * @brief Initialize a `TokenString` that lives until the end of the file.
+ *
+ * Like `tok_str_new`, but the tokens are recorded in the token string
+ * arena, which is released when the file is done (see `free_defines`):
+ * the string must not be passed to `tok_str_free`.
+ *
+ * @param s The `TokenString` structure to initialize.
+ */
+static inline void tok_str_new_tu(TokenString *s)
+{
+    tok_str_new(s);
+    s->arena = &tokstr_arena;
 }
 
 /**
@@ -899,7 +916,10 @@ static int *tok_str_realloc(TokenString *s)
     } else {
         len = s->allocated_len * 2;
     }
-    str = tcc_realloc(s->str, len * sizeof(int));
+    if (s->arena)
+        str = arena_realloc(s->arena, s->str, s->allocated_len * sizeof(int), len * sizeof(int));
+    else
+        str = tcc_realloc(s->str, len * sizeof(int));
     s->allocated_len = len;
     s->str = str;
     return str;
@@ -965,7 +985,8 @@ static void tok_str_add2(TokenString *s, int t, CValue *cv)
         break;
     case TOK_PPNUM:
     case TOK_STR:
-    case TOK_LSTR: {
+    case TOK_LSTR:
+    case TOK_FILENAME: {
         int nb_words;
         CString *cstr;
 
@@ -1072,6 +1093,7 @@ static void tok_str_add_tok(TokenString *s)
         case TOK_STR:                                        \
         case TOK_LSTR:                                       \
         case TOK_PPNUM:                                      \
+        case TOK_FILENAME:                                   \
             cv.cstr = (CString *) p;                         \
             cv.cstr->data = (char *) p + sizeof(CString);    \
             p += (sizeof(CString) + cv.cstr->size + 3) >> 2; \
@@ -1107,6 +1129,7 @@ static void tok_str_add_tok(TokenString *s)
         case TOK_STR:                                        \
         case TOK_LSTR:                                       \
         case TOK_PPNUM:                                      \
+        case TOK_FILENAME:                                   \
             cv.cstr = (CString *) p;                         \
             cv.cstr->data = (char *) p + sizeof(CString);    \
             p += (sizeof(CString) + cv.cstr->size + 3) >> 2; \
@@ -1166,9 +1189,8 @@ static void free_defines(TokenSym *b)
     top = define_stack;
     while (top != b) {
         top1 = top->prev;
-        /* do not free args or predefined defines */
-        if (top->d)
-            tok_str_free(top->d);
+        /* the macro bodies are in the token string arena, released by the
+           caller */
         v = top->v;
         if (v >= TOK_IDENT && v < tok_ident)
             table_ident[v - TOK_IDENT]->sym_define = NULL;
@@ -1325,7 +1347,7 @@ static void parse_define(void)
             next_nomacro_spc();
         t = MACRO_FUNC;
     }
-    tok_str_new(&str);
+    tok_str_new_tu(&str);
     spc = 2;
     /* EOF testing necessary for '-D' handling */
     while (tok != TOK_LINEFEED && tok != TOK_EOF) {
@@ -2673,6 +2695,10 @@ static void next_nomacro_spc(void)
                 file->line_num = tokc.i;
                 goto redo;
             }
+            if (tok == TOK_FILENAME) {
+                pstrcpy(file->filename, sizeof(file->filename), tokc.cstr->data);
+                goto redo;
+            }
         }
     } else {
         next_nomacro1();
@@ -3074,7 +3100,7 @@ static void macro_subst(TokenString *tok_str,
 }
 
 /* return next token with macro substitution */
-static void next(void)
+static void next_expand(void)
 {
     TokenSym *nested_list, *s;
     TokenString str;
@@ -3126,6 +3152,13 @@ redo:
     }
 }
 
+static void next(void)
+{
+    BENCH_ENTER(BENCH_PP);
+    next_expand();
+    BENCH_LEAVE();
+}
+
 /* push back current token and set current token to 'last_tok'. Only
    identifier case handled for labels. */
 static inline void unget_tok(int last_tok)
@@ -3196,12 +3229,14 @@ void preprocess_new()
 static int tcc_preprocess(TCCState *s1)
 {
     TokenSym *define_start;
+    TCCArena tokstr_start;
     BufferedFile *file_ref, **iptr, **iptr_new;
     int token_seen, line_ref, d;
     const char *s;
 
     preprocess_init(s1);
     define_start = define_stack;
+    tokstr_start = tokstr_arena;
     ch = file->buf_ptr[0];
     tok_flags = TOK_FLAG_BOL | TOK_FLAG_BOF;
     parse_flags = PARSE_FLAG_ASM_COMMENTS | PARSE_FLAG_PREPROCESS | PARSE_FLAG_LINEFEED
@@ -3245,5 +3280,6 @@ static int tcc_preprocess(TCCState *s1)
         fputs(get_tok_str(tok, &tokc), s1->outfile);
     }
     free_defines(define_start);
+    arena_release(&tokstr_arena, &tokstr_start);
     return 0;
 }
@@ -62,6 +62,10 @@ DEF(TOK_LABEL, "__label__")
 DEF(TOK_ASM1, "asm")
 DEF(TOK_ASM2, "__asm")
 DEF(TOK_ASM3, "__asm__")
+#ifdef TCC_TARGET_816
+DEF(TOK_FIXED, "__fixed")
+DEF(TOK_NEAR3, "__near")
+#endif
 
 /*********************************************************************/
 /* the following are not keywords. They are included to ease parsing */
@@ -127,6 +131,14 @@ DEF(TOK_free, "free")
 #endif
 DEF(TOK_REGPARM1, "regparm")
 DEF(TOK_REGPARM2, "__regparm__")
+#ifdef TCC_TARGET_816
+DEF(TOK_NEAR1, "near")
+DEF(TOK_NEAR2, "__near__")
+DEF(TOK_ZEROPAGE1, "zeropage")
+DEF(TOK_ZEROPAGE2, "__zeropage__")
+DEF(TOK_FAR1, "far")
+DEF(TOK_FAR2, "__far__")
+#endif
 
 /* pragma */
 DEF(TOK_pack, "pack")
@@ -30,6 +30,8 @@
 
 */
 
+#include "constify.h"
+
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -43,78 +45,25 @@ int quietmode = 0; // 0 = not quiet, 1 = i can't say anything :P
 
 using namespace std;
 
-vector<string> constVars;
-vector<string> asmSections[3];
-int blockDepth;
-int lineNum = 0;
-
-bool is_whitespace(char c)
-{
-    return ((c == ' ') || (c == '\t') || (c == -1));
-}
-
-int safe_string_access(string s, int pos)
-{
-    if ((pos >= 0) && (pos < (int)s.length()))
-        return s[pos];
-    return -1;
-}
-
-// Finds a word (i.e. word=="foo" would match on "foo bar" or "a foo bar" but not on "foobar")
-size_t find_word(string s, const char *word)
-{
-    int p = s.find(word);
-    if (is_whitespace(safe_string_access(s, p - 1)) && is_whitespace(safe_string_access(s, p + strlen(word))))
-        return p;
-    return string::npos;
-}
-
-void check_for_const(string s)
+// Read a whole file in memory, exit on error
+static string read_file(const char *filename)
 {
-    unsigned int i, j;
-    const string staticPrefix = "tccs_";
+    FILE *f;
+    string text;
+    char buf[8192];
+    size_t n;
 
-    // We are only interested in global consts that are initialized in this file
-    if ((find_word(s, "const") != string::npos) && (s.find("extern") == string::npos) && (blockDepth == 0))
+    f = fopen(filename, "rb");
+    if (f == NULL)
     {
-
-        for (i = 0; i < s.length(); i++)
-        {
-            if ((s[i] == '=') || (s[i] == '['))
-            {
-                break;
-            }
-        }
-
-        if (i < s.length())
-        {
-            if ((s.rfind("const") > s.find("*")) || (s.find("*") == string::npos))
-            {
-                while (is_whitespace(s[i]))
-                {
-                    i--;
-                }
-                j = i - 1;
-                if ((s[i] == '=') && (s[j] == ' ')) // Alek : to avoid breaking with name =
-                {
-                    j--;
-                    i--;
-                }
-                // printf("Found %s %d %d\n",s.data(),i,j);
-                while ((!is_whitespace(s[j])) && (s[j] != '*'))
-                {
-                    j--;
-                }
-
-                // printf("Found const named '%s' (%d,%d) on line %d\n", s.substr(j + 1, i-j-1).data(), i,j, lineNum);
-
-                if (find_word(s, "static") != string::npos)
-                    constVars.push_back(staticPrefix + s.substr(j + 1, i - j - 1));
-                else
-                    constVars.push_back(s.substr(j + 1, i - j - 1));
-            }
-        }
+        printf("\nconstify: error 'Cannot open file %s'\n", filename);
+        exit(1);
     }
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        text.append(buf, n);
+    fclose(f);
+
+    return text;
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -145,12 +94,10 @@ void PrintVersion(void)
 /// M A I N ////////////////////////////////////////////////////////////
 int main(int argc, char **argv)
 {
-    FILE *cFile, *asmFile, *outFile;
-    string oneLine, sectName;
-    bool saveCode;
-    unsigned int i, j;
+    FILE *outFile;
+    string sectName;
     int k;
-    int varOffs, varSize = 0, varsMoved, bytesMoved, ch, currSection;
+    int varsMoved, bytesMoved;
     char cFilebase[256]   = "";
     char asmFilebase[256] = "";
     char outFilebase[256] = "";
@@ -236,47 +183,9 @@ int main(int argc, char **argv)
         exit(1);
     }
 
-    // Find all const variables that and store them in constVars
-    cFile = fopen(cFilebase, "rb");
-    if (cFile == NULL)
-    {
-        printf("\nconstify: error 'Cannot open file %s'\n", cFilebase);
-        exit(1);
-    }
-    oneLine.clear();
-    while (1)
-    {
-        if ((ch = fgetc(cFile)) != EOF)
-        {
-            if ((ch == 10) || (ch == 13))
-            {
-                lineNum += (ch == 10) ? 1 : 0;
-                check_for_const(oneLine);
-                oneLine.clear();
-            }
-            else
-            {
-                oneLine += (char)ch;
-                if (ch == '{')
-                    blockDepth++;
-                else if (ch == '}')
-                    blockDepth--;
-            }
-        }
-        else
-        {
-            check_for_const(oneLine);
-            break;
-        }
-    }
-    fclose(cFile);
+    string cText   = read_file(cFilebase);
+    string asmText = read_file(asmFilebase);
 
-    asmFile = fopen(asmFilebase, "rb");
-    if (asmFile == NULL)
-    {
-        printf("\nconstify: error 'Cannot open file %s'\n", asmFilebase);
-        exit(1);
-    }
     outFile = fopen(outFilebase, "wb");
     if (outFile == NULL)
     {
@@ -284,174 +193,23 @@ int main(int argc, char **argv)
         exit(1);
     }
 
-    oneLine.clear();
-    saveCode    = false;
-    currSection = -1;
-    while (1)
+    // split the assembly in lines, in place
+    vector<char *> asmLines;
+    char *p = &asmText[0], *eol;
+    while (*p)
     {
-        if ((ch = fgetc(asmFile)) != EOF)
-        {
-            if ((ch == 10) || (ch == 13))
-            {
-                if (oneLine.length())
-                {
-                    // if (oneLine.find(".RAMSECTION \"ram.data\"") != string::npos)
-                    if (oneLine.find("APPENDTO \"globram.data\"") != string::npos)
-                    {
-                        saveCode    = true;
-                        currSection = 0;
-                        asmSections[currSection].push_back(oneLine);
-                    }
-                    // else if (oneLine.find(".SECTION \".data\"") != string::npos)
-                    else if (oneLine.find("APPENDTO \"glob.data\"") != string::npos)
-                    {
-                        saveCode    = true;
-                        currSection = 1;
-                        asmSections[currSection].push_back(oneLine);
-                    }
-                    else if (oneLine.find(".SECTION \".rodata\"") != string::npos)
-                    {
-                        saveCode    = true;
-                        currSection = 2;
-                        if (sectName.length())
-                        {
-                            asmSections[currSection].push_back(".SECTION \"." + sectName + "\" SUPERFREE");
-                        }
-                        else
-                            asmSections[currSection].push_back(oneLine);
-                    }
-                    else if (oneLine.find(".ENDS") != string::npos)
-                    {
-                        saveCode = false;
-                        if (currSection == 2)
-                            break;
-                        if (currSection >= 0)
-                            asmSections[currSection].push_back(oneLine);
-                        else
-                            fprintf(outFile, "%s\n", oneLine.data());
-                    }
-                    else if (saveCode)
-                    {
-                        asmSections[currSection].push_back(oneLine);
-                    }
-                    else
-                    {
-                        fprintf(outFile, "%s\n", oneLine.data());
-                    }
-                }
-                oneLine.clear();
-            }
-            else
-            {
-                oneLine += (char)ch;
-            }
-        }
-        else
-        {
+        asmLines.push_back(p);
+        if ((eol = strchr(p, '\n')) == NULL)
             break;
-        }
-    }
-
-    varsMoved = bytesMoved = 0;
-    vector<string>::iterator it;
-
-    for (i = 0; i < constVars.size(); i++)
-    {
-        unsigned int k, m;
-        int n;
-        j       = 1;
-        varOffs = 0;
-        while (j < asmSections[0].size())
-        {
-            if (asmSections[0][j].find(constVars[i] + ' ') != string::npos) // +' ' to avoid var with same beginning name
-            {
-                break;
-            }
-            else
-            {
-                k = asmSections[0][j].find("dsb");
-                if (k != string::npos)
-                {
-                    varOffs += atoi(asmSections[0][j].substr(k + 4).data());
-                }
-            }
-            j++;
-        }
-
-        if (j < asmSections[0].size())
-        {
-            k = asmSections[0][j].find("dsb");
-            if (k != string::npos)
-            {
-                varSize = atoi(asmSections[0][j].substr(k + 4).data());
-            }
-            int dataOffs = 0;
-            m            = 1;
-            while ((dataOffs < varOffs) && (m < asmSections[1].size()))
-            {
-                n = 1;
-                if (asmSections[1][m].find(".dw") != string::npos)
-                    n = 2;
-                for (unsigned int p = 0; p < asmSections[1][m].size(); p++)
-                {
-                    if (asmSections[1][m][p] == ',')
-                        dataOffs += n;
-                }
-                dataOffs += n;
-                m++;
-            }
-            int dataStart = m, q = 0;
-            while ((q < varSize) && (m < asmSections[1].size()))
-            {
-                n = 1;
-                if (asmSections[1][m].find(".dw") != string::npos)
-                    n = 2;
-                for (unsigned int p = 0; p < asmSections[1][m].size(); p++)
-                {
-                    if (asmSections[1][m][p] == ',')
-                        q += n;
-                }
-                q += n;
-                m++;
-            }
-            asmSections[2].push_back(constVars[i] + ":");
-            for (k = dataStart; k < m; k++)
-            {
-                asmSections[2].push_back(asmSections[1][dataStart]);
-                it = asmSections[1].begin();
-                advance(it, dataStart);
-                asmSections[1].erase(it);
-            }
-            it = asmSections[0].begin();
-            advance(it, j);
-            asmSections[0].erase(it);
-            bytesMoved += varSize;
-            varsMoved++;
-        }
-        // printf("%s at offset %d\n", constVars[i].data(), varOffs);
+        *eol = 0;
+        p    = eol + 1;
     }
 
+    constify_lines(cText.data(), cText.size(), asmLines.data(), asmLines.size(),
+                   sectName.c_str(), outFile, &varsMoved, &bytesMoved);
     printf("constify: Done 'Moved %d variables (%d bytes)'\n", varsMoved, bytesMoved);
-    for (i = 0; i < 3; i++)
-    {
-        for (j = 0; j < asmSections[i].size(); j++)
-        {
-            fprintf(outFile, "%s\n", asmSections[i][j].data());
-        }
-    }
-    fputs(".ENDS\n\n", outFile);
-
-    while ((ch = fgetc(asmFile)) != EOF)
-    {
-        fputc(ch, outFile);
-    }
 
-    fclose(asmFile);
     fclose(outFile);
-    asmSections[0].clear();
-    asmSections[1].clear();
-    asmSections[2].clear();
-    constVars.clear();
 
     return 0;
 }
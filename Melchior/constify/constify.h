@@ -0,0 +1,57 @@
+/*---------------------------------------------------------------------------------
+
+    Copyright (C) 2012-2021
+        Alekmaul
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any
+    damages arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any
+    purpose, including commercial applications, and to alter it and
+    redistribute it freely, subject to the following restrictions:
+
+    1.	The origin of this software must not be misrepresented; you
+        must not claim that you wrote the original software. If you use
+        this software in a product, an acknowledgment in the product
+        documentation would be appreciated but is not required.
+    2.	Altered source versions must be plainly marked as such, and
+        must not be misrepresented as being the original software.
+    3.	This notice may not be removed or altered from any source
+        distribution.
+
+    Library interface of constify, usable from C, so that a driver can
+    run it on buffers already in memory (see 816-cc)
+
+---------------------------------------------------------------------------------*/
+#ifndef CONSTIFY_H
+#define CONSTIFY_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*!
+ * @brief Move the initialized global consts of a C source from the data
+ * sections of its assembly to the .rodata section.
+ * @param csrc The C source text.
+ * @param csrcLen Length of csrc in bytes.
+ * @param asmLines The assembly, one line per entry, without end-of-line
+ * characters (a trailing '\r' is tolerated).
+ * @param asmCount Number of entries in asmLines.
+ * @param sectName Name replacing the default .rodata section, or NULL.
+ * @param out Where the resulting assembly is written.
+ * @param varsMoved If not NULL, receives the number of variables moved.
+ * @param bytesMoved If not NULL, receives the number of bytes moved.
+ */
+void constify_lines(const char *csrc, size_t csrcLen, char **asmLines, size_t asmCount,
+                    const char *sectName, FILE *out, int *varsMoved, int *bytesMoved);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,320 @@
+/*---------------------------------------------------------------------------------
+
+    Copyright (C) 2012-2021
+        Alekmaul
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any
+    damages arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any
+    purpose, including commercial applications, and to alter it and
+    redistribute it freely, subject to the following restrictions:
+
+    1.	The origin of this software must not be misrepresented; you
+        must not claim that you wrote the original software. If you use
+        this software in a product, an acknowledgment in the product
+        documentation would be appreciated but is not required.
+    2.	Altered source versions must be plainly marked as such, and
+        must not be misrepresented as being the original software.
+    3.	This notice may not be removed or altered from any source
+        distribution.
+
+    Moves const data from .data/.ram.data to .rodata
+    Based on Constify from Mic
+
+---------------------------------------------------------------------------------*/
+/*
+    Constify - A tool for the SNES-SDK
+    Mic, 2010
+
+*/
+
+#include "constify.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+static vector<string> constVars;
+static vector<string> asmSections[3];
+static int blockDepth;
+static int lineNum = 0;
+
+static bool is_whitespace(char c)
+{
+    return ((c == ' ') || (c == '\t') || (c == -1));
+}
+
+static int safe_string_access(string s, int pos)
+{
+    if ((pos >= 0) && (pos < (int)s.length()))
+        return s[pos];
+    return -1;
+}
+
+// Finds a word (i.e. word=="foo" would match on "foo bar" or "a foo bar" but not on "foobar")
+static size_t find_word(string s, const char *word)
+{
+    int p = s.find(word);
+    if (is_whitespace(safe_string_access(s, p - 1)) && is_whitespace(safe_string_access(s, p + strlen(word))))
+        return p;
+    return string::npos;
+}
+
+static void check_for_const(string s)
+{
+    unsigned int i, j;
+    const string staticPrefix = "tccs_";
+
+    // We are only interested in global consts that are initialized in this file
+    if ((find_word(s, "const") != string::npos) && (s.find("extern") == string::npos) && (blockDepth == 0))
+    {
+
+        for (i = 0; i < s.length(); i++)
+        {
+            if ((s[i] == '=') || (s[i] == '['))
+            {
+                break;
+            }
+        }
+
+        if (i < s.length())
+        {
+            if ((s.rfind("const") > s.find("*")) || (s.find("*") == string::npos))
+            {
+                while (is_whitespace(s[i]))
+                {
+                    i--;
+                }
+                j = i - 1;
+                if ((s[i] == '=') && (s[j] == ' ')) // Alek : to avoid breaking with name =
+                {
+                    j--;
+                    i--;
+                }
+                // printf("Found %s %d %d\n",s.data(),i,j);
+                while ((!is_whitespace(s[j])) && (s[j] != '*'))
+                {
+                    j--;
+                }
+
+                // printf("Found const named '%s' (%d,%d) on line %d\n", s.substr(j + 1, i-j-1).data(), i,j, lineNum);
+
+                if (find_word(s, "static") != string::npos)
+                    constVars.push_back(staticPrefix + s.substr(j + 1, i - j - 1));
+                else
+                    constVars.push_back(s.substr(j + 1, i - j - 1));
+            }
+        }
+    }
+}
+
+// Find all const variables of the C source and store them in constVars
+static void collect_consts(const char *csrc, size_t csrcLen)
+{
+    string oneLine;
+    int ch;
+
+    blockDepth = 0;
+    lineNum    = 0;
+    for (size_t i = 0; i < csrcLen; i++)
+    {
+        ch = (unsigned char)csrc[i];
+        if ((ch == 10) || (ch == 13))
+        {
+            lineNum += (ch == 10) ? 1 : 0;
+            check_for_const(oneLine);
+            oneLine.clear();
+        }
+        else
+        {
+            oneLine += (char)ch;
+            if (ch == '{')
+                blockDepth++;
+            else if (ch == '}')
+                blockDepth--;
+        }
+    }
+    check_for_const(oneLine);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void constify_lines(const char *csrc, size_t csrcLen, char **asmLines, size_t asmCount,
+                    const char *sectName, FILE *out, int *varsMoved, int *bytesMoved)
+{
+    string oneLine;
+    bool saveCode;
+    unsigned int i, j;
+    size_t line;
+    int varOffs, varSize = 0, nbVars, nbBytes, currSection;
+
+    collect_consts(csrc, csrcLen);
+
+    saveCode    = false;
+    currSection = -1;
+    for (line = 0; line < asmCount; line++)
+    {
+        oneLine = asmLines[line];
+        if (oneLine.length() && oneLine[oneLine.length() - 1] == '\r')
+            oneLine.erase(oneLine.length() - 1);
+        if (oneLine.length())
+        {
+            // if (oneLine.find(".RAMSECTION \"ram.data\"") != string::npos)
+            if (oneLine.find("APPENDTO \"globram.data\"") != string::npos)
+            {
+                saveCode    = true;
+                currSection = 0;
+                asmSections[currSection].push_back(oneLine);
+            }
+            // else if (oneLine.find(".SECTION \".data\"") != string::npos)
+            else if (oneLine.find("APPENDTO \"glob.data\"") != string::npos)
+            {
+                saveCode    = true;
+                currSection = 1;
+                asmSections[currSection].push_back(oneLine);
+            }
+            else if (oneLine.find(".SECTION \".rodata\"") != string::npos)
+            {
+                saveCode    = true;
+                currSection = 2;
+                if (sectName && sectName[0])
+                {
+                    asmSections[currSection].push_back(string(".SECTION \".") + sectName + "\" SUPERFREE");
+                }
+                else
+                    asmSections[currSection].push_back(oneLine);
+            }
+            else if (oneLine.find(".ENDS") != string::npos)
+            {
+                saveCode = false;
+                if (currSection == 2)
+                {
+                    line++;
+                    break;
+                }
+                if (currSection >= 0)
+                    asmSections[currSection].push_back(oneLine);
+                else
+                    fprintf(out, "%s\n", oneLine.data());
+            }
+            else if (saveCode)
+            {
+                asmSections[currSection].push_back(oneLine);
+            }
+            else
+            {
+                fprintf(out, "%s\n", oneLine.data());
+            }
+        }
+    }
+
+    nbVars = nbBytes = 0;
+    vector<string>::iterator it;
+
+    for (i = 0; i < constVars.size(); i++)
+    {
+        unsigned int k, m;
+        int n;
+        j       = 1;
+        varOffs = 0;
+        while (j < asmSections[0].size())
+        {
+            if (asmSections[0][j].find(constVars[i] + ' ') != string::npos) // +' ' to avoid var with same beginning name
+            {
+                break;
+            }
+            else
+            {
+                k = asmSections[0][j].find("dsb");
+                if (k != string::npos)
+                {
+                    varOffs += atoi(asmSections[0][j].substr(k + 4).data());
+                }
+            }
+            j++;
+        }
+
+        if (j < asmSections[0].size())
+        {
+            k = asmSections[0][j].find("dsb");
+            if (k != string::npos)
+            {
+                varSize = atoi(asmSections[0][j].substr(k + 4).data());
+            }
+            int dataOffs = 0;
+            m            = 1;
+            while ((dataOffs < varOffs) && (m < asmSections[1].size()))
+            {
+                n = 1;
+                if (asmSections[1][m].find(".dw") != string::npos)
+                    n = 2;
+                for (unsigned int p = 0; p < asmSections[1][m].size(); p++)
+                {
+                    if (asmSections[1][m][p] == ',')
+                        dataOffs += n;
+                }
+                dataOffs += n;
+                m++;
+            }
+            int dataStart = m, q = 0;
+            while ((q < varSize) && (m < asmSections[1].size()))
+            {
+                n = 1;
+                if (asmSections[1][m].find(".dw") != string::npos)
+                    n = 2;
+                for (unsigned int p = 0; p < asmSections[1][m].size(); p++)
+                {
+                    if (asmSections[1][m][p] == ',')
+                        q += n;
+                }
+                q += n;
+                m++;
+            }
+            asmSections[2].push_back(constVars[i] + ":");
+            for (k = dataStart; k < m; k++)
+            {
+                asmSections[2].push_back(asmSections[1][dataStart]);
+                it = asmSections[1].begin();
+                advance(it, dataStart);
+                asmSections[1].erase(it);
+            }
+            it = asmSections[0].begin();
+            advance(it, j);
+            asmSections[0].erase(it);
+            nbBytes += varSize;
+            nbVars++;
+        }
+        // printf("%s at offset %d\n", constVars[i].data(), varOffs);
+    }
+
+    for (i = 0; i < 3; i++)
+    {
+        for (j = 0; j < asmSections[i].size(); j++)
+        {
+            fprintf(out, "%s\n", asmSections[i][j].data());
+        }
+    }
+    fputs(".ENDS\n\n", out);
+
+    // the rest of the file is copied as is
+    for (; line < asmCount; line++)
+    {
+        fputs(asmLines[line], out);
+        fputc('\n', out);
+    }
+
+    asmSections[0].clear();
+    asmSections[1].clear();
+    asmSections[2].clear();
+    constVars.clear();
+
+    if (varsMoved)
+        *varsMoved = nbVars;
+    if (bytesMoved)
+        *bytesMoved = nbBytes;
+}
@@ -53,7 +53,7 @@ int tile_reduction=1;	        	// 0 = no tile reduction (warning !)
 int savepalette=1;		           	// 1 = save the palette
 int savemap=1;				    	// 1 = save the map
 int colortabinc=16;                 // 16 for 16 color mode, 4 for 4 color mode
-int lzpacked=0;                     // 1 = compress file with LZSS algorithm
+int lzpacked=0;                     // 1 = compress file with LZSS algorithm, 2 = with optimal parsing
 int highpriority=0;                 // 1 = high priority for map
 int blanktile=0;                    // 1 = blank tile generated
 int palette_rnd=0;                  // 1 = round palette up & down
@@ -127,6 +127,7 @@ void PrintOptions(char *str)
 	printf("\n-gb               add blank tile management (for multiple bgs)");
 	printf("\n-gp               Output in packed pixel format");
 	printf("\n-glz              Output in lz77 compressed pixel format");
+	printf("\n-glzo             Output in lz77 compressed pixel format with optimal parsing (smaller, slower)");
 	printf("\n-gs(8|16|32|64)   Size of image blocks in pixels [8]");
 	printf("\n\n--- Map options ---");
 	printf("\n-m!               Exclude map from output");
@@ -213,6 +214,10 @@ int main(int argc, char **arg)
 				{
 					lzpacked=1;
 				}
+				else if( strcmp(&arg[i][1],"glzo") == 0)	// lzss compressed pixels with optimal parsing
+				{
+					lzpacked=2;
+				}
 				else if(arg[i][2]=='s')  //size specification
 				{
 					size=atoi(&arg[i][3]);
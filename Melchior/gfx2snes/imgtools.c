@@ -27,11 +27,22 @@
 
 ***************************************************************************/
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include "gfx2snes.h"
 #include "imgtools.h"
 #include "loadimg.h"
 
+#if defined(__AVX2__)
+#define IMGTOOLS_USE_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define IMGTOOLS_USE_SSE2
+#include <emmintrin.h>
+#endif
+
 unsigned char *ArrangeBlocks(unsigned char *img, int width, int height,
                              int size, int *xsize, int *ysize, int new_width, int border)
 {
@@ -141,6 +152,90 @@ unsigned char *ArrangeBlocks(unsigned char *img, int width, int height,
     return buffer;
 } // end of ArrangeBlocks()
 
+//////////////////////////////////////////////////////////////////////////////
+// hash table of the tiles kept by the tile reduction of MakeMap()
+typedef struct
+{
+    unsigned long long *hashes; // hash of the tile in each slot
+    int *tileno;                // kept tile number + 1 in each slot, 0 = empty
+    unsigned int mask;          // number of slots - 1
+    int collisions;             // same hash, different tile
+} TileHash;
+
+static unsigned long long TileHashValue(const unsigned char *tile, int sizetile)
+{
+    /*
+    ** returns a 64 bits hash of the tile, 8 bytes at a time
+    */
+    unsigned long long hash, word;
+    int i;
+
+    hash = 0x9e3779b97f4a7c15ULL ^ sizetile;
+    for (i = 0; i + 8 <= sizetile; i += 8)
+    {
+        memcpy(&word, &tile[i], 8);
+        hash = (hash ^ word) * 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 32;
+    }
+    for (; i < sizetile; i++)
+        hash = (hash ^ tile[i]) * 0x100000001b3ULL;
+
+    return hash ^ (hash >> 29);
+}
+
+static int TileHashInit(TileHash *th, int num_tiles)
+{
+    unsigned int size;
+
+    // keep the table at most half full
+    size = 64;
+    while (size < (unsigned int)num_tiles * 2)
+        size <<= 1;
+
+    th->hashes = malloc(size * sizeof(unsigned long long));
+    th->tileno = calloc(size, sizeof(int));
+    th->mask = size - 1;
+    th->collisions = 0;
+    if (th->hashes == NULL || th->tileno == NULL)
+    {
+        free(th->hashes);
+        free(th->tileno);
+        return 0;
+    }
+    return 1;
+}
+
+static int TileHashFind(TileHash *th, unsigned char *img, int sizetile, int current, int newtiles)
+{
+    /*
+    ** img = tiles, the kept ones first
+    ** current = tile to look for
+    ** newtiles = number the tile gets if it is a new one
+    **
+    ** returns:
+    **      the number of the kept tile identical to the current one, or
+    **      newtiles after adding it to the table (the caller copies it)
+    */
+    unsigned long long hash;
+    unsigned int slot;
+    int tileno;
+
+    hash = TileHashValue(&img[current * sizetile], sizetile);
+    for (slot = (unsigned int)hash & th->mask; (tileno = th->tileno[slot]) != 0; slot = (slot + 1) & th->mask)
+    {
+        if (th->hashes[slot] == hash)
+        {
+            if (memcmp(&img[(tileno - 1) * sizetile], &img[current * sizetile], sizetile) == 0)
+                return tileno - 1;
+            th->collisions++;
+        }
+    }
+
+    th->hashes[slot] = hash;
+    th->tileno[slot] = newtiles + 1;
+    return newtiles;
+}
+
 //////////////////////////////////////////////////////////////////////////////
 int *MakeMap(unsigned char *img, int *num_tiles, int *tiletab,
              int xsize, int ysize, int tile_x, int tile_y, int colors, int rearrange, int pal_entry)
@@ -153,6 +248,8 @@ int *MakeMap(unsigned char *img, int *num_tiles, int *tiletab,
     int i, t, palette, j, newadd, tileno;
     int x, y;
     int sizetile;
+    TileHash tilehash;
+    clock_t start;
 
     // allocate map
     map = malloc((size_t)tile_x * tile_y * sizeof(int));
@@ -278,6 +375,19 @@ int *MakeMap(unsigned char *img, int *num_tiles, int *tiletab,
     map[0] += t;
     tiletab[j++] = map[0];
 
+    // the first tile is always kept
+    start = clock();
+    if (tile_reduction)
+    {
+        if (!TileHashInit(&tilehash, xsize * ysize))
+        {
+            printf("\ngfx2snes: error 'Can't allocate enough memory for the tile hash table in MakeMap'");
+            free(map);
+            return 0;
+        }
+        TileHashFind(&tilehash, img, sizetile, 0, 0);
+    }
+
     for (y = 0; y < ysize; y++)
     {
         for (x = 0; x < xsize; x++)
@@ -299,9 +409,7 @@ int *MakeMap(unsigned char *img, int *num_tiles, int *tiletab,
                 else
                 {
                     // check for matches with previous tiles if tile_reduction on
-                    for (i = 0; i < newtiles; i++)
-                        if (memcmp(&img[i * sizetile], &img[current * sizetile], sizetile) == 0)
-                            break;
+                    i = TileHashFind(&tilehash, img, sizetile, current, newtiles);
 
                     // is it a new tile?
                     if (i == newtiles)
@@ -409,6 +517,15 @@ int *MakeMap(unsigned char *img, int *num_tiles, int *tiletab,
         }
     }
 
+    if (tile_reduction)
+    {
+        if (quietmode == 0)
+            printf("\ngfx2snes: 'Tile reduction of %d tiles to %d done in %ldms (%d hash collisions)'",
+                   xsize * ysize, newtiles, (long)((clock() - start) * 1000 / CLOCKS_PER_SEC), tilehash.collisions);
+        free(tilehash.hashes);
+        free(tilehash.tileno);
+    }
+
     // also return the number of new tiles
     // make it negative if we need to add the blank tile
     if (blank_absent)
@@ -664,18 +781,166 @@ int RearrangePalette(unsigned char *buffer, int *palette,
     return -1;
 } // end of RearrangePalette()
 
+//////////////////////////////////////////////////////////////////////////////
+#if defined(IMGTOOLS_USE_AVX2)
+static __m256i TileRowPlanesAVX2(__m256i rows)
+{
+    /*
+    ** same as TileRowPlanes() for the 4 tile rows held in rows
+    */
+    __m256i t;
+
+    t = _mm256_and_si256(_mm256_xor_si256(rows, _mm256_srli_epi64(rows, 9)), _mm256_set1_epi64x(0x0055005500550055LL));
+    rows = _mm256_xor_si256(rows, _mm256_xor_si256(t, _mm256_slli_epi64(t, 9)));
+    t = _mm256_and_si256(_mm256_xor_si256(rows, _mm256_srli_epi64(rows, 18)), _mm256_set1_epi64x(0x0000333300003333LL));
+    rows = _mm256_xor_si256(rows, _mm256_xor_si256(t, _mm256_slli_epi64(t, 18)));
+    t = _mm256_and_si256(_mm256_xor_si256(rows, _mm256_srli_epi64(rows, 36)), _mm256_set1_epi64x(0x000000000F0F0F0FLL));
+    rows = _mm256_xor_si256(rows, _mm256_xor_si256(t, _mm256_slli_epi64(t, 36)));
+
+    // swap the bytes of each bitplane pair so that the even plane comes first
+    return _mm256_or_si256(_mm256_slli_epi16(rows, 8), _mm256_srli_epi16(rows, 8));
+}
+#elif defined(IMGTOOLS_USE_SSE2)
+static __m128i TileRowPlanesSSE2(__m128i rows)
+{
+    /*
+    ** same as TileRowPlanes() for the 2 tile rows held in rows
+    */
+    __m128i t;
+
+    t = _mm_and_si128(_mm_xor_si128(rows, _mm_srli_epi64(rows, 9)), _mm_set1_epi64x(0x0055005500550055LL));
+    rows = _mm_xor_si128(rows, _mm_xor_si128(t, _mm_slli_epi64(t, 9)));
+    t = _mm_and_si128(_mm_xor_si128(rows, _mm_srli_epi64(rows, 18)), _mm_set1_epi64x(0x0000333300003333LL));
+    rows = _mm_xor_si128(rows, _mm_xor_si128(t, _mm_slli_epi64(t, 18)));
+    t = _mm_and_si128(_mm_xor_si128(rows, _mm_srli_epi64(rows, 36)), _mm_set1_epi64x(0x000000000F0F0F0FLL));
+    rows = _mm_xor_si128(rows, _mm_xor_si128(t, _mm_slli_epi64(t, 36)));
+
+    // swap the bytes of each bitplane pair so that the even plane comes first
+    return _mm_or_si128(_mm_slli_epi16(rows, 8), _mm_srli_epi16(rows, 8));
+}
+#else
+static unsigned long long TileRowPlanes(const unsigned char *row)
+{
+    /*
+    ** row = 8 pixels of a tile row, one byte per pixel
+    **
+    ** returns the 8x8 bit matrix of the row flipped around its anti-diagonal:
+    ** byte 7-b is bitplane b, with pixel 0 in bit 7
+    */
+    unsigned long long word, t;
+
+    word = (unsigned long long)row[0] | ((unsigned long long)row[1] << 8) |
+           ((unsigned long long)row[2] << 16) | ((unsigned long long)row[3] << 24) |
+           ((unsigned long long)row[4] << 32) | ((unsigned long long)row[5] << 40) |
+           ((unsigned long long)row[6] << 48) | ((unsigned long long)row[7] << 56);
+
+    // three block swaps (1x1, 2x2 then 4x4 bits)
+    t = (word ^ (word >> 9)) & 0x0055005500550055ULL;
+    word ^= t ^ (t << 9);
+    t = (word ^ (word >> 18)) & 0x0000333300003333ULL;
+    word ^= t ^ (t << 18);
+    t = (word ^ (word >> 36)) & 0x000000000F0F0F0FULL;
+    word ^= t ^ (t << 36);
+
+    return word;
+}
+#endif
+
+static void ConvertPlanar(unsigned char *planar, const unsigned char *buffer, int num_tiles, int bitplanes)
+{
+    /*
+    ** planar = buffer receiving the snes tiles (8 * bitplanes bytes per tile)
+    ** buffer = tiles buffer, 64 bytes per tile
+    ** num_tiles = number of tiles to convert
+    ** bitplanes = number of bitplanes to keep (2, 4 or 8)
+    */
+    int t;
+#if defined(IMGTOOLS_USE_AVX2)
+    __m256i r0123, r4567, lo, hi;
+
+    // rows of a bitplane pair are 16-bit words, gather them with a 8x4 words transpose
+    for (t = 0; t < num_tiles; t++, buffer += 64)
+    {
+        r0123 = TileRowPlanesAVX2(_mm256_loadu_si256((const __m256i *)buffer));
+        r4567 = TileRowPlanesAVX2(_mm256_loadu_si256((const __m256i *)(buffer + 32)));
+
+        lo = _mm256_permute2x128_si256(r0123, r4567, 0x20); // rows 0,1 | 4,5
+        hi = _mm256_permute2x128_si256(r0123, r4567, 0x31); // rows 2,3 | 6,7
+        r0123 = _mm256_unpacklo_epi16(lo, hi);              // rows 0,2 | 4,6
+        r4567 = _mm256_unpackhi_epi16(lo, hi);              // rows 1,3 | 5,7
+        lo = _mm256_unpacklo_epi16(r0123, r4567);           // pairs 3,2 of rows 0-3 | 4-7
+        hi = _mm256_unpackhi_epi16(r0123, r4567);           // pairs 1,0 of rows 0-3 | 4-7
+
+        // pairs 0 and 1, then pairs 2 and 3
+        hi = _mm256_permute4x64_epi64(hi, _MM_SHUFFLE(2, 0, 3, 1));
+        if (bitplanes == 2)
+            _mm_storeu_si128((__m128i *)planar, _mm256_castsi256_si128(hi));
+        else
+            _mm256_storeu_si256((__m256i *)planar, hi);
+        if (bitplanes == 8)
+            _mm256_storeu_si256((__m256i *)(planar + 32), _mm256_permute4x64_epi64(lo, _MM_SHUFFLE(2, 0, 3, 1)));
+        planar += 8 * bitplanes;
+    }
+#elif defined(IMGTOOLS_USE_SSE2)
+    __m128i r01, r23, r45, r67, lo, hi;
+    __m128i pairs[4];
+    int p;
+
+    // rows of a bitplane pair are 16-bit words, gather them with a 8x4 words transpose
+    for (t = 0; t < num_tiles; t++, buffer += 64)
+    {
+        r01 = TileRowPlanesSSE2(_mm_loadu_si128((const __m128i *)buffer));
+        r23 = TileRowPlanesSSE2(_mm_loadu_si128((const __m128i *)(buffer + 16)));
+        r45 = TileRowPlanesSSE2(_mm_loadu_si128((const __m128i *)(buffer + 32)));
+        r67 = TileRowPlanesSSE2(_mm_loadu_si128((const __m128i *)(buffer + 48)));
+
+        lo = _mm_unpacklo_epi16(r01, r23); // rows 0,2
+        hi = _mm_unpackhi_epi16(r01, r23); // rows 1,3
+        r01 = _mm_unpacklo_epi16(lo, hi);  // pairs 3,2 of rows 0-3
+        r23 = _mm_unpackhi_epi16(lo, hi);  // pairs 1,0 of rows 0-3
+        lo = _mm_unpacklo_epi16(r45, r67);
+        hi = _mm_unpackhi_epi16(r45, r67);
+        r45 = _mm_unpacklo_epi16(lo, hi);  // pairs 3,2 of rows 4-7
+        r67 = _mm_unpackhi_epi16(lo, hi);  // pairs 1,0 of rows 4-7
+        pairs[0] = _mm_unpackhi_epi64(r23, r67);
+        pairs[1] = _mm_unpacklo_epi64(r23, r67);
+        pairs[2] = _mm_unpackhi_epi64(r01, r45);
+        pairs[3] = _mm_unpacklo_epi64(r01, r45);
+
+        for (p = 0; p < bitplanes / 2; p++, planar += 16)
+            _mm_storeu_si128((__m128i *)planar, pairs[p]);
+    }
+#else
+    unsigned long long planes;
+    int y, p;
+
+    for (t = 0; t < num_tiles; t++, buffer += 64)
+    {
+        // each row gives one byte for each bitplane, bitplanes are stored by pairs of 8 rows
+        for (y = 0; y < 8; y++)
+        {
+            planes = TileRowPlanes(&buffer[y * 8]);
+            for (p = 0; p < bitplanes / 2; p++)
+            {
+                planar[p * 16 + y * 2] = (unsigned char)(planes >> (56 - p * 16));
+                planar[p * 16 + y * 2 + 1] = (unsigned char)(planes >> (48 - p * 16));
+            }
+        }
+        planar += 8 * bitplanes;
+    }
+#endif
+} // end of ConvertPlanar()
+
 //////////////////////////////////////////////////////////////////////////////
 extern int Convert2PicLZ77(int quietmode, unsigned char *bufin, int buflen, unsigned char *bufout);
+extern int Convert2PicLZ77Optimal(int quietmode, unsigned char *bufin, int buflen, unsigned char *bufout);
 int Convert2Pic(char *filebase, unsigned char *buffer,
                 int num_tiles, int blank_absent, int colors, int packed, int lzsspacked)
 {
     char filename[80];
-    int x, y, t, b;
     int i, j;
     int bitplanes;
-    int mask;
     int bufsize,bufsizeout;
-    unsigned char data;
     unsigned char *buftolzin, *buftolzout;
     FILE *fp;
 
@@ -716,59 +981,30 @@ int Convert2Pic(char *filebase, unsigned char *buffer,
     else if (colors <= 128)
         bitplanes = 4;
 
-    // if lzss encoding begin with transferring data
-    if (lzsspacked)
+    // convert all the tiles to planar, the blank tile is added first if needed
+    bufsize = (blank_absent ? 8 * bitplanes : 0) + num_tiles * 8 * bitplanes;
+    buftolzin = malloc(bufsize);
+    if (buftolzin == NULL)
     {
-        bufsize = 8 * bitplanes + num_tiles * 8 * bitplanes;
-        buftolzin = malloc(bufsize);
-        if (buftolzin == NULL)
-        {
-            printf("\ngfx2snes: error 'Can't allocate enough memory for the buffer compression 1'");
-            fclose(fp);
-            return 0;
-        }
-        // remember to add the blank if its needed....
-        j = 0;
-        if (blank_absent)
-            for (i = 0; i < 8 * bitplanes; i++, j++)
-                *(buftolzin + i) = 0;
-
-        for (t = 0; t < num_tiles; t++)
-        { // loop through tiles
-            for (b = 0; b < bitplanes; b += 2)
-            { // loop through bitplane pairs
-                for (y = 0; y < 8; y++)
-                {
-                    // get bit-mask
-                    mask = 1 << b;
-                    data = 0;
-
-                    // get row of bit-plane
-                    for (x = 0; x < 8; x++)
-                    {
-                        data = data << 1;
-                        if (buffer[t * 64 + y * 8 + x] & mask)
-                            data = data + 1;
-                    }
-                    *(buftolzin + j) = data;
-                    j++;
+        printf("\ngfx2snes: error 'Can't allocate enough memory for the tiles buffer'");
+        fclose(fp);
+        return 0;
+    }
+    j = 0;
+    if (blank_absent)
+    {
+        memset(buftolzin, 0, 8 * bitplanes);
+        j = 8 * bitplanes;
+    }
 
-                    // adjust bit-mask
-                    mask = mask << 1;
-                    data = 0;
+    if ((quietmode == 0) && (lzsspacked == 0))
+        printf("\ngfx2snes: 'decode for %d tiles and %d bitplanes'\n", num_tiles, bitplanes);
+    ConvertPlanar(buftolzin + j, buffer, num_tiles, bitplanes);
+    j += num_tiles * 8 * bitplanes;
 
-                    // get row of next bit-plane
-                    for (x = 0; x < 8; x++)
-                    {
-                        data = data << 1;
-                        if (buffer[t * 64 + y * 8 + x] & mask)
-                            data = data + 1;
-                    }
-                    *(buftolzin + j) = data;
-                    j++;
-                }
-            }
-        }
+    // if lzss encoding compress the planar data
+    if (lzsspacked)
+    {
         // Prepare outside buffer
         bufsizeout = j + (j>>3) + 16;
         buftolzout = malloc(bufsizeout);
@@ -780,69 +1016,25 @@ int Convert2Pic(char *filebase, unsigned char *buffer,
             return 0;
         }
 
-        // Compress data and save to disc
-		bufsize = Convert2PicLZ77(quietmode, buftolzin, j, buftolzout);
+        // Compress data and save to disc (2 = with optimal parsing)
+        if (lzsspacked == 2)
+            bufsize = Convert2PicLZ77Optimal(quietmode, buftolzin, j, buftolzout);
+        else
+            bufsize = Convert2PicLZ77(quietmode, buftolzin, j, buftolzout);
         if (bufsize ==0)
         {
+            free(buftolzout);
             free(buftolzin);
             fclose(fp);
             return 0;
         }
 
-        for (i = 0; i < bufsize; i++)
-            fputc(*(buftolzout + i), fp);
+        fwrite(buftolzout, bufsize, 1, fp);
         free(buftolzout);
-        free(buftolzin);
     }
     else
-    {
-        // remember to add the blank if its needed....
-        if (blank_absent)
-		{
-            for (i = 0; i < 8 * bitplanes; i++)
-			{
-                fputc(0, fp);
-			}
-		}
-
-        if (quietmode == 0)
-            printf("\ngfx2snes: 'decode for %d tiles and %d bitplanes'\n", num_tiles, bitplanes);
-
-        for (t = 0; t < num_tiles; t++)        // loop through tiles
-		{
-            for (b = 0; b < bitplanes; b += 2) // loop through bitplane pairs
-			{
-                for (y = 0; y < 8; y++)
-                {
-                    // get bit-mask
-                    mask = 1 << b;
-                    data = 0;
-
-                    // get row of bit-plane and save row
-                    for (x = 0; x < 8; x++)
-                    {
-                        data = data << 1;
-                        if (buffer[t * 64 + y * 8 + x] & mask)
-                            data = data + 1;
-                    }
-                    fputc(data, fp);
-
-                    // adjust bit-mask
-                    mask = mask << 1;
-                    data = 0;
-
-                    // get row of next bit-plane and save row
-                    for (x = 0; x < 8; x++)
-                    {
-                        data = data << 1;
-                        if (buffer[t * 64 + y * 8 + x] & mask)
-                            data = data + 1;
-                    }
-                    fputc(data, fp);
-                }
-			}
-		}
-    }
+        fwrite(buftolzin, j, 1, fp);
+    free(buftolzin);
 
     fclose(fp);
 
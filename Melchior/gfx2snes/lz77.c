@@ -65,6 +65,7 @@
     and anything else that you can think of. Use it at your own risk."
 */
 #include <stdio.h>
+#include <stdlib.h>
 
 /// === TYPES =========================================================
 
@@ -472,3 +473,140 @@ int Convert2PicLZ77(int quietmode, unsigned char *bufin, int buflen, unsigned ch
 
     return OutSize;
 } // end of Convert2PicLZSS
+
+
+/* Convert2PicLZ77Optimal() *************
+   Same format as Convert2PicLZ77(), but instead of taking the longest
+   match at each position, the whole buffer is parsed to find the
+   smallest output:
+   - the longest match at each position is found with hash chains of
+     the 3 bytes strings, with the same window and the same VRAM safety
+     (no match with the previous byte) as the binary trees,
+   - from the end of the buffer, cost[i] is the smallest size in bits
+     to encode bufin[i..], with a literal (8 bits + 1 flag bit) or a
+     match of any length up to the longest one (16 bits + 1 flag bit).
+*/
+#define LZ77_HASHBITS     12   // 3 bytes strings hash table size
+#define LZ77_MAXDIST   (N-F)   // farthest match of the ring buffer
+
+int Convert2PicLZ77Optimal(int quietmode, unsigned char *bufin, int buflen, unsigned char *bufout)
+{
+	int *head, *prev, *cost;
+	unsigned char *matchlen, *choice;
+	unsigned short *matchdist;
+	int i, p, l, maxlen, c, code_buf_ptr, outsize;
+	unsigned int h, savematch;
+	unsigned short mask;
+
+	if(buflen == 0)
+	{
+		printf("\ngfx2snes: error 'Size to compress is null'\n");
+		return 0;
+	}
+
+	head= (int *) malloc((1<<LZ77_HASHBITS) * sizeof(int));
+	prev= (int *) malloc(buflen * sizeof(int));
+	cost= (int *) malloc((buflen+1) * sizeof(int));
+	matchlen= (unsigned char *) calloc(buflen, 1);
+	choice= (unsigned char *) malloc(buflen);
+	matchdist= (unsigned short *) malloc(buflen * sizeof(unsigned short));
+	if(head == NULL || prev == NULL || cost == NULL || matchlen == NULL || choice == NULL || matchdist == NULL)
+	{
+		printf("\ngfx2snes: error 'Can't allocate memory for lz77 optimal parsing'\n");
+		free(head); free(prev); free(cost); free(matchlen); free(choice); free(matchdist);
+		return 0;
+	}
+	for(i=0; i < (1<<LZ77_HASHBITS); i++)
+		head[i]= -1;
+
+	// longest match at each position, the nearest one if several
+	for(i=0; i+THRESHOLD < buflen; i++)
+	{
+		h= ((bufin[i]<<16) | (bufin[i+1]<<8) | bufin[i+2]) * 2654435761u >> (32-LZ77_HASHBITS);
+		maxlen= (buflen-i < F) ? buflen-i : F;
+		for(p= head[h]; p >= 0 && i-p <= LZ77_MAXDIST; p= prev[p])
+		{
+			if(p == i-1)
+				continue;
+			for(l=0; l < maxlen && bufin[p+l] == bufin[i+l]; l++);
+			if(l > matchlen[i])
+			{
+				matchlen[i]= l;
+				matchdist[i]= i-p;
+				if(l == maxlen)
+					break;
+			}
+		}
+		prev[i]= head[h];
+		head[h]= i;
+	}
+
+	// smallest cost from the end, longest match if same cost
+	cost[buflen]= 0;
+	for(i=buflen-1; i >= 0; i--)
+	{
+		cost[i]= cost[i+1] + 9;
+		choice[i]= 1;
+		for(l=THRESHOLD+1; l <= matchlen[i]; l++)
+		{
+			if((c= cost[i+l] + 17) <= cost[i])
+			{
+				cost[i]= c;
+				choice[i]= l;
+			}
+		}
+	}
+
+	// encode the chosen literals & matches, GBA LZSS masks are big-endian
+	outsize= 4;
+	code_buf_ptr= outsize++;
+	bufout[code_buf_ptr]= 0;
+	mask= 0x80;
+	for(i=0; i < buflen; i+= choice[i])
+	{
+		if(choice[i] == 1)
+			bufout[outsize++]= bufin[i];
+		else
+		{
+			bufout[code_buf_ptr] |= mask;
+			savematch= matchdist[i]-1;
+			bufout[outsize++]= ((BYTE)((savematch>>8)&0xf)) | ((choice[i] - (THRESHOLD + 1))<<4);
+			bufout[outsize++]= (BYTE)savematch;
+		}
+		if((mask >>= 1) == 0 && i+choice[i] < buflen)
+		{
+			code_buf_ptr= outsize++;
+			bufout[code_buf_ptr]= 0;
+			mask= 0x80;
+		}
+	}
+
+	free(head);
+	free(prev);
+	free(cost);
+	free(matchlen);
+	free(choice);
+	free(matchdist);
+
+	bufout[0]= CPRS_LZ77_TAG;
+	bufout[1]= ((buflen>>0)&0xFF);
+	bufout[2]= ((buflen>>8)&0xFF);
+	bufout[3]= ((buflen>>16)&0xFF);
+
+	// return an error if ratio<100
+	if ( ((buflen*100)/ outsize)<100)
+	{
+		printf("\ngfx2snes: error 'Ratio for compression is not good (%d%%))'\n",((buflen*100)/ outsize));
+		return 0;
+	}
+
+	// clear trails bytes
+	while (outsize != ALIGN4(outsize))
+		bufout[outsize++]= 0;
+    if (quietmode == 0)
+    {
+        printf("\ngfx2snes: 'Compression Lz77 with optimal parsing from %d bytes to %d bytes (ratio %d%%)'", buflen, outsize, ((buflen*100)/ outsize)-100 );
+    }
+
+    return outsize;
+}
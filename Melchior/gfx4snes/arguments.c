@@ -29,141 +29,200 @@
 #include "arguments.h"
 #include "cmdparser.h"
 #include "gfx4snes.h"
+#include "tiles.h"
 #include <stdio.h>
 
 char errormessage_arg[256];				    								// error message if argument is not correct
 
 //-------------------------------------------------------------------------------------------------
-void argument_set_default_values(void) 
+void argument_set_default_values(t_gfx4snes_args *args) 
 {
-	if (!gfx4snes_args.tilesize) gfx4snes_args.tilesize=8; 
-	if (!gfx4snes_args.mapscreenmode) gfx4snes_args.mapscreenmode=1;
-	if (!gfx4snes_args.paletteoutput) gfx4snes_args.paletteoutput=-1;
-	if (!gfx4snes_args.palettecolors) gfx4snes_args.palettecolors=16;
-	if (!gfx4snes_args.palettesave) gfx4snes_args.palettesave=1;
+	if (!args->tilesize) args->tilesize=8; 
+	if (!args->mapscreenmode) args->mapscreenmode=1;
+	if (!args->paletteoutput) args->paletteoutput=-1;
+	if (!args->palettecolors) args->palettecolors=16;
+	if (!args->palettesave) args->palettesave=1;
+	if (args->palettesolvetime==-1) args->palettesolvetime=1000;
 }
 //-------------------------------------------------------------------------------------------------
-cmdp_action_t argument_callback(cmdp_process_param_st *params)
+// args = options of the image to convert, checked and completed with default values
+// exits gfx4snes if an option is not correct
+void argument_check(t_gfx4snes_args *args)
 {
 	char *filename_dot;
 	int offset,nbcols;
 
-	// if version, go out
-	if (gfx4snes_args.dispversion)
-	{
-		return CMDP_ACT_OK;	
-	}
-	
 	// put default values if not in parametres
-	argument_set_default_values();
+	argument_set_default_values(args);
 	
 	// to have a correct display of messages if we are too fast
 	fflush(stdout);
 
 	// File options -----------------------------------------------
 	// check input filename
-	if (gfx4snes_args.filebase==NULL)
+	if (args->filebase==NULL)
 	{
 		fatal("no image input file\nconversion terminated."); // exit gfx4snes at this point
 	}
 	// remove extension of filename if needed
-	filename_dot = strchr(gfx4snes_args.filebase, '.');
+	filename_dot = strchr(args->filebase, '.');
 	if (filename_dot!=NULL) 
 	{
-		offset = filename_dot - gfx4snes_args.filebase;
-		gfx4snes_args.filebase[offset] = '\0';
+		offset = filename_dot - args->filebase;
+		args->filebase[offset] = '\0';
 	}
 
 	// check file type (default is png, which is NULL value)
-	if (gfx4snes_args.filetype)
+	if (args->filetype)
 	{
-		if (strcmp(gfx4snes_args.filetype,"bmp") && strcmp(gfx4snes_args.filetype,"png")) 
+		if (strcmp(args->filetype,"bmp") && strcmp(args->filetype,"png")) 
 		{
-			fatal("incorrect file type [%s]\nconversion terminated.", gfx4snes_args.filetype); // exit gfx4snes at this point
+			fatal("incorrect file type [%s]\nconversion terminated.", args->filetype); // exit gfx4snes at this point
 		}
 	}
 
 	// Tiles options -----------------------------------------------
 	// check size of image block parameter (default is 8)
-	if ( (gfx4snes_args.tilesize!=8) && (gfx4snes_args.tilesize!=16) && (gfx4snes_args.tilesize!=32) && (gfx4snes_args.tilesize!=64) )
+	if ( (args->tilesize!=8) && (args->tilesize!=16) && (args->tilesize!=32) && (args->tilesize!=64) )
 	{
-		fatal("incorrect size for image block [%d]\nconversion terminated.", gfx4snes_args.tilesize); // exit gfx4snes at this point
+		fatal("incorrect size for image block [%d]\nconversion terminated.", args->tilesize); // exit gfx4snes at this point
 	}
 	// if tile width or height are not like size, reinit them
-	if (!gfx4snes_args.tilewidth) gfx4snes_args.tilewidth=gfx4snes_args.tilesize; 
-	if (!gfx4snes_args.tileheight) gfx4snes_args.tileheight=gfx4snes_args.tilesize; 
-	if (gfx4snes_args.tilewidth != gfx4snes_args.tilesize) {
-		warning("tile width (%d) and size (%d) inconsistent, change size...",gfx4snes_args.tilewidth,gfx4snes_args.tilesize);
-		gfx4snes_args.tilesize=gfx4snes_args.tilewidth;
-	}
-	if (gfx4snes_args.tileheight != gfx4snes_args.tilesize) {
-		if (gfx4snes_args.tilewidth != gfx4snes_args.tilesize) { // only if we are sure that we are going to use squares
-			warning("tile height (%d) and size (%d) inconsistent, change size...",gfx4snes_args.tileheight,gfx4snes_args.tilesize);
-			gfx4snes_args.tilesize=gfx4snes_args.tileheight;
+	if (!args->tilewidth) args->tilewidth=args->tilesize; 
+	if (!args->tileheight) args->tileheight=args->tilesize; 
+	if (args->tilewidth != args->tilesize) {
+		warning("tile width (%d) and size (%d) inconsistent, change size...",args->tilewidth,args->tilesize);
+		args->tilesize=args->tilewidth;
+	}
+	if (args->tileheight != args->tilesize) {
+		if (args->tilewidth != args->tilesize) { // only if we are sure that we are going to use squares
+			warning("tile height (%d) and size (%d) inconsistent, change size...",args->tileheight,args->tilesize);
+			args->tilesize=args->tileheight;
+		}
+	}
+
+	// optimal parsing and chunks are for a LZSS compression
+	if (args->tilelzchunk<0)
+	{
+		fatal("incorrect value for lz77 chunk size [%d]\nconversion terminated.", args->tilelzchunk); // exit gfx4snes at this point
+	}
+	if (args->tilelzoptimal || args->tilelzchunk) args->tilelzpacked=1;
+
+	// check compression format (default is lz77 if compressed, else raw)
+	args->tileformat = args->tilelzpacked ? TILES_LZ77 : TILES_RAW;
+	if (args->tileformatname)
+	{
+		if (!strcmp(args->tileformatname,"lz77")) args->tileformat=TILES_LZ77;
+		else if (!strcmp(args->tileformatname,"lz4")) args->tileformat=TILES_LZ4;
+		else if (!strcmp(args->tileformatname,"rle")) args->tileformat=TILES_RLE;
+		else if (!strcmp(args->tileformatname,"fastest")) args->tileformat=TILES_FASTEST;
+		else
+		{
+			fatal("incorrect compression format [%s]\nconversion terminated.", args->tileformatname); // exit gfx4snes at this point
 		}
 	}
+	if (args->tilelzchunk && ((args->tileformat==TILES_LZ4) || (args->tileformat==TILES_RLE)))
+	{
+		warning("chunks are only for lz77 compression, not used with the %s format", args->tileformatname);
+	}
+
+	// check VRAM budget (default is 0, no budget)
+	if (args->vrambudget<0)
+	{
+		fatal("incorrect value for VRAM budget [%d]\nconversion terminated.", args->vrambudget); // exit gfx4snes at this point
+	}
 
 	// Maps options -----------------------------------------------
 	// check tile offset for map (default is 0)
-	if ( (gfx4snes_args.tileoffset<0) || (gfx4snes_args.tileoffset>2047) )
+	if ( (args->tileoffset<0) || (args->tileoffset>2047) )
 	{
-		fatal("incorrect value for tile offset [%d]\nconversion terminated.", gfx4snes_args.tileoffset); // exit gfx4snes at this point
+		fatal("incorrect value for tile offset [%d]\nconversion terminated.", args->tileoffset); // exit gfx4snes at this point
 	}
 
 	// check map mode (default is 1)
-	if ( (gfx4snes_args.mapscreenmode!=1) && (gfx4snes_args.mapscreenmode!=5) && (gfx4snes_args.mapscreenmode!=6) && (gfx4snes_args.mapscreenmode!=7) && (gfx4snes_args.mapscreenmode!=9) )
+	if ( (args->mapscreenmode!=1) && (args->mapscreenmode!=5) && (args->mapscreenmode!=6) && (args->mapscreenmode!=7) && (args->mapscreenmode!=9) )
 	{
-		fatal("incorrect value for map mode format [%d]\nconversion terminated.", gfx4snes_args.mapscreenmode); // exit gfx4snes at this point
+		fatal("incorrect value for map mode format [%d]\nconversion terminated.", args->mapscreenmode); // exit gfx4snes at this point
 	}
 
 	// Palette options -----------------------------------------------
 	// check automatic palettte management
-	if(gfx4snes_args.paletterearrange)
+	if(args->paletterearrange)
 	{
 		//let nbcols = the number of colors in all 8 palettes
-		nbcols = gfx4snes_args.palettecolors*8;
+		nbcols = args->palettecolors*8;
 		if(nbcols>256) nbcols=256;
 
-		if((gfx4snes_args.palettecolors == 256) || (gfx4snes_args.palettecolors == 128))
+		if((args->palettecolors == 256) || (args->palettecolors == 128))
 		{
 			warning("-o 128 and -o 256 override the -a option. The palette will not be re-arranged");
-			gfx4snes_args.paletterearrange=0;
+			args->paletterearrange=0;
 		}
-		if(gfx4snes_args.mapoutput == 0)
+		if(args->mapoutput == 0)
 		{
 			warning("the -a option means nothing in image block mode. The palette will not be re-arranged");
-			gfx4snes_args.paletterearrange=0;
+			args->paletterearrange=0;
 		}
-		else if((gfx4snes_args.paletteoutput != nbcols) && (gfx4snes_args.paletteoutput != -1))
+		else if((args->paletteoutput != nbcols) && (args->paletteoutput != -1))
 		{
 			warning("-o # is not over-riden, but because -a was selected, anything other than the 8 palettes won't mean much after all the colors are re-arranged");
 		}
 		else
-			gfx4snes_args.paletteoutput=nbcols;
+			args->paletteoutput=nbcols;
 	}
+	// check time budget of the palette solver (default is 1000ms)
+	if (args->palettesolvetime<0)
+	{
+		fatal("incorrect value for palette solver time [%d]\nconversion terminated.", args->palettesolvetime); // exit gfx4snes at this point
+	}
+
 	// check palette entry (default is 0)
-	if ( (gfx4snes_args.paletteentry<0) || (gfx4snes_args.paletteentry>7) )
+	if ( (args->paletteentry<0) || (args->paletteentry>7) )
 	{
-		fatal("incorrect value for palette entry [%d]\nconversion terminated.", gfx4snes_args.paletteentry); // exit gfx4snes at this point
+		fatal("incorrect value for palette entry [%d]\nconversion terminated.", args->paletteentry); // exit gfx4snes at this point
 	}
 
 	// check palette number of color to output (default is 256)
-	if (gfx4snes_args.paletteoutput!=-1) 
+	if (args->paletteoutput!=-1) 
 	{
-		if ( (gfx4snes_args.paletteoutput<0) || (gfx4snes_args.paletteoutput>256) )
+		if ( (args->paletteoutput<0) || (args->paletteoutput>256) )
 		{
-			fatal("incorrect value for palette color to output [%d]\nconversion terminated.", gfx4snes_args.palettecolors); // exit gfx4snes at this point
+			fatal("incorrect value for palette color to output [%d]\nconversion terminated.", args->palettecolors); // exit gfx4snes at this point
 		}
 	}
 	// put default to 256 colors to export
 	else
-		gfx4snes_args.paletteoutput=256;
+		args->paletteoutput=256;
 
 	// check palette number of color to use (default is 256)
-	if ( (gfx4snes_args.palettecolors!=4) && (gfx4snes_args.palettecolors!=16) && (gfx4snes_args.palettecolors!=128) && (gfx4snes_args.palettecolors!=256) )
+	if ( (args->palettecolors!=4) && (args->palettecolors!=16) && (args->palettecolors!=128) && (args->palettecolors!=256) )
 	{
-		fatal("incorrect value for palette color to use [%d]\nconversion terminated.", gfx4snes_args.palettecolors); // exit gfx4snes at this point
+		fatal("incorrect value for palette color to use [%d]\nconversion terminated.", args->palettecolors); // exit gfx4snes at this point
 	}
+}
+
+//-------------------------------------------------------------------------------------------------
+cmdp_action_t argument_callback(cmdp_process_param_st *params)
+{
+	// if version, go out
+	if (gfx4snes_args.dispversion)
+	{
+		return CMDP_ACT_OK;	
+	}
+
+	// a shared tileset is for the images of a manifest
+	if (gfx4snes_args.tileset && !gfx4snes_args.batchfile)
+	{
+		fatal("shared tileset [%s] needs a batch manifest\nconversion terminated.", gfx4snes_args.tileset); // exit gfx4snes at this point
+	}
+
+	// in batch mode, the options are the default ones of each image of the manifest, checked with it
+	if (gfx4snes_args.batchfile)
+	{
+		return CMDP_ACT_OK;	
+	}
+
+	argument_check(&gfx4snes_args);
 
 #if 0
 	// TEST parameters option
@@ -3,9 +3,11 @@
 #define _GFX4SNES_ARGUMENTS_H
 
 #include "cmdparser.h"
+#include "gfx4snes.h"
 
 
 //-------------------------------------------------------------------------------------------------
 cmdp_action_t argument_callback(cmdp_process_param_st* params);
+void argument_check(t_gfx4snes_args* args);
 
 #endif
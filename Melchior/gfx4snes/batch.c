@@ -0,0 +1,426 @@
+/*---------------------------------------------------------------------------------
+
+	Copyright (C) 2012-2023
+		Alekmaul 
+
+	This software is provided 'as-is', without any express or implied
+	warranty.  In no event will the authors be held liable for any
+	damages arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any
+	purpose, including commercial applications, and to alter it and
+	redistribute it freely, subject to the following restrictions:
+
+	1.	The origin of this software must not be misrepresented; you
+		must not claim that you wrote the original software. If you use
+		this software in a product, an acknowledgment in the product
+		documentation would be appreciated but is not required.
+	2.	Altered source versions must be plainly marked as such, and
+		must not be misrepresented as being the original software.
+	3.	This notice may not be removed or altered from any source
+		distribution.
+
+	Image converter for Super Nintendo.
+	Parts from pcx2snes from Neviksti
+	palette rounded option from Artemio Urbina
+  BMP BI_RLE8 compression support by Andrey Beletsky
+	
+***************************************************************************/
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arguments.h"
+#include "batch.h"
+#include "convert.h"
+#include "errors.h"
+#include "threads.h"
+#include "tiles.h"
+#include <malloc.h>
+
+#define BATCH_LINEMAX 1024															// max length of a manifest line
+
+//-------------------------------------------------------------------------------------------------
+// options allowed for each image of the manifest, same names as the command line ones
+typedef enum
+{
+	BATCH_BOOL,
+	BATCH_INT,
+	BATCH_STRING
+} t_batch_type;
+
+typedef struct
+{
+	char shortname;
+	const char* longname;
+	t_batch_type type;
+	size_t offset;																	// offset of the option in t_gfx4snes_args
+} t_batch_option;
+
+static const t_batch_option batch_options[] = {
+	{'b', "til-blank", BATCH_BOOL, offsetof(t_gfx4snes_args, tileblank)},
+	{'s', "til-size", BATCH_INT, offsetof(t_gfx4snes_args, tilesize)},
+	{'k', "til-pack", BATCH_BOOL, offsetof(t_gfx4snes_args, tilepacked)},
+	{'z', "til-lzpack", BATCH_BOOL, offsetof(t_gfx4snes_args, tilelzpacked)},
+	{'Z', "til-lzoptimal", BATCH_BOOL, offsetof(t_gfx4snes_args, tilelzoptimal)},
+	{'C', "til-lzchunk", BATCH_INT, offsetof(t_gfx4snes_args, tilelzchunk)},
+	{'x', "til-format", BATCH_STRING, offsetof(t_gfx4snes_args, tileformatname)},
+	{'X', "til-report", BATCH_BOOL, offsetof(t_gfx4snes_args, tilereport)},
+	{'W', "tile-width", BATCH_INT, offsetof(t_gfx4snes_args, tilewidth)},
+	{'H', "tile-height", BATCH_INT, offsetof(t_gfx4snes_args, tileheight)},
+	{'V', "til-budget", BATCH_INT, offsetof(t_gfx4snes_args, vrambudget)},
+	{'f', "map-offset", BATCH_INT, offsetof(t_gfx4snes_args, tileoffset)},
+	{'m', "map-output", BATCH_BOOL, offsetof(t_gfx4snes_args, mapoutput)},
+	{'g', "map-highpriority", BATCH_BOOL, offsetof(t_gfx4snes_args, maphighpriority)},
+	{'y', "map-32x32", BATCH_BOOL, offsetof(t_gfx4snes_args, map32pages)},
+	{'R', "map-noreduction", BATCH_BOOL, offsetof(t_gfx4snes_args, notilereduction)},
+	{'F', "map-flip", BATCH_BOOL, offsetof(t_gfx4snes_args, mapflipreduction)},
+	{'M', "map-mode", BATCH_INT, offsetof(t_gfx4snes_args, mapscreenmode)},
+	{'a', "pal-rearrange", BATCH_BOOL, offsetof(t_gfx4snes_args, paletterearrange)},
+	{'A', "pal-solvetime", BATCH_INT, offsetof(t_gfx4snes_args, palettesolvetime)},
+	{'d', "pal-rounded", BATCH_BOOL, offsetof(t_gfx4snes_args, paletteround)},
+	{'e', "pal-entry", BATCH_INT, offsetof(t_gfx4snes_args, paletteentry)},
+	{'o', "pal-col-output", BATCH_INT, offsetof(t_gfx4snes_args, paletteoutput)},
+	{'p', "pal-output", BATCH_BOOL, offsetof(t_gfx4snes_args, palettesave)},
+	{'u', "pal-col-use", BATCH_INT, offsetof(t_gfx4snes_args, palettecolors)},
+	{'t', "file-type", BATCH_STRING, offsetof(t_gfx4snes_args, filetype)},
+	{0},
+};
+
+// step of the conversion done by the threads for each image
+typedef enum
+{
+	BATCH_CONVERT,																	// whole conversion of the image
+	BATCH_LOAD,																		// image loaded and converted to tiles (shared tileset)
+	BATCH_SAVE																		// map & palette saved (shared tileset)
+} t_batch_step;
+
+// images to convert, shared by all the threads
+typedef struct
+{
+	t_convert* convs;																// images of the manifest
+	int nbconvs;
+	int next;																		// next image to convert
+	t_mutex mutex;																	// protects next
+	t_batch_step step;
+} t_batch;
+
+//-------------------------------------------------------------------------------------------------
+// str = string to copy
+static char *batch_strdup(const char *str)
+{
+	char *copy;
+
+	copy = (char *) malloc(strlen(str) + 1);
+	if (copy == NULL)
+	{
+		fatal("can't allocate memory for batch manifest");
+	}
+	strcpy(copy, str);
+
+	return copy;
+}
+
+//-------------------------------------------------------------------------------------------------
+// line = manifest line, modified
+// tokens = pointers to the words of the line, words with spaces are between double quotes
+// returns the number of words
+static int batch_splitline(char *line, char **tokens, int maxtokens)
+{
+	int nbtokens = 0;
+
+	while (nbtokens < maxtokens)
+	{
+		while ((*line == ' ') || (*line == '\t') || (*line == '\r') || (*line == '\n')) line++;
+		if ((*line == '\0') || (*line == '#')) break;
+
+		if (*line == '"')
+		{
+			tokens[nbtokens++] = ++line;
+			while ((*line != '\0') && (*line != '"')) line++;
+		}
+		else
+		{
+			tokens[nbtokens++] = line;
+			while ((*line != '\0') && (*line != ' ') && (*line != '\t') && (*line != '\r') && (*line != '\n')) line++;
+		}
+		if (*line == '\0') break;
+		*line++ = '\0';
+	}
+
+	return nbtokens;
+}
+
+//-------------------------------------------------------------------------------------------------
+// manifest = manifest file name, for error messages
+// linenum = line of the manifest
+// args = options of the image, changed by the line options
+// tokens = words of the line, the image file name and its options
+static void batch_parseline(const char *manifest, int linenum, t_gfx4snes_args *args, char **tokens, int nbtokens)
+{
+	const t_batch_option *option;
+	const char *value;
+	char *name;
+	int i;
+
+	for (i = 0; i < nbtokens; i++)
+	{
+		// image file name
+		if (tokens[i][0] != '-')
+		{
+			if (args->filebase != NULL)
+			{
+				fatal("%s(%d): more than one image file [%s]", manifest, linenum, tokens[i]);
+			}
+			args->filebase = batch_strdup(tokens[i]);
+			continue;
+		}
+
+		// find option with its short (-s) or long (--til-size) name, value can be --til-size=16
+		value = NULL;
+		name = tokens[i] + 1;
+		if (*name == '-')
+		{
+			name++;
+			value = strchr(name, '=');
+			if (value != NULL) *(char *) value++ = '\0';
+			for (option = batch_options; option->shortname; option++)
+				if (!strcmp(option->longname, name)) break;
+		}
+		else
+		{
+			for (option = batch_options; option->shortname; option++)
+				if ((name[0] == option->shortname) && (name[1] == '\0')) break;
+		}
+		if (!option->shortname)
+		{
+			fatal("%s(%d): unknown option [%s]", manifest, linenum, tokens[i]);
+		}
+
+		if (option->type == BATCH_BOOL)
+		{
+			*(int *) ((char *) args + option->offset) = 1;
+			continue;
+		}
+		if ((value == NULL) && (i + 1 < nbtokens))
+		{
+			value = tokens[++i];
+		}
+		if (value == NULL)
+		{
+			fatal("%s(%d): missing value for option [%s]", manifest, linenum, tokens[i]);
+		}
+		if (option->type == BATCH_INT)
+			*(int *) ((char *) args + option->offset) = atoi(value);
+		else
+			*(const char **) ((char *) args + option->offset) = batch_strdup(value);
+	}
+
+	if (args->filebase == NULL)
+	{
+		fatal("%s(%d): no image file", manifest, linenum);
+	}
+}
+
+//-------------------------------------------------------------------------------------------------
+// param = t_batch of the images to convert
+static void batch_worker(void *param)
+{
+	t_batch *batch = (t_batch *) param;
+	int i;
+
+	for (;;)
+	{
+		mutex_lock(&batch->mutex);
+		i = batch->next++;
+		mutex_unlock(&batch->mutex);
+
+		if (i >= batch->nbconvs) break;
+		if (batch->step == BATCH_LOAD)
+			convert_load(&batch->convs[i]);
+		else if (batch->step == BATCH_SAVE)
+			convert_save(&batch->convs[i], false);
+		else
+			convert_image(&batch->convs[i]);
+	}
+}
+
+//-------------------------------------------------------------------------------------------------
+// batch = images of the manifest
+// step = step of the conversion done for all the images
+// nbthreads = number of threads doing it, this one included
+// returns the number of threads really used
+static int batch_runstep(t_batch *batch, t_batch_step step, int nbthreads)
+{
+	t_thread *threads;
+	int i;
+
+	batch->step = step;
+	batch->next = 0;
+
+	// this thread is one of the workers
+	threads = (t_thread *) malloc(nbthreads * sizeof(t_thread));
+	if (threads == NULL)
+	{
+		fatal("can't allocate memory for batch threads");
+	}
+	for (i = 1; i < nbthreads; i++)
+	{
+		if (!thread_create(&threads[i], batch_worker, batch))
+		{
+			warning("can't create more than %d threads", i);
+			break;
+		}
+	}
+	nbthreads = i;
+	batch_worker(batch);
+	for (i = 1; i < nbthreads; i++)
+		thread_join(threads[i]);
+	free(threads);
+
+	return nbthreads;
+}
+
+//-------------------------------------------------------------------------------------------------
+// batch = images of the manifest, all with a map
+// name = file name of the shared tileset (without extension)
+// nbthreads = number of threads loading and saving the images
+// isquiet = 0 if we want some messages in console
+// the maps are made one image after the other, in the manifest order, so that the tileset is always the same
+static void batch_sharedtileset(t_batch *batch, const char *name, int nbthreads, bool isquiet)
+{
+	const t_gfx4snes_args *first = &batch->convs[0].args;
+	t_tileset tileset;
+	t_convert *conv;
+	int i, nbtiles = 0;
+
+	// all the images go to the same tiles file
+	for (i = 0; i < batch->nbconvs; i++)
+	{
+		conv = &batch->convs[i];
+		if (!conv->args.mapoutput)
+		{
+			fatal("image [%s] needs a map (-m) to use the shared tileset [%s]", conv->args.filebase, name);
+		}
+		if ((conv->args.palettecolors != first->palettecolors) || (conv->args.mapscreenmode != first->mapscreenmode) || (conv->args.tileblank != first->tileblank)
+			|| (conv->args.tilepacked != first->tilepacked) || (conv->args.tileformat != first->tileformat) || (conv->args.tilelzoptimal != first->tilelzoptimal)
+			|| (conv->args.tilelzchunk != first->tilelzchunk))
+		{
+			fatal("image [%s] has not the same colors, mode, blank tile or packing options than [%s] for the shared tileset [%s]", conv->args.filebase, first->filebase, name);
+		}
+	}
+
+	nbthreads = batch_runstep(batch, BATCH_LOAD, nbthreads);
+
+	map_tileset_init(&tileset);
+	for (i = 0; i < batch->nbconvs; i++)
+	{
+		conv = &batch->convs[i];
+		convert_map(conv, &tileset);
+	}
+	nbtiles = convert_vramtiles(&batch->convs[batch->nbconvs - 1], &tileset);
+
+	// blank tile is already in the tileset if needed
+	if ((first->tilepacked) || (first->mapscreenmode == 7))
+	{
+		tiles_savepacked(name, tileset.tiles, nbtiles, false, isquiet);
+	}
+	else
+	{
+		tiles_save(name, tileset.tiles, nbtiles, first->palettecolors, false, first->tileformat, first->tilelzoptimal, first->tilelzchunk, first->tilereport, isquiet);
+	}
+	if (!isquiet) info("%d tiles in the tileset [%s] shared by %d images", nbtiles, name, batch->nbconvs);
+	map_tileset_free(&tileset);
+
+	batch_runstep(batch, BATCH_SAVE, nbthreads);
+}
+
+//-------------------------------------------------------------------------------------------------
+// manifest = file with one image per line, followed by its options (same as the command line ones)
+// defaults = options used for all the images of the manifest, before their own options
+// nbjobs = number of images converted at the same time (0 = one per processor)
+// isquiet = 0 if we want the summary of the conversion in console
+// returns EXIT_SUCCESS or EXIT_FAILURE
+int batch_run(const char *manifest, const t_gfx4snes_args *defaults, int nbjobs, bool isquiet)
+{
+	t_batch batch = { NULL, 0, 0, MUTEX_INITIALIZER, BATCH_CONVERT };
+	char line[BATCH_LINEMAX];
+	char *tokens[BATCH_LINEMAX / 2];
+	int i, nbtokens, nbthreads, linenum;
+	long long start;
+	long mstotal;
+	FILE *fp;
+
+	start = thread_clockms();
+
+	// read the images and their options
+	fp = fopen(manifest, "r");
+	if (fp == NULL)
+	{
+		fatal("can't open batch manifest [%s]", manifest);
+	}
+	for (linenum = 1; fgets(line, sizeof(line), fp) != NULL; linenum++)
+	{
+		nbtokens = batch_splitline(line, tokens, BATCH_LINEMAX / 2);
+		if (nbtokens == 0) continue;
+
+		batch.convs = (t_convert *) realloc(batch.convs, (batch.nbconvs + 1) * sizeof(t_convert));
+		if (batch.convs == NULL)
+		{
+			fatal("can't allocate memory for batch manifest");
+		}
+		memset(&batch.convs[batch.nbconvs], 0, sizeof(t_convert));
+		batch.convs[batch.nbconvs].args = *defaults;
+		batch.convs[batch.nbconvs].args.filebase = NULL;
+		batch.convs[batch.nbconvs].args.batchfile = NULL;
+		batch.convs[batch.nbconvs].args.tileset = NULL;
+		batch_parseline(manifest, linenum, &batch.convs[batch.nbconvs].args, tokens, nbtokens);
+		argument_check(&batch.convs[batch.nbconvs].args);
+		batch.nbconvs++;
+	}
+	fclose(fp);
+	if (batch.nbconvs == 0)
+	{
+		warning("no image in batch manifest [%s]", manifest);
+		return EXIT_SUCCESS;
+	}
+
+	// messages of different images would be mixed, only the summary is displayed with several threads
+	nbthreads = (nbjobs > 0) ? nbjobs : thread_cpucount();
+	if (nbthreads > batch.nbconvs) nbthreads = batch.nbconvs;
+	if (nbthreads > 1)
+	{
+		for (i = 0; i < batch.nbconvs; i++)
+			batch.convs[i].args.quietmode = 1;
+	}
+	if (!isquiet) info("converting %d images with %d threads...", batch.nbconvs, nbthreads);
+
+	if (defaults->tileset)
+		batch_sharedtileset(&batch, defaults->tileset, nbthreads, isquiet);
+	else
+		batch_runstep(&batch, BATCH_CONVERT, nbthreads);
+
+	// summary of timings
+	mstotal = 0;
+	for (i = 0; i < batch.nbconvs; i++)
+	{
+		t_convert *conv = &batch.convs[i];
+
+		mstotal += conv->msload + conv->msconvert + conv->mssave;
+		if (!isquiet) info("%-32s %6d tiles  load %5ldms  convert %5ldms  save %5ldms", conv->args.filebase, conv->nbtiles, conv->msload, conv->msconvert, conv->mssave);
+	}
+	if (!isquiet) info("%d images converted in %ldms (%ldms for each image one after the other)", batch.nbconvs, (long) (thread_clockms() - start), mstotal);
+
+	// options strings are our own copies
+	for (i = 0; i < batch.nbconvs; i++)
+	{
+		free(batch.convs[i].args.filebase);
+		if (batch.convs[i].args.filetype != defaults->filetype) free((char *) batch.convs[i].args.filetype);
+		if (batch.convs[i].args.tileformatname != defaults->tileformatname) free((char *) batch.convs[i].args.tileformatname);
+	}
+	free(batch.convs);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,11 @@
+#ifndef _GFX4SNES_BATCH_H
+#define _GFX4SNES_BATCH_H
+
+#include <stdbool.h>
+
+#include "gfx4snes.h"
+
+//-------------------------------------------------------------------------------------------------
+extern int batch_run(const char* manifest, const t_gfx4snes_args* defaults, int nbjobs, bool isquiet);
+
+#endif
@@ -0,0 +1,196 @@
+/*---------------------------------------------------------------------------------
+
+	Copyright (C) 2012-2023
+		Alekmaul 
+
+	This software is provided 'as-is', without any express or implied
+	warranty.  In no event will the authors be held liable for any
+	damages arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any
+	purpose, including commercial applications, and to alter it and
+	redistribute it freely, subject to the following restrictions:
+
+	1.	The origin of this software must not be misrepresented; you
+		must not claim that you wrote the original software. If you use
+		this software in a product, an acknowledgment in the product
+		documentation would be appreciated but is not required.
+	2.	Altered source versions must be plainly marked as such, and
+		must not be misrepresented as being the original software.
+	3.	This notice may not be removed or altered from any source
+		distribution.
+
+	Image converter for Super Nintendo.
+	Parts from pcx2snes from Neviksti
+	palette rounded option from Artemio Urbina
+  BMP BI_RLE8 compression support by Andrey Beletsky
+	
+***************************************************************************/
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "convert.h"
+#include "errors.h"
+#include "maps.h"
+#include "palettes.h"
+#include "threads.h"
+#include "tiles.h"
+#include <malloc.h>
+
+//-------------------------------------------------------------------------------------------------
+// conv = image to load, with its options in conv->args
+// loads the image and its palette, and converts it to snes tiles
+void convert_load(t_convert *conv)
+{
+	t_gfx4snes_args *args = &conv->args;
+	unsigned char *tiles_nomap;																		// tiles in snes format when no map generated
+	int nbtiles,nbtilesx;																			// number of tiles to save (nbtilesx is useless with map output)
+	int blksx,blksy;
+	long long start;
+
+	start=thread_clockms();
+
+	// load image file
+	image_load(args->filebase, args->filetype, &conv->image, args->quietmode);
+
+	// convert palette to a snes format
+	palette_convert_snes((t_RGB_color *) &conv->image.palette,(int *) &conv->palette, args->paletteround, args->quietmode);
+	conv->msload=thread_clockms()-start; start+=conv->msload;
+
+	// processes image file
+	blksx=nbtilesx=conv->image.header.width/args->tilewidth; blksy=nbtiles=conv->image.header.height/args->tileheight;
+	if (conv->image.header.width%args->tilewidth) { blksx++; nbtilesx++; }
+	if (conv->image.header.height%args->tileheight) { blksy++; nbtiles++; }
+
+	// if we generate a map
+	if (args->mapoutput)
+	{
+		// convert tiles to a snes format (8x8)
+		conv->tiles=tiles_convertsnes (conv->image.buffer, conv->image.header.width, conv->image.header.height, args->tilewidth, args->tileheight, &nbtilesx, &nbtiles, 8, args->quietmode);
+
+		// if we want to make palettes before, just do it !
+		if (args->paletterearrange) 
+		{
+			palette_rearrange_snes(conv->image.buffer, (int *) &conv->palette, nbtiles, args->palettecolors, args->palettesolvetime, args->quietmode);
+		}
+	}
+	// no map, only tiles (for sprites certainly)
+	else {
+		// first conversion in SNES image block format
+		tiles_nomap=tiles_convertsnes (conv->image.buffer, conv->image.header.width, conv->image.header.height, args->tilewidth, args->tileheight, &blksx, &blksy, 16*8, args->quietmode);
+
+		// now re-arrange into a list of 8x8 blocks for easy conversion
+		blksx *= args->tilewidth/8;
+		blksy *= args->tileheight/8;
+
+		// second  conversion in SNES image block format
+		conv->tiles=tiles_convertsnes (tiles_nomap, blksx*8, blksy*8, 8, 8, &blksx, &blksy, 8, args->quietmode);
+		free(tiles_nomap);
+		
+		nbtiles=blksx*blksy;
+	}
+	conv->nbtiles=nbtiles;
+	conv->blksx=blksx; conv->blksy=blksy;
+	conv->msconvert=thread_clockms()-start;
+}
+
+//-------------------------------------------------------------------------------------------------
+// conv = image loaded by convert_load()
+// tileset = tileset shared with other images where the tiles of the map are added, NULL to keep them in conv->tiles
+void convert_map(t_convert *conv, t_tileset *tileset)
+{
+	t_gfx4snes_args *args = &conv->args;
+	long long start;
+
+	start=thread_clockms();
+
+	// convert map to a snes format if needed and /!\ optimize tiles in conv->tiles
+	if (args->mapoutput)
+	{
+		conv->map=map_convertsnes (conv->tiles, &conv->nbtiles, tileset, args->tilewidth, args->tileheight, conv->blksx, conv->blksy, args->palettecolors, args->paletteentry , args->mapscreenmode, args->notilereduction, args->mapflipreduction, args->tileblank, args->map32pages, args->quietmode);
+	}
+
+	// tiles of a shared tileset are checked with the whole tileset
+	convert_checkbudget(conv, tileset);
+	conv->msconvert+=thread_clockms()-start;
+}
+
+//-------------------------------------------------------------------------------------------------
+// conv = image converted by convert_map()
+// istiles = 1 to save the tiles of the image, 0 if they are in a shared tileset
+void convert_save(t_convert *conv, bool istiles)
+{
+	t_gfx4snes_args *args = &conv->args;
+	long long start;
+
+	start=thread_clockms();
+
+	// save now the map
+	if (args->mapoutput)
+	{
+		map_save (args->filebase, conv->map,args->mapscreenmode, conv->blksx, conv->blksy, args->tileoffset,args->maphighpriority, args->quietmode);
+	}
+
+	// save tiles (if not in a shared tileset)
+	if (istiles)
+	{
+		if ((args->tilepacked) || (args->mapscreenmode==7))
+		{
+			tiles_savepacked (args->filebase, conv->tiles,conv->nbtiles, args->tileblank, args->quietmode);
+		}
+		else
+		{
+			tiles_save (args->filebase, conv->tiles,conv->nbtiles, args->palettecolors, args->tileblank, args->tileformat, args->tilelzoptimal, args->tilelzchunk, args->tilereport,args->quietmode);
+		}
+	}
+
+	// save palette if needed
+	if (args->palettesave)
+	{
+		palette_save (args->filebase,(int *) &conv->palette,args->paletteoutput , args->quietmode);
+	}
+	conv->mssave=thread_clockms()-start;
+
+	// free memory used for image processing
+	if (conv->map != NULL) free(conv->map);
+	if (conv->tiles != NULL) free(conv->tiles);
+	if (conv->image.buffer != NULL) free (conv->image.buffer);
+	conv->map=NULL; conv->tiles=NULL; conv->image.buffer=NULL;
+}
+
+//-------------------------------------------------------------------------------------------------
+// conv = image to convert, with its options in conv->args
+// all the state of the conversion is in conv, so that images can be converted in parallel
+void convert_image(t_convert *conv)
+{
+	convert_load(conv);
+	convert_map(conv, NULL);
+	convert_save(conv, true);
+}
+
+//-------------------------------------------------------------------------------------------------
+// conv = image converted by convert_map()
+// tileset = tileset shared with other images, NULL if the image has its own tiles
+// returns the number of 8x8 tiles in VRAM with this image (the whole tileset if it is shared)
+int convert_vramtiles(const t_convert *conv, const t_tileset *tileset)
+{
+	// map_convertsnes() counts 16x8 tiles of modes 5 & 6 as two 8x8 tiles, and all the tiles of a shared tileset
+	// the blank tile is added when the tiles of the image are saved, a shared tileset already has it
+	return conv->nbtiles + (((tileset == NULL) && conv->args.tileblank) ? 1 : 0);
+}
+
+//-------------------------------------------------------------------------------------------------
+// conv = image converted, with the VRAM budget in conv->args.vrambudget (0 = no budget)
+// tileset = tileset shared with other images, NULL if the image has its own tiles
+// exits gfx4snes if the tiles do not fit in the budget
+void convert_checkbudget(const t_convert *conv, const t_tileset *tileset)
+{
+	int nbtiles = convert_vramtiles(conv, tileset);
+
+	if ((conv->args.vrambudget > 0) && (nbtiles > conv->args.vrambudget))
+	{
+		fatal("%d tiles with image [%s], more than the VRAM budget of %d tiles\nconversion terminated.", nbtiles, conv->args.filebase, conv->args.vrambudget);
+	}
+	if (!conv->args.quietmode && (conv->args.vrambudget > 0)) info("%d tiles of the VRAM budget of %d tiles used",nbtiles,conv->args.vrambudget);
+}
@@ -0,0 +1,31 @@
+#ifndef _GFX4SNES_CONVERT_H
+#define _GFX4SNES_CONVERT_H
+
+#include "gfx4snes.h"
+#include "images.h"
+#include "maps.h"
+
+//-------------------------------------------------------------------------------------------------
+typedef struct
+{
+	t_gfx4snes_args args;														// options used for this image
+	t_image image;																// image converted
+	int palette[256];															// palette in snes format (5bits RGB)
+	unsigned short* map;														// map in snes format (16 bits table)
+	unsigned char* tiles;														// tiles in snes format
+	int nbtiles;																// number of tiles saved
+	int blksx, blksy;															// number of image blocks in width & height
+	long msload;																// time (in ms) to load the image
+	long msconvert;																// time (in ms) to convert tiles, map & palette
+	long mssave;																// time (in ms) to save the files
+} t_convert;
+
+//-------------------------------------------------------------------------------------------------
+extern void convert_load(t_convert* conv);
+extern void convert_map(t_convert* conv, t_tileset* tileset);
+extern void convert_save(t_convert* conv, bool istiles);
+extern void convert_image(t_convert* conv);
+extern int convert_vramtiles(const t_convert* conv, const t_tileset* tileset);
+extern void convert_checkbudget(const t_convert* conv, const t_tileset* tileset);
+
+#endif
@@ -28,7 +28,9 @@
 ***************************************************************************/
 #include <stdlib.h>
 
+#include "batch.h"
 #include "cmdparser.h"
+#include "convert.h"
 #include "gfx4snes.h"
 #include "images.h"
 #include "palettes.h"
@@ -52,17 +54,24 @@ static cmdp_command_st gfx4snes_command = {
 			{'s', "til-size", "size of image blocks in pixels {[8],16,32,64}", CMDP_TYPE_INT4, &gfx4snes_args.tilesize},
 			{'k', "til-pack", "output in packed pixel format", CMDP_TYPE_BOOL, &gfx4snes_args.tilepacked},
 			{'z', "til-lzpack", "add blank tile management (for multiple bgs)", CMDP_TYPE_BOOL, &gfx4snes_args.tilelzpacked},
+			{'Z', "til-lzoptimal", "output in lz77 compressed pixel format with optimal parsing (smaller, slower)", CMDP_TYPE_BOOL, &gfx4snes_args.tilelzoptimal},
+			{'x', "til-format", "compression format of tiles, fastest is the one decoded the fastest", CMDP_TYPE_STRING_PTR, &gfx4snes_args.tileformatname, .type_name = "<lz77,lz4,rle,fastest>"},
+			{'X', "til-report", "display size and decoding time of tiles in each compression format", CMDP_TYPE_BOOL, &gfx4snes_args.tilereport},
+			{'C', "til-lzchunk", "output in lz77 chunks of this number of tiles, each one decompressed on its own {[0]=one chunk}", CMDP_TYPE_INT4, &gfx4snes_args.tilelzchunk},
 			{'W', "tile-width", "width of image block in pixels", CMDP_TYPE_INT4, &gfx4snes_args.tilewidth},
 			{'H', "tile-height", "height of image block in pixels", CMDP_TYPE_INT4, &gfx4snes_args.tileheight},
+			{'V', "til-budget", "fail if the image needs more 8x8 tiles in VRAM than this budget {[0]=no budget}", CMDP_TYPE_INT4, &gfx4snes_args.vrambudget},
             {0, 0, "Maps options:\n", CMDP_TYPE_NONE, NULL,NULL},
 			{'f', "map-offset", "generate the whole picture with an offset for tile number {0..2047}", CMDP_TYPE_INT4, &gfx4snes_args.tileoffset},
 			{'m', "map-output", "include map for output", CMDP_TYPE_BOOL, &gfx4snes_args.mapoutput},
 			{'g', "map-highpriority", "include high priority bit in map", CMDP_TYPE_BOOL, &gfx4snes_args.maphighpriority},
 			{'y', "map-32x32", "generate map in pages of 32x32 (good for scrolling)", CMDP_TYPE_BOOL, &gfx4snes_args.map32pages},
 			{'R', "map-noreduction", "no tile reduction (not advised)", CMDP_TYPE_BOOL, &gfx4snes_args.notilereduction},
+			{'F', "map-flip", "tile reduction with flipped tiles (H/V flip bits in map)", CMDP_TYPE_BOOL, &gfx4snes_args.mapflipreduction},
 			{'M', "map-mode", "convert the whole picture for mode 1,5,6 or 7 format {[1],5,6,7}", CMDP_TYPE_INT4, &gfx4snes_args.mapscreenmode},
             {0, 0, "Palettes options:\n", CMDP_TYPE_NONE, NULL,NULL},
 			{'a', "pal-rearrange", "rearrange palette and preserve palette numbers in tilemap", CMDP_TYPE_BOOL, &gfx4snes_args.paletterearrange},
+			{'A', "pal-solvetime", "time budget of the palette solver in ms, when the rearranged palettes don't fit {0=no budget,[1000]}", CMDP_TYPE_INT4, &gfx4snes_args.palettesolvetime},
 			{'d', "pal-rounded", "palette rounding (to a maximum value of 63)", CMDP_TYPE_BOOL, &gfx4snes_args.paletteround},
 			{'e', "pal-entry", "palette entry to add to map tiles {0..7}", CMDP_TYPE_INT4, &gfx4snes_args.paletteentry},
 			{'o', "pal-col-output", "number of colors to output to filename.pal {0..256}", CMDP_TYPE_INT4, &gfx4snes_args.paletteoutput},
@@ -71,6 +80,9 @@ static cmdp_command_st gfx4snes_command = {
             {0, 0, "Files options:\n", CMDP_TYPE_NONE, NULL,NULL},
             {'i', "file-input", "png or bmp image to convert", CMDP_TYPE_STRING_PTR, &gfx4snes_args.filebase},
             {'t', "file-type", "convert a png or bmp file", CMDP_TYPE_STRING_PTR, &gfx4snes_args.filetype, .type_name = "<png,bmp>"},
+            {'B', "batch", "convert all the images of a manifest (one image and its options per line)", CMDP_TYPE_STRING_PTR, &gfx4snes_args.batchfile},
+            {'j', "jobs", "number of images converted at the same time in batch mode {[0]=one per processor}", CMDP_TYPE_INT4, &gfx4snes_args.batchjobs},
+            {'T', "til-shared", "in batch mode, one tileset file shared by the maps of all the images", CMDP_TYPE_STRING_PTR, &gfx4snes_args.tileset},
             {0, 0, "Miscellaneous options:\n", CMDP_TYPE_NONE, NULL,NULL},
 			{'q', "quiet", "quiet mode", CMDP_TYPE_BOOL, &gfx4snes_args.quietmode},
 			{'v', "version", "display version information", CMDP_TYPE_BOOL, &gfx4snes_args.dispversion},
@@ -81,12 +93,7 @@ static cmdp_command_st gfx4snes_command = {
 */
 
 cmdp_ctx gfx4snes_ctx = {0};																		// contect for command line options
-t_gfx4snes_args gfx4snes_args={0};															// generic struct for all arguments
-
-int palette_snes[256];					                        									// palette in snes format (5bits RGB)
-unsigned short *map_snes=NULL;																		// map in snes format (16 bits table)
-unsigned char *tiles_snes=NULL;																		// tiles in snes format
-unsigned char *tiles_snes_nomap=NULL;																// tiles in snes format when no map generated
+t_gfx4snes_args gfx4snes_args={.palettesolvetime=-1};															// generic struct for all arguments
 
 //-------------------------------------------------------------------------------------------------
 void display_version(void)
@@ -102,8 +109,7 @@ int main(int argc, const char **argv)
 {
 	int parseret;
 	clock_t startimgconv, endimgconv;																// start and finished time for conversion
-	int nbtiles,nbtilesx;																			// number of tiles to save (nbtilesx is useless with map output)
-	int blksx,blksy;
+	t_convert conv={0};																				// image converted with its options
 
 	// get the current time
 	startimgconv=clock();
@@ -137,72 +143,15 @@ int main(int argc, const char **argv)
 	// begin process
 	info("(%s) version %s",GFX4SNESVERSION,GFX4SNESDATE);
 
-	// load image file
-	image_load(gfx4snes_args.filebase, gfx4snes_args.filetype, &snesimage, gfx4snes_args.quietmode);
-	
-	// convert palette to a snes format
-	palette_convert_snes((t_RGB_color *) &snesimage.palette,(int *) &palette_snes, gfx4snes_args.paletteround, gfx4snes_args.quietmode);
-
-	// processes image file
-	blksx=nbtilesx=snesimage.header.width/gfx4snes_args.tilewidth; blksy=nbtiles=snesimage.header.height/gfx4snes_args.tileheight;
-	if (snesimage.header.width%gfx4snes_args.tilewidth) { blksx++; nbtilesx++; }
-	if (snesimage.header.height%gfx4snes_args.tileheight) { blksy++; nbtiles++; }
-
-	// if we generate a map
-	if (gfx4snes_args.mapoutput)
-	{
-		// convert tiles to a snes format (8x8)
-		tiles_snes=tiles_convertsnes (snesimage.buffer, snesimage.header.width, snesimage.header.height, gfx4snes_args.tilewidth, gfx4snes_args.tileheight, &nbtilesx, &nbtiles, 8, gfx4snes_args.quietmode);
-
-		// if we want to make palettes before, just do it !
-		if (gfx4snes_args.paletterearrange) 
-		{
-			palette_rearrange_snes(snesimage.buffer, (int *) &palette_snes, nbtiles, gfx4snes_args.palettecolors, gfx4snes_args.quietmode);
-		}
-
-		// convert map to a snes format if needed and /!\ optimize tiles in tiles_snes
-		map_snes=map_convertsnes (tiles_snes, &nbtiles, gfx4snes_args.tilewidth, gfx4snes_args.tileheight, blksx, blksy, gfx4snes_args.palettecolors, gfx4snes_args.paletteentry , gfx4snes_args.mapscreenmode, gfx4snes_args.notilereduction, gfx4snes_args.tileblank, gfx4snes_args.map32pages, gfx4snes_args.quietmode);
-
-		// save now the map
-		map_save (gfx4snes_args.filebase, map_snes,gfx4snes_args.mapscreenmode, blksx, blksy, gfx4snes_args.tileoffset,gfx4snes_args.maphighpriority, gfx4snes_args.quietmode);
-	}
-	// no map, only tiles (for sprites certainly)
-	else {
-		// first conversion in SNES image block format
-		tiles_snes_nomap=tiles_convertsnes (snesimage.buffer, snesimage.header.width, snesimage.header.height, gfx4snes_args.tilewidth, gfx4snes_args.tileheight, &blksx, &blksy, 16*8, gfx4snes_args.quietmode);
-
-		// now re-arrange into a list of 8x8 blocks for easy conversion
-		blksx *= gfx4snes_args.tilewidth/8;
-		blksy *= gfx4snes_args.tileheight/8;
-
-		// second  conversion in SNES image block format
-		tiles_snes=tiles_convertsnes (tiles_snes_nomap, blksx*8, blksy*8, 8, 8, &blksx, &blksy, 8, gfx4snes_args.quietmode);
-		free(tiles_snes_nomap);
-		
-		nbtiles=blksx*blksy;
-	}
-
-	// save tiles
-	if ((gfx4snes_args.tilepacked) || (gfx4snes_args.mapscreenmode==7))
-	{
-		tiles_savepacked (gfx4snes_args.filebase, tiles_snes,nbtiles, gfx4snes_args.tileblank, gfx4snes_args.quietmode);
-	}
-	else
-	{
-		tiles_save (gfx4snes_args.filebase, tiles_snes,nbtiles, gfx4snes_args.palettecolors, gfx4snes_args.tileblank, gfx4snes_args.tilelzpacked,gfx4snes_args.quietmode);
-
-	}
-
-	// save palette if needed
-	if (gfx4snes_args.palettesave)
+	// convert all the images of the manifest
+	if (gfx4snes_args.batchfile)
 	{
-		palette_save (gfx4snes_args.filebase,(int *) &palette_snes,gfx4snes_args.paletteoutput , gfx4snes_args.quietmode);
+		return batch_run(gfx4snes_args.batchfile, &gfx4snes_args, gfx4snes_args.batchjobs, gfx4snes_args.quietmode);
 	}
 
-	// free memory used for image processing
-	if (map_snes != NULL) free(map_snes);
-	if (tiles_snes != NULL) free(tiles_snes);
-	if (snesimage.buffer != NULL) free (snesimage.buffer);
+	// convert the image
+	conv.args=gfx4snes_args;
+	convert_image(&conv);
 
 	// display time processing
 	endimgconv=clock();
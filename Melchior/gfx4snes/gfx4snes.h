@@ -18,12 +18,19 @@ typedef struct
 	int tileheight;
 	int notilereduction;	        								    		// 1 = no tile reduction (warning !)
 	int tilelzpacked;                     										// 1 = compress file with LZSS algorithm
+	int tilelzoptimal;                     										// 1 = LZSS compression with optimal parsing (implies tilelzpacked)
+	int tilelzchunk;                     										// number of tiles of each LZSS chunk compressed on its own (0 = one chunk, else implies tilelzpacked)
+	const char* tileformatname;			    									// lz77, lz4, rle or fastest = compression format of tiles
+	int tileformat;                     										// compression format of tiles (TILES_RAW, ..), from tilelzpacked & tileformatname
+	int tilereport;                     										// 1 = display size and decoding time of tiles in each format
 	int tilepacked;                     										// 1 = compress file with packed pixel format
 	int tileoffset;                                                             // tile offset (0..2047)
+	int vrambudget;                                                             // max number of 8x8 tiles in VRAM (0 = no budget)
 	int mapscreenmode;															// screen mode for map generation (1 or 7)
 	int mapoutput;				    											// 1 = save the map
 	int maphighpriority;                                                        // 1 = b13 of high priority on
 	int map32pages;                                                             // 1 = tile map pages of 32x32 (for scrolling)
+	int mapflipreduction;                                                       // 1 = tile reduction with flipped tiles (H/V flip bits in map)
 
 	int paletteoutput;	            											// -1= not managed, number of color for palette output 
 	int paletteentry;		        											// value of palette entry (0 to 15)
@@ -31,9 +38,14 @@ typedef struct
 	int palettesave;		           											// 1 = save the palette
 	int paletteround;                  											// 1 = round palette up & down
 	int paletterearrange;				    									// 1 = compute palette to fit with snes capabilities
+	int palettesolvetime;			    										// time budget of the palette solver when the rearrangement doesn't fit (ms, 0 = no budget, -1 = default)
+
+	char* batchfile;			    											// manifest of the images to convert in batch mode
+	int batchjobs;			    												// number of images converted at the same time (0 = one per processor)
+	char* tileset;			    												// file of the tileset shared by all the images in batch mode (NULL = one per image)
 } t_gfx4snes_args;
 
 //-------------------------------------------------------------------------------------------------
-t_gfx4snes_args gfx4snes_args;
+extern t_gfx4snes_args gfx4snes_args;
 
 #endif
@@ -34,8 +34,6 @@
 #include "lodepng.h"
 #include <malloc.h>
 
-t_image snesimage={0};														// current image converted
-
 //-------------------------------------------------------------------------------------------------
 void image_load_png(const char *filename, t_image *img, bool isquiet) 
 {
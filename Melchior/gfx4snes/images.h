@@ -25,7 +25,6 @@ typedef struct pngbmp_image_typ
 	unsigned char* buffer;                                          // The buffer to hold the image
 } t_image;
 
-extern t_image snesimage;											// current image converted
 
 //-------------------------------------------------------------------------------------------------
 extern void image_load(const char* filename, const char* filetype, t_image* img, bool isquiet);
@@ -65,6 +65,7 @@
     and anything else that you can think of. Use it at your own risk."
 */
 #include "lz77.h"
+#include "threads.h"
 
 /// === TYPES =========================================================
 
@@ -88,8 +89,8 @@ typedef struct RECORD
 
 // Define information for compression
 //   (dont modify from 4096/18/2 if AGBCOMP format is required)
-#define N               4096   // size of ring buffer (12 bit)
-#define F                 18   // upper limit for match_length
+#define N             LZ77_N   // size of ring buffer (12 bit)
+#define F             LZ77_F   // upper limit for match_length
 #define THRESHOLD          2   // encode string into position and length
                                //   if matched length is greater than this 
 #define NIL                N   // index for root of binary search trees 
@@ -101,22 +102,20 @@ typedef struct RECORD
 // GLOBALS
 // --------------------------------------------------------------------
 
-/* Compressor global variables.  If you actually want to USE this
-   code in a non-trivial app, put these global variables in a struct,
-   as the Allegro library did.
+/* Compressor global variables are in a t_lz77 context, as the Allegro
+   library did, so that buffers can be compressed in parallel, each one
+   with its own context.
 */
-static unsigned int codesize = 0;  // code size counter
-unsigned int textsize = 0; /* text size counter */
 
-// ring buffer of size N with extra F-1 bytes to facilitate string comparison
-unsigned char text_buf[N + F - 1];
-int match_position;  // global string match position
-int match_length;  // global string match length
-int lson[N+1], rson[N+256+1], dad[N+1];  // left & right children & parents -- These constitute binary search trees.
-
-
-//BYTE *InBuf, *OutBuf;
-int InSize, OutSize, InOffset;
+// buffers of a job list, shared by the threads compressing them
+typedef struct
+{
+	t_lz77job* jobs;
+	int nbjobs;
+	int next;          // next buffer to compress
+	t_mutex mutex;     // protects next
+	bool isoptimal;
+} t_lz77jobs;
 
 
 // --------------------------------------------------------------------
@@ -129,12 +128,12 @@ int InSize, OutSize, InOffset;
 int cprs_gba_lz77(RECORD *dst, const RECORD *src);
 
 /* Binary search tree functions */
-void InitTree(void);
-void InsertNode(int r);
-void DeleteNode(int p);
+static void InitTree(t_lz77 *lz);
+static void InsertNode(t_lz77 *lz, int r);
+static void DeleteNode(t_lz77 *lz, int p);
 
 /* Misc Functions */
-int InChar(unsigned char *bufin);
+static int InChar(t_lz77 *lz, unsigned char *bufin);
 
 
 // --------------------------------------------------------------------
@@ -184,13 +183,13 @@ int cprs_gba_lz77(RECORD *dst, const RECORD *src)
    for strings that begin with character i.  These are
    initialized to NIL.  Note there are 256 trees.
 */
-void InitTree(void)
+static void InitTree(t_lz77 *lz)
 {
 	int  i;
 	for(i= N+1; i <= N+256; i++)
-		rson[i]= NIL;
+		lz->rson[i]= NIL;
 	for(i=0; i < N; i++)
-		dad[i]= NIL;
+		lz->dad[i]= NIL;
 }
 
 /* InsertNode() ************************
@@ -201,44 +200,44 @@ void InitTree(void)
    one, because the old one will be deleted sooner.
    Note r plays double role, as tree node and position in buffer.
 */
-void InsertNode(int r)
+static void InsertNode(t_lz77 *lz, int r)
 {
 	int  i, p, cmp/*, prev_length*/;
 	BYTE *key;
 
-	cmp= 1;  key= &text_buf[r];  p= N + 1 + key[0];
-	rson[r]= lson[r]= NIL;  
-	/*prev_length= */match_length= 0;
+	cmp= 1;  key= &lz->text_buf[r];  p= N + 1 + key[0];
+	lz->rson[r]= lz->lson[r]= NIL;  
+	/*prev_length= */lz->match_length= 0;
 	for( ; ; )
 	{
 		if(cmp >= 0)
 		{
-			if(rson[p] != NIL)
-				p= rson[p];
+			if(lz->rson[p] != NIL)
+				p= lz->rson[p];
 			else
 			{
-				rson[p]= r;
-				dad[r]= p;
+				lz->rson[p]= r;
+				lz->dad[r]= p;
 				return;
 			}
 		}
 		else
 		{
-			if(lson[p] != NIL)
-				p= lson[p];
+			if(lz->lson[p] != NIL)
+				p= lz->lson[p];
 			else
 			{
-				lson[p]= r;
-				dad[r]= p;
+				lz->lson[p]= r;
+				lz->dad[r]= p;
 				return;
 			}
 
 		}
 		for(i=1; i < F; i++)
-			if((cmp = key[i] - text_buf[p + i]) != 0)
+			if((cmp = key[i] - lz->text_buf[p + i]) != 0)
 				break;
 
-		if(i > match_length)
+		if(i > lz->match_length)
 		{
 			// VRAM safety:
 			// match_length= i ONLY if the matched position 
@@ -247,80 +246,80 @@ void InsertNode(int r)
 			// That's _IT_?!? Yup, that's it.
 			if(p != ((r-1)&NMASK) )
 			{
-				match_length= i;
-				match_position= p;
+				lz->match_length= i;
+				lz->match_position= p;
 			}
-			if(match_length >= F)
+			if(lz->match_length >= F)
 				break;
 		}
 	}
 
 	// Full length match, remove old node in favor of this one
-	dad[r]= dad[p];
-	lson[r]= lson[p];
-	rson[r]= rson[p];
-	dad[lson[p]]= r;
-	dad[rson[p]]= r;
-	if(rson[dad[p]] == p)
-		rson[dad[p]]= r;
+	lz->dad[r]= lz->dad[p];
+	lz->lson[r]= lz->lson[p];
+	lz->rson[r]= lz->rson[p];
+	lz->dad[lz->lson[p]]= r;
+	lz->dad[lz->rson[p]]= r;
+	if(lz->rson[lz->dad[p]] == p)
+		lz->rson[lz->dad[p]]= r;
 	else
-		lson[dad[p]]= r;
-	dad[p]= NIL;
+		lz->lson[lz->dad[p]]= r;
+	lz->dad[p]= NIL;
 }
 
 
 /* DeleteNode() ************************
    Deletes node p from the tree.
 */
-void DeleteNode(int p)  
+static void DeleteNode(t_lz77 *lz, int p)  
 {
 	int  q;
 
-	if(dad[p] == NIL)
+	if(lz->dad[p] == NIL)
 		return;  /* not in tree */
-	if(rson[p] == NIL)
-		q = lson[p];
-	else if(lson[p] == NIL)
-		q = rson[p];
+	if(lz->rson[p] == NIL)
+		q = lz->lson[p];
+	else if(lz->lson[p] == NIL)
+		q = lz->rson[p];
 	else
 	{
-		q = lson[p];
-		if(rson[q] != NIL)
+		q = lz->lson[p];
+		if(lz->rson[q] != NIL)
 		{
 			do {
-				q = rson[q];
-			} while(rson[q] != NIL);
+				q = lz->rson[q];
+			} while(lz->rson[q] != NIL);
 
-			rson[dad[q]] = lson[q];
-			dad[lson[q]] = dad[q];
-			lson[q] = lson[p];
-			dad[lson[p]] = q;
+			lz->rson[lz->dad[q]] = lz->lson[q];
+			lz->dad[lz->lson[q]] = lz->dad[q];
+			lz->lson[q] = lz->lson[p];
+			lz->dad[lz->lson[p]] = q;
 		}
-		rson[q] = rson[p];
-		dad[rson[p]] = q;
+		lz->rson[q] = lz->rson[p];
+		lz->dad[lz->rson[p]] = q;
 	}
 
-	dad[q] = dad[p];
+	lz->dad[q] = lz->dad[p];
 
-	if(rson[dad[p]] == p)
-		rson[dad[p]] = q;
+	if(lz->rson[lz->dad[p]] == p)
+		lz->rson[lz->dad[p]] = q;
 	else
-		lson[dad[p]] = q;
+		lz->lson[lz->dad[p]] = q;
 
-	dad[p] = NIL;
+	lz->dad[p] = NIL;
 }
 
 
 /* InChar() ****************************
    Get the next character from the input stream, or -1 for end of file.
 */
-int InChar(unsigned char *bufin)
+static int InChar(t_lz77 *lz, unsigned char *bufin)
 {
-	return (InOffset < InSize) ? bufin[InOffset++] : -1;
+	return (lz->InOffset < lz->InSize) ? bufin[lz->InOffset++] : -1;
 }
 
 
-int Convert2PicLZ77(unsigned char *bufin, int buflen, unsigned char *bufout,int quietmode)
+static int lz77_compress(t_lz77 *lz, unsigned char *bufin, int buflen, unsigned char *bufout,int quietmode)
 {
 	int  i, c, len, r, s, last_match_length, code_buf_ptr;
 	unsigned char  code_buf[17];
@@ -329,13 +328,14 @@ int Convert2PicLZ77(unsigned char *bufin, int buflen, unsigned char *bufout,int
 	unsigned int curmatch;		// PONDER: doesn't this do what r does?
 	unsigned int savematch;
 
-	InSize= buflen;
+	lz->InSize= buflen;
+	lz->codesize= 0;
 
-	OutSize=4;  // skip the compression type and file size
-	InOffset=0;
-	match_position= curmatch= N-F;
+	lz->OutSize=4;  // skip the compression type and file size
+	lz->InOffset=0;
+	lz->match_position= curmatch= N-F;
 
-	InitTree();  // initialize trees
+	InitTree(lz);  // initialize trees
 	code_buf[0] = 0;  /* code_buf[1..16] saves eight units of code, and
 	code_buf[0] works as eight flags, "0" representing that the unit
 	is an unencoded letter (1 byte), "1" a position-and-length pair
@@ -345,12 +345,12 @@ int Convert2PicLZ77(unsigned char *bufin, int buflen, unsigned char *bufout,int
 
 	// Clear the buffer
 	for(i = s; i < r; i++)
-		text_buf[i] = TEXT_BUF_CLEAR;
+		lz->text_buf[i] = TEXT_BUF_CLEAR;
 	// Read F bytes into the last F bytes of the buffer
-	for(len = 0; len < F && (c = InChar(bufin)) != -1; len++)
-		text_buf[r + len] = c;  
+	for(len = 0; len < F && (c = InChar(lz, bufin)) != -1; len++)
+		lz->text_buf[r + len] = c;  
 	
-	if((textsize=len) == 0)
+	if((lz->textsize=len) == 0)
 	{
 		errorcontinue("size to compress is null");
 		return 0;
@@ -367,33 +367,33 @@ int Convert2PicLZ77(unsigned char *bufin, int buflen, unsigned char *bufout,int
 	//	InsertNode(r - i);
 
 	// Create the first node, sets match_length to 0
-	InsertNode(r);
+	InsertNode(lz, r);
 
 	// GBA LZSS masks are big-endian
 	mask = 0x80;
 	do
 	{
-		if(match_length > len) 
-			match_length = len;  
+		if(lz->match_length > len) 
+			lz->match_length = len;  
 
 		// match too short: add one unencoded byte
-		if(match_length <= THRESHOLD)
+		if(lz->match_length <= THRESHOLD)
 		{
-			match_length = 1;
-			code_buf[code_buf_ptr++] = text_buf[r];
+			lz->match_length = 1;
+			code_buf[code_buf_ptr++] = lz->text_buf[r];
 		} 
 		else	// Long enough: add position and length pair.
 		{
 			code_buf[0] |= mask;	// set match flag
 
 			// 0 byte is 4:length and 4:top 4 bits of match_position
-			savematch= ((curmatch-match_position)&NMASK)-1;
+			savematch= ((curmatch-lz->match_position)&NMASK)-1;
 			code_buf[code_buf_ptr++] = ((BYTE)((savematch>>8)&0xf))
-				| ((match_length - (THRESHOLD + 1))<<4);
+				| ((lz->match_length - (THRESHOLD + 1))<<4);
 
 			code_buf[code_buf_ptr++] = (BYTE)savematch;
 		}
-		curmatch += match_length;
+		curmatch += lz->match_length;
 		curmatch &= NMASK;
 
 		// if mask is empty, the buffer's full; write it out the code buffer
@@ -401,9 +401,9 @@ int Convert2PicLZ77(unsigned char *bufin, int buflen, unsigned char *bufout,int
 		if((mask >>= 1) == 0) 
 		{  
 			for(i=0; i < code_buf_ptr; i++)
-				bufout[OutSize++]= code_buf[i];
+				bufout[lz->OutSize++]= code_buf[i];
 
-			codesize += code_buf_ptr;
+			lz->codesize += code_buf_ptr;
 			code_buf[0] = 0;  
 			code_buf_ptr = 1;
 			mask = 0x80;
@@ -411,33 +411,33 @@ int Convert2PicLZ77(unsigned char *bufin, int buflen, unsigned char *bufout,int
 
 		// Inserts nodes for this match. The last_match_length is 
 		// required because InsertNode changes match_length.
-		last_match_length = match_length;
-		for(i=0; i < last_match_length && (c = InChar(bufin)) != -1; i++) 
+		last_match_length = lz->match_length;
+		for(i=0; i < last_match_length && (c = InChar(lz, bufin)) != -1; i++) 
 		{
-			DeleteNode(s);      // Delete string beforelook-ahead
-			text_buf[s] = c;    // place new bytes
+			DeleteNode(lz, s);      // Delete string beforelook-ahead
+			lz->text_buf[s] = c;    // place new bytes
 			// text_buf[N..N+F> is a double for text_buf[0..F>
 			// for easier string comparison
 			if(s < F-1)
-				text_buf[s + N] = c;
+				lz->text_buf[s + N] = c;
 
 			// add and wrap around the buffer
 			s = (s + 1) & NMASK;
 			r = (r + 1) & NMASK;
 
 			// Register the string in text_buf[r..r+F-1]
-			InsertNode(r);
+			InsertNode(lz, r);
 		}
-		textsize += i;
+		lz->textsize += i;
 
 		while(i++ < last_match_length) 
 		{    
 			// After the end of text
-			DeleteNode(s);            // no need to read, but
+			DeleteNode(lz, s);            // no need to read, but
 			s = (s + 1) & NMASK;
 			r = (r + 1) & NMASK;
 			if(--len)
-				InsertNode(r);        // buffer may not be empty
+				InsertNode(lz, r);        // buffer may not be empty
 		}
 	} while(len > 0);    // until length of string to be processed is zero
 
@@ -445,27 +445,254 @@ int Convert2PicLZ77(unsigned char *bufin, int buflen, unsigned char *bufout,int
 	{     
 		// Send remaining code.
 		for(i=0; i < code_buf_ptr; i++) 
-			bufout[OutSize++]=code_buf[i]; 
+			bufout[lz->OutSize++]=code_buf[i]; 
 
-		codesize += code_buf_ptr;
+		lz->codesize += code_buf_ptr;
 	}
 
 	FileSize= (BYTE*)bufout;
 	FileSize[0]= CPRS_LZ77_TAG;
-	FileSize[1]= ((InSize>>0)&0xFF);
-	FileSize[2]= ((InSize>>8)&0xFF);
-	FileSize[3]= ((InSize>>16)&0xFF);
+	FileSize[1]= ((lz->InSize>>0)&0xFF);
+	FileSize[2]= ((lz->InSize>>8)&0xFF);
+	FileSize[3]= ((lz->InSize>>16)&0xFF);
 	
 	// return an error if ratio<100
-	if ( ((textsize*100)/ OutSize)<100)
+	if ( ((lz->textsize*100)/ lz->OutSize)<100)
 	{
-		errorcontinue("ratio for compression is not good (%d%%))",((textsize*100)/ OutSize));
+		errorcontinue("ratio for compression is not good (%d%%))",((lz->textsize*100)/ lz->OutSize));
 		return 0;
 	}
 	
-	// remove trails bytes and encoding is done
-	OutSize=ALIGN4(OutSize);
-    if (!quietmode) info("compression Lz77 from %d bytes to %d bytes (ratio %d%%)", textsize, OutSize, ((textsize*100)/ OutSize)-100 ); 
+	// clear trails bytes (bufout is not initialized) and encoding is done
+	while (lz->OutSize != ALIGN4(lz->OutSize))
+		bufout[lz->OutSize++]= 0;
+    if (!quietmode) info("compression Lz77 from %d bytes to %d bytes (ratio %d%%)", lz->textsize, lz->OutSize, ((lz->textsize*100)/ lz->OutSize)-100 ); 
     
-    return OutSize;
+    return lz->OutSize;
 } 
+
+
+/* lz77_compressoptimal() **************
+   Same format as lz77_compress(), but instead of taking the longest
+   match at each position, the whole buffer is parsed to find the
+   smallest output:
+   - the longest match at each position is found with hash chains of
+     the 3 bytes strings, with the same window and the same VRAM safety
+     (no match with the previous byte) as the binary trees,
+   - from the end of the buffer, cost[i] is the smallest size in bits
+     to encode bufin[i..], with a literal (8 bits + 1 flag bit) or a
+     match of any length up to the longest one (16 bits + 1 flag bit).
+   All the state is local, it doesn't use the globals of the trees.
+*/
+#define LZ77_HASHBITS     12   // 3 bytes strings hash table size
+#define LZ77_MAXDIST   (N-F)   // farthest match of the ring buffer
+
+static int lz77_compressoptimal(unsigned char *bufin, int buflen, unsigned char *bufout,int quietmode)
+{
+	int *head, *prev, *cost;
+	unsigned char *matchlen, *choice;
+	unsigned short *matchdist;
+	int i, p, l, maxlen, c, code_buf_ptr, outsize;
+	unsigned int h, savematch;
+	unsigned short mask;
+
+	if(buflen == 0)
+	{
+		errorcontinue("size to compress is null");
+		return 0;
+	}
+
+	head= (int *) malloc((1<<LZ77_HASHBITS) * sizeof(int));
+	prev= (int *) malloc(buflen * sizeof(int));
+	cost= (int *) malloc((buflen+1) * sizeof(int));
+	matchlen= (unsigned char *) calloc(buflen, 1);
+	choice= (unsigned char *) malloc(buflen);
+	matchdist= (unsigned short *) malloc(buflen * sizeof(unsigned short));
+	if(head == NULL || prev == NULL || cost == NULL || matchlen == NULL || choice == NULL || matchdist == NULL)
+	{
+		fatal("can't allocate memory for lz77 optimal parsing");
+	}
+	for(i=0; i < (1<<LZ77_HASHBITS); i++)
+		head[i]= -1;
+
+	// longest match at each position, the nearest one if several
+	for(i=0; i+THRESHOLD < buflen; i++)
+	{
+		h= ((bufin[i]<<16) | (bufin[i+1]<<8) | bufin[i+2]) * 2654435761u >> (32-LZ77_HASHBITS);
+		maxlen= (buflen-i < F) ? buflen-i : F;
+		for(p= head[h]; p >= 0 && i-p <= LZ77_MAXDIST; p= prev[p])
+		{
+			if(p == i-1)
+				continue;
+			for(l=0; l < maxlen && bufin[p+l] == bufin[i+l]; l++);
+			if(l > matchlen[i])
+			{
+				matchlen[i]= l;
+				matchdist[i]= i-p;
+				if(l == maxlen)
+					break;
+			}
+		}
+		prev[i]= head[h];
+		head[h]= i;
+	}
+
+	// smallest cost from the end, longest match if same cost
+	cost[buflen]= 0;
+	for(i=buflen-1; i >= 0; i--)
+	{
+		cost[i]= cost[i+1] + 9;
+		choice[i]= 1;
+		for(l=THRESHOLD+1; l <= matchlen[i]; l++)
+		{
+			if((c= cost[i+l] + 17) <= cost[i])
+			{
+				cost[i]= c;
+				choice[i]= l;
+			}
+		}
+	}
+
+	// encode the chosen literals & matches, GBA LZSS masks are big-endian
+	outsize= 4;
+	code_buf_ptr= outsize++;
+	bufout[code_buf_ptr]= 0;
+	mask= 0x80;
+	for(i=0; i < buflen; i+= choice[i])
+	{
+		if(choice[i] == 1)
+			bufout[outsize++]= bufin[i];
+		else
+		{
+			bufout[code_buf_ptr] |= mask;
+			savematch= matchdist[i]-1;
+			bufout[outsize++]= ((BYTE)((savematch>>8)&0xf)) | ((choice[i] - (THRESHOLD + 1))<<4);
+			bufout[outsize++]= (BYTE)savematch;
+		}
+		if((mask >>= 1) == 0 && i+choice[i] < buflen)
+		{
+			code_buf_ptr= outsize++;
+			bufout[code_buf_ptr]= 0;
+			mask= 0x80;
+		}
+	}
+
+	free(head);
+	free(prev);
+	free(cost);
+	free(matchlen);
+	free(choice);
+	free(matchdist);
+
+	bufout[0]= CPRS_LZ77_TAG;
+	bufout[1]= ((buflen>>0)&0xFF);
+	bufout[2]= ((buflen>>8)&0xFF);
+	bufout[3]= ((buflen>>16)&0xFF);
+
+	// return an error if ratio<100
+	if ( ((buflen*100)/ outsize)<100)
+	{
+		errorcontinue("ratio for compression is not good (%d%%))",((buflen*100)/ outsize));
+		return 0;
+	}
+
+	// clear trails bytes (bufout is not initialized) and encoding is done
+	while (outsize != ALIGN4(outsize))
+		bufout[outsize++]= 0;
+	if (!quietmode) info("compression Lz77 with optimal parsing from %d bytes to %d bytes (ratio %d%%)", buflen, outsize, ((buflen*100)/ outsize)-100 );
+
+	return outsize;
+}
+
+
+// lz = compressor context, one for each thread compressing at the same time
+// isoptimal = 1 to parse the whole buffer for the smallest output (slower)
+int lz77_compressbuffer(t_lz77 *lz, unsigned char *bufin, int buflen, unsigned char *bufout,int quietmode, bool isoptimal)
+{
+	if (isoptimal)
+		return lz77_compressoptimal(bufin, buflen, bufout, quietmode);
+
+	return lz77_compress(lz, bufin, buflen, bufout, quietmode);
+}
+
+
+// param = t_lz77jobs of the buffers to compress
+static void lz77_worker(void *param)
+{
+	t_lz77jobs *lzjobs = (t_lz77jobs *) param;
+	t_lz77 *lz;
+	t_lz77job *job;
+	int i;
+
+	lz = (t_lz77 *) malloc(sizeof(t_lz77));
+	if (lz == NULL)
+	{
+		fatal("can't allocate memory for lz77 compression");
+	}
+	for (;;)
+	{
+		mutex_lock(&lzjobs->mutex);
+		i = lzjobs->next++;
+		mutex_unlock(&lzjobs->mutex);
+
+		if (i >= lzjobs->nbjobs) break;
+		job = &lzjobs->jobs[i];
+		job->outsize = lz77_compressbuffer(lz, job->bufin, job->buflen, job->bufout, 1, lzjobs->isoptimal);
+	}
+	free(lz);
+}
+
+
+// jobs = independent buffers to compress, job->outsize is 0 if the buffer was not compressed
+// nbthreads = number of threads compressing them (0 = one per processor)
+// returns 1 if all the buffers are compressed
+int lz77_compressjobs(t_lz77job *jobs, int nbjobs, int nbthreads, bool isoptimal)
+{
+	t_lz77jobs lzjobs = { jobs, nbjobs, 0, MUTEX_INITIALIZER, isoptimal };
+	t_thread *threads;
+	int i;
+
+	if (nbthreads <= 0) nbthreads = thread_cpucount();
+	if (nbthreads > nbjobs) nbthreads = nbjobs;
+
+	// this thread is one of the workers
+	threads = (t_thread *) malloc((nbthreads + 1) * sizeof(t_thread));
+	if (threads == NULL)
+	{
+		fatal("can't allocate memory for lz77 threads");
+	}
+	for (i = 1; i < nbthreads; i++)
+	{
+		if (!thread_create(&threads[i], lz77_worker, &lzjobs))
+			break;
+	}
+	nbthreads = i;
+	lz77_worker(&lzjobs);
+	for (i = 1; i < nbthreads; i++)
+		thread_join(threads[i]);
+	free(threads);
+
+	for (i = 0; i < nbjobs; i++)
+		if (jobs[i].outsize == 0)
+			return 0;
+
+	return 1;
+}
+
+
+// compress one buffer with a context of its own
+int Convert2PicLZ77(unsigned char *bufin, int buflen, unsigned char *bufout,int quietmode, bool isoptimal)
+{
+	t_lz77 *lz;
+	int outsize;
+
+	lz = (t_lz77 *) malloc(sizeof(t_lz77));
+	if (lz == NULL)
+	{
+		fatal("can't allocate memory for lz77 compression");
+	}
+	outsize = lz77_compressbuffer(lz, bufin, buflen, bufout, quietmode, isoptimal);
+	free(lz);
+
+	return outsize;
+}
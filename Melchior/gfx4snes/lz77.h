@@ -1,9 +1,36 @@
 #ifndef _GFX4SNES_LZ77_H
 #define _GFX4SNES_LZ77_H
 
+#include <stdbool.h>
 
+#define LZ77_N 4096																// size of ring buffer (12 bit)
+#define LZ77_F 18																// upper limit for match length
 
 //-------------------------------------------------------------------------------------------------
-extern int Convert2PicLZ77(unsigned char* bufin, int buflen, unsigned char* bufout, int quietmode);
+// state of the compressor, one for each buffer compressed at the same time
+typedef struct
+{
+	unsigned char text_buf[LZ77_N + LZ77_F - 1];								// ring buffer of size N with extra F-1 bytes to facilitate string comparison
+	int match_position;															// string match position
+	int match_length;															// string match length
+	int lson[LZ77_N + 1], rson[LZ77_N + 256 + 1], dad[LZ77_N + 1];				// left & right children & parents -- These constitute binary search trees.
+	int InSize, OutSize, InOffset;
+	unsigned int textsize;														// text size counter
+	unsigned int codesize;														// code size counter
+} t_lz77;
+
+// buffer to compress with lz77_compressjobs()
+typedef struct
+{
+	unsigned char* bufin;														// buffer to compress
+	int buflen;
+	unsigned char* bufout;														// compressed buffer, buflen + buflen/8 + 16 bytes
+	int outsize;																// size of the compressed buffer, 0 if not compressed
+} t_lz77job;
+
+//-------------------------------------------------------------------------------------------------
+extern int lz77_compressbuffer(t_lz77* lz, unsigned char* bufin, int buflen, unsigned char* bufout, int quietmode, bool isoptimal);
+extern int lz77_compressjobs(t_lz77job* jobs, int nbjobs, int nbthreads, bool isoptimal);
+extern int Convert2PicLZ77(unsigned char* bufin, int buflen, unsigned char* bufout, int quietmode, bool isoptimal);
 
 #endif
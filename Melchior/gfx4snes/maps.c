@@ -29,15 +29,296 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include "maps.h"
 
 #include "common.h"
+#include "errors.h"
 #include <malloc.h>
 
+//-------------------------------------------------------------------------------------------------
+// tile = tile pixels
+// sizetile = size of the tile in bytes
+// returns a 64 bits hash of the tile (8 bytes at a time, then byte by byte)
+static unsigned long long map_tilehash(const unsigned char *tile, unsigned int sizetile)
+{
+    unsigned long long hash, word;
+    unsigned int i;
+
+    hash = 0x9e3779b97f4a7c15ULL ^ sizetile;
+    for (i = 0; i + 8 <= sizetile; i += 8)
+    {
+        memcpy(&word, &tile[i], 8);
+        hash = (hash ^ word) * 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 32;
+    }
+    for (; i < sizetile; i++)
+        hash = (hash ^ tile[i]) * 0x100000001b3ULL;
+
+    return hash ^ (hash >> 29);
+}
+
+//-------------------------------------------------------------------------------------------------
+// th = hash table to initialize
+// nbtiles = maximum number of tiles it will hold
+static void map_tilehash_init(t_tilehash *th, unsigned int nbtiles)
+{
+    unsigned int size;
+
+    // keep the table at most half full
+    size = 64;
+    while (size < nbtiles * 2)
+        size <<= 1;
+
+    th->hashes = (unsigned long long *) malloc(size * sizeof(unsigned long long));
+    th->tileno = (int *) calloc(size, sizeof(int));
+    if ((th->hashes == NULL) || (th->tileno == NULL))
+    {
+        fatal("can't allocate enough memory for the tile hash table");
+    }
+    th->mask = size - 1;
+    th->collisions = 0;
+}
+
+//-------------------------------------------------------------------------------------------------
+// th = hash table to double, when it becomes half full
+static void map_tilehash_grow(t_tilehash *th)
+{
+    t_tilehash newth;
+    unsigned int slot, newslot;
+
+    map_tilehash_init(&newth, th->mask + 1);
+    newth.collisions = th->collisions;
+    for (slot = 0; slot <= th->mask; slot++)
+    {
+        if (th->tileno[slot] == 0) continue;
+        for (newslot = (unsigned int) th->hashes[slot] & newth.mask; newth.tileno[newslot] != 0; newslot = (newslot + 1) & newth.mask);
+        newth.hashes[newslot] = th->hashes[slot];
+        newth.tileno[newslot] = th->tileno[slot];
+    }
+
+    free(th->hashes);
+    free(th->tileno);
+    *th = newth;
+}
+
+//-------------------------------------------------------------------------------------------------
+// th = hash table of the kept tiles
+// tiles = tiles buffer, kept tiles first
+// sizetile = size of a tile in bytes
+// tile = tile to look for
+// newtileno = number the tile gets if it is a new one
+// returns the number of the kept tile identical to tile, or newtileno after adding it to the table
+static unsigned int map_tilehash_find(t_tilehash *th, const unsigned char *tiles, unsigned int sizetile, const unsigned char *tile, unsigned int newtileno)
+{
+    unsigned long long hash;
+    unsigned int slot;
+    int tileno;
+
+    hash = map_tilehash(tile, sizetile);
+    for (slot = (unsigned int) hash & th->mask; (tileno = th->tileno[slot]) != 0; slot = (slot + 1) & th->mask)
+    {
+        if (th->hashes[slot] == hash)
+        {
+            if (memcmp(&tiles[(tileno - 1) * sizetile], tile, sizetile) == 0)
+                return tileno - 1;
+            th->collisions++;
+        }
+    }
+
+    // new tile, the caller copies it to newtileno
+    th->hashes[slot] = hash;
+    th->tileno[slot] = newtileno + 1;
+    return newtileno;
+}
+
+//-------------------------------------------------------------------------------------------------
+static void map_tilehash_free(t_tilehash *th)
+{
+    free(th->hashes);
+    free(th->tileno);
+}
+
+//-------------------------------------------------------------------------------------------------
+// flipped = 8x8 tile to write
+// tile = 8x8 tile to flip
+// flip = 1 for an horizontal flip, 2 for a vertical one, 3 for both (bits 14 & 15 of map entries)
+static void map_tileflip(unsigned char *flipped, const unsigned char *tile, unsigned int flip)
+{
+    unsigned int x, y, xs, ys;
+
+    for (y = 0; y < 8; y++)
+    {
+        ys = (flip & 2) ? 7 - y : y;
+        for (x = 0; x < 8; x++)
+        {
+            xs = (flip & 1) ? 7 - x : x;
+            flipped[y * 8 + x] = tile[ys * 8 + xs];
+        }
+    }
+}
+
+//-------------------------------------------------------------------------------------------------
+// canonical = 8x8 tile to write, the smallest (memcmp order) of the four flips of tile
+// tile = 8x8 tile
+// returns the flip that gives canonical from tile (and tile from canonical)
+static unsigned int map_tilecanonical(unsigned char *canonical, const unsigned char *tile)
+{
+    unsigned char flipped[64];
+    unsigned int flip, bestflip;
+
+    memcpy(canonical, tile, 64);
+    bestflip = 0;
+    for (flip = 1; flip < 4; flip++)
+    {
+        map_tileflip(flipped, tile, flip);
+        if (memcmp(flipped, canonical, 64) < 0)
+        {
+            memcpy(canonical, flipped, 64);
+            bestflip = flip;
+        }
+    }
+
+    return bestflip;
+}
+
+//-------------------------------------------------------------------------------------------------
+// tileset = tileset to prepare for the tiles of a map
+// tiles = buffer of the tiles (kept in place, maxtiles at most), NULL if the tileset allocates it
+// maxtiles = number of tiles of the buffer
+// sizetile = size of a tile in bytes
+static void map_tileset_setup(t_tileset *tileset, unsigned char *tiles, unsigned int maxtiles, unsigned int sizetile, bool isnoreduction, bool isflipreduction)
+{
+    tileset->sizetile = sizetile;
+    tileset->isreduction = !isnoreduction;
+    tileset->isflip = isflipreduction;
+    tileset->isowner = (tiles == NULL);
+    if (tileset->isowner)
+    {
+        maxtiles = 256;
+        tiles = (unsigned char *) malloc(maxtiles * sizetile);
+        if (tiles == NULL)
+        {
+            fatal("can't allocate enough memory for the tileset");
+        }
+    }
+    tileset->tiles = tiles;
+    tileset->maxtiles = maxtiles;
+    tileset->nbtiles = 0;
+
+    // with flips, kept tiles are looked up by their canonical form
+    tileset->keys = tiles;
+    tileset->flips = NULL;
+    if (isflipreduction)
+    {
+        tileset->keys = (unsigned char *) malloc(maxtiles * sizetile);
+        tileset->flips = (unsigned char *) malloc(maxtiles);
+        if ((tileset->keys == NULL) || (tileset->flips == NULL))
+        {
+            fatal("can't allocate enough memory for the flipped tiles of the tileset");
+        }
+    }
+    if (tileset->isreduction)
+    {
+        map_tilehash_init(&tileset->hash, maxtiles);
+    }
+}
+
+//-------------------------------------------------------------------------------------------------
+// tileset = tileset receiving the tile
+// tile = tile to add
+// *flip = flip of the kept tile to get tile (bits 14 & 15 of map entries)
+// returns the number of the kept tile identical to tile, or of the new tile
+static unsigned int map_tileset_add(t_tileset *tileset, const unsigned char *tile, unsigned int *flip)
+{
+    unsigned int sizetile = tileset->sizetile;
+    unsigned char canonical[64];
+    const unsigned char *key;
+    unsigned int i, tileflip;
+
+    // make room for a new tile in the tileset we own
+    if (tileset->nbtiles == tileset->maxtiles)
+    {
+        tileset->maxtiles *= 2;
+        tileset->tiles = (unsigned char *) realloc(tileset->tiles, tileset->maxtiles * sizetile);
+        if (tileset->tiles == NULL)
+        {
+            fatal("can't allocate enough memory for the tileset");
+        }
+        if (!tileset->isflip)
+        {
+            tileset->keys = tileset->tiles;
+        }
+        else
+        {
+            tileset->keys = (unsigned char *) realloc(tileset->keys, tileset->maxtiles * sizetile);
+            tileset->flips = (unsigned char *) realloc(tileset->flips, tileset->maxtiles);
+            if ((tileset->keys == NULL) || (tileset->flips == NULL))
+            {
+                fatal("can't allocate enough memory for the flipped tiles of the tileset");
+            }
+        }
+    }
+
+    *flip = 0;
+    key = tile;
+    tileflip = 0;
+    if (tileset->isreduction)
+    {
+        if (tileset->isflip)
+        {
+            tileflip = map_tilecanonical(canonical, tile);
+            key = canonical;
+        }
+        if (tileset->nbtiles * 2 >= tileset->hash.mask)
+        {
+            map_tilehash_grow(&tileset->hash);
+        }
+        i = map_tilehash_find(&tileset->hash, tileset->keys, sizetile, key, tileset->nbtiles);
+        if (i != tileset->nbtiles)
+        {
+            if (tileset->isflip) *flip = tileflip ^ tileset->flips[i];
+            return i;
+        }
+    }
+
+    // new tile (tiles kept in place only move down in the buffer)
+    memmove(&tileset->tiles[tileset->nbtiles * sizetile], tile, sizetile);
+    if (tileset->isflip)
+    {
+        memcpy(&tileset->keys[tileset->nbtiles * sizetile], canonical, sizetile);
+        tileset->flips[tileset->nbtiles] = tileflip;
+    }
+
+    return tileset->nbtiles++;
+}
+
+//-------------------------------------------------------------------------------------------------
+// tileset = tileset to initialize, it is prepared by the first map_convertsnes() using it
+void map_tileset_init(t_tileset *tileset)
+{
+    memset(tileset, 0, sizeof(t_tileset));
+}
+
+//-------------------------------------------------------------------------------------------------
+void map_tileset_free(t_tileset *tileset)
+{
+    if (tileset->isowner) free(tileset->tiles);
+    if (tileset->isflip)
+    {
+        free(tileset->keys);
+        free(tileset->flips);
+    }
+    if (tileset->isreduction) map_tilehash_free(&tileset->hash);
+    memset(tileset, 0, sizeof(t_tileset));
+}
+
 //-------------------------------------------------------------------------------------------------
 // imgbuf = image buffer
 // *nbtiles = number of tiles after map conversion
+// tileset = tileset shared by several images where the tiles are added, NULL to keep them in imgbuf
 // blksizex = size in pixels of image blocks width
 // blksizey = size in pixels of image blocks height
 // nbblockx = number of blocks in width for the image buffer
@@ -47,9 +328,10 @@
 // gaphicmode = snes mode. Specific transformation for mode 5 and 6
 // offsetpal = palette entry (0..7)
 // istilereduction = 1 if we want tile reduction (i hope often ;) )
+// isflipreduction = 1 if a tile can also be a flipped copy of a previous one (8x8 tiles, not for modes 5, 6 & 7)
 // isblanktile = 1 if we want the 1st tile to be blank
 // isquiet = 0 if we want some messages in console
-unsigned short *map_convertsnes (unsigned char *imgbuf, int *nbtiles, int blksizex, int blksizey, int nbblockx, int nbblocky, int nbcolors, int offsetpal, int graphicmode, bool isnoreduction, bool isblanktile, bool is32size, bool isquiet)
+unsigned short *map_convertsnes (unsigned char *imgbuf, int *nbtiles, t_tileset *tileset, int blksizex, int blksizey, int nbblockx, int nbblocky, int nbcolors, int offsetpal, int graphicmode, bool isnoreduction, bool isflipreduction, bool isblanktile, bool is32size, bool isquiet)
 {
     unsigned short *map;                                                            
     unsigned short tilevalue;
@@ -57,6 +339,9 @@ unsigned short *map_convertsnes (unsigned char *imgbuf, int *nbtiles, int blksiz
     unsigned char blanktile[128];
     unsigned int paletteno;
     unsigned int i, x, y;
+    t_tileset localtileset;
+    clock_t startreduction;
+    unsigned int flip, nbflipped, firsttile;
 
     // if mode 5 or 6, reduce number of tiles in x
     if ((graphicmode==5) || (graphicmode==6)) 
@@ -73,6 +358,14 @@ unsigned short *map_convertsnes (unsigned char *imgbuf, int *nbtiles, int blksiz
     // size of a tile block (64 bytes for a 8x8 block)
     sizetile = blksizex*blksizey;
 
+    // flips are for 8x8 tiles with 16 bits map entries
+    if (isflipreduction && (isnoreduction || (sizetile != 64) || (graphicmode == 5) || (graphicmode == 6) || (graphicmode == 7)))
+    {
+        warning("tile reduction with flips needs 8x8 tiles and a mode 1 map, flips not used");
+        isflipreduction = false;
+    }
+    if (!isquiet && isflipreduction) info("will also match tiles flipped horizontally and/or vertically...");
+
     // allocate map
       // get memory for the new buffer
     map = (unsigned short *) malloc(nbblockx * nbblocky * sizeof(unsigned short));
@@ -154,22 +447,42 @@ unsigned short *map_convertsnes (unsigned char *imgbuf, int *nbtiles, int blksiz
     memset(blanktile, 0, sizeof(blanktile));
 
     // do we want tile #0 to be blank..
-    tilevalue = 0;
     blanktileabsent = 0;
-    currenttile = 1;
-    newnbtiles = 1;
-    if (isblanktile == 1)
+    startreduction = clock();
+    if (tileset == NULL)
+    {
+        // tiles are kept in place in imgbuf
+        tileset = &localtileset;
+        map_tileset_setup(tileset, imgbuf, nbblockx * nbblocky, sizetile, isnoreduction, isflipreduction);
+        if (isblanktile == 1)
+        {
+            if (memcmp(blanktile, imgbuf, sizetile) != 0)
+            {
+                blanktileabsent = 1;
+                if (!isquiet) info("no blank tile detected...");
+            }
+            // the first tile is the blank one, the other blank tiles use it
+            else if (!isnoreduction)
+            {
+                map_tileset_add(tileset, imgbuf, &flip);
+            }
+        }
+    }
+    else
     {
-        if (memcmp(blanktile, imgbuf, sizetile) != 0)
+        // the first image sharing the tileset gives its options, with the blank tile at #0 if needed
+        if (tileset->sizetile == 0)
+        {
+            map_tileset_setup(tileset, NULL, 0, sizetile, isnoreduction, isflipreduction);
+            if (isblanktile == 1) map_tileset_add(tileset, blanktile, &flip);
+        }
+        if ((tileset->sizetile != sizetile) || (tileset->isreduction == isnoreduction) || (tileset->isflip != isflipreduction))
         {
-            tilevalue = 1;
-            blanktileabsent = 1;
-            if (!isquiet) info("no blank tile detected...");
+            fatal("images sharing a tileset need the same tile size, mode and reduction options");
         }
     }
-
-    // save the first tilemap piece
-    map[0] += tilevalue;
+    firsttile = tileset->nbtiles;
+    nbflipped = 0;
 
     // add all the tiles to time map
     if (!isquiet) {
@@ -177,60 +490,32 @@ unsigned short *map_convertsnes (unsigned char *imgbuf, int *nbtiles, int blksiz
         else info("check whole bitmap for tile map (%dx%d blocks) with tile reduction...",nbblockx,nbblocky);
     }
 
+    currenttile = 0;
     for (y = 0; y < nbblocky; y++)
     {
         for (x = 0; x < nbblockx; x++)
         {
-            // if we already processed this, move on
-            if ( (x == 0) && (y == 0) )
-                continue;
-
-            // if no tile reduction
-            if (isnoreduction)
-            {   
-                // always add a new tile
-                i = newnbtiles;
-
-                // yes -> add it
-                memcpy(&imgbuf[newnbtiles * sizetile], &imgbuf[currenttile * sizetile], sizetile);
-                tilevalue = newnbtiles + blanktileabsent;
-                newnbtiles++;
+            // check if the current is tile blank?
+            if ((memcmp(blanktile, &imgbuf[currenttile * sizetile], sizetile) == 0) && (isblanktile == 1) && !isnoreduction)
+            {
+                tilevalue = 0;
             }
+            // check for matches with previous tiles if tile reduction on (always a new tile if not)
             else
             {
-                // check if the current is tile blank?
-                if ((memcmp(blanktile, &imgbuf[currenttile * sizetile], sizetile) == 0) && (isblanktile == 1))
-                {
-                    tilevalue = 0;
-                }
-                // check for matches with previous tiles if tile reduction on
-                else
-                {
-                    for (i = 0; i < newnbtiles; i++)
-                    {
-                        if (memcmp(&imgbuf[i * sizetile], &imgbuf[currenttile * sizetile], sizetile) == 0)
-                            break;
-                    }
-
-                    // is it a new tile?
-                    if (i == newnbtiles)
-                    {
-                        // yes -> add it
-                        memcpy(&imgbuf[newnbtiles * sizetile], &imgbuf[currenttile * sizetile], sizetile);
-                        tilevalue = newnbtiles + blanktileabsent;
-                        newnbtiles++;
-                    }
-                    else
-                    { 
-                        // no -> find what tile number it is
-                        tilevalue = i + blanktileabsent;
-                    }
-                }
+                // find what tile number it is, and how it is flipped (bits 14 & 15)
+                i = map_tileset_add(tileset, &imgbuf[currenttile * sizetile], &flip);
+                tilevalue = (i + blanktileabsent) | (flip << 14);
+                if (flip) nbflipped++;
             }
 
             if ((graphicmode==5) || (graphicmode==6))  
             {
-                map[y * nbblockx + x] += (tilevalue<<1);
+                // the first entry of an image with its own tiles is not shifted (only the blank tile offset)
+                if ((currenttile == 0) && (tileset == &localtileset))
+                    map[0] += tilevalue;
+                else
+                    map[y * nbblockx + x] += (tilevalue<<1);
             }
             else {
                 // put tile number in map
@@ -294,10 +579,18 @@ unsigned short *map_convertsnes (unsigned char *imgbuf, int *nbtiles, int blksiz
     }
 
     // also return the number of new tiles (if mode  or ), must be *2because tiles are 16*X
+    newnbtiles = tileset->nbtiles;
     if (!isquiet) {
-        if (!isnoreduction) info("%d tiles (ratio %.0f%%) processed",newnbtiles,100.0-(100.0*newnbtiles/(*nbtiles)));
+        if (tileset != &localtileset) info("%d tiles added to the shared tileset (%d tiles)",newnbtiles-firsttile,newnbtiles);
+        else if (!isnoreduction) info("%d tiles (ratio %.0f%%) processed",newnbtiles,100.0-(100.0*newnbtiles/(*nbtiles)));
         else info("%d tiles processed",newnbtiles);
     }
+    if (!isnoreduction)
+    {
+        if (!isquiet) info("tile reduction of %d tiles done in %ldms (%d hash collisions)",nbblockx*nbblocky,(clock() - startreduction) * 1000 / CLOCKS_PER_SEC,tileset->hash.collisions);
+        if (!isquiet && isflipreduction) info("%d map entries use a flipped tile",nbflipped);
+    }
+    if (tileset == &localtileset) map_tileset_free(tileset);
     *nbtiles = ((graphicmode==5) || (graphicmode==6)) ? newnbtiles<<1 : newnbtiles;
 
     return map;
@@ -4,7 +4,34 @@
 #include <stdbool.h>
 
 //-------------------------------------------------------------------------------------------------
-extern unsigned short* map_convertsnes(unsigned char* imgbuf, int* nbtiles, int blksizex, int blksizey, int nbblockx, int nbblocky, int nbcolors, int offsetpal, int graphicmode, bool isnoreduction, bool isblanktile, bool is32size, bool isquiet);
+// hash table of the tiles kept by the tile reduction, to find a tile in linear time
+typedef struct
+{
+	unsigned long long* hashes;													// hash of the tile in each slot
+	int* tileno;																// kept tile number + 1 in each slot, 0 = empty
+	unsigned int mask;															// number of slots - 1
+	int collisions;																// same hash, different tile
+} t_tilehash;
+
+// tiles kept by the tile reduction, for one image or shared by several ones
+typedef struct
+{
+	unsigned char* tiles;														// kept tiles
+	unsigned char* keys;														// kept tiles as looked up (canonical form with flips, else tiles)
+	unsigned char* flips;														// flip of each kept tile to its canonical form
+	unsigned int nbtiles;														// number of kept tiles
+	unsigned int maxtiles;														// number of tiles the buffers can hold
+	unsigned int sizetile;														// size of a tile in bytes, 0 if not prepared yet
+	bool isreduction;															// 1 = identical tiles are kept once
+	bool isflip;																// 1 = flipped tiles are identical too
+	bool isowner;																// 1 = tiles is allocated by the tileset
+	t_tilehash hash;
+} t_tileset;
+
+//-------------------------------------------------------------------------------------------------
+extern void map_tileset_init(t_tileset* tileset);
+extern void map_tileset_free(t_tileset* tileset);
+extern unsigned short* map_convertsnes(unsigned char* imgbuf, int* nbtiles, t_tileset* tileset, int blksizex, int blksizey, int nbblockx, int nbblocky, int nbcolors, int offsetpal, int graphicmode, bool isnoreduction, bool isflipreduction, bool isblanktile, bool is32size, bool isquiet);
 extern void map_save(const char* filename, unsigned short* map, int snesmode, int nbtilex, int nbtiley, int tileoffset, int priority, bool isquiet);
 
 #endif
@@ -29,10 +29,13 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "palettes.h"
 #include "common.h"
+#include "errors.h"
 #include "images.h"
+#include "threads.h"
 #include <malloc.h>
 
 //-------------------------------------------------------------------------------------------------
@@ -109,17 +112,504 @@ void palette_convert_snes(t_RGB_color *palette, int *palettesnes, bool isrounded
     } // loop through all colors
 }
 
+// a set of the 256 palette entries, one bit per color index
+#define PALETTE_SETWORDS (256/32)
+
+#define palette_setbit(set,color)   ((set)[(color)>>5] |= 1u<<((color)&31))
+#define palette_hasbit(set,color)   (((set)[(color)>>5]>>((color)&31)) & 1)
+
+//-------------------------------------------------------------------------------------------------
+// value = 32 bits of a color set
+static int palette_popcount(unsigned int value)
+{
+    int count = 0;
+
+    while (value)
+    {
+        value &= value - 1;
+        count++;
+    }
+
+    return count;
+}
+
+//-------------------------------------------------------------------------------------------------
+// palettesnes = RGB555 converted palette
+// remap = filled with the first palette entry having the same RGB555 value, for each entry
+static void palette_duplicates(int *palettesnes, unsigned char *remap)
+{
+    int i, ii;
+
+    for (i = 0; i < 256; i++)
+    {
+        remap[i] = i;
+        for (ii = 0; ii < i; ii++)
+        {
+            if (palettesnes[ii] == palettesnes[i])
+            {
+                remap[i] = ii;
+                break;
+            }
+        }
+    }
+}
+
+#define PALETTE_MAXPAL 8                                                    // number of palettes of 4 or 16 colors on snes
+#define PALETTE_SOLVERCHECK 1024                                            // nodes explored between two checks of the time budget
+
+// packing of the color combos of the tiles in the 8 palettes
+typedef struct {
+    unsigned int *sets;                                                     // colors of each combo to pack, greatest first
+    int *counts;                                                            // number of colors of each combo
+    int *assign;                                                            // palette of each combo
+    int nbsets;                                                             // number of combos to pack
+    int nbcolors;                                                           // number of colors of a palette
+    unsigned int bins[PALETTE_MAXPAL * PALETTE_SETWORDS];                   // colors of each palette
+    int binsize[PALETTE_MAXPAL];                                            // number of colors of each palette
+    int nbbins;                                                             // number of palettes used
+    unsigned int *undo;                                                     // colors of the palette before adding each combo
+    long long start;                                                        // time the search started (ms)
+    int solvetime;                                                          // time budget of the search (ms, 0 = no budget)
+    long nodes;                                                             // number of nodes explored
+    bool istimeout;                                                         // true if the search stopped on the time limit
+} t_palsolver;
+
+//-------------------------------------------------------------------------------------------------
+// set1, set2 = color sets
+// returns the number of colors of the union of the two sets
+static int palette_unionsize(unsigned int *set1, unsigned int *set2)
+{
+    int i, count = 0;
+
+    for (i = 0; i < PALETTE_SETWORDS; i++)
+        count += palette_popcount(set1[i] | set2[i]);
+
+    return count;
+}
+
+//-------------------------------------------------------------------------------------------------
+// solver = packing in progress
+// index = combo to put in a palette
+// returns true if all the combos from index are put in the palettes
+static bool palette_solvenext(t_palsolver *solver, int index)
+{
+    unsigned int *set, *undo;
+    int added[PALETTE_MAXPAL];
+    int b, i, nbadd, size;
+
+    if (index == solver->nbsets)
+        return true;
+
+    // check the time budget from time to time
+    if (solver->solvetime && (((++solver->nodes) % PALETTE_SOLVERCHECK) == 0) && (thread_clockms() - solver->start > solver->solvetime))
+        solver->istimeout = true;
+    if (solver->istimeout)
+        return false;
+
+    set = &solver->sets[index * PALETTE_SETWORDS];
+    undo = &solver->undo[index * PALETTE_SETWORDS];
+
+    // number of colors each palette needs to receive the combo (-1 if it can't)
+    for (b = 0; b < solver->nbbins; b++)
+    {
+        size = palette_unionsize(&solver->bins[b * PALETTE_SETWORDS], set);
+        added[b] = (size <= solver->nbcolors) ? size - solver->binsize[b] : -1;
+
+        // a palette that already has all the colors is always the best choice
+        if (added[b] == 0)
+        {
+            solver->assign[index] = b;
+            return palette_solvenext(solver, index + 1);
+        }
+    }
+
+    // try the palettes that need the fewest colors first
+    for (nbadd = 1; nbadd < solver->nbcolors; nbadd++)
+    {
+        for (b = 0; b < solver->nbbins; b++)
+        {
+            if (added[b] != nbadd)
+                continue;
+
+            memcpy(undo, &solver->bins[b * PALETTE_SETWORDS], PALETTE_SETWORDS * sizeof(int));
+            for (i = 0; i < PALETTE_SETWORDS; i++)
+                solver->bins[b * PALETTE_SETWORDS + i] |= set[i];
+            solver->binsize[b] += nbadd;
+            solver->assign[index] = b;
+
+            if (palette_solvenext(solver, index + 1))
+                return true;
+
+            memcpy(&solver->bins[b * PALETTE_SETWORDS], undo, PALETTE_SETWORDS * sizeof(int));
+            solver->binsize[b] -= nbadd;
+            if (solver->istimeout)
+                return false;
+        }
+    }
+
+    // then a new palette (empty palettes are all the same, only one is tried)
+    if (solver->nbbins < PALETTE_MAXPAL)
+    {
+        b = solver->nbbins++;
+        memcpy(&solver->bins[b * PALETTE_SETWORDS], set, PALETTE_SETWORDS * sizeof(int));
+        solver->binsize[b] = solver->counts[index];
+        solver->assign[index] = b;
+
+        if (palette_solvenext(solver, index + 1))
+            return true;
+
+        solver->nbbins--;
+    }
+
+    return false;
+}
+
+//-------------------------------------------------------------------------------------------------
+// solver = packing in progress
+// bincounts = number of combos using each color of each palette
+// index = combo to test
+// bin = palette to test
+// returns the number of colors of the palette with the combo (or without it if it is already in the palette)
+static int palette_binsize(t_palsolver *solver, int *bincounts, int index, int bin)
+{
+    int c, size;
+
+    size = solver->binsize[bin];
+    for (c = 0; c < 256; c++)
+    {
+        if (palette_hasbit(&solver->sets[index * PALETTE_SETWORDS], c))
+        {
+            if (solver->assign[index] == bin)
+                size -= (bincounts[bin * 256 + c] == 1);
+            else
+                size += (bincounts[bin * 256 + c] == 0);
+        }
+    }
+
+    return size;
+}
+
+//-------------------------------------------------------------------------------------------------
+// solver = packing in progress
+// bincounts = number of combos using each color of each palette
+// index = combo to move
+// bin = new palette of the combo (-1 to only remove it)
+static void palette_binmove(t_palsolver *solver, int *bincounts, int index, int bin)
+{
+    int c, src = solver->assign[index];
+
+    for (c = 0; c < 256; c++)
+    {
+        if (palette_hasbit(&solver->sets[index * PALETTE_SETWORDS], c))
+        {
+            if (src != -1)
+                solver->binsize[src] -= ((--bincounts[src * 256 + c]) == 0);
+            if (bin != -1)
+                solver->binsize[bin] += ((bincounts[bin * 256 + c]++) == 0);
+        }
+    }
+    solver->assign[index] = bin;
+}
+
+//-------------------------------------------------------------------------------------------------
+// solver = combos to put in the palettes, with a time limit
+// bincounts = filled with the number of combos using each color of each palette
+// returns the number of colors over the size of the palettes (0 if all the combos fit in the palettes)
+static int palette_solvebest(t_palsolver *solver, int *bincounts)
+{
+    int b, k, src, over, cost, bestcost, bestbin, srcsize, dstsize;
+    bool isimproved;
+
+    // first look for an exact packing, with backtracking
+    solver->nbbins = 0;
+    solver->nodes = 0;
+    solver->istimeout = false;
+    if (palette_solvenext(solver, 0))
+    {
+        memset(bincounts, 0, PALETTE_MAXPAL * 256 * sizeof(int));
+        memset(solver->binsize, 0, sizeof(solver->binsize));
+        for (k = 0; k < solver->nbsets; k++)
+        {
+            b = solver->assign[k];
+            solver->assign[k] = -1;
+            palette_binmove(solver, bincounts, k, b);
+        }
+        return 0;
+    }
+
+    // none (or not found in time), put each combo where it adds the fewest colors over the size of the palettes
+    memset(bincounts, 0, PALETTE_MAXPAL * 256 * sizeof(int));
+    memset(solver->binsize, 0, sizeof(solver->binsize));
+    for (k = 0; k < solver->nbsets; k++)
+    {
+        solver->assign[k] = -1;
+        bestbin = 0; bestcost = 0x7FFFFFFF;
+        for (b = 0; b < PALETTE_MAXPAL; b++)
+        {
+            dstsize = palette_binsize(solver, bincounts, k, b);
+            over = (dstsize > solver->nbcolors ? dstsize - solver->nbcolors : 0) - (solver->binsize[b] > solver->nbcolors ? solver->binsize[b] - solver->nbcolors : 0);
+            cost = over * 256 + dstsize - solver->binsize[b];
+            if (cost < bestcost)
+            {
+                bestcost = cost;
+                bestbin = b;
+            }
+        }
+        palette_binmove(solver, bincounts, k, bestbin);
+    }
+
+    // then move combos from one palette to another while it lowers the number of colors over the size of the palettes
+    do
+    {
+        isimproved = false;
+        for (k = 0; k < solver->nbsets; k++)
+        {
+            src = solver->assign[k];
+            srcsize = palette_binsize(solver, bincounts, k, src);
+            for (b = 0; b < PALETTE_MAXPAL; b++)
+            {
+                if (b == src)
+                    continue;
+
+                dstsize = palette_binsize(solver, bincounts, k, b);
+                cost  = (srcsize > solver->nbcolors ? srcsize - solver->nbcolors : 0) + (dstsize > solver->nbcolors ? dstsize - solver->nbcolors : 0);
+                cost -= (solver->binsize[src] > solver->nbcolors ? solver->binsize[src] - solver->nbcolors : 0) + (solver->binsize[b] > solver->nbcolors ? solver->binsize[b] - solver->nbcolors : 0);
+                if (cost < 0)
+                {
+                    palette_binmove(solver, bincounts, k, b);
+                    isimproved = true;
+                    break;
+                }
+            }
+        }
+    } while (isimproved);
+
+    over = 0;
+    for (b = 0; b < PALETTE_MAXPAL; b++)
+        if (solver->binsize[b] > solver->nbcolors)
+            over += solver->binsize[b] - solver->nbcolors;
+
+    return over;
+}
+
+//-------------------------------------------------------------------------------------------------
+// palettesnes = RGB555 converted palette
+// color1, color2 = palette entries to compare
+// returns the square of the distance between the two colors
+static int palette_distance(int *palettesnes, int color1, int color2)
+{
+    int r, g, b;
+
+    r = (palettesnes[color1] & 0x1F) - (palettesnes[color2] & 0x1F);
+    g = ((palettesnes[color1] >> 5) & 0x1F) - ((palettesnes[color2] >> 5) & 0x1F);
+    b = ((palettesnes[color1] >> 10) & 0x1F) - ((palettesnes[color2] >> 10) & 0x1F);
+
+    return r * r + g * g + b * b;
+}
+
+//-------------------------------------------------------------------------------------------------
+// imgbuf = image buffer
+// palettesnes = RGB555 converted palette
+// colorsets = memory for the color sets of the tiles
+// nbtiles = number of tiles of the image
+// nbcolors = number of colors of the palette buffer
+// solvetime = time budget of the search of a packing (ms, 0 = no budget)
+// isquiet = 0 if we want some messages in console
+// used when the greedy combine of palette_rearrange_snes doesn't fit in 8 palettes
+static void palette_solve_snes(unsigned char *imgbuf, int *palettesnes, unsigned int *colorsets, int nbtiles, int nbcolors, int solvetime, bool isquiet)
+{
+    t_palsolver solver;
+    int *uniques;                                                          // tile of each different combo
+    int *tilecombos;                                                       // combo packed for each tile
+    int *packed;                                                           // combo packed for each different combo
+    int *bincounts;                                                        // number of combos using each color of each palette
+    int new_palette[256];
+    unsigned char color_table[PALETTE_MAXPAL * 256], mergeto[256];
+    int nbuniques, nbmerged, nbpalettes, colortabinc;
+    int b, c, c1, c2, i, k, t, slot, dist, bestdist;
+
+    if (!isquiet)
+    {
+        if (solvetime) info("greedy rearrangement failed, looking for a packing of the palettes in %dms...", solvetime);
+        else info("greedy rearrangement failed, looking for a packing of the palettes...");
+    }
+
+    uniques = (int *) malloc(nbtiles * sizeof(int));
+    tilecombos = (int *) malloc(nbtiles * sizeof(int));
+    packed = (int *) malloc(nbtiles * sizeof(int));
+    bincounts = (int *) malloc(PALETTE_MAXPAL * 256 * sizeof(int));
+    solver.sets = (unsigned int *) malloc(nbtiles * PALETTE_SETWORDS * sizeof(int));
+    solver.undo = (unsigned int *) malloc(nbtiles * PALETTE_SETWORDS * sizeof(int));
+    solver.counts = (int *) malloc(nbtiles * sizeof(int));
+    solver.assign = (int *) malloc(nbtiles * sizeof(int));
+    if ((uniques == NULL) || (tilecombos == NULL) || (packed == NULL) || (bincounts == NULL) || (solver.sets == NULL) || (solver.undo == NULL) || (solver.counts == NULL) || (solver.assign == NULL))
+    {
+        fatal("can't allocate enough memory for the palette solver in rearrange_snes");
+    }
+    solver.nbcolors = nbcolors;
+    solver.solvetime = solvetime;
+    solver.start = thread_clockms();
+
+    // colors of each tile (the greedy combine added colors to the sets of its palettes)
+    memset(colorsets, 0, nbtiles * PALETTE_SETWORDS * sizeof(int));
+    for (t = 0; t < nbtiles; t++)
+    {
+        palette_setbit(&colorsets[t * PALETTE_SETWORDS], 0);
+        for (i = 0; i < 64; i++)
+            palette_setbit(&colorsets[t * PALETTE_SETWORDS], imgbuf[t * 64 + i]);
+    }
+
+    // keep each combo once
+    nbuniques = 0;
+    for (t = 0; t < nbtiles; t++)
+    {
+        for (k = 0; k < nbuniques; k++)
+            if (!memcmp(&colorsets[t * PALETTE_SETWORDS], &colorsets[uniques[k] * PALETTE_SETWORDS], PALETTE_SETWORDS * sizeof(int)))
+                break;
+        if (k == nbuniques)
+            uniques[nbuniques++] = t;
+        tilecombos[t] = k;
+    }
+
+    // in order of number of colors (greatest to least), pack only the combos that are not in a bigger one
+    solver.nbsets = 0;
+    for (c = nbcolors; c > 0; c--)
+    {
+        for (k = 0; k < nbuniques; k++)
+        {
+            unsigned int *set = &colorsets[uniques[k] * PALETTE_SETWORDS];
+
+            if (palette_unionsize(set, set) != c)
+                continue;
+
+            for (i = 0; i < solver.nbsets; i++)
+                if (palette_unionsize(&solver.sets[i * PALETTE_SETWORDS], set) == solver.counts[i])
+                    break;
+            if (i == solver.nbsets)
+            {
+                memcpy(&solver.sets[i * PALETTE_SETWORDS], set, PALETTE_SETWORDS * sizeof(int));
+                solver.counts[i] = c;
+                solver.nbsets++;
+            }
+
+            packed[k] = i;
+        }
+    }
+    for (t = 0; t < nbtiles; t++)
+        tilecombos[t] = packed[tilecombos[t]];
+
+    nbmerged = palette_solvebest(&solver, bincounts);
+
+    // build the palettes, merging the closest colors of the palettes with too many colors
+    colortabinc = nbcolors == 4 ? 4 : 16;
+    memcpy(new_palette, palettesnes, 256 * sizeof(int));
+    memset(color_table, 0, sizeof(color_table));
+    nbpalettes = 0;
+    for (b = 0; b < PALETTE_MAXPAL; b++)
+    {
+        if (solver.binsize[b] == 0)
+            continue;
+        nbpalettes = b + 1;
+
+        for (c = 0; c < 256; c++)
+            mergeto[c] = c;
+
+        while (solver.binsize[b] > nbcolors)
+        {
+            // color zero is transparent, it is never merged
+            bestdist = 0x7FFFFFFF; k = 1; i = 1;
+            for (c1 = 1; c1 < 256; c1++)
+            {
+                if (bincounts[b * 256 + c1] == 0)
+                    continue;
+                for (c2 = c1 + 1; c2 < 256; c2++)
+                {
+                    if (bincounts[b * 256 + c2] == 0)
+                        continue;
+                    dist = palette_distance(palettesnes, c1, c2);
+                    if (dist < bestdist)
+                    {
+                        bestdist = dist;
+                        k = c1; i = c2;
+                    }
+                }
+            }
+
+            // keep the color used by the most combos
+            if (bincounts[b * 256 + i] > bincounts[b * 256 + k])
+            {
+                c = k; k = i; i = c;
+            }
+            mergeto[i] = k;
+            bincounts[b * 256 + k] += bincounts[b * 256 + i];
+            bincounts[b * 256 + i] = 0;
+            solver.binsize[b]--;
+        }
+
+        slot = 0;
+        for (c = 0; c < 256; c++)
+        {
+            if (bincounts[b * 256 + c])
+            {
+                color_table[b * 256 + c] = b * colortabinc + slot;
+                new_palette[b * colortabinc + slot] = palettesnes[c];
+                slot++;
+            }
+        }
+        for (c = 0; c < 256; c++)
+        {
+            for (k = c; mergeto[k] != k; k = mergeto[k]);
+            color_table[b * 256 + c] = color_table[b * 256 + k];
+        }
+    }
+
+    if (nbmerged)
+    {
+        if (solver.istimeout)
+            warning("no palette packing found in %dms, %d colors merged to fit the picture in %d palettes", solvetime, nbmerged, nbpalettes);
+        else
+            warning("no palette packing exists, %d colors merged to fit the picture in %d palettes", nbmerged, nbpalettes);
+    }
+    else
+    {
+        if (!isquiet) info("rearrangement possible! Accomplished in %d palettes by the solver...", nbpalettes);
+    }
+
+    // convert the image
+    for (t = 0; t < nbtiles; t++)
+    {
+        b = solver.assign[tilecombos[t]];
+        for (i = 64 * t; i < 64 * (t + 1); i++)
+            imgbuf[i] = color_table[b * 256 + imgbuf[i]];
+    }
+
+    // save back the palette
+    memcpy(palettesnes, new_palette, 256 * sizeof(int));
+
+    free(solver.assign);
+    free(solver.counts);
+    free(solver.undo);
+    free(solver.sets);
+    free(bincounts);
+    free(packed);
+    free(tilecombos);
+    free(uniques);
+}
+
 //-------------------------------------------------------------------------------------------------
 // imgbuf = image buffer
 // nbtiles = number of tiles to write to file
 // palettesnes = RGB555 converted palette
 // nbcolors = number of colors of the palette buffer
+// solvetime = time budget of the palette solver when the greedy combine doesn't fit (ms, 0 = no budget)
 // isquiet = 0 if we want some messages in console
-void palette_rearrange_snes(unsigned char *imgbuf, int *palettesnes, int nbtiles, int nbcolors, bool isquiet)
+void palette_rearrange_snes(unsigned char *imgbuf, int *palettesnes, int nbtiles, int nbcolors, int solvetime, bool isquiet)
 {
     unsigned int *combos;                                                    // holds sorted list of colors in combo of each tile
     signed int *num;                                                       // holds number of colors in each combo
     unsigned int *list;                                                      // for sorting combos
+    unsigned int *colorsets;                                                 // holds the set of colors of each combo
+    unsigned char remap[256];                                                // first entry with the same color, for each entry
     unsigned int final[8], num_final;
     unsigned int new_palette[256], color_table[256];
     unsigned int index, last_index;
@@ -150,6 +640,15 @@ void palette_rearrange_snes(unsigned char *imgbuf, int *palettesnes, int nbtiles
         fatal("can't allocate enough memory for the list of combos in rearrange_snes");
     }
 
+    colorsets = (unsigned int *) calloc(nbtiles * PALETTE_SETWORDS, sizeof(int));
+    if (colorsets == NULL)
+    {
+        free(list);
+        free(combos);
+        free(num);
+        fatal("can't allocate enough memory for the sets of colors in rearrange_snes");
+    }
+
     // clear 'color combo' lists
     memset(combos, 0, nbtiles * 16 * sizeof(int));
     if (!isquiet) info("prepare palette rearrangement for %d tiles and %d colors...", nbtiles,nbcolors);
@@ -161,46 +660,36 @@ void palette_rearrange_snes(unsigned char *imgbuf, int *palettesnes, int nbtiles
     }
 
     // if two colors have the same RGB values...
-    // replace all instances of the redundant color with the first color
-    for (i = 0; i < 256; i++)
+    // replace all instances of the redundant color with the first color, in one pass over the image
+    palette_duplicates(palettesnes, remap);
+    for (index = 0; index < nbtiles * 8 * 8; index++)
     {
-        for (ii = i + 1; ii < 256; ii++)
-            if (palettesnes[i] == palettesnes[ii])
-            {
-                for (index = 0; index < nbtiles * 8 * 8; index++)
-                {
-                    if (imgbuf[index] == ii)
-                        imgbuf[index] = i;
-                }
-            }
+        imgbuf[index] = remap[imgbuf[index]];
     }
 
     // now, build up the 'color combo' list...
+    // the set of each tile keeps the membership test constant, the list keeps the order colors were found
     colortabinc=nbcolors==4 ? 4 : 16;
     for (index = 0; index < nbtiles; index++)
     {
+        palette_setbit(&colorsets[index * PALETTE_SETWORDS], 0);
         for (i = 0; i < 64; i++)
         {
             data = imgbuf[index * 64 + i];
 
-            // is this color already in the list?
-            for (ii = 0; ii < num[index]; ii++)
-            {
-                if (combos[index * colortabinc + ii] == data)
-                    break;
-            }
-
-            // if not add it to the list
-            if (ii == num[index])
+            // is this color already in the list? if not add it to the list
+            if (!palette_hasbit(&colorsets[index * PALETTE_SETWORDS], data))
             {
                 if (num[index] == nbcolors) // combo is full
                 {
+                    free(colorsets);
                     free(list);
                     free(combos);
                     free(num);
                     fatal("detected more colors in one 8x8 tile than is allowed");
                 }
-                combos[index * colortabinc + ii] = data;
+                palette_setbit(&colorsets[index * PALETTE_SETWORDS], data);
+                combos[index * colortabinc + num[index]] = data;
                 num[index]++;
             }
         }
@@ -242,11 +731,13 @@ void palette_rearrange_snes(unsigned char *imgbuf, int *palettesnes, int nbtiles
         // check if we've failed
         if (num_final == 8)
         {
-            // we already have 8 palettes... can't add more
+            // we already have 8 palettes... can't add more, the solver looks for another packing
+            palette_solve_snes(imgbuf, palettesnes, colorsets, nbtiles, nbcolors, solvetime, isquiet);
+            free(colorsets);
             free(list);
             free(combos);
             free(num);
-            fatal("not enough colors/palettes to represent the picture");
+            return;
         }
 
         // if one exists, then add to final and start combining
@@ -263,34 +754,32 @@ void palette_rearrange_snes(unsigned char *imgbuf, int *palettesnes, int nbtiles
                 continue;
 
             // can it be combined?
+            // count the colors of the combo missing in the 'final combo'
             num_miss = 0;
-            for (ii = test2 * colortabinc; ii < test2 * colortabinc + num[test2]; ii++)
-            {
-                // ii = index into the 'attempting to combine' combo
-                //  i = index into the 'final combo'
-                // check for non-matched colors
-                for (i = test * colortabinc; i < test * colortabinc + num[test] + num_miss; i++)
-                {
-                    if (combos[ii] == combos[i])
-                        break;
-                }
+            for (i = 0; i < PALETTE_SETWORDS; i++)
+                num_miss += palette_popcount(colorsets[test2 * PALETTE_SETWORDS + i] & ~colorsets[test * PALETTE_SETWORDS + i]);
 
-                // is there a miss?
-                if (i == test * colortabinc + num[test] + num_miss)
+            if (num[test] + num_miss > nbcolors)
+            {
+                // we can't add anymore colors
+                // this combine has failed
+                num_miss = -1;
+            }
+            else
+            {
+                // add the missed colors to the 'final combo', in the order of the combo
+                num_miss = 0;
+                for (ii = test2 * colortabinc; ii < test2 * colortabinc + num[test2]; ii++)
                 {
-                    if (num[test] + num_miss == nbcolors)
+                    if (!palette_hasbit(&colorsets[test * PALETTE_SETWORDS], combos[ii]))
                     {
-                        // we can't add anymore colors
-                        // this combine has failed
-                        num_miss = -1;
-                        break;
+                        combos[test * colortabinc + num[test] + num_miss] = combos[ii];
+                        num_miss++;
                     }
-
-                    // temporarily add the missed color to the 'final combo'
-                    combos[test * colortabinc + num[test] + num_miss] = combos[ii];
-                    num_miss++;
                 }
-            } // loop - try to combine an individual combo
+                for (i = 0; i < PALETTE_SETWORDS; i++)
+                    colorsets[test * PALETTE_SETWORDS + i] |= colorsets[test2 * PALETTE_SETWORDS + i];
+            }
 
             // did we succeed?
             if (num_miss >= 0)
@@ -356,6 +845,7 @@ void palette_rearrange_snes(unsigned char *imgbuf, int *palettesnes, int nbtiles
     memcpy(palettesnes, new_palette, 256 * sizeof(int));
 
     // free up mem from the combo lists
+    free(colorsets);
     free(list);
     free(combos);
     free(num);
@@ -0,0 +1,155 @@
+/*---------------------------------------------------------------------------------
+
+	Copyright (C) 2012-2023
+		Alekmaul 
+
+	This software is provided 'as-is', without any express or implied
+	warranty.  In no event will the authors be held liable for any
+	damages arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any
+	purpose, including commercial applications, and to alter it and
+	redistribute it freely, subject to the following restrictions:
+
+	1.	The origin of this software must not be misrepresented; you
+		must not claim that you wrote the original software. If you use
+		this software in a product, an acknowledgment in the product
+		documentation would be appreciated but is not required.
+	2.	Altered source versions must be plainly marked as such, and
+		must not be misrepresented as being the original software.
+	3.	This notice may not be removed or altered from any source
+		distribution.
+
+	Image converter for Super Nintendo.
+	Parts from pcx2snes from Neviksti
+	palette rounded option from Artemio Urbina
+  BMP BI_RLE8 compression support by Andrey Beletsky
+	
+***************************************************************************/
+#include <stdlib.h>
+#include <time.h>
+
+#include "threads.h"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+// function and argument of a thread, to hide the different prototypes of each system
+typedef struct
+{
+	void (*func)(void*);
+	void* arg;
+} t_threadstart;
+
+//-------------------------------------------------------------------------------------------------
+#ifdef _WIN32
+static DWORD WINAPI thread_start(LPVOID param)
+#else
+static void* thread_start(void* param)
+#endif
+{
+	t_threadstart start = *(t_threadstart*) param;
+
+	free(param);
+	start.func(start.arg);
+
+	return 0;
+}
+
+//-------------------------------------------------------------------------------------------------
+// thread = thread created
+// func = function run by the thread
+// arg = argument given to func
+// returns 0 if the thread can't be created
+int thread_create(t_thread* thread, void (*func)(void*), void* arg)
+{
+	t_threadstart* start;
+
+	start = (t_threadstart*) malloc(sizeof(t_threadstart));
+	if (start == NULL)
+		return 0;
+	start->func = func;
+	start->arg = arg;
+
+#ifdef _WIN32
+	*thread = CreateThread(NULL, 0, thread_start, start, 0, NULL);
+	if (*thread == NULL)
+#else
+	if (pthread_create(thread, NULL, thread_start, start) != 0)
+#endif
+	{
+		free(start);
+		return 0;
+	}
+
+	return 1;
+}
+
+//-------------------------------------------------------------------------------------------------
+// thread = thread to wait for
+void thread_join(t_thread thread)
+{
+#ifdef _WIN32
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+#else
+	pthread_join(thread, NULL);
+#endif
+}
+
+//-------------------------------------------------------------------------------------------------
+// returns the number of processors available, at least 1
+int thread_cpucount(void)
+{
+	long nbcpus;
+
+#ifdef _WIN32
+	SYSTEM_INFO sysinfo;
+
+	GetSystemInfo(&sysinfo);
+	nbcpus = sysinfo.dwNumberOfProcessors;
+#else
+	nbcpus = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+	return nbcpus < 1 ? 1 : (int) nbcpus;
+}
+
+//-------------------------------------------------------------------------------------------------
+// mutex = mutex to take (initialized with MUTEX_INITIALIZER)
+void mutex_lock(t_mutex* mutex)
+{
+#ifdef _WIN32
+	AcquireSRWLockExclusive((PSRWLOCK) mutex);
+#else
+	pthread_mutex_lock(mutex);
+#endif
+}
+
+//-------------------------------------------------------------------------------------------------
+// mutex = mutex to release
+void mutex_unlock(t_mutex* mutex)
+{
+#ifdef _WIN32
+	ReleaseSRWLockExclusive((PSRWLOCK) mutex);
+#else
+	pthread_mutex_unlock(mutex);
+#endif
+}
+
+//-------------------------------------------------------------------------------------------------
+// returns a monotonic wall clock time in milliseconds (clock() counts the time of all the threads)
+long long thread_clockms(void)
+{
+#ifdef _WIN32
+	return (long long) GetTickCount64();
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+}
@@ -0,0 +1,25 @@
+#ifndef _GFX4SNES_THREADS_H
+#define _GFX4SNES_THREADS_H
+
+#ifdef _WIN32
+// same layout as HANDLE and SRWLOCK, to keep windows.h out of the other files
+typedef void* t_thread;
+typedef struct { void* ptr; } t_mutex;
+#define MUTEX_INITIALIZER { 0 }
+#else
+#include <pthread.h>
+
+typedef pthread_t t_thread;
+typedef pthread_mutex_t t_mutex;
+#define MUTEX_INITIALIZER PTHREAD_MUTEX_INITIALIZER
+#endif
+
+//-------------------------------------------------------------------------------------------------
+extern int thread_create(t_thread* thread, void (*func)(void*), void* arg);
+extern void thread_join(t_thread thread);
+extern int thread_cpucount(void);
+extern void mutex_lock(t_mutex* mutex);
+extern void mutex_unlock(t_mutex* mutex);
+extern long long thread_clockms(void);
+
+#endif
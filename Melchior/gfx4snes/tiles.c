@@ -31,9 +31,18 @@
 #include <stdlib.h>
 
 #include "tiles.h"
+#include "lz77.h"
 #include "common.h"
 #include <malloc.h>
 
+#if defined(__AVX2__)
+#define TILES_USE_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TILES_USE_SSE2
+#include <emmintrin.h>
+#endif
+
 //-------------------------------------------------------------------------------------------------
 // imgbuf = image buffer
 // imgwidth = width (in pixels) of image buffer
@@ -111,22 +120,577 @@ unsigned char *tiles_convertsnes (unsigned char *imgbuf, int imgwidth, int imghe
     return buffer;
 }
 
+#if defined(TILES_USE_AVX2)
+//-------------------------------------------------------------------------------------------------
+// rows = 4 rows of a tile, 8 pixels of one byte per row
+// returns each row flipped around the anti-diagonal of its 8x8 bit matrix, see tiles_rowplanes
+static __m256i tiles_rowplanes_avx2 (__m256i rows)
+{
+    __m256i t;
+
+    t = _mm256_and_si256(_mm256_xor_si256(rows, _mm256_srli_epi64(rows, 9)), _mm256_set1_epi64x(0x0055005500550055LL));
+    rows = _mm256_xor_si256(rows, _mm256_xor_si256(t, _mm256_slli_epi64(t, 9)));
+    t = _mm256_and_si256(_mm256_xor_si256(rows, _mm256_srli_epi64(rows, 18)), _mm256_set1_epi64x(0x0000333300003333LL));
+    rows = _mm256_xor_si256(rows, _mm256_xor_si256(t, _mm256_slli_epi64(t, 18)));
+    t = _mm256_and_si256(_mm256_xor_si256(rows, _mm256_srli_epi64(rows, 36)), _mm256_set1_epi64x(0x000000000F0F0F0FLL));
+    rows = _mm256_xor_si256(rows, _mm256_xor_si256(t, _mm256_slli_epi64(t, 36)));
+
+    // swap the bytes of each bitplane pair so that the even plane comes first
+    return _mm256_or_si256(_mm256_slli_epi16(rows, 8), _mm256_srli_epi16(rows, 8));
+}
+#elif defined(TILES_USE_SSE2)
+//-------------------------------------------------------------------------------------------------
+// rows = 2 rows of a tile, 8 pixels of one byte per row
+// returns each row flipped around the anti-diagonal of its 8x8 bit matrix, see tiles_rowplanes
+static __m128i tiles_rowplanes_sse2 (__m128i rows)
+{
+    __m128i t;
+
+    t = _mm_and_si128(_mm_xor_si128(rows, _mm_srli_epi64(rows, 9)), _mm_set1_epi64x(0x0055005500550055LL));
+    rows = _mm_xor_si128(rows, _mm_xor_si128(t, _mm_slli_epi64(t, 9)));
+    t = _mm_and_si128(_mm_xor_si128(rows, _mm_srli_epi64(rows, 18)), _mm_set1_epi64x(0x0000333300003333LL));
+    rows = _mm_xor_si128(rows, _mm_xor_si128(t, _mm_slli_epi64(t, 18)));
+    t = _mm_and_si128(_mm_xor_si128(rows, _mm_srli_epi64(rows, 36)), _mm_set1_epi64x(0x000000000F0F0F0FLL));
+    rows = _mm_xor_si128(rows, _mm_xor_si128(t, _mm_slli_epi64(t, 36)));
+
+    // swap the bytes of each bitplane pair so that the even plane comes first
+    return _mm_or_si128(_mm_slli_epi16(rows, 8), _mm_srli_epi16(rows, 8));
+}
+#else
+//-------------------------------------------------------------------------------------------------
+// row = 8 pixels of a tile row, one byte per pixel
+// returns the 8x8 bit matrix of the row flipped around its anti-diagonal: byte 7-b is bitplane b, with pixel 0 in bit 7
+static unsigned long long tiles_rowplanes (const unsigned char *row)
+{
+    unsigned long long word, t;
+
+    word = (unsigned long long) row[0] | ((unsigned long long) row[1] << 8) |
+           ((unsigned long long) row[2] << 16) | ((unsigned long long) row[3] << 24) |
+           ((unsigned long long) row[4] << 32) | ((unsigned long long) row[5] << 40) |
+           ((unsigned long long) row[6] << 48) | ((unsigned long long) row[7] << 56);
+
+    // three block swaps (1x1, 2x2 then 4x4 bits)
+    t = (word ^ (word >> 9)) & 0x0055005500550055ULL;
+    word ^= t ^ (t << 9);
+    t = (word ^ (word >> 18)) & 0x0000333300003333ULL;
+    word ^= t ^ (t << 18);
+    t = (word ^ (word >> 36)) & 0x000000000F0F0F0FULL;
+    word ^= t ^ (t << 36);
+
+    return word;
+}
+#endif
+
+//-------------------------------------------------------------------------------------------------
+// planar = buffer receiving the snes tiles (8 * bitplanes bytes per tile)
+// tiles = graphic tile buffer, 64 bytes per tile
+// nbtiles = number of tiles to convert
+// bitplanes = number of bitplanes to keep (2, 4 or 8)
+static void tiles_toplanar (unsigned char *planar, const unsigned char *tiles, int nbtiles, int bitplanes)
+{
+    int t;
+#if defined(TILES_USE_AVX2)
+    __m256i r0123, r4567, lo, hi;
+
+    // rows of a bitplane pair are 16-bit words, gather them with a 8x4 words transpose
+    for (t = 0; t < nbtiles; t++, tiles += 64)
+    {
+        r0123 = tiles_rowplanes_avx2(_mm256_loadu_si256((const __m256i *) tiles));
+        r4567 = tiles_rowplanes_avx2(_mm256_loadu_si256((const __m256i *) (tiles + 32)));
+
+        lo = _mm256_permute2x128_si256(r0123, r4567, 0x20);                             // rows 0,1 | 4,5
+        hi = _mm256_permute2x128_si256(r0123, r4567, 0x31);                             // rows 2,3 | 6,7
+        r0123 = _mm256_unpacklo_epi16(lo, hi);                                          // rows 0,2 | 4,6
+        r4567 = _mm256_unpackhi_epi16(lo, hi);                                          // rows 1,3 | 5,7
+        lo = _mm256_unpacklo_epi16(r0123, r4567);                                       // pairs 3,2 of rows 0-3 | 4-7
+        hi = _mm256_unpackhi_epi16(r0123, r4567);                                       // pairs 1,0 of rows 0-3 | 4-7
+
+        // pairs 0 and 1, then pairs 2 and 3
+        hi = _mm256_permute4x64_epi64(hi, _MM_SHUFFLE(2, 0, 3, 1));
+        if (bitplanes == 2)
+            _mm_storeu_si128((__m128i *) planar, _mm256_castsi256_si128(hi));
+        else
+            _mm256_storeu_si256((__m256i *) planar, hi);
+        if (bitplanes == 8)
+            _mm256_storeu_si256((__m256i *) (planar + 32), _mm256_permute4x64_epi64(lo, _MM_SHUFFLE(2, 0, 3, 1)));
+        planar += 8 * bitplanes;
+    }
+#elif defined(TILES_USE_SSE2)
+    __m128i r01, r23, r45, r67, lo, hi;
+    __m128i pairs[4];
+    int p;
+
+    // rows of a bitplane pair are 16-bit words, gather them with a 8x4 words transpose
+    for (t = 0; t < nbtiles; t++, tiles += 64)
+    {
+        r01 = tiles_rowplanes_sse2(_mm_loadu_si128((const __m128i *) tiles));
+        r23 = tiles_rowplanes_sse2(_mm_loadu_si128((const __m128i *) (tiles + 16)));
+        r45 = tiles_rowplanes_sse2(_mm_loadu_si128((const __m128i *) (tiles + 32)));
+        r67 = tiles_rowplanes_sse2(_mm_loadu_si128((const __m128i *) (tiles + 48)));
+
+        lo = _mm_unpacklo_epi16(r01, r23);                                              // rows 0,2
+        hi = _mm_unpackhi_epi16(r01, r23);                                              // rows 1,3
+        r01 = _mm_unpacklo_epi16(lo, hi);                                               // pairs 3,2 of rows 0-3
+        r23 = _mm_unpackhi_epi16(lo, hi);                                               // pairs 1,0 of rows 0-3
+        lo = _mm_unpacklo_epi16(r45, r67);
+        hi = _mm_unpackhi_epi16(r45, r67);
+        r45 = _mm_unpacklo_epi16(lo, hi);                                               // pairs 3,2 of rows 4-7
+        r67 = _mm_unpackhi_epi16(lo, hi);                                               // pairs 1,0 of rows 4-7
+        pairs[0] = _mm_unpackhi_epi64(r23, r67);
+        pairs[1] = _mm_unpacklo_epi64(r23, r67);
+        pairs[2] = _mm_unpackhi_epi64(r01, r45);
+        pairs[3] = _mm_unpacklo_epi64(r01, r45);
+
+        for (p = 0; p < bitplanes / 2; p++, planar += 16)
+            _mm_storeu_si128((__m128i *) planar, pairs[p]);
+    }
+#else
+    unsigned long long planes;
+    int y, p;
+
+    for (t = 0; t < nbtiles; t++, tiles += 64)
+    {
+        // each row gives one byte for each bitplane, bitplanes are stored by pairs of 8 rows
+        for (y = 0; y < 8; y++)
+        {
+            planes = tiles_rowplanes(&tiles[y * 8]);
+            for (p = 0; p < bitplanes / 2; p++)
+            {
+                planar[p * 16 + y * 2] = (unsigned char) (planes >> (56 - p * 16));
+                planar[p * 16 + y * 2 + 1] = (unsigned char) (planes >> (48 - p * 16));
+            }
+        }
+        planar += 8 * bitplanes;
+    }
+#endif
+}
+
+//-------------------------------------------------------------------------------------------------
+// bufout = compressed chunks one after the other, buflen + (buflen>>3) + 16 bytes per chunk
+// bufin = planar tiles to compress
+// chunksize = size in bytes of each chunk to compress (the last one can be smaller)
+// lzoptimal = 1 if we want the lz77 compression with optimal parsing
+// returns the size of all the chunks, 0 if one of them can't be compressed
+static int tiles_lzchunks (unsigned char *bufout, unsigned char *bufin, int buflen, int chunksize, bool lzoptimal)
+{
+	t_lz77job *jobs;
+	int i, nbchunks, outsize;
+
+	// each chunk is a whole lz77 stream, they are compressed at the same time in their own part of bufout
+	nbchunks = (buflen + chunksize - 1) / chunksize;
+	jobs = (t_lz77job *) malloc(nbchunks * sizeof(t_lz77job));
+	if (jobs == NULL)
+	{
+		fatal("can't allocate enough memory for the lz77 chunks");
+	}
+	for (i = 0; i < nbchunks; i++)
+	{
+		jobs[i].bufin = bufin + i * chunksize;
+		jobs[i].buflen = (i == nbchunks - 1) ? buflen - i * chunksize : chunksize;
+		jobs[i].bufout = bufout + i * (chunksize + (chunksize>>3) + 16);
+		jobs[i].outsize = 0;
+	}
+
+	// and are put one after the other (they are 4 bytes aligned)
+	outsize = 0;
+	if (lz77_compressjobs(jobs, nbchunks, 0, lzoptimal))
+	{
+		for (i = 0; i < nbchunks; i++)
+		{
+			memmove(bufout + outsize, jobs[i].bufout, jobs[i].outsize);
+			outsize += jobs[i].outsize;
+		}
+	}
+	free(jobs);
+
+	return outsize;
+}
+
+//-------------------------------------------------------------------------------------------------
+// Other compression formats, byte aligned for fast 65816 decoders. Like lz77, they begin with
+// a 4 bytes header (format tag and 24 bits size of the uncompressed data) and are 4 bytes aligned.
+// - rle (tag 0x30, same as the gba bios): a block byte 1nnnnnnn is a run of the next byte
+//   repeated nnnnnnn+3 times, 0nnnnnnn is followed by nnnnnnn+1 bytes to copy
+// - lz4 (tag 0x40, lz4 block sequences): a token byte with the number of bytes to copy in the
+//   high nibble and the match length - 4 in the low one (15 = more bytes are added, up to a byte
+//   != 255), the bytes to copy, the match offset (16 bits), the match length bytes.
+//   The last sequence stops after its bytes to copy if all the data is uncompressed.
+#define TILES_RLE_TAG 0x30
+#define TILES_RLE_MINRUN 3
+#define TILES_RLE_MAXRUN (0x7F + TILES_RLE_MINRUN)
+#define TILES_RLE_MAXCOPY (0x7F + 1)
+
+#define TILES_LZ4_TAG 0x40
+#define TILES_LZ4_MINMATCH 4
+#define TILES_LZ4_HASHBITS 12															// 4 bytes strings hash table size
+#define TILES_LZ4_MAXCHAIN 256															// max matches tested at each position
+#define TILES_LZ4_MAXDIST 0xFFFF
+
+// Rough cost in 65816 cycles of a plain decoder for each format, to compare them (not exact timings):
+// bytes copied with mvn (7 cycles per byte), the other ones read and written in a loop
+#define TILES_CYCLES_COPY 7																// one byte copied with mvn
+#define TILES_CYCLES_RAWSETUP 30														// raw data copied with one mvn
+#define TILES_CYCLES_LZ77FLAG 23														// lz77 flag byte read & 8 bits loop
+#define TILES_CYCLES_LZ77LITERAL 16														// lz77 byte copied in the flags loop
+#define TILES_CYCLES_LZ77MATCH 45														// lz77 match offset & length decoded
+#define TILES_CYCLES_LZ77MATCHBYTE 14													// lz77 match byte copy (offset can be < length)
+#define TILES_CYCLES_LZ4SEQUENCE 48														// lz4 token, offset & pointers of a sequence
+#define TILES_CYCLES_LZ4LENGTH 12														// lz4 extra length byte
+#define TILES_CYCLES_RLEBLOCK 30														// rle block byte & mvn setup
+
+//-------------------------------------------------------------------------------------------------
+// bufout = buffer beginning with the 4 bytes header
+// tag = format of the compressed data
+// buflen = size of the uncompressed data
+static void tiles_header (unsigned char *bufout, unsigned char tag, int buflen)
+{
+	bufout[0] = tag;
+	bufout[1] = (buflen>>0) & 0xFF;
+	bufout[2] = (buflen>>8) & 0xFF;
+	bufout[3] = (buflen>>16) & 0xFF;
+}
+
+//-------------------------------------------------------------------------------------------------
+// bufout = rle compressed data, buflen + (buflen>>3) + 16 bytes
+// bufin = planar tiles to compress
+// returns the size of the compressed data
+static int tiles_rlecompress (unsigned char *bufout, const unsigned char *bufin, int buflen)
+{
+	int i, run, copy, outsize;
+
+	outsize = 4;
+	copy = 0;
+	for (i = 0; i < buflen; )
+	{
+		for (run = 1; (i + run < buflen) && (run < TILES_RLE_MAXRUN) && (bufin[i + run] == bufin[i]); run++);
+
+		// bytes to copy end with the run or when the block is full
+		if ((copy > 0) && ((run >= TILES_RLE_MINRUN) || (copy == TILES_RLE_MAXCOPY)))
+		{
+			bufout[outsize++] = copy - 1;
+			memcpy(&bufout[outsize], &bufin[i - copy], copy);
+			outsize += copy;
+			copy = 0;
+		}
+		if (run >= TILES_RLE_MINRUN)
+		{
+			bufout[outsize++] = 0x80 | (run - TILES_RLE_MINRUN);
+			bufout[outsize++] = bufin[i];
+			i += run;
+		}
+		else
+		{
+			copy++;
+			i++;
+		}
+	}
+	if (copy > 0)
+	{
+		bufout[outsize++] = copy - 1;
+		memcpy(&bufout[outsize], &bufin[i - copy], copy);
+		outsize += copy;
+	}
+
+	tiles_header(bufout, TILES_RLE_TAG, buflen);
+	while (outsize & 3) bufout[outsize++] = 0;
+
+	return outsize;
+}
+
+//-------------------------------------------------------------------------------------------------
+// bufout = where the length is added
+// length = length to add after the 15 of the token nibble
+// returns the next byte of bufout
+static unsigned char *tiles_lz4length (unsigned char *bufout, int length)
+{
+	for (; length >= 255; length -= 255)
+		*bufout++ = 255;
+	*bufout++ = length;
+
+	return bufout;
+}
+
+//-------------------------------------------------------------------------------------------------
+// bufout = lz4 compressed data, buflen + (buflen>>3) + 16 bytes
+// bufin = planar tiles to compress
+// returns the size of the compressed data
+// the longest match at each position is found with hash chains of the 4 bytes strings
+static int tiles_lz4compress (unsigned char *bufout, const unsigned char *bufin, int buflen)
+{
+	int *head, *prev;
+	unsigned char *out, *token;
+	int i, p, l, chain, maxlen, matchlen, matchdist, copystart, copy;
+	unsigned int h;
+
+	head = (int *) malloc((1<<TILES_LZ4_HASHBITS) * sizeof(int));
+	prev = (int *) malloc((buflen + 1) * sizeof(int));
+	if ((head == NULL) || (prev == NULL))
+	{
+		fatal("can't allocate enough memory for the lz4 compression");
+	}
+	for (i = 0; i < (1<<TILES_LZ4_HASHBITS); i++)
+		head[i] = -1;
+
+	out = bufout + 4;
+	copystart = 0;
+	for (i = 0; i < buflen; )
+	{
+		// longest match, the nearest one if several
+		matchlen = 0; matchdist = 0;
+		if (i + TILES_LZ4_MINMATCH <= buflen)
+		{
+			h = (((unsigned int) bufin[i]<<24) | (bufin[i+1]<<16) | (bufin[i+2]<<8) | bufin[i+3]) * 2654435761u >> (32-TILES_LZ4_HASHBITS);
+			maxlen = buflen - i;
+			for (p = head[h], chain = 0; (p >= 0) && (i - p <= TILES_LZ4_MAXDIST) && (chain < TILES_LZ4_MAXCHAIN); p = prev[p], chain++)
+			{
+				for (l = 0; (l < maxlen) && (bufin[p + l] == bufin[i + l]); l++);
+				if (l > matchlen)
+				{
+					matchlen = l;
+					matchdist = i - p;
+					if (l == maxlen) break;
+				}
+			}
+			prev[i] = head[h];
+			head[h] = i;
+		}
+		if (matchlen < TILES_LZ4_MINMATCH)
+		{
+			i++;
+			continue;
+		}
+
+		// sequence of the bytes to copy before the match, and the match
+		copy = i - copystart;
+		token = out++;
+		*token = ((copy < 15) ? copy : 15) << 4;
+		if (copy >= 15) out = tiles_lz4length(out, copy - 15);
+		memcpy(out, &bufin[copystart], copy);
+		out += copy;
+		*out++ = matchdist & 0xFF;
+		*out++ = matchdist >> 8;
+		*token |= (matchlen - TILES_LZ4_MINMATCH < 15) ? matchlen - TILES_LZ4_MINMATCH : 15;
+		if (matchlen - TILES_LZ4_MINMATCH >= 15) out = tiles_lz4length(out, matchlen - TILES_LZ4_MINMATCH - 15);
+
+		// strings of the match are in the hash chains too
+		for (l = 1; l < matchlen; l++)
+		{
+			if (i + l + TILES_LZ4_MINMATCH > buflen) break;
+			h = (((unsigned int) bufin[i+l]<<24) | (bufin[i+l+1]<<16) | (bufin[i+l+2]<<8) | bufin[i+l+3]) * 2654435761u >> (32-TILES_LZ4_HASHBITS);
+			prev[i + l] = head[h];
+			head[h] = i + l;
+		}
+		i += matchlen;
+		copystart = i;
+	}
+
+	// last bytes to copy
+	if (copystart < buflen)
+	{
+		copy = buflen - copystart;
+		token = out++;
+		*token = ((copy < 15) ? copy : 15) << 4;
+		if (copy >= 15) out = tiles_lz4length(out, copy - 15);
+		memcpy(out, &bufin[copystart], copy);
+		out += copy;
+	}
+	free(head);
+	free(prev);
+
+	tiles_header(bufout, TILES_LZ4_TAG, buflen);
+	while ((out - bufout) & 3) *out++ = 0;
+
+	return out - bufout;
+}
+
+//-------------------------------------------------------------------------------------------------
+// buf = compressed data (or the tiles if TILES_RAW)
+// size = size of buf
+// format = format of buf
+// returns the estimated number of 65816 cycles to decode buf, from the blocks of the data
+static long tiles_decodecycles (const unsigned char *buf, int size, int format)
+{
+	long cycles;
+	int i, n, out, outsize, length, flags;
+
+	if (format == TILES_RAW)
+		return TILES_CYCLES_RAWSETUP + (long) size * TILES_CYCLES_COPY;
+
+	// lz77 chunks are one after the other
+	cycles = 0;
+	for (i = 0; i + 4 <= size; i = (i + 3) & ~3)
+	{
+		outsize = buf[i + 1] | (buf[i + 2]<<8) | (buf[i + 3]<<16);
+		if (outsize == 0) break;
+		i += 4;
+		for (out = 0; (out < outsize) && (i < size); )
+		{
+			if (format == TILES_RLE)
+			{
+				cycles += TILES_CYCLES_RLEBLOCK;
+				if (buf[i] & 0x80) { n = (buf[i] & 0x7F) + TILES_RLE_MINRUN; i += 2; }
+				else { n = buf[i] + 1; i += 1 + n; }
+				cycles += n * TILES_CYCLES_COPY;
+				out += n;
+			}
+			else if (format == TILES_LZ4)
+			{
+				cycles += TILES_CYCLES_LZ4SEQUENCE;
+				flags = buf[i++];
+				n = flags >> 4;
+				if (n == 15) do { cycles += TILES_CYCLES_LZ4LENGTH; n += buf[i]; } while (buf[i++] == 255);
+				i += n;
+				out += n;
+				cycles += n * TILES_CYCLES_COPY;
+				if (out >= outsize) break;
+				i += 2;
+				length = (flags & 15) + TILES_LZ4_MINMATCH;
+				if ((flags & 15) == 15) do { cycles += TILES_CYCLES_LZ4LENGTH; length += buf[i]; } while (buf[i++] == 255);
+				out += length;
+				cycles += length * TILES_CYCLES_COPY;
+			}
+			else
+			{
+				cycles += TILES_CYCLES_LZ77FLAG;
+				flags = buf[i++];
+				for (n = 0; (n < 8) && (out < outsize); n++, flags <<= 1)
+				{
+					if (flags & 0x80)
+					{
+						length = (buf[i]>>4) + 3;
+						i += 2;
+						out += length;
+						cycles += TILES_CYCLES_LZ77MATCH + length * TILES_CYCLES_LZ77MATCHBYTE;
+					}
+					else
+					{
+						i++;
+						out++;
+						cycles += TILES_CYCLES_LZ77LITERAL;
+					}
+				}
+			}
+		}
+	}
+
+	return cycles;
+}
+
+//-------------------------------------------------------------------------------------------------
+// bufout = compressed data, buflen + (buflen>>3) + 16 bytes (and 16 more bytes per lz77 chunk)
+// bufin = planar tiles to compress
+// format = compression format (TILES_LZ77, TILES_LZ4 or TILES_RLE)
+// lzoptimal = 1 if we want the lz77 compression with optimal parsing
+// lzchunk = size in bytes of each lz77 chunk compressed on its own, 0 for one lz77 stream
+// returns the size of the compressed data, 0 if it can't be compressed
+static int tiles_compress (unsigned char *bufout, unsigned char *bufin, int buflen, int format, bool lzoptimal, int lzchunk, bool isquiet)
+{
+	int outsize;
+
+	if (format == TILES_LZ4)
+		outsize = tiles_lz4compress(bufout, bufin, buflen);
+	else if (format == TILES_RLE)
+		outsize = tiles_rlecompress(bufout, bufin, buflen);
+	else if (lzchunk > 0)
+	{
+		outsize = tiles_lzchunks(bufout, bufin, buflen, lzchunk, lzoptimal);
+		if (!isquiet && outsize) info("compression Lz77 in chunks of %d bytes from %d bytes to %d bytes", lzchunk, buflen, outsize);
+		return outsize;
+	}
+	else
+		return Convert2PicLZ77(bufin, buflen, bufout, isquiet, lzoptimal);
+
+	// same as lz77, compressed data must be smaller
+	if (outsize >= buflen)
+	{
+		if (!isquiet) errorcontinue("ratio for compression is not good (%d%%))",(buflen*100)/outsize);
+		return 0;
+	}
+
+	return outsize;
+}
+
+//-------------------------------------------------------------------------------------------------
+// bufout = compressed data, bufsizeout bytes
+// bufin = planar tiles to compress
+// *format = format to use, TILES_FASTEST to get the one decoded the fastest, changed to the format used
+// isreport = 1 if we want the size and decoding time of each format in console
+// returns the size of the compressed data, 0 if it can't be compressed
+static int tiles_compressformats (unsigned char *bufout, unsigned char *bufin, int buflen, int bufsizeout, int *format, bool lzoptimal, int lzchunk, bool isreport, bool isquiet)
+{
+	static const char *names[] = { "raw", "lz77", "lz4", "rle" };
+	unsigned char *buftest;
+	long cycles, bestcycles;
+	int f, size, bestsize, bestformat;
+
+	if ((*format != TILES_FASTEST) && !isreport)
+	{
+		if (!isquiet) info("compress graphics in %s format...", names[*format]);
+		return tiles_compress(bufout, bufin, buflen, *format, lzoptimal, lzchunk, isquiet);
+	}
+
+	buftest = (unsigned char *) malloc(bufsizeout);
+	if (buftest == NULL)
+	{
+		fatal("can't allocate enough memory for the tiles buffer compression");
+	}
+	if (isreport)
+	{
+		cycles = tiles_decodecycles(bufin, buflen, TILES_RAW);
+		info("%-4s %7d bytes, about %8ld cycles to decode (%ldms at 3.58MHz)", names[TILES_RAW], buflen, cycles, cycles / 3580);
+	}
+
+	// compress in each format, the fastest one is only for the compressed formats
+	bestformat = TILES_RAW; bestcycles = 0; bestsize = 0;
+	for (f = TILES_LZ77; f <= TILES_RLE; f++)
+	{
+		size = tiles_compress(buftest, bufin, buflen, f, lzoptimal, (f == TILES_LZ77) ? lzchunk : 0, true);
+		if (size == 0)
+		{
+			if (isreport) info("%-4s not smaller than raw data", names[f]);
+			continue;
+		}
+		cycles = tiles_decodecycles(buftest, size, f);
+		if (isreport) info("%-4s %7d bytes, about %8ld cycles to decode (%ldms at 3.58MHz)", names[f], size, cycles, cycles / 3580);
+
+		if ((f == *format) || ((*format == TILES_FASTEST) && ((bestformat == TILES_RAW) || (cycles < bestcycles))))
+		{
+			bestformat = f;
+			bestcycles = cycles;
+			bestsize = size;
+			memcpy(bufout, buftest, size);
+		}
+	}
+	free(buftest);
+
+	if ((*format == TILES_FASTEST) && !isquiet)
+	{
+		if (bestformat != TILES_RAW) info("fastest format to decode is %s", names[bestformat]);
+		else warning("no format compresses the tiles, they are saved as raw data");
+	}
+	if (*format == TILES_FASTEST) *format = bestformat;
+
+	return bestsize;
+}
+
 //-------------------------------------------------------------------------------------------------
 // filename = bitmap file name (png or bmp)
 // tiles = graphic tile buffer to save
 // nbtiles = number of tiles to write to file
 // nbcolors = number of colors of the graphic tile buffer
 // addblank = 1 if we need to add a blank tile
-// lzcompress = 1 if we want lz77 compression
+// format = compression format (TILES_RAW, TILES_LZ77, TILES_LZ4, TILES_RLE or TILES_FASTEST to decode)
+// lzoptimal = 1 if we want the lz77 compression with optimal parsing (smaller but slower)
+// lzchunk = number of tiles of each lz77 chunk compressed on its own, 0 for one lz77 stream
+// isreport = 1 if we want the size and decoding time of each format in console
 // isquiet = 0 if we want some messages in console
-void tiles_save (const char *filename, unsigned char *tiles,int nbtiles, int nbcolors, bool addblank, bool lzcompress,bool isquiet)
+void tiles_save (const char *filename, unsigned char *tiles,int nbtiles, int nbcolors, bool addblank, int format, bool lzoptimal, int lzchunk, bool isreport, bool isquiet)
 {
 	char *outputname;
 	FILE *fp;
-	int x,y,t,b, nbbytestowrite;
+	int b, nbbytestowrite;
     unsigned char *buftolzin, *buftolzout;
     int bitplanes;
-    unsigned char data, mask;
     int bufsize,bufsizeout;
 
 	// remove extension and put the ".map/mp7" to filename
@@ -163,47 +727,15 @@ void tiles_save (const char *filename, unsigned char *tiles,int nbtiles, int nbc
 
     // manipulate the graphics to fit bits in planes
     if (!isquiet) info("manipulate the graphics to fit bits in planes...");
-	for (t = 0; t < nbtiles; t++)
-    { 
-		// loop through tiles
-        for (b = 0; b < bitplanes; b += 2)
-		{ 
-			// loop through bitplane pairs
-            for (y = 0; y < 8; y++)
-            {
-            	// get bit-mask
-                mask = 1 << b;
-                data = 0;
-
-                // get row of bit-plane
-                for (x = 0; x < 8; x++)
-                {
-                    data = data << 1;
-                    if (tiles[t * 64 + y * 8 + x] & mask) data = data + 1;
-                }
-                *(buftolzin + nbbytestowrite) = data;
-                nbbytestowrite++;
-
-                // adjust bit-mask
-                mask = mask << 1;
-                data = 0;
-
-                // get row of next bit-plane
-                for (x = 0; x < 8; x++)
-                {
-                    data = data << 1;
-                    if (tiles[t * 64 + y * 8 + x] & mask) data = data + 1;
-                }
-                *(buftolzin + nbbytestowrite) = data;
-                nbbytestowrite++;
-            }
-        }
-    }
+    tiles_toplanar(buftolzin + nbbytestowrite, tiles, nbtiles, bitplanes);
+    nbbytestowrite += nbtiles * 8 * bitplanes;
         
-	// Prepare outside buffer if lz77
-	if (lzcompress) {
-        if (!isquiet) info("compress graphics in lz77 format...");
+	// Prepare outside buffer if compressed (or to compare the formats)
+	buftolzout=buftolzin;
+	bufsize=nbbytestowrite;
+	if ((format != TILES_RAW) || isreport) {
 	    bufsizeout = nbbytestowrite + (nbbytestowrite>>3) + 16;
+	    if (lzchunk > 0) bufsizeout += (nbbytestowrite / (lzchunk * 8 * bitplanes) + 1) * 16;
 	    buftolzout = (unsigned char *) malloc(bufsizeout);
     	if (buftolzout == NULL)
     	{
@@ -213,20 +745,22 @@ void tiles_save (const char *filename, unsigned char *tiles,int nbtiles, int nbc
         }
 
         // Compress data and save to disc
-		bufsize = Convert2PicLZ77(buftolzin, nbbytestowrite, buftolzout,isquiet);
-        if (bufsize ==0)
+		bufsize = tiles_compressformats(buftolzout, buftolzin, nbbytestowrite, bufsizeout, &format, lzoptimal, lzchunk * 8 * bitplanes, isreport, isquiet);
+        if ((bufsize ==0) && (format != TILES_RAW))
         {
 			free(buftolzout);
 			free(buftolzin);
 			free (outputname);
-			fatal("error during lz77 compression");
+			fatal("error during tiles compression");
         }
-	}
-	// no compression, get the default values
-	else
-	{
-		buftolzout=buftolzin;
-		bufsize=nbbytestowrite;
+
+		// no compression, get the default values
+		if (format == TILES_RAW)
+		{
+			free(buftolzout);
+			buftolzout=buftolzin;
+			bufsize=nbbytestowrite;
+		}
 	}
 
 	// try to open file for write
@@ -234,7 +768,7 @@ void tiles_save (const char *filename, unsigned char *tiles,int nbtiles, int nbc
 	fp = fopen(outputname,"wb");
 	if(fp==NULL)
 	{
-		if (lzcompress) free(buftolzout);
+		if (buftolzout != buftolzin) free(buftolzout);
 		free(buftolzin);
 		errorcontinue("can't open tiles file [%s] for writing", outputname);
 		free (outputname);
@@ -242,12 +776,11 @@ void tiles_save (const char *filename, unsigned char *tiles,int nbtiles, int nbc
 	}
 
 	// add graphics to file
-    for (t=0;t<bufsize;t++)
-        WRITEFILEBYTE(buftolzout[t],fp);
+    fwrite(buftolzout, bufsize, 1, fp);
 
 	// close file and leave
 	fclose(fp);
-	if (lzcompress) free(buftolzout);
+	if (buftolzout != buftolzin) free(buftolzout);
 	free(buftolzin);
 	free (outputname);
 }
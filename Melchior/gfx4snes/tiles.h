@@ -4,9 +4,16 @@
 
 #include <stdbool.h>
 
+// compression formats of tiles_save()
+#define TILES_RAW 0																// no compression
+#define TILES_LZ77 1															// gba lz77 (lz77.c)
+#define TILES_LZ4 2																// lz4 sequences, byte aligned
+#define TILES_RLE 3																// gba rle
+#define TILES_FASTEST 4															// compressed format decoded the fastest
+
 //-------------------------------------------------------------------------------------------------
 extern void tiles_savepacked(const char* filename, unsigned char* tiles, int tilesnumber, bool addblank, bool isquiet);
-extern void tiles_save(const char* filename, unsigned char* tiles, int tilesnumber, int colorsnumber, bool addblank, bool lzcompress, bool isquiet);
+extern void tiles_save(const char* filename, unsigned char* tiles, int tilesnumber, int colorsnumber, bool addblank, int format, bool lzoptimal, int lzchunk, bool isreport, bool isquiet);
 extern unsigned char* tiles_convertsnes(unsigned char* imgbuf, int imgwidth, int imgheight, int blksizex, int blksizey, int* sizex, int* sizey, int newwidth, bool isquiet);
 
 #endif